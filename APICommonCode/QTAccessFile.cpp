@@ -37,6 +37,7 @@
 #include "QTSS.h"
 #include "QTSSModuleUtils.h"
 #include "QTAccessFile.h"
+#include "QTAccessFileCache.h"
 
 #ifdef __MacOSX__
 #include <membership.h>
@@ -93,6 +94,8 @@ void QTAccessFile::Initialize() { // called by server at initialize never call a
   if (NULL == sAccessFileMutex) {
     sAccessFileMutex = new Core::Mutex();
   }
+
+  QTAccessFileCache::Initialize();
 }
 
 void QTAccessFile::SetAccessFileName(char const *inQTAccessFileName) {
@@ -110,6 +113,15 @@ void QTAccessFile::SetAccessFileName(char const *inQTAccessFileName) {
   sQTAccessFileName = new char[strlen(inQTAccessFileName) + 1];
   ::strcpy(sQTAccessFileName, inQTAccessFileName);
 
+  // the cached policies were found under the old name
+  QTAccessFileCache::Invalidate();
+}
+
+char *QTAccessFile::GetAccessFileName_Copy() {
+  Core::MutexLocker locker(sAccessFileMutex);
+  char *theName = new char[::strlen(sQTAccessFileName) + 1];
+  ::strcpy(theName, sQTAccessFileName);
+  return theName;
 }
 
 bool QTAccessFile::HaveUser(char *userName, void *extraDataPtr) {
@@ -334,60 +346,15 @@ bool QTAccessFile::AccessAllowed(char *userName,
 
 char *QTAccessFile::GetAccessFile_Copy(char const *movieRootDir,
                                        char const *dirPath) {
-  Core::MutexLocker locker(sAccessFileMutex);
-
-  char *currentDir = NULL;
-  char *lastSlash = NULL;
-  int movieRootDirLen = ::strlen(movieRootDir);
-  int maxLen = strlen(dirPath) + strlen(sQTAccessFileName)
-      + strlen(kPathDelimiterString) + 1;
-  currentDir = new char[maxLen];
-
-  ::strcpy(currentDir, dirPath);
-
-  //strip off filename
-  lastSlash = ::strrchr(currentDir, kPathDelimiterChar);
-  if (lastSlash != NULL)
-    lastSlash[0] = '\0';
-
-  //check qtaccess files
-
-  while (true) { //walk backward up the dir tree.
+  QTAccessFileCache::PolicyRef thePolicy = QTAccessFileCache::GetPolicy(movieRootDir, dirPath);
 
-    int curLen = strlen(currentDir) + strlen(sQTAccessFileName)
-        + strlen(kPathDelimiterString);
+  char *accessFilePath = thePolicy->GetAccessFilePath();
+  if (accessFilePath == NULL)
+    return NULL;
 
-    if (curLen >= maxLen)
-      break;
-
-    ::strcat(currentDir, kPathDelimiterString);
-    ::strcat(currentDir, sQTAccessFileName);
-
-    QTSS_Object fileObject = NULL;
-    if (QTSS_OpenFileObject(currentDir, qtssOpenFileNoFlags, &fileObject)
-        == QTSS_NoErr) {
-      (void) QTSS_CloseFileObject(fileObject);
-      return currentDir;
-    }
-
-    //strip off the "/qtaccess"
-    lastSlash = ::strrchr(currentDir, kPathDelimiterChar);
-    lastSlash[0] = '\0';
-
-    //strip of the tailing directory
-    lastSlash = ::strrchr(currentDir, kPathDelimiterChar);
-    if (lastSlash == NULL)
-      break;
-    else
-      lastSlash[0] = '\0';
-
-    if ((lastSlash - currentDir)
-        < movieRootDirLen) //bail if we start eating our way out of fMovieRootDir
-      break;
-  }
-
-  delete[] currentDir;
-  return NULL;
+  char *currentDir = new char[::strlen(accessFilePath) + 1];
+  ::strcpy(currentDir, accessFilePath);
+  return currentDir;
 }
 
 // allocates memory for outUsersFilePath and outGroupsFilePath - remember to delete
@@ -396,22 +363,29 @@ QTSS_AuthScheme QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(char *inAcces
                                                                    QTSS_ActionFlags inAction,
                                                                    char **outUsersFilePath,
                                                                    char **outGroupsFilePath) {
+  if (inAccessFilePath == NULL)
+    return qtssAuthNone;
+
+  StrPtrLen accessFileBuf;
+  (void) QTSSModuleUtils::ReadEntireFile(inAccessFilePath, &accessFileBuf);
+  CharArrayDeleter accessFileBufDeleter(accessFileBuf.Ptr);
+
+  return FindUsersAndGroupsFilesAndAuthScheme(&accessFileBuf, inAction, outUsersFilePath, outGroupsFilePath);
+}
+
+QTSS_AuthScheme QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(StrPtrLen *inAccessFileBuf,
+                                                                   QTSS_ActionFlags inAction,
+                                                                   char **outUsersFilePath,
+                                                                   char **outGroupsFilePath) {
   QTSS_AuthScheme authScheme = qtssAuthNone;
   QTSS_ActionFlags currentFlags = qtssActionFlagsRead;
 
-  if (inAccessFilePath == NULL)
-    return authScheme;
-
   *outUsersFilePath = NULL;
   *outGroupsFilePath = NULL;
   //Assert(outUsersFilePath == NULL);
   //Assert(outGroupsFilePath == NULL);
 
-  StrPtrLen accessFileBuf;
-  (void) QTSSModuleUtils::ReadEntireFile(inAccessFilePath, &accessFileBuf);
-  CharArrayDeleter accessFileBufDeleter(accessFileBuf.Ptr);
-
-  StringParser accessFileParser(&accessFileBuf);
+  StringParser accessFileParser(inAccessFileBuf);
   StrPtrLen line;
   StrPtrLen word;
 
@@ -545,9 +519,9 @@ QTSS_Error QTAccessFile::AuthorizeRequest(QTSS_StandardRTSP_Params *inParams,
   if (NULL == theUserProfile)
     return QTSS_RequestFailed;
 
-  char *accessFilePath =
-      QTAccessFile::GetAccessFile_Copy(movieRootDirStr, pathBuffStr);
-  CharArrayDeleter accessFilePathDeleter(accessFilePath);
+  // the access file is read once per directory, not per request
+  QTAccessFileCache::PolicyRef accessPolicy =
+      QTAccessFileCache::GetPolicy(movieRootDirStr, pathBuffStr);
 
   char *username = QTSSModuleUtils::GetUserName_Copy(theUserProfile);
   CharArrayDeleter usernameDeleter(username);
@@ -557,9 +531,7 @@ QTSS_Error QTAccessFile::AuthorizeRequest(QTSS_StandardRTSP_Params *inParams,
       QTSSModuleUtils::GetGroupsArray_Copy(theUserProfile, &numGroups);
   CharPointerArrayDeleter groupCharPtrArrayDeleter(groupCharPtrArray);
 
-  StrPtrLen accessFileBuf;
-  (void) QTSSModuleUtils::ReadEntireFile(accessFilePath, &accessFileBuf);
-  CharArrayDeleter accessFileBufDeleter(accessFileBuf.Ptr);
+  StrPtrLen accessFileBuf(*accessPolicy->GetAccessFileBuf()); // owned by accessPolicy
 
   if (accessFileBuf.Len == 0 && !allowNoAccessFiles) {
     accessFileBuf.Set(sAccessValidUser);
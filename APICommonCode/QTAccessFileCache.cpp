@@ -0,0 +1,291 @@
+/*
+    File:       QTAccessFileCache.cpp
+
+    Contains:   Implementation of the qtaccess cache, see QTAccessFileCache.h
+*/
+
+#include <string.h>
+#include <errno.h>
+
+#if __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <CF/ArrayObjectDeleter.h>
+#include <CF/Core/Time.h>
+#include <CF/Thread/Task.h>
+
+#include "QTSSModuleUtils.h"
+#include "QTAccessFile.h"
+#include "QTAccessFileCache.h"
+
+using namespace CF;
+
+#define DEBUG_QTACCESS_CACHE 0
+#define debug_printf if (DEBUG_QTACCESS_CACHE) s_printf
+
+Core::Mutex *QTAccessFileCache::sCacheMutex = NULL;
+std::unordered_map<std::string, QTAccessFileCache::Entry> *QTAccessFileCache::sEntries = NULL;
+UInt32 QTAccessFileCache::sGeneration = 0;
+int QTAccessFileCache::sInotifyFD = -1;
+
+#if __linux__
+// what may change the access file of a directory: the file itself, or a directory on the path
+static const uint32_t kWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+    | IN_DELETE_SELF | IN_MOVE_SELF;
+#endif
+
+static char *CopyString(char const *inString) {
+  if (inString == NULL)
+    return NULL;
+  char *theCopy = new char[::strlen(inString) + 1];
+  ::strcpy(theCopy, inString);
+  return theCopy;
+}
+
+class QTAccessFileWatchTask : public Thread::Task {
+ public:
+  QTAccessFileWatchTask() : Task() {
+    this->SetTaskName("QTAccessFileWatchTask");
+    this->Signal(kStartEvent);
+  }
+  ~QTAccessFileWatchTask() override = default;
+
+ private:
+  SInt64 Run() override;
+};
+
+SInt64 QTAccessFileWatchTask::Run() {
+  EventFlags events = this->GetEvents();
+  if (events & kKillEvent)
+    return -1;
+
+  QTAccessFileCache::ReadWatchEvents();
+  return QTAccessFileCache::kWatchIntervalMSec;
+}
+
+QTAccessPolicy::QTAccessPolicy(char *inAccessFilePath, StrPtrLen const &inAccessFileBuf)
+    : fAccessFilePath(inAccessFilePath), fAccessFileBuf(inAccessFileBuf) {
+  fReadFiles.fAuthScheme = QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(&fAccessFileBuf,
+                                                                              qtssActionFlagsRead,
+                                                                              &fReadFiles.fUsersFilePath,
+                                                                              &fReadFiles.fGroupsFilePath);
+  fWriteFiles.fAuthScheme = QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(&fAccessFileBuf,
+                                                                               qtssActionFlagsWrite,
+                                                                               &fWriteFiles.fUsersFilePath,
+                                                                               &fWriteFiles.fGroupsFilePath);
+}
+
+QTAccessPolicy::~QTAccessPolicy() {
+  delete[] fAccessFilePath;
+  delete[] fAccessFileBuf.Ptr;
+  delete[] fReadFiles.fUsersFilePath;
+  delete[] fReadFiles.fGroupsFilePath;
+  delete[] fWriteFiles.fUsersFilePath;
+  delete[] fWriteFiles.fGroupsFilePath;
+}
+
+QTSS_AuthScheme QTAccessPolicy::FindUsersAndGroupsFilesAndAuthScheme(QTSS_ActionFlags inAction,
+                                                                     char **outUsersFilePath,
+                                                                     char **outGroupsFilePath) const {
+  *outUsersFilePath = NULL;
+  *outGroupsFilePath = NULL;
+
+  if (fAccessFilePath == NULL)
+    return qtssAuthNone;
+
+  AuthFiles const *theFiles = NULL;
+  if (inAction == qtssActionFlagsRead)
+    theFiles = &fReadFiles;
+  else if (inAction == qtssActionFlagsWrite)
+    theFiles = &fWriteFiles;
+
+  if (theFiles == NULL) { // a combination of actions, not resolved up front
+    StrPtrLen theAccessFileBuf(fAccessFileBuf);
+    return QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(&theAccessFileBuf,
+                                                              inAction,
+                                                              outUsersFilePath,
+                                                              outGroupsFilePath);
+  }
+
+  *outUsersFilePath = CopyString(theFiles->fUsersFilePath);
+  *outGroupsFilePath = CopyString(theFiles->fGroupsFilePath);
+  return theFiles->fAuthScheme;
+}
+
+void QTAccessFileCache::Initialize() {
+  if (NULL != sCacheMutex)
+    return;
+
+  sCacheMutex = new Core::Mutex();
+  sEntries = new std::unordered_map<std::string, Entry>();
+
+#if __linux__
+  sInotifyFD = ::inotify_init();
+  if (sInotifyFD >= 0) {
+    int flags = ::fcntl(sInotifyFD, F_GETFL, 0);
+    (void) ::fcntl(sInotifyFD, F_SETFL, flags | O_NONBLOCK);
+    (void) ::fcntl(sInotifyFD, F_SETFD, FD_CLOEXEC);
+    new QTAccessFileWatchTask();
+  } else {
+    debug_printf("QTAccessFileCache::Initialize inotify_init failed, errno=%d\n", errno);
+  }
+#endif
+}
+
+void QTAccessFileCache::Invalidate() {
+  if (NULL == sCacheMutex)
+    return;
+
+  Core::MutexLocker locker(sCacheMutex);
+  sGeneration++;
+  sEntries->clear();
+}
+
+QTAccessFileCache::PolicyRef QTAccessFileCache::GetPolicy(char const *inMovieRootDir, char const *inFilePath) {
+  bool watched = false;
+  if (NULL == sCacheMutex) // not initialized, nothing to invalidate us
+    return BuildPolicy(inMovieRootDir, inFilePath, &watched);
+
+  // the key is the directory of the file, under its movie folder
+  std::string theKey(inMovieRootDir);
+  theKey += '\n';
+  char const *lastSlash = ::strrchr(inFilePath, kPathDelimiterChar);
+  if (lastSlash != NULL)
+    theKey.append(inFilePath, lastSlash - inFilePath);
+  else
+    theKey.append(inFilePath);
+
+  SInt64 theNow = Core::Time::Milliseconds();
+  UInt32 theGeneration;
+  {
+    Core::MutexLocker locker(sCacheMutex);
+    auto theEntry = sEntries->find(theKey);
+    if (theEntry != sEntries->end()) {
+      if (theEntry->second.fExpireTime < 0 || theNow < theEntry->second.fExpireTime)
+        return theEntry->second.fPolicy;
+      sEntries->erase(theEntry);
+    }
+    theGeneration = sGeneration;
+  }
+
+  // walk the directories without the lock, concurrent misses of one directory build it twice
+  PolicyRef thePolicy = BuildPolicy(inMovieRootDir, inFilePath, &watched);
+
+  Core::MutexLocker locker(sCacheMutex);
+  if (theGeneration == sGeneration) { // else it may have been built from a stale file
+    if (sEntries->size() >= kMaxEntries)
+      sEntries->clear();
+    Entry &theEntry = (*sEntries)[theKey];
+    theEntry.fPolicy = thePolicy;
+    theEntry.fExpireTime = watched ? -1 : theNow + kUnwatchedTTLMSec;
+  }
+  return thePolicy;
+}
+
+QTAccessFileCache::PolicyRef QTAccessFileCache::BuildPolicy(char const *inMovieRootDir,
+                                                            char const *inFilePath,
+                                                            bool *outWatched) {
+  char *accessFileName = QTAccessFile::GetAccessFileName_Copy();
+  CharArrayDeleter accessFileNameDeleter(accessFileName);
+
+  std::string::size_type movieRootDirLen = ::strlen(inMovieRootDir);
+  std::string currentDir(inFilePath);
+  char *accessFilePath = NULL;
+
+  *outWatched = (sInotifyFD >= 0);
+
+  //strip off filename
+  std::string::size_type lastSlash = currentDir.rfind(kPathDelimiterChar);
+  if (lastSlash != std::string::npos)
+    currentDir.resize(lastSlash);
+
+  while (true) { //walk backward up the dir tree.
+
+    // watch before looking, a change from now on reaches the watch task
+    if (*outWatched && !AddWatch(currentDir))
+      *outWatched = false;
+
+    std::string accessFile(currentDir);
+    accessFile += kPathDelimiterString;
+    accessFile += accessFileName;
+
+    QTSS_Object fileObject = NULL;
+    if (QTSS_OpenFileObject((char *) accessFile.c_str(), qtssOpenFileNoFlags, &fileObject) == QTSS_NoErr) {
+      (void) QTSS_CloseFileObject(fileObject);
+      accessFilePath = CopyString(accessFile.c_str());
+      break;
+    }
+
+    //strip of the tailing directory
+    lastSlash = currentDir.rfind(kPathDelimiterChar);
+    if (lastSlash == std::string::npos)
+      break;
+    currentDir.resize(lastSlash);
+
+    if (lastSlash < movieRootDirLen) //bail if we start eating our way out of fMovieRootDir
+      break;
+  }
+
+  StrPtrLen accessFileBuf;
+  if (accessFilePath != NULL)
+    (void) QTSSModuleUtils::ReadEntireFile(accessFilePath, &accessFileBuf);
+
+  debug_printf("QTAccessFileCache::BuildPolicy file=%s access file=%s watched=%d\n",
+               inFilePath, accessFilePath != NULL ? accessFilePath : "(none)", *outWatched);
+
+  return std::make_shared<QTAccessPolicy const>(accessFilePath, accessFileBuf);
+}
+
+bool QTAccessFileCache::AddWatch(std::string const &inDir) {
+#if __linux__
+  // the kernel hands back the same watch for a directory already watched
+  if (::inotify_add_watch(sInotifyFD, inDir.empty() ? kPathDelimiterString : inDir.c_str(), kWatchMask) >= 0)
+    return true;
+  debug_printf("QTAccessFileCache::AddWatch %s failed, errno=%d\n", inDir.c_str(), errno);
+#endif
+  return false;
+}
+
+void QTAccessFileCache::ReadWatchEvents() {
+#if __linux__
+  if (sInotifyFD < 0)
+    return;
+
+  char *accessFileName = NULL;
+  CharArrayDeleter accessFileNameDeleter;
+  bool invalidate = false;
+
+  alignas(struct inotify_event) char theBuffer[4096];
+  while (true) {
+    ssize_t theLen = ::read(sInotifyFD, theBuffer, sizeof(theBuffer));
+    if (theLen <= 0)
+      break;
+
+    if (accessFileName == NULL) {
+      accessFileName = QTAccessFile::GetAccessFileName_Copy();
+      accessFileNameDeleter.SetObject(accessFileName);
+    }
+
+    for (char *thePtr = theBuffer; thePtr < theBuffer + theLen;) {
+      auto *theEvent = reinterpret_cast<struct inotify_event *>(thePtr);
+      thePtr += sizeof(struct inotify_event) + theEvent->len;
+
+      if (invalidate)
+        continue;
+
+      if (theEvent->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF | IN_ISDIR))
+        invalidate = true; // lost events, or a directory of some path went away or came in
+      else if (theEvent->len > 0 && ::strcmp(theEvent->name, accessFileName) == 0)
+        invalidate = true;
+    }
+  }
+
+  if (invalidate) {
+    debug_printf("QTAccessFileCache::ReadWatchEvents invalidate\n");
+    Invalidate();
+  }
+#endif
+}
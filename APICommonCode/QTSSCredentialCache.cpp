@@ -0,0 +1,207 @@
+/*
+    File:       QTSSCredentialCache.cpp
+
+    Contains:   Implementation of the credential cache, see QTSSCredentialCache.h
+*/
+
+#include <string.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include <CF/Core/Mutex.h>
+#include <CF/Core/Time.h>
+
+#include "QTSSCredentialCache.h"
+
+using namespace CF;
+
+namespace {
+
+struct CacheEntry {
+  UInt64 fCheck;
+  SInt64 fExpireTime;
+};
+
+struct CacheState {
+  CacheState() : fGeneration(1) {
+    std::random_device theRandom;
+    for (UInt64 &theKey : fKeys)
+      theKey = ((UInt64) theRandom() << 32) | theRandom();
+  }
+
+  Core::Mutex fMutex;
+  std::unordered_map<UInt64, CacheEntry> fEntries;
+  UInt64 fKeys[4];    // SipHash keys of fKey and fCheck
+  std::atomic<UInt32> fGeneration;
+};
+
+CacheState &GetState() {
+  static CacheState sState;
+  return sState;
+}
+
+inline UInt64 RotateLeft(UInt64 inValue, int inBits) {
+  return (inValue << inBits) | (inValue >> (64 - inBits));
+}
+
+inline void SipRound(UInt64 &v0, UInt64 &v1, UInt64 &v2, UInt64 &v3) {
+  v0 += v1; v1 = RotateLeft(v1, 13); v1 ^= v0; v0 = RotateLeft(v0, 32);
+  v2 += v3; v3 = RotateLeft(v3, 16); v3 ^= v2;
+  v0 += v3; v3 = RotateLeft(v3, 21); v3 ^= v0;
+  v2 += v1; v1 = RotateLeft(v1, 17); v1 ^= v2; v2 = RotateLeft(v2, 32);
+}
+
+// SipHash-2-4, by Aumasson and Bernstein
+UInt64 SipHash24(UInt64 inKey0, UInt64 inKey1, UInt8 const *inData, size_t inLen) {
+  UInt64 v0 = 0x736f6d6570736575ULL ^ inKey0;
+  UInt64 v1 = 0x646f72616e646f6dULL ^ inKey1;
+  UInt64 v2 = 0x6c7967656e657261ULL ^ inKey0;
+  UInt64 v3 = 0x7465646279746573ULL ^ inKey1;
+
+  size_t theEnd = inLen - inLen % 8;
+  size_t i = 0;
+  for (; i < theEnd; i += 8) {
+    UInt64 m = 0;
+    for (int j = 7; j >= 0; j--)  // little endian
+      m = (m << 8) | inData[i + j];
+    v3 ^= m;
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  UInt64 b = (UInt64) inLen << 56;
+  for (int j = (int) (inLen - i) - 1; j >= 0; j--)
+    b |= (UInt64) inData[i + j] << (8 * j);
+
+  v3 ^= b;
+  SipRound(v0, v1, v2, v3);
+  SipRound(v0, v1, v2, v3);
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SipRound(v0, v1, v2, v3);
+  SipRound(v0, v1, v2, v3);
+  SipRound(v0, v1, v2, v3);
+  SipRound(v0, v1, v2, v3);
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// each field is preceded by its length, so no two credentials give the same message
+void AppendField(std::string *ioMessage, StrPtrLen const &inField) {
+  UInt32 theLen = inField.Ptr != nullptr ? inField.Len : 0;
+  for (int i = 0; i < 4; i++)
+    ioMessage->push_back((char) (theLen >> (8 * i)));
+  if (theLen > 0)
+    ioMessage->append(inField.Ptr, theLen);
+}
+
+} // namespace
+
+QTSSCredentialCache::Credential QTSSCredentialCache::Hash(StrPtrLen const &inUserName,
+                                                          StrPtrLen const &inPassword,
+                                                          StrPtrLen const &inRealm,
+                                                          StrPtrLen const &inStoredPassword) {
+  CacheState &theState = GetState();
+
+  std::string theMessage;
+  theMessage.reserve(16 + inUserName.Len + inPassword.Len + inRealm.Len + inStoredPassword.Len);
+  AppendField(&theMessage, inUserName);
+  AppendField(&theMessage, inPassword);
+  AppendField(&theMessage, inRealm);
+  AppendField(&theMessage, inStoredPassword);
+
+  UInt8 const *theData = (UInt8 const *) theMessage.data();
+  Credential theCredential;
+  theCredential.fKey = SipHash24(theState.fKeys[0], theState.fKeys[1], theData, theMessage.size());
+  theCredential.fCheck = SipHash24(theState.fKeys[2], theState.fKeys[3], theData, theMessage.size());
+
+  // the password doesn't stay in the heap
+  ::memset(&theMessage[0], 0, theMessage.size());
+  return theCredential;
+}
+
+bool QTSSCredentialCache::IsVerified(Credential const &inCredential, SInt64 *outExpireTime) {
+  CacheState &theState = GetState();
+  SInt64 theNow = Core::Time::Milliseconds();
+
+  Core::MutexLocker locker(&theState.fMutex);
+  auto theEntry = theState.fEntries.find(inCredential.fKey);
+  if (theEntry == theState.fEntries.end())
+    return false;
+
+  if (theEntry->second.fExpireTime <= theNow) {
+    theState.fEntries.erase(theEntry);
+    return false;
+  }
+
+  if (theEntry->second.fCheck != inCredential.fCheck)
+    return false;
+
+  if (outExpireTime != nullptr)
+    *outExpireTime = theEntry->second.fExpireTime;
+  return true;
+}
+
+void QTSSCredentialCache::SetVerified(Credential const &inCredential) {
+  CacheState &theState = GetState();
+  SInt64 theNow = Core::Time::Milliseconds();
+
+  Core::MutexLocker locker(&theState.fMutex);
+  if (theState.fEntries.size() >= kMaxEntries && theState.fEntries.count(inCredential.fKey) == 0) {
+    for (auto theEntry = theState.fEntries.begin(); theEntry != theState.fEntries.end();) {
+      if (theEntry->second.fExpireTime <= theNow)
+        theEntry = theState.fEntries.erase(theEntry);
+      else
+        ++theEntry;
+    }
+    if (theState.fEntries.size() >= kMaxEntries)
+      theState.fEntries.clear();
+  }
+
+  CacheEntry &theEntry = theState.fEntries[inCredential.fKey];
+  theEntry.fCheck = inCredential.fCheck;
+  theEntry.fExpireTime = theNow + kTTLMSec;
+}
+
+void QTSSCredentialCache::Invalidate() {
+  CacheState &theState = GetState();
+
+  Core::MutexLocker locker(&theState.fMutex);
+  theState.fGeneration++;
+  theState.fEntries.clear();
+}
+
+UInt32 QTSSCredentialCache::GetGeneration() {
+  return GetState().fGeneration.load(std::memory_order_acquire);
+}
+
+bool QTSSCredentialCache::Connection::IsVerified(Credential const &inCredential) {
+  SInt64 theNow = Core::Time::Milliseconds();
+  UInt32 theGeneration = GetGeneration();
+
+  if (fExpireTime > theNow && fGeneration == theGeneration
+      && fCredential.fKey == inCredential.fKey && fCredential.fCheck == inCredential.fCheck)
+    return true;
+
+  SInt64 theExpireTime = 0;
+  if (!QTSSCredentialCache::IsVerified(inCredential, &theExpireTime))
+    return false;
+
+  fCredential = inCredential;
+  fExpireTime = theExpireTime;
+  fGeneration = theGeneration;
+  return true;
+}
+
+void QTSSCredentialCache::Connection::SetVerified(Credential const &inCredential) {
+  // the generation before the entry goes in, an Invalidate in between drops this one
+  fGeneration = GetGeneration();
+  fCredential = inCredential;
+  fExpireTime = Core::Time::Milliseconds() + kTTLMSec;
+
+  QTSSCredentialCache::SetVerified(inCredential);
+}
@@ -50,13 +50,26 @@ using namespace CF;
 
 static bool sCloseOnWrite = true;
 
+static std::atomic<UInt32> sNextLogID(1); // 0 marks an empty ring cache entry
+
+// the log whose header the current thread is writing, its writes go straight to the file
+static thread_local QTSSRollingLog *sHeaderLog = nullptr;
+
+thread_local QTSSRollingLog::RingCacheEntry QTSSRollingLog::sRingCache[kRingCacheSize];
+
 QTSSRollingLog::QTSSRollingLog() :
     fLog(nullptr),
     fLogCreateTime(-1),
     fLogFullPath(nullptr),
     fAppendDotLog(true),
-    fLogging(true) {
+    fLogging(true),
+    fLogID(sNextLogID++),
+    fRings(nullptr),
+    fWritePending(false),
+    fRollPending(false) {
   this->SetTaskName("QTSSRollingLog");
+  // disk I/O, keep it off the short task threads
+  this->SetThreadPicker(Task::GetBlockingTaskThreadPicker());
 }
 
 QTSSRollingLog::~QTSSRollingLog() {
@@ -64,6 +77,13 @@ QTSSRollingLog::~QTSSRollingLog() {
   // Log should already be closed, but just in case...
   this->CloseLog();
   delete[] fLogFullPath;
+
+  LogRing *theRing = fRings.load();
+  while (theRing != nullptr) {
+    LogRing *theNext = theRing->fNext;
+    delete theRing;
+    theRing = theNext;
+  }
 }
 
 // Set this to true to get the log to close the file between writes.
@@ -76,7 +96,97 @@ bool QTSSRollingLog::IsLogEnabled() {
 }
 
 void QTSSRollingLog::WriteToLog(char *inLogData, bool allowLogToRoll) {
+  this->WriteToLog(inLogData, (UInt32) ::strlen(inLogData), allowLogToRoll);
+}
+
+void QTSSRollingLog::WriteToLog(char const *inLogData, UInt32 inLen, bool allowLogToRoll) {
+  if (fLogging == false)
+    return;
+
+  // the header goes at the top of the file being opened, before anything queued
+  if (sHeaderLog == this) {
+    if (fLog != nullptr) {
+      ::fwrite(inLogData, 1, inLen, fLog);
+      ::fflush(fLog);
+    }
+    return;
+  }
+
+  if (this->QueueLogData(inLogData, inLen)) {
+    if (allowLogToRoll)
+      fRollPending.store(true, std::memory_order_relaxed);
+    if (!fWritePending.exchange(true))
+      this->Signal(kUpdateEvent);
+    return;
+  }
+
+  // the ring is full (or the message is bigger than it), the log task is behind: write it ourselves
+  this->WriteLogData(inLogData, inLen, allowLogToRoll);
+}
+
+void QTSSRollingLog::WriteToLogNow(char const *inLogData, UInt32 inLen, bool allowLogToRoll) {
+  if (fLogging == false)
+    return;
+
+  this->WriteLogData(inLogData, inLen, allowLogToRoll);
+}
+
+void QTSSRollingLog::Flush() {
   Core::MutexLocker locker(&fMutex);
+  this->WriteQueuedLogData();
+}
+
+QTSSRollingLog::LogRing *QTSSRollingLog::GetThreadRing() {
+  RingCacheEntry *theEntry = &sRingCache[fLogID % kRingCacheSize];
+  if (theEntry->fLogID == fLogID)
+    return theEntry->fRing;
+
+  // not cached, this thread may still have a ring from an evicted entry
+  std::thread::id theThreadID = std::this_thread::get_id();
+  Core::MutexLocker locker(&fRingMutex);
+
+  LogRing *theRing = fRings.load(std::memory_order_relaxed);
+  while (theRing != nullptr && theRing->fThreadID != theThreadID)
+    theRing = theRing->fNext;
+
+  if (theRing == nullptr) {
+    theRing = new LogRing;
+    theRing->fWritePos.store(0, std::memory_order_relaxed);
+    theRing->fReadPos.store(0, std::memory_order_relaxed);
+    theRing->fThreadID = theThreadID;
+    theRing->fNext = fRings.load(std::memory_order_relaxed);
+    fRings.store(theRing, std::memory_order_release);
+  }
+
+  theEntry->fLogID = fLogID;
+  theEntry->fRing = theRing;
+  return theRing;
+}
+
+bool QTSSRollingLog::QueueLogData(char const *inLogData, UInt32 inLen) {
+  LogRing *theRing = this->GetThreadRing();
+
+  UInt32 theWritePos = theRing->fWritePos.load(std::memory_order_relaxed);
+  UInt32 theReadPos = theRing->fReadPos.load(std::memory_order_acquire);
+  if (inLen > kRingBufferSize - (theWritePos - theReadPos))
+    return false;
+
+  UInt32 theOffset = theWritePos & (kRingBufferSize - 1);
+  UInt32 theFirstLen = kRingBufferSize - theOffset;
+  if (theFirstLen > inLen)
+    theFirstLen = inLen;
+  ::memcpy(theRing->fBuffer + theOffset, inLogData, theFirstLen);
+  ::memcpy(theRing->fBuffer, inLogData + theFirstLen, inLen - theFirstLen);
+
+  theRing->fWritePos.store(theWritePos + inLen, std::memory_order_release);
+  return true;
+}
+
+void QTSSRollingLog::WriteLogData(char const *inLogData, UInt32 inLen, bool allowLogToRoll) {
+  Core::MutexLocker locker(&fMutex);
+
+  // what this thread queued before goes first
+  this->WriteQueuedLogData();
 
   if (fLogging == false)
     return;
@@ -88,7 +198,7 @@ void QTSSRollingLog::WriteToLog(char *inLogData, bool allowLogToRoll) {
     (void) this->CheckRollLog();
 
   if (fLog != nullptr) {
-    s_fprintf(fLog, "%s", inLogData);
+    ::fwrite(inLogData, 1, inLen, fLog);
     ::fflush(fLog);
   }
 
@@ -96,6 +206,57 @@ void QTSSRollingLog::WriteToLog(char *inLogData, bool allowLogToRoll) {
     this->CloseLog(false);
 }
 
+void QTSSRollingLog::WriteQueuedLogData() {
+  bool hasData = false;
+  for (LogRing *theRing = fRings.load(std::memory_order_acquire); theRing != nullptr; theRing = theRing->fNext) {
+    if (theRing->fWritePos.load(std::memory_order_acquire) != theRing->fReadPos.load(std::memory_order_relaxed)) {
+      hasData = true;
+      break;
+    }
+  }
+  if (!hasData)
+    return;
+
+  if (fLogging == false) {
+    // drop what was queued before logging was turned off
+    for (LogRing *theRing = fRings.load(std::memory_order_acquire); theRing != nullptr; theRing = theRing->fNext)
+      theRing->fReadPos.store(theRing->fWritePos.load(std::memory_order_acquire), std::memory_order_release);
+    return;
+  }
+
+  if (sCloseOnWrite && fLog == nullptr)
+    this->EnableLog(fAppendDotLog); //re-open log file before we write
+
+  // one roll check for the whole batch
+  if (fRollPending.exchange(false, std::memory_order_relaxed))
+    (void) this->CheckRollLog();
+
+  for (LogRing *theRing = fRings.load(std::memory_order_acquire); theRing != nullptr; theRing = theRing->fNext) {
+    UInt32 theWritePos = theRing->fWritePos.load(std::memory_order_acquire);
+    UInt32 theReadPos = theRing->fReadPos.load(std::memory_order_relaxed);
+    UInt32 theLen = theWritePos - theReadPos;
+    if (theLen == 0)
+      continue;
+
+    if (fLog != nullptr) {
+      UInt32 theOffset = theReadPos & (kRingBufferSize - 1);
+      UInt32 theFirstLen = kRingBufferSize - theOffset;
+      if (theFirstLen > theLen)
+        theFirstLen = theLen;
+      ::fwrite(theRing->fBuffer + theOffset, 1, theFirstLen, fLog);
+      ::fwrite(theRing->fBuffer, 1, theLen - theFirstLen, fLog);
+    }
+
+    theRing->fReadPos.store(theWritePos, std::memory_order_release);
+  }
+
+  if (fLog != nullptr)
+    ::fflush(fLog);
+
+  if (sCloseOnWrite)
+    this->CloseLog(false);
+}
+
 bool QTSSRollingLog::RollLog() {
   Core::MutexLocker locker(&fMutex);
 
@@ -168,8 +329,12 @@ void QTSSRollingLog::EnableLog(bool appendDotLog) {
 
   fLog = ::fopen(fLogFullPath, "a+");//open for "append"
   if (nullptr != fLog) {
+    ::setvbuf(fLog, nullptr, _IOFBF, kWriteBufferSize); //the queued messages are written in batches
     if (!logExists) { //the file is new, write a log header with the create time of the file.
+      QTSSRollingLog *theHeaderLog = sHeaderLog;
+      sHeaderLog = this;
       fLogCreateTime = this->WriteLogHeader(fLog);
+      sHeaderLog = theHeaderLog;
 #if __MacOSX__
       (void) ::chown(fLogFullPath, 76, (gid_t)-1);//set owner to user qtss.
 #endif
@@ -192,14 +357,23 @@ void QTSSRollingLog::CloseLog(bool leaveEnabled) {
 
 //returns false if some error has occurred
 bool QTSSRollingLog::FormatDate(char *ioDateBuffer, bool logTimeInGMT) {
-  Assert(nullptr != ioDateBuffer);
-
   //use ansi routines for getting the date.
   time_t calendarTime = ::time(nullptr);
   Assert(-1 != calendarTime);
   if (-1 == calendarTime)
     return false;
 
+  return FormatDate(ioDateBuffer, logTimeInGMT, calendarTime);
+}
+
+//formats inTime instead of the current time, for entries formatted after the fact
+bool QTSSRollingLog::FormatDate(char *ioDateBuffer, bool logTimeInGMT, time_t inTime) {
+  Assert(nullptr != ioDateBuffer);
+
+  time_t calendarTime = inTime;
+  if (-1 == calendarTime)
+    return false;
+
   struct tm *theTime = nullptr;
   struct tm timeResult;
 
@@ -479,6 +653,10 @@ SInt64 QTSSRollingLog::Run() {
 
   Core::MutexLocker locker(&fMutex);
 
+  // writers signal again once this is cleared, so nothing queued after it is missed
+  fWritePending.store(false);
+  this->WriteQueuedLogData();
+
   UInt32 theRollInterval = (this->GetRollIntervalInDays()) * 60 * 60 * 24;
 
   if ((fLogCreateTime != -1) && (fLog != nullptr)) {
@@ -44,9 +44,10 @@ class QTAccessFile {
 
   static char *GetUserNameCopy(QTSS_UserProfileObject inUserProfile);
 
-  //GetGroupsArrayCopy
+  //GetAccessFile_Copy
   //
-  // GetGroupsArrayCopy allocates outGroupCharPtrArray. Caller must "delete [] outGroupCharPtrArray" when done.
+  // The access file that applies to dirPath, NULL if none. Caller must "delete []" the result.
+  // Resolved by QTAccessFileCache, see there.
   static char *GetAccessFile_Copy(char const *movieRootDir,
                                   char const *dirPath);
 
@@ -96,6 +97,7 @@ class QTAccessFile {
 
   static void SetAccessFileName(char const *inQTAccessFileName); //makes a copy and stores it
   static char *GetAccessFileName() { return sQTAccessFileName; }; // a reference. Don't delete!
+  static char *GetAccessFileName_Copy(); // Caller must "delete []" the copy
 
   // allocates memory for outUsersFilePath and outGroupsFilePath - remember to delete
   // returns the auth scheme
@@ -104,6 +106,12 @@ class QTAccessFile {
                                                               char **outUsersFilePath,
                                                               char **outGroupsFilePath);
 
+  // same as above, for an access file already read into inAccessFileBuf
+  static QTSS_AuthScheme FindUsersAndGroupsFilesAndAuthScheme(StrPtrLen *inAccessFileBuf,
+                                                              QTSS_ActionFlags inAction,
+                                                              char **outUsersFilePath,
+                                                              char **outGroupsFilePath);
+
   QTSS_Error AuthorizeRequest(QTSS_StandardRTSP_Params *inParams,
                               bool allowNoAccessFiles,
                               QTSS_ActionFlags noAction,
@@ -0,0 +1,109 @@
+/*
+    File:       QTAccessFileCache.h
+
+    Contains:   A cache of the qtaccess file that applies to a movie directory.
+
+                The first request for a directory walks up to the movie folder
+                the way QTAccessFile::GetAccessFile_Copy did, reads the access
+                file it finds and resolves its AuthUserFile, AuthGroupFile and
+                AuthScheme. Later requests for the directory are served from
+                memory.
+
+                On Linux the walked directories are watched with inotify, and
+                the cache is dropped when a qtaccess file on a cached path is
+                created, written, renamed or removed, or when a directory on it
+                goes away. The events are read once a second by a task. Where
+                inotify isn't available, or a directory can't be watched,
+                entries expire after a few seconds instead.
+*/
+
+#ifndef _QT_ACCESS_FILE_CACHE_H_
+#define _QT_ACCESS_FILE_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <CF/StrPtrLen.h>
+#include <CF/Core/Mutex.h>
+
+#include "QTSS.h"
+
+//
+// What a request needs from its access file. Immutable once built, shared by the
+// requests holding it after the cache drops it.
+class QTAccessPolicy {
+ public:
+
+  // takes ownership of inAccessFilePath and of inAccessFileBuf's data
+  QTAccessPolicy(char *inAccessFilePath, CF::StrPtrLen const &inAccessFileBuf);
+  ~QTAccessPolicy();
+
+  // NULL if there is no access file up to the movie folder
+  char *GetAccessFilePath() const { return fAccessFilePath; }
+
+  // the access file, empty if there is none
+  CF::StrPtrLen const *GetAccessFileBuf() const { return &fAccessFileBuf; }
+
+  // as QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme, without reading the file.
+  // allocates memory for outUsersFilePath and outGroupsFilePath - remember to delete
+  QTSS_AuthScheme FindUsersAndGroupsFilesAndAuthScheme(QTSS_ActionFlags inAction,
+                                                       char **outUsersFilePath,
+                                                       char **outGroupsFilePath) const;
+
+ private:
+
+  struct AuthFiles {
+    char *fUsersFilePath;
+    char *fGroupsFilePath;
+    QTSS_AuthScheme fAuthScheme;
+  };
+
+  char *fAccessFilePath;
+  CF::StrPtrLen fAccessFileBuf;
+  AuthFiles fReadFiles;   // resolved for qtssActionFlagsRead
+  AuthFiles fWriteFiles;  // resolved for qtssActionFlagsWrite
+};
+
+class QTAccessFileCache {
+ public:
+
+  typedef std::shared_ptr<QTAccessPolicy const> PolicyRef;
+
+  enum {
+    kMaxEntries = 4096,           // beyond this the cache starts over
+    kWatchIntervalMSec = 1000,    // inotify events are read this often
+    kUnwatchedTTLMSec = 5000      // lifetime of the entries nothing watches
+  };
+
+  static void Initialize(); // called by QTAccessFile::Initialize
+
+  //
+  // The policy for the directory of inFilePath, never NULL
+  static PolicyRef GetPolicy(char const *inMovieRootDir, char const *inFilePath);
+
+  //
+  // Drop everything, e.g. when the access file name changes
+  static void Invalidate();
+
+  //
+  // Read the pending inotify events, called by the watcher task
+  static void ReadWatchEvents();
+
+ private:
+
+  struct Entry {
+    PolicyRef fPolicy;
+    SInt64 fExpireTime;   // -1 while watched
+  };
+
+  static PolicyRef BuildPolicy(char const *inMovieRootDir, char const *inFilePath, bool *outWatched);
+  static bool AddWatch(std::string const &inDir);
+
+  static CF::Core::Mutex *sCacheMutex;
+  static std::unordered_map<std::string, Entry> *sEntries;
+  static UInt32 sGeneration;  // bumped by Invalidate, a policy built across it isn't cached
+  static int sInotifyFD;
+};
+
+#endif //_QT_ACCESS_FILE_CACHE_H_
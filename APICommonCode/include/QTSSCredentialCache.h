@@ -0,0 +1,77 @@
+/*
+    File:       QTSSCredentialCache.h
+
+    Contains:   Remembers the Basic credentials that passed the password check,
+                so a client repeating them (every request of an RTSP session,
+                or a reconnect) doesn't cost another crypt().
+
+                A credential is known by two SipHash-2-4 values of the user name,
+                the password as sent, the realm and the stored password hash it
+                was checked against, under keys drawn when the process starts.
+                The first value indexes the cache, the second confirms the match.
+                The password itself isn't kept.
+
+                Entries expire after kTTLMSec. The cache holds up to kMaxEntries
+                entries; when it is full the expired ones are dropped, or all of
+                them if none has expired. Invalidate drops everything. It is
+                called when a users file is reloaded. A changed password gives
+                another stored hash, so it never matches an old entry anyway.
+
+                Each connection keeps the last credential it verified in a
+                Connection, checked before the shared cache.
+*/
+
+#ifndef __QTSS_CREDENTIAL_CACHE_H__
+#define __QTSS_CREDENTIAL_CACHE_H__
+
+#include <CF/Types.h>
+#include <CF/StrPtrLen.h>
+
+class QTSSCredentialCache {
+ public:
+
+  enum {
+    kMaxEntries = 65536,
+    kTTLMSec = 300000   // 5 minutes
+  };
+
+  struct Credential {
+    UInt64 fKey;
+    UInt64 fCheck;
+  };
+
+  static Credential Hash(CF::StrPtrLen const &inUserName,
+                         CF::StrPtrLen const &inPassword,
+                         CF::StrPtrLen const &inRealm,
+                         CF::StrPtrLen const &inStoredPassword);
+
+  // outExpireTime, if given, gets when the entry found expires
+  static bool IsVerified(Credential const &inCredential, SInt64 *outExpireTime = nullptr);
+  static void SetVerified(Credential const &inCredential);
+
+  static void Invalidate();
+
+  //
+  // The last credential verified on a connection. Not thread safe, a connection
+  // checks its requests one at a time.
+  class Connection {
+   public:
+    Connection() : fExpireTime(0), fGeneration(0) {}
+
+    // this one, or else the shared cache
+    bool IsVerified(Credential const &inCredential);
+
+    // here and in the shared cache
+    void SetVerified(Credential const &inCredential);
+
+   private:
+    Credential fCredential;
+    SInt64 fExpireTime;
+    UInt32 fGeneration;   // of the shared cache, a bump by Invalidate drops this one too
+  };
+
+ private:
+  static UInt32 GetGeneration();
+};
+
+#endif // __QTSS_CREDENTIAL_CACHE_H__
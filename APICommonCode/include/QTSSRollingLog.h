@@ -28,6 +28,12 @@
     Contains:   A log toolkit, log can roll either by time or by size, clients
                 must derive off of this object ot provide configuration information. 
 
+                WriteToLog doesn't touch the file: each writing thread copies its
+                messages into its own lock-free ring, and the log task drains all
+                rings with one buffered write, rolling the log as it goes. Messages
+                of one thread keep their order, messages of different threads are
+                ordered per drain.
+
 
 
 */
@@ -41,6 +47,9 @@
 #include <sys/time.h>
 #endif
 
+#include <atomic>
+#include <thread>
+
 #include <CF/Thread/Task.h>
 
 const bool kAllowLogToRoll = true;
@@ -52,15 +61,27 @@ class QTSSRollingLog : public CF::Thread::Task {
   QTSSRollingLog();
 
   //
-  // Call this to delete. Closes the log and sends a kill event
+  // Call this to delete. Writes out what is queued, closes the log and sends a kill event
   void Delete() {
+    Flush();
     CloseLog(false);
     this->Signal(kKillEvent);
   }
 
   //
-  // Write a log message
+  // Write a log message. The message is queued and written by the log task,
+  // unless the ring of this thread is full.
   void WriteToLog(char *inLogData, bool allowLogToRoll);
+  void WriteToLog(char const *inLogData, UInt32 inLen, bool allowLogToRoll);
+
+  //
+  // Write a log message before returning, after the queued messages of all threads.
+  // For the messages that must not be lost if the process exits right after.
+  void WriteToLogNow(char const *inLogData, UInt32 inLen, bool allowLogToRoll);
+
+  //
+  // Write out the queued messages of all threads now
+  void Flush();
 
   //log rolls automatically based on the configuration criteria,
   //but you may roll the log manually by calling this function.
@@ -87,6 +108,7 @@ class QTSSRollingLog : public CF::Thread::Task {
   //General purpose utility function
   //returns false if some error has occurred
   static bool FormatDate(char *ioDateBuffer, bool logTimeInGMT);
+  static bool FormatDate(char *ioDateBuffer, bool logTimeInGMT, time_t inTime);
 
   // Check the log to see if it needs to roll
   // (rolls the log if necessary)
@@ -97,7 +119,10 @@ class QTSSRollingLog : public CF::Thread::Task {
 
   enum {
     kMaxDateBufferSizeInBytes = 30, //UInt32
-    kMaxFilenameLengthInBytes = 31  //UInt32
+    kMaxFilenameLengthInBytes = 31, //UInt32
+    kRingBufferSize = 64 * 1024,    //UInt32, per writing thread, power of 2
+    kWriteBufferSize = 256 * 1024,  //UInt32, stdio buffer of the log file
+    kRingCacheSize = 4              //UInt32, logs a thread finds its ring of without locking
   };
 
  protected:
@@ -132,9 +157,38 @@ class QTSSRollingLog : public CF::Thread::Task {
   static void ResetToMidnight(time_t *inTimePtr, time_t *outTimePtr);
   char *GetLogPath(char *extension);
 
+  //
+  // single producer single consumer: the owning thread advances fWritePos,
+  // whoever drains under fMutex advances fReadPos. Positions are free running.
+  struct LogRing {
+    std::atomic<UInt32> fWritePos;
+    std::atomic<UInt32> fReadPos;
+    std::thread::id fThreadID;
+    LogRing *fNext;
+    char fBuffer[kRingBufferSize];
+  };
+
+  struct RingCacheEntry {
+    UInt32 fLogID;
+    LogRing *fRing;
+  };
+
+  LogRing *GetThreadRing();
+  bool QueueLogData(char const *inLogData, UInt32 inLen);
+  void WriteLogData(char const *inLogData, UInt32 inLen, bool allowLogToRoll);
+  void WriteQueuedLogData();  // call with fMutex held
+
   // To make sure what happens in Run doesn't also happen at the same time
   // in the public functions.
   CF::Core::Mutex fMutex;
+
+  UInt32 fLogID;                      // never reused, keys the thread local ring cache
+  std::atomic<LogRing *> fRings;      // pushed under fRingMutex, freed with the log
+  CF::Core::Mutex fRingMutex;
+  std::atomic<bool> fWritePending;    // the log task has been signaled
+  std::atomic<bool> fRollPending;     // some queued message allows the log to roll
+
+  static thread_local RingCacheEntry sRingCache[kRingCacheSize];
 };
 
 #endif // __QTSS_ROLLINGLOG_H__
@@ -31,13 +31,10 @@
 
 */
 
-#include <CF/StringParser.h>
-#include <CF/StringFormatter.h>
-#include <CF/StringTranslator.h>
-
-#include <UserAgentParser.h>
+#include <CF/ResizeableStringFormatter.h>
 
 #include "QTSSAccessLogModule.h"
+#include "QTSSAccessLogRecord.h"
 #include "QTSSModuleUtils.h"
 #include "QTSSRollingLog.h"
 
@@ -47,6 +44,7 @@ using namespace CF;
 
 class QTSSAccessLog;
 class LogCheckTask;
+class LogFormatTask;
 
 // STATIC DATA
 
@@ -58,9 +56,9 @@ static QTSS_PrefsObject sServerPrefs = NULL;
 
 static UInt32 sDefaultMaxLogBytes = 10240000;
 static UInt32 sDefaultRollInterval = 7;
-static char *sVoidField = "-";
 static bool sStartedUp = false;
 static bool sDefaultLogTimeInGMT = true;
+static bool sDefaultLogBinary = false;
 
 static QTSS_AttributeID sLoggedAuthorizationAttrID = qtssIllegalAttrID;
 
@@ -69,6 +67,7 @@ static bool sLogEnabled = true;
 static UInt32 sMaxLogBytes = 51200000;
 static UInt32 sRollInterval = 7;
 static bool sLogTimeInGMT = true;
+static bool sLogBinary = false;
 
 static Core::Mutex *sLogMutex = NULL;//Log module isn't reentrant
 static QTSSAccessLog *sAccessLog = NULL;
@@ -76,6 +75,19 @@ static QTSS_ServerObject sServer = NULL;
 static QTSS_ModulePrefsObject sPrefs = NULL;
 static LogCheckTask *sLogCheckTask = NULL;
 
+// Records of closed sessions waiting for the formatter task. The formatter swaps the
+// two record buffers, so queueing a record is a copy under sRecordMutex.
+enum {
+  kMaxPendingRecordBytes = 1024 * 1024, // beyond this the closing thread formats the backlog itself
+  kMaxLogChunkBytes = QTSSRollingLog::kRingBufferSize // a bigger write bypasses the log ring
+};
+static Core::Mutex *sRecordMutex = NULL;
+static Core::Mutex *sFormatMutex = NULL;  // one formatter at a time, taken before sLogMutex
+static ResizeableStringFormatter *sPendingRecords = NULL;
+static ResizeableStringFormatter *sFormatRecords = NULL;
+static ResizeableStringFormatter *sFormattedLines = NULL;
+static LogFormatTask *sLogFormatTask = NULL;
+
 // This header conforms to the W3C "Extended Log File Format". 
 // (See "http://www.w3.org/TR/WD-logfile.html" for details.)
 // The final remark filed of the log header tells us if the logged times are in GMT or in system local time.
@@ -107,6 +119,15 @@ class LogCheckTask : public Thread::Task {
   SInt64 Run() override;
 };
 
+class LogFormatTask : public Thread::Task {
+ public:
+  LogFormatTask() : Task() { this->SetTaskName("LogFormatTask"); }
+  ~LogFormatTask() override = default;
+
+ private:
+  SInt64 Run() override;
+};
+
 class QTSSAccessLog : public QTSSRollingLog {
  public:
 
@@ -144,9 +165,10 @@ static QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
                              QTSS_CliSesClosingReason *inCloseReasonPtr);
 static void CheckAccessLogState(bool forceEnabled);
 static QTSS_Error RollAccessLog(QTSS_ServiceFunctionArgsPtr inArgs);
-static void ReplaceSpaces(StrPtrLen *sourcePtr,
-                          StrPtrLen *destPtr,
-                          char *replaceStr);
+static void QueueRecord(char const *inRecord, UInt32 inLen);
+static void FormatPendingRecords();
+static void WriteLogChunks(char const *inLogData, UInt32 *ioChunkStart, UInt32 inBoundary, UInt32 inEnd);
+static void SwitchLogFormat(bool inLogBinary);
 
 static QTSS_Error StateChange(QTSS_StateChange_Params *stateChangeParams);
 static void WriteStartupMessage();
@@ -174,6 +196,11 @@ QTSS_Error QTSSAccessLogModuleDispatch(QTSS_Role inRole,
 
 QTSS_Error Register(QTSS_Register_Params *inParams) {
   sLogMutex = new Core::Mutex();
+  sRecordMutex = new Core::Mutex();
+  sFormatMutex = new Core::Mutex();
+  sPendingRecords = new ResizeableStringFormatter(NULL, 0);
+  sFormatRecords = new ResizeableStringFormatter(NULL, 0);
+  sFormattedLines = new ResizeableStringFormatter(NULL, 0);
 
   // Do role & service setup
 
@@ -207,6 +234,7 @@ QTSS_Error Initialize(QTSS_Initialize_Params *inParams) {
   RereadPrefs();
   WriteStartupMessage();
   sLogCheckTask = new LogCheckTask();
+  sLogFormatTask = new LogFormatTask();
   return QTSS_NoErr;
 }
 
@@ -218,6 +246,9 @@ QTSS_Error RereadPrefs() {
   QTSSModuleUtils::GetAttribute(sPrefs, "request_logfile_size", qtssAttrDataTypeUInt32, &sMaxLogBytes, &sDefaultMaxLogBytes, sizeof(sMaxLogBytes));
   QTSSModuleUtils::GetAttribute(sPrefs, "request_logfile_interval", qtssAttrDataTypeUInt32, &sRollInterval, &sDefaultRollInterval, sizeof(sRollInterval));
   QTSSModuleUtils::GetAttribute(sPrefs, "request_logtime_in_gmt", qtssAttrDataTypeBool16, &sLogTimeInGMT, &sDefaultLogTimeInGMT, sizeof(sLogTimeInGMT));
+  bool theLogBinary = sLogBinary;
+  QTSSModuleUtils::GetAttribute(sPrefs, "request_log_binary", qtssAttrDataTypeBool16, &theLogBinary, &sDefaultLogBinary, sizeof(theLogBinary));
+  SwitchLogFormat(theLogBinary);
 
   CheckAccessLogState(false);
 
@@ -226,12 +257,23 @@ QTSS_Error RereadPrefs() {
 
 QTSS_Error Shutdown() {
   WriteShutdownMessage();
+
+  // the log task won't run again, write out the records and the remark queued for it
+  {
+    Core::MutexLocker locker(sLogMutex);
+    if (sAccessLog != NULL)
+      sAccessLog->Flush();
+  }
   if (sLogCheckTask != NULL) {
     //sLogCheckTask is a task object, so don't delete it directly
     // instead we signal it to kill itself.
     sLogCheckTask->Signal(Thread::Task::kKillEvent);
     sLogCheckTask = NULL;
   }
+  if (sLogFormatTask != NULL) {
+    sLogFormatTask->Signal(Thread::Task::kKillEvent);
+    sLogFormatTask = NULL;
+  }
   return QTSS_NoErr;
 }
 
@@ -295,67 +337,24 @@ QTSS_Error ClientSessionClosing(QTSS_ClientSessionClosing_Params *inParams) {
   return LogRequest(inParams->inClientSession, NULL, &inParams->inReason);
 }
 
-void ReplaceSpaces(StrPtrLen *sourcePtr, StrPtrLen *destPtr, char *replaceStr) {
-
-  if ((nullptr != destPtr) && (nullptr != destPtr->Ptr) && (0 < destPtr->Len))
-    destPtr->Ptr[0] = 0;
-  do {
-    if ((nullptr == sourcePtr) || (nullptr == destPtr) ||
-        (nullptr == sourcePtr->Ptr) || (nullptr == destPtr->Ptr) ||
-        (0 == sourcePtr->Len) || (0 == destPtr->Len))
-      break;
-
-    if (0 == sourcePtr->Ptr[0]) {
-      destPtr->Len = 0;
-      break;
-    }
-
-    const StrPtrLen replaceValue(replaceStr);
-    StringFormatter formattedString(destPtr->Ptr, destPtr->Len);
-    StringParser sourceStringParser(sourcePtr);
-    StrPtrLen preStopChars;
-
-    do {
-      sourceStringParser.ConsumeUntil(&preStopChars, StringParser::sEOLWhitespaceMask);
-      if (preStopChars.Len > 0) {
-        formattedString.Put(preStopChars);// copy the string up to the space or eol. it will be truncated if there's not enough room.
-        if (sourceStringParser.Expect(' ') && (formattedString.GetSpaceLeft() > replaceValue.Len)) {
-          formattedString.Put(replaceValue.Ptr, replaceValue.Len);
-        } else { //no space character or no room for replacement
-          break;
-        }
-      }
-
-    } while (preStopChars.Len != 0);
-
-    destPtr->Set(formattedString.GetBufPtr(), formattedString.GetBytesWritten());
-
-  } while (false);
+//
+// copy a string attribute straight into the record, an attribute that doesn't fit is logged as "-"
+static void PutStringAttribute(QTSSAccessLogRecordBuilder *ioBuilder, UInt32 inIndex,
+                               QTSS_Object inObject, QTSS_AttributeID inAttrID) {
+  StrPtrLen theSpace = ioBuilder->GetStringSpace(inIndex);
+  UInt32 theLen = theSpace.Len;
+  if (QTSS_GetValue(inObject, inAttrID, 0, theSpace.Ptr, &theLen) != QTSS_NoErr)
+    theLen = 0;
+  ioBuilder->CommitString(inIndex, theLen);
 }
 
 QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
-                      QTSS_RTSPSessionObject inRTSPSession,
+                      QTSS_RTSPSessionObject /*inRTSPSession*/,
                       QTSS_CliSesClosingReason *inCloseReasonPtr) {
-  static StrPtrLen sUnknownStr(sVoidField);
-  static StrPtrLen sTCPStr("TCP");
-  static StrPtrLen sUDPStr("UDP");
-
-  //Fetch the URL, user agent, movielength & movie bytes to log out of the RTP session
   enum {
-    eTempLogItemSize = 256, // must be same or larger than others
-    eURLSize = 256,
-    eUserAgentSize = 256,
-    ePlayerIDSize = 32,
-    ePlayerVersionSize = 32,
-    ePlayerLangSize = 32,
-    ePlayerOSSize = 32,
-    ePlayerOSVersSize = 32,
-    ePlayerCPUSize = 32
+    ePayloadNameSize = 32
   };
 
-  char tempLogItemBuf[eTempLogItemSize] = {0};
-  StrPtrLen tempLogStr(tempLogItemBuf, eTempLogItemSize - 1);
-
   //
   // Check to see if this session is closing because authorization failed. If that's
   // the case, we've logged that already, let's not log it twice
@@ -369,74 +368,33 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
   ///inClientSession should never be NULL
   //inRTSPRequest may be NULL if this is a timeout
 
-  Core::MutexLocker locker(sLogMutex);
-  CheckAccessLogState(false);
-  if (sAccessLog == NULL)
-    return QTSS_NoErr;
-
-  //if logging is on, then log the request... first construct a timestamp
-  char theDateBuffer[QTSSRollingLog::kMaxDateBufferSizeInBytes];
-  bool result = QTSSRollingLog::FormatDate(theDateBuffer, sLogTimeInGMT);
-
-
-  //for now, just ignore the error.
-  if (!result)
-    theDateBuffer[0] = '\0';
+  {
+    Core::MutexLocker locker(sLogMutex);
+    CheckAccessLogState(false);
+    if (sAccessLog == NULL)
+      return QTSS_NoErr;
+  }
 
-  theLen = sizeof(QTSS_RTSPSessionObject);
-  QTSS_RTSPSessionObject theRTSPSession = inRTSPSession;
-  if (theRTSPSession == NULL)
-    (void) QTSS_GetValue(inClientSession, qtssCliSesLastRTSPSession, 0, (void *) &theRTSPSession, &theLen);
+  // Fill a record with the fields to log, the formatter task renders the line.
+  // Numbers are read in place, strings are copied once into the record.
 
-  // Get lots of neat info to log from the various dictionaries
+  QTSSAccessLogRecordBuilder theBuilder;
+  QTSSAccessLogRecord *theRecord = theBuilder.GetRecord();
 
-  // Each attribute must be copied out to ensure that it is NULL terminated.
-  // To ensure NULL termination, just memset the buffers to 0, and make sure that
-  // the last byte of each array is untouched.
+  // Find out what time it is
+  SInt64 curTime = QTSS_Milliseconds();
+  theRecord->fLogTime = QTSS_MilliSecsTo1970Secs(curTime);
 
   Float32 *packetLossPercent = NULL;
   Float64 *movieDuration = NULL;
   UInt64 *movieSizeInBytes = NULL;
-  UInt32 *movieAverageBitRatePtr = 0;
-  UInt32 clientPacketsReceived = 0;
-  UInt32 clientPacketsLost = 0;
-  StrPtrLen *theTransportType = &sUnknownStr;
+  UInt32 *movieAverageBitRatePtr = NULL;
   SInt64 *theCreateTime = NULL;
   SInt64 *thePlayTime = NULL;
-
-  UInt32 startPlayTimeInSecs = 0;
-
-  char localIPAddrBuf[20] = {0};
-  StrPtrLen localIPAddr(localIPAddrBuf, 19);
-
-  char localDNSBuf[70] = {0};
-  StrPtrLen localDNS(localDNSBuf, 69);
-
-  char remoteDNSBuf[70] = {0};
-  StrPtrLen remoteDNS(remoteDNSBuf, 69);
-
-  char remoteAddrBuf[20] = {0};
-  StrPtrLen remoteAddr(remoteAddrBuf, 19);
-
-  char playerIDBuf[ePlayerIDSize] = {0};
-  StrPtrLen playerID(playerIDBuf, ePlayerIDSize - 1);
-
-  // First, get networking info from the RTSP session
-  (void) QTSS_GetValue(inClientSession, qtssCliRTSPSessLocalAddrStr, 0, localIPAddr.Ptr, &localIPAddr.Len);
-  (void) QTSS_GetValue(inClientSession, qtssCliRTSPSessLocalDNS, 0, localDNS.Ptr, &localDNS.Len);
-  (void) QTSS_GetValue(inClientSession, qtssCliSesHostName, 0, remoteDNS.Ptr, &remoteDNS.Len);
-  (void) QTSS_GetValue(inClientSession, qtssCliRTSPSessRemoteAddrStr, 0, remoteAddr.Ptr, &remoteAddr.Len);
-  (void) QTSS_GetValue(inClientSession, qtssCliRTSPSessRemoteAddrStr, 0, playerID.Ptr, &playerID.Len);
-
   UInt32 *rtpBytesSent = NULL;
   UInt32 *rtcpBytesRecv = NULL;
   UInt32 *rtpPacketsSent = NULL;
 
-  // Second, get networking info from the Client's session.
-  // (Including the stats for incoming RTCP packets.)
-  char urlBuf[eURLSize] = {0};
-  StrPtrLen url(urlBuf, eURLSize - 1);
-  (void) QTSS_GetValue(inClientSession, qtssCliSesPresentationURL, 0, url.Ptr, &url.Len);
   (void) QTSS_GetValuePtr(inClientSession, qtssCliSesPacketLossPercent, 0, (void **) &packetLossPercent, &theLen);
   (void) QTSS_GetValuePtr(inClientSession, qtssCliSesMovieDurationInSecs, 0, (void **) &movieDuration, &theLen);
   (void) QTSS_GetValuePtr(inClientSession, qtssCliSesMovieSizeInBytes, 0, (void **) &movieSizeInBytes, &theLen);
@@ -447,9 +405,24 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
   (void) QTSS_GetValuePtr(inClientSession, qtssCliSesRTPPacketsSent, 0, (void **) &rtpPacketsSent, &theLen);
   (void) QTSS_GetValuePtr(inClientSession, qtssCliSesRTCPBytesRecv, 0, (void **) &rtcpBytesRecv, &theLen);
 
+  UInt32 startPlayTimeInSecs = 0;
   if (theCreateTime != NULL && thePlayTime != NULL)
     startPlayTimeInSecs = (UInt32) (((*theCreateTime - *thePlayTime) / 1000) + 0.5);
 
+  if (theCreateTime != NULL)
+    theRecord->fDuration = (UInt32) (QTSS_MilliSecsTo1970Secs(curTime) - QTSS_MilliSecsTo1970Secs(*theCreateTime));
+  if (movieDuration != NULL)
+    theRecord->fMovieDuration = *movieDuration;
+  if (movieSizeInBytes != NULL)
+    theRecord->fMovieSize = *movieSizeInBytes;
+  if (movieAverageBitRatePtr != NULL)
+    theRecord->fAvgBitRate = *movieAverageBitRatePtr;
+  if (rtpBytesSent != NULL)
+    theRecord->fRTPBytesSent = *rtpBytesSent;
+  if (rtcpBytesRecv != NULL)
+    theRecord->fRTCPBytesRecv = *rtcpBytesRecv;
+  if (rtpPacketsSent != NULL)
+    theRecord->fRTPPacketsSent = *rtpPacketsSent;
 
   // We need a value of 'c-bytes' to report as a log entry. This is supposed to be the total number
   // of bytes the client has received during the session. Unfortunately, the QT client does not give
@@ -462,65 +435,21 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
   // sent to the server from the client. If those values are accurate then the above formula will not
   // be exactly correct but it will be nearly correct.
 
-  UInt32 clientBytesRecv = (UInt32) ((*rtpBytesSent * (100.0 - *packetLossPercent)) / 100.0);
-
-  tempLogStr.Ptr[0] = 0;
-  tempLogStr.Len = eUserAgentSize;
-  (void) QTSS_GetValue(inClientSession, qtssCliSesFirstUserAgent, 0, tempLogStr.Ptr, &tempLogStr.Len);
-
-  char userAgentBuf[eUserAgentSize] = {0};
-  StrPtrLen userAgent(userAgentBuf, eUserAgentSize - 1);
-  ReplaceSpaces(&tempLogStr, &userAgent, "%20");
-
-  UserAgentParser userAgentParser(&userAgent);
-
-  //  StrPtrLen* playerID = userAgentParser.GetUserID() ;
-  StrPtrLen *playerVersion = userAgentParser.GetUserVersion();
-  StrPtrLen *playerLang = userAgentParser.GetUserLanguage();
-  StrPtrLen *playerOS = userAgentParser.GetrUserOS();
-  StrPtrLen *playerOSVers = userAgentParser.GetUserOSVersion();
-  StrPtrLen *playerCPU = userAgentParser.GetUserCPU();
-
-  //  char playerIDBuf[ePlayerIDSize] = {};
-  char playerVersionBuf[ePlayerVersionSize] = {0};
-  char playerLangBuf[ePlayerLangSize] = {0};
-  char playerOSBuf[ePlayerOSSize] = {0};
-  char playerOSVersBuf[ePlayerOSVersSize] = {0};
-  char playerCPUBuf[ePlayerCPUSize] = {0};
-
-  UInt32 size;
-  //  (ePlayerIDSize < playerID->Len ) ? size = ePlayerIDSize -1 : size = playerID->Len;
-  //  if (playerID->Ptr != NULL) memcpy (playerIDBuf, playerID->Ptr, size);
-
-  (ePlayerVersionSize < playerVersion->Len) ? size = ePlayerVersionSize - 1 : size = playerVersion->Len;
-  if (playerVersion->Ptr != NULL)
-    memcpy(playerVersionBuf, playerVersion->Ptr, size);
-  (ePlayerLangSize < playerLang->Len) ? size = ePlayerLangSize - 1 : size =
-                                                                         playerLang->Len;
-  if (playerLang->Ptr != NULL) memcpy(playerLangBuf, playerLang->Ptr, size);
-
-  (ePlayerOSSize < playerOS->Len) ? size = ePlayerOSSize - 1 : size = playerOS->Len;
-  if (playerOS->Ptr != NULL) memcpy(playerOSBuf, playerOS->Ptr, size);
-
-  (ePlayerOSVersSize < playerOSVers->Len) ? size = ePlayerOSVersSize - 1 : size = playerOSVers->Len;
-  if (playerOSVers->Ptr != NULL)
-    memcpy(playerOSVersBuf, playerOSVers->Ptr, size);
-
-  (ePlayerCPUSize < playerCPU->Len) ? size = ePlayerCPUSize - 1 : size = playerCPU->Len;
-  if (playerCPU->Ptr != NULL) memcpy(playerCPUBuf, playerCPU->Ptr, size);
-
+  if (packetLossPercent != NULL)
+    theRecord->fClientBytesRecv = (UInt32) ((theRecord->fRTPBytesSent * (100.0 - *packetLossPercent)) / 100.0);
 
   // clientPacketsReceived, clientPacketsLost, videoPayloadName and audioPayloadName
   // are all stored on a per-stream basis, so let's iterate through all the streams,
   // finding this information
 
-  char videoPayloadNameBuf[32] = {0};
-  StrPtrLen videoPayloadName(videoPayloadNameBuf, 31);
+  char videoPayloadNameBuf[ePayloadNameSize] = {0};
+  UInt32 videoPayloadNameLen = 0;
 
-  char audioPayloadNameBuf[32] = {0};
-  StrPtrLen audioPayloadName(audioPayloadNameBuf, 31);
+  char audioPayloadNameBuf[ePayloadNameSize] = {0};
+  UInt32 audioPayloadNameLen = 0;
 
-  UInt32 qualityLevel = 0;
+  UInt32 clientPacketsReceived = 0;
+  UInt32 clientPacketsLost = 0;
   UInt32 clientBufferTime = 0;
   UInt32 theStreamIndex = 0;
   bool *isTCPPtr = NULL;
@@ -545,10 +474,15 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
     QTSS_RTPPayloadType *thePayloadType = NULL;
     (void) QTSS_GetValuePtr(theRTPStreamObject, qtssRTPStrPayloadType, 0, (void **) &thePayloadType, &theLen);
     if (thePayloadType != NULL) {
-      if (*thePayloadType == qtssVideoPayloadType)
-        (void) QTSS_GetValue(theRTPStreamObject, qtssRTPStrPayloadName, 0, videoPayloadName.Ptr, &videoPayloadName.Len);
-      else if (*thePayloadType == qtssAudioPayloadType)
-        (void) QTSS_GetValue(theRTPStreamObject, qtssRTPStrPayloadName, 0, audioPayloadName.Ptr, &audioPayloadName.Len);
+      if (*thePayloadType == qtssVideoPayloadType) {
+        videoPayloadNameLen = sizeof(videoPayloadNameBuf) - 1;
+        if (QTSS_GetValue(theRTPStreamObject, qtssRTPStrPayloadName, 0, videoPayloadNameBuf, &videoPayloadNameLen) != QTSS_NoErr)
+          videoPayloadNameLen = 0;
+      } else if (*thePayloadType == qtssAudioPayloadType) {
+        audioPayloadNameLen = sizeof(audioPayloadNameBuf) - 1;
+        if (QTSS_GetValue(theRTPStreamObject, qtssRTPStrPayloadName, 0, audioPayloadNameBuf, &audioPayloadNameLen) != QTSS_NoErr)
+          audioPayloadNameLen = 0;
+      }
     }
 
     // If any one of the streams is being delivered over UDP instead of TCP,
@@ -556,7 +490,7 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
     if (isTCPPtr == nullptr) {
       (void) QTSS_GetValuePtr(theRTPStreamObject, qtssRTPStrIsTCP, 0, (void **) &isTCPPtr, &theLen);
       if (isTCPPtr != nullptr) {
-        theTransportType = *isTCPPtr ? &sTCPStr : &sUDPStr;
+        theRecord->fTransport = *isTCPPtr ? QTSSAccessLogRecord::kTransportTCP : QTSSAccessLogRecord::kTransportUDP;
       }
     }
 
@@ -569,35 +503,38 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
   }
 
   // Add the client buffer time to our client start latency (in whole seconds).
-  startPlayTimeInSecs += clientBufferTime;
+  theRecord->fStartPlayTime = startPlayTimeInSecs + clientBufferTime;
+  theRecord->fClientPacketsRecv = clientPacketsReceived;
+  theRecord->fClientPacketsLost = clientPacketsLost;
+  theRecord->fClientBufferTime = clientBufferTime;
 
-  if (*rtpPacketsSent == 0) { // no packets sent
-    qualityLevel = 0; // no quality
+  if (theRecord->fRTPPacketsSent == 0) { // no packets sent
+    theRecord->fQuality = 0; // no quality
   } else {
     if ((clientPacketsReceived == 0) && (clientPacketsLost == 0)) { // no info from client
-      qualityLevel = 100; //so assume 100
+      theRecord->fQuality = 100; //so assume 100
     } else {
       float qualityPercent = (float) clientPacketsReceived / (float) (clientPacketsReceived + clientPacketsLost);
       qualityPercent += (float) .005; // round up
-      qualityLevel = (UInt32) ((float) 100.0 * qualityPercent); // average of sum of packet counts for all streams
+      theRecord->fQuality = (UInt32) ((float) 100.0 * qualityPercent); // average of sum of packet counts for all streams
     }
   }
 
   //we may not have an RTSP request. Assume that the status code is 504 timeout, if there is an RTSP
   //request, though, we can find out what the real status code of the response is
   static UInt32 sTimeoutCode = 504;
-  UInt32 *theStatusCode = &sTimeoutCode;
+  UInt32 *theStatusCodePtr = &sTimeoutCode;
   theLen = sizeof(UInt32);
-  (void) QTSS_GetValuePtr(inClientSession, qtssCliRTSPReqRealStatusCode, 0, (void **) &theStatusCode, &theLen);
-  //  s_printf("qtssCliRTSPReqRealStatusCode = %"   _U32BITARG_   " \n", *theStatusCode);
-
+  (void) QTSS_GetValuePtr(inClientSession, qtssCliRTSPReqRealStatusCode, 0, (void **) &theStatusCodePtr, &theLen);
+  UInt32 theStatusCode = *theStatusCodePtr;
+  //  s_printf("qtssCliRTSPReqRealStatusCode = %"   _U32BITARG_   " \n", theStatusCode);
 
   if (inCloseReasonPtr) {
     do {
-      if (*theStatusCode < 300) { // it was a successful RTSP request but...
+      if (theStatusCode < 300) { // it was a successful RTSP request but...
         if (*inCloseReasonPtr == qtssCliSesCloseTimeout) {
           // there was a timeout
-          *theStatusCode = sTimeoutCode;
+          theStatusCode = sTimeoutCode;
           s_printf(" log timeout\n");
           break;
         } else if (*inCloseReasonPtr == qtssCliSesCloseClientTeardown) {
@@ -617,19 +554,19 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
 
           if (*theReasonPtr == qtssCliSesTearDownUnsupportedMedia) {
             //  An error occured while streaming the file.
-            *theStatusCode = 415;
+            theStatusCode = 415;
             s_printf(" log UnsupportedMedia \n");
             break;
           }
           if (*theReasonPtr == qtssCliSesTearDownBroadcastEnded) {
             //  a broadcaster stopped broadcasting
-            *theStatusCode = 452;
+            theStatusCode = 452;
             s_printf(" log broadcast removed \n");
             break;
           }
 
           // some unknown reason for cancelling the connection
-          *theStatusCode = 500;
+          theStatusCode = 500;
         }
 
         s_printf("return status ");
@@ -638,15 +575,8 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
     } while (false);
   }
 
-  //  s_printf(" = %"   _U32BITARG_   " \n", *theStatusCode);
-
-
-  // Find out what time it is
-  SInt64 curTime = QTSS_Milliseconds();
-
-  UInt32 numCurClients = 0;
-  theLen = sizeof(numCurClients);
-  (void) QTSS_GetValue(sServer, qtssRTPSvrCurConn, 0, &numCurClients, &theLen);
+  //  s_printf(" = %"   _U32BITARG_   " \n", theStatusCode);
+  theRecord->fStatusCode = theStatusCode;
 
   /*
       IMPORTANT!!!!
@@ -655,145 +585,129 @@ QTSS_Error LogRequest(QTSS_ClientSessionObject inClientSession,
 
   */
 
+  theLen = sizeof(theRecord->fNumCurClients);
+  (void) QTSS_GetValue(sServer, qtssRTPSvrCurConn, 0, &theRecord->fNumCurClients, &theLen);
+
+  Float32 fcpuUtilized = 0;
+  theLen = sizeof(fcpuUtilized);
+  (void) QTSS_GetValue(sServer, qtssSvrCPULoadPercent, 0, &fcpuUtilized, &theLen);
+  theRecord->fCPUUtilized = (UInt32) fcpuUtilized;
+
 #if TESTUNIXTIME
   char thetestDateBuffer[QTSSRollingLog::kMaxDateBufferSizeInBytes];
   TestUnixTime(QTSS_MilliSecsTo1970Secs(*theCreateTime), thetestDateBuffer);
   s_printf("%s\n", thetestDateBuffer);
 #endif
 
-  float zeroFloat = 0;
-  UInt64 zeroUInt64 = 0;
-  Float32 fcpuUtilized = 0;
+  // the strings, in record order
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kRemoteAddr, inClientSession, qtssCliRTSPSessRemoteAddrStr);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kRemoteDNS, inClientSession, qtssCliSesHostName);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kURL, inClientSession, qtssCliSesPresentationURL);
+  StrPtrLen remoteAddr = theRecord->GetString(QTSSAccessLogRecord::kRemoteAddr);
+  theBuilder.PutString(QTSSAccessLogRecord::kPlayerID, remoteAddr.Ptr, remoteAddr.Len);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kUserAgent, inClientSession, qtssCliSesFirstUserAgent);
+  theBuilder.PutString(QTSSAccessLogRecord::kAudioCodec, audioPayloadNameBuf, audioPayloadNameLen);
+  theBuilder.PutString(QTSSAccessLogRecord::kVideoCodec, videoPayloadNameBuf, videoPayloadNameLen);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kLocalAddr, inClientSession, qtssCliRTSPSessLocalAddrStr);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kLocalDNS, inClientSession, qtssCliRTSPSessLocalDNS);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kQuery, inClientSession, qtssCliSesReqQueryString);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kUserName, inClientSession, qtssCliRTSPSesUserName);
+  PutStringAttribute(&theBuilder, QTSSAccessLogRecord::kRealm, inClientSession, qtssCliRTSPSesURLRealm);
+
+  QueueRecord(theBuilder.GetBuffer(), theBuilder.GetLen());
 
-  theLen = sizeof(fcpuUtilized);
-  (void) QTSS_GetValue(sServer, qtssSvrCPULoadPercent, 0, &fcpuUtilized, &theLen);
-  UInt32 cpuUtilized = (UInt32) fcpuUtilized;
-
-  char lastUserName[eTempLogItemSize] = {0};
-  StrPtrLen lastUserNameStr(lastUserName, eTempLogItemSize);
-
-  char lastURLRealm[eTempLogItemSize] = {0};
-  StrPtrLen lastURLRealmStr(lastURLRealm, eTempLogItemSize);
-
-  //s_printf("logging of saved params are in dictionary \n");
-
-  tempLogStr.Ptr[0] = 0;
-  tempLogStr.Len = eTempLogItemSize;
-  (void) QTSS_GetValue(inClientSession, qtssCliRTSPSesUserName, 0, tempLogStr.Ptr, &tempLogStr.Len);
-  ReplaceSpaces(&tempLogStr, &lastUserNameStr, "%20");
-  //s_printf("qtssRTSPSesLastUserName dictionary item = %s len = %" _S32BITARG_ "\n",lastUserNameStr.Ptr,lastUserNameStr.Len);
-
-  tempLogStr.Ptr[0] = 0;
-  tempLogStr.Len = eTempLogItemSize;
-  (void) QTSS_GetValue(inClientSession, qtssCliRTSPSesURLRealm, 0, tempLogStr.Ptr, &tempLogStr.Len);
-  ReplaceSpaces(&tempLogStr, &lastURLRealmStr, "%20");
-  //s_printf("qtssRTSPSesLastURLRealm dictionary  item = %s len = %" _S32BITARG_ "\n",lastURLRealmStr.Ptr,lastURLRealmStr.Len);
-
-  char respMsgBuffer[1024] = {0};
-  StrPtrLen theRespMsg;
-  (void) QTSS_GetValuePtr(inClientSession, qtssCliRTSPReqRespMsg, 0, (void **) &theRespMsg.Ptr, &theRespMsg.Len);
-  StrPtrLen respMsgEncoded(respMsgBuffer, 1024 - 1);
-  SInt32 theErr = StringTranslator::EncodeURL(theRespMsg.Ptr, theRespMsg.Len, respMsgEncoded.Ptr, respMsgEncoded.Len);
-  if (theErr <= 0) {
-    respMsgEncoded.Ptr[0] = '\0';
-  } else {
-    respMsgEncoded.Len = theErr;
-    respMsgEncoded.Ptr[respMsgEncoded.Len] = '\0';
+  return QTSS_NoErr;
+}
+
+void QueueRecord(char const *inRecord, UInt32 inLen) {
+  bool isBacklogged = false;
+  {
+    Core::MutexLocker locker(sRecordMutex);
+    sPendingRecords->Put(inRecord, inLen);
+    isBacklogged = sPendingRecords->GetBytesWritten() > kMaxPendingRecordBytes;
   }
 
-  //cs-uri-query
-  char urlQryBuf[eURLSize] = {0};
-  StrPtrLen urlQry(urlQryBuf, eURLSize - 1);
-  (void) QTSS_GetValue(inClientSession, qtssCliSesReqQueryString, 0, urlQry.Ptr, &urlQry.Len);
-
-  char tempLogBuffer[1024];
-  char logBuffer[2048];
-  // compatible fields (no respMsgEncoded field)
-  ::memset(logBuffer, 0, 2048);
-  s_sprintf(tempLogBuffer, "%s ", (remoteAddr.Ptr[0] == '\0') ? sVoidField : remoteAddr.Ptr); //c-ip*
-  ::strcpy(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (theDateBuffer[0] == '\0') ? sVoidField : theDateBuffer);   //date* time*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (remoteDNS.Ptr[0] == '\0') ? sVoidField : remoteDNS.Ptr); //c-dns
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (url.Ptr[0] == '\0') ? sVoidField : url.Ptr);   //cs-uri-stem*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", startPlayTimeInSecs);  //c-starttime
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", theCreateTime == nullptr ? (UInt32) 0 : (UInt32) ( QTSS_MilliSecsTo1970Secs(curTime) - QTSS_MilliSecsTo1970Secs(*theCreateTime)));   //x-duration*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%" _S32BITARG_ " ", (UInt32) 1);  //c-rate
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%" _S32BITARG_ " ", *theStatusCode);   //c-status*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (playerIDBuf[0] == '\0') ? sVoidField : playerIDBuf);   //c-playerid*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (playerVersionBuf[0] == '\0') ? sVoidField : playerVersionBuf); //c-playerversion
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (playerLangBuf[0] == '\0') ? sVoidField : playerLangBuf);   //c-playerlanguage*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (userAgent.Ptr[0] == '\0') ? sVoidField : userAgent.Ptr);   //cs(User-Agent)
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (playerOSBuf[0] == '\0') ? sVoidField : playerOSBuf);   //c-os* ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (playerOSVersBuf[0] == '\0') ? sVoidField : playerOSVersBuf);   //c-osversion
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (playerCPUBuf[0] == '\0') ? sVoidField : playerCPUBuf); //c-cpu*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%0.0f ", movieDuration == nullptr ? zeroFloat : *movieDuration); //filelength in secs*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%" _64BITARG_ "d ", movieSizeInBytes == nullptr ? zeroUInt64 : *movieSizeInBytes); //filesize in bytes*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", movieAverageBitRatePtr == nullptr ? (UInt32) 0 : *movieAverageBitRatePtr);    //avgbandwidth in bits per second
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", "RTP"); //protocol
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (theTransportType->Ptr[0] == '\0') ? sVoidField : theTransportType->Ptr);   //transport
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (audioPayloadName.Ptr[0] == '\0') ? sVoidField : audioPayloadName.Ptr); //audiocodec*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (videoPayloadName.Ptr[0] == '\0') ? sVoidField : videoPayloadName.Ptr); //videocodec*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", rtpBytesSent == nullptr ? (UInt32) 0 : *rtpBytesSent);    //sc-bytes*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", rtcpBytesRecv == nullptr ? (UInt32) 0 : *rtcpBytesRecv);    //cs-bytes*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", clientBytesRecv);  //c-bytes
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", rtpPacketsSent == nullptr ? (UInt32) 0 : *rtpPacketsSent);   //s-pkts-sent*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", clientPacketsReceived);    //c-pkts-recieved
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", clientPacketsLost);    //c-pkts-lost-client*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", (UInt32) 1);  //c-buffercount
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", clientBufferTime);     //c-totalbuffertime*
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", qualityLevel); //c-quality
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (localIPAddr.Ptr[0] == '\0') ? sVoidField : localIPAddr.Ptr);   //s-ip
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (localDNS.Ptr[0] == '\0') ? sVoidField : localDNS.Ptr); //s-dns
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", numCurClients);    //s-totalclients
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%"   _U32BITARG_   " ", cpuUtilized);  //s-cpu-util
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (urlQry.Ptr[0] == '\0') ? sVoidField : urlQry.Ptr); //cs-uri-query
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (lastUserName[0] == '\0') ? sVoidField : lastUserName); //c-username
-  ::strcat(logBuffer, tempLogBuffer);
-  s_sprintf(tempLogBuffer, "%s ", (lastURLRealm[0] == '\0') ? sVoidField : lastURLRealm); //sc(Realm)
-  ::strcat(logBuffer, tempLogBuffer);
-
-  ::strcat(logBuffer, "\n");
-
-  Assert(::strlen(logBuffer) < 2048);
-
-  //finally, write the log message
-  sAccessLog->WriteToLog(logBuffer, kAllowLogToRoll);
+  if (isBacklogged || sLogFormatTask == NULL)
+    FormatPendingRecords(); // the formatter is behind, help it out
+  else
+    sLogFormatTask->Signal(Thread::Task::kUpdateEvent);
+}
 
-  return QTSS_NoErr;
+void FormatPendingRecords() {
+  Core::MutexLocker formatLocker(sFormatMutex);
+
+  ResizeableStringFormatter *theRecords = NULL;
+  {
+    Core::MutexLocker locker(sRecordMutex);
+    if (sPendingRecords->GetBytesWritten() == 0)
+      return;
+    theRecords = sPendingRecords;
+    sPendingRecords = sFormatRecords;
+    sFormatRecords = theRecords;
+  }
+
+  char *theRecordData = theRecords->GetBufPtr();
+  UInt32 theRecordDataLen = theRecords->GetBytesWritten();
+
+  // written in chunks that fit the log ring, each ends with a whole record or line
+  sFormattedLines->Reset();
+  UInt32 theChunkStart = 0;
+  UInt32 theOffset = 0;
+  QTSSAccessLogRecord const *theRecord = NULL;
+  while ((theRecord = QTSSAccessLogRecord::Parse(theRecordData + theOffset, theRecordDataLen - theOffset)) != NULL) {
+    if (sLogBinary) {
+      WriteLogChunks(theRecordData, &theChunkStart, theOffset, theOffset + theRecord->fLen);
+    } else {
+      UInt32 theBoundary = sFormattedLines->GetBytesWritten();
+      theRecord->FormatW3C(sFormattedLines, sLogTimeInGMT);
+      WriteLogChunks(sFormattedLines->GetBufPtr(), &theChunkStart, theBoundary, sFormattedLines->GetBytesWritten());
+    }
+    theOffset += theRecord->fLen;
+  }
+  Assert(theOffset == theRecordDataLen);
+
+  if (sLogBinary)
+    WriteLogChunks(theRecordData, &theChunkStart, theRecordDataLen, theRecordDataLen);
+  else
+    WriteLogChunks(sFormattedLines->GetBufPtr(), &theChunkStart, sFormattedLines->GetBytesWritten(),
+                   sFormattedLines->GetBytesWritten());
+
+  theRecords->Reset();
+}
+
+/**
+ * 写出 [*ioChunkStart, inBoundary) 的数据，如果它再加上到 inEnd 的数据会超出一块的大小；到结尾时 inBoundary == inEnd，全部写出
+ */
+void WriteLogChunks(char const *inLogData, UInt32 *ioChunkStart, UInt32 inBoundary, UInt32 inEnd) {
+  if (inBoundary < inEnd && inEnd - *ioChunkStart <= kMaxLogChunkBytes)
+    return;
+  if (inBoundary == *ioChunkStart)
+    return; // a single record longer than a chunk, it is written alone by the next call
+
+  {
+    Core::MutexLocker locker(sLogMutex);
+    if (sAccessLog != NULL)
+      sAccessLog->WriteToLog(inLogData + *ioChunkStart, inBoundary - *ioChunkStart, kAllowLogToRoll);
+  }
+  *ioChunkStart = inBoundary;
+}
+
+/**
+ * request_log_binary 改变时，之前的记录按旧格式写完，再滚动日志，新文件的头部与记录使用新格式
+ */
+void SwitchLogFormat(bool inLogBinary) {
+  if (inLogBinary == sLogBinary)
+    return;
+
+  Core::MutexLocker formatLocker(sFormatMutex);
+  FormatPendingRecords();
+  sLogBinary = inLogBinary;
+
+  Core::MutexLocker locker(sLogMutex);
+  if (sAccessLog != NULL) {
+    sAccessLog->Flush(); // the queued lines belong to the old file
+    sAccessLog->RollLog();
+  }
 }
 
 void CheckAccessLogState(bool forceEnabled) {
@@ -816,6 +730,9 @@ void CheckAccessLogState(bool forceEnabled) {
 QTSS_Error RollAccessLog(QTSS_ServiceFunctionArgsPtr /*inArgs*/) {
   const bool kForceEnable = true;
 
+  // the sessions closed so far belong to the log being rolled
+  FormatPendingRecords();
+
   Core::MutexLocker locker(sLogMutex);
   //calling CheckLogState is a kludge to allow logs
   //to be rolled while logging is disabled.
@@ -848,6 +765,16 @@ SInt64 LogCheckTask::Run() {
   return (60 * 60 * 1000);
 }
 
+// This task renders the queued records whenever LogRequest signals it.
+SInt64 LogFormatTask::Run() {
+  EventFlags events = this->GetEvents();
+  if (events & kKillEvent)
+    return -1;
+
+  FormatPendingRecords();
+  return 0;
+}
+
 time_t QTSSAccessLog::WriteLogHeader(FILE *inFile) {
   time_t calendarTime = QTSSRollingLog::WriteLogHeader(inFile);
 
@@ -865,6 +792,11 @@ time_t QTSSAccessLog::WriteLogHeader(FILE *inFile) {
     this->WriteToLog(tempBuffer, !kAllowLogToRoll);
   }
 
+  if (sLogBinary) {
+    s_sprintf(tempBuffer, "#Remark: the fields are in binary records, version %d.\n", (int) QTSSAccessLogRecord::kVersion);
+    this->WriteToLog(tempBuffer, !kAllowLogToRoll);
+  }
+
   return calendarTime;
 }
 
@@ -893,6 +825,9 @@ void WriteShutdownMessage() {
 
   sStartedUp = false;
 
+  // the sessions closed so far go before the remark
+  FormatPendingRecords();
+
   //log shutdown message
   //format a date for the shutdown time
   char theDateBuffer[QTSSRollingLog::kMaxDateBufferSizeInBytes];
@@ -0,0 +1,206 @@
+/*
+    File:       QTSSAccessLogRecord.cpp
+
+    Contains:   Implementation of the access log record, see QTSSAccessLogRecord.h
+*/
+
+#include <string.h>
+
+#include <UserAgentParser.h>
+
+#include "QTSSAccessLogRecord.h"
+#include "QTSSRollingLog.h"
+
+using namespace CF;
+
+static char const *sVoidField = "-";
+
+enum {
+  kPlayerFieldSize = 31,  // c-playerversion, c-playerlanguage, c-os, c-osversion, c-cpu
+  kEscapedStringSize = 255
+};
+
+//
+// spaces become "%20", any other white space or eol ends the value
+static UInt32 EscapeSpaces(StrPtrLen const &inValue, char *ioBuffer, UInt32 inBufferSize) {
+  UInt32 theLen = 0;
+  for (UInt32 i = 0; i < inValue.Len; i++) {
+    char theChar = inValue.Ptr[i];
+    if (theChar == ' ') {
+      if (theLen + 3 > inBufferSize)
+        break;
+      ioBuffer[theLen++] = '%';
+      ioBuffer[theLen++] = '2';
+      ioBuffer[theLen++] = '0';
+    } else if (theChar == '\t' || theChar == '\r' || theChar == '\n' || theChar == '\0') {
+      break;
+    } else {
+      if (theLen + 1 > inBufferSize)
+        break;
+      ioBuffer[theLen++] = theChar;
+    }
+  }
+  return theLen;
+}
+
+static void PutNumber(StringFormatter *ioFormatter, UInt64 inValue) {
+  char theDigits[24];
+  UInt32 theIndex = sizeof(theDigits);
+  do {
+    theDigits[--theIndex] = (char) ('0' + inValue % 10);
+    inValue /= 10;
+  } while (inValue != 0);
+  ioFormatter->Put(theDigits + theIndex, sizeof(theDigits) - theIndex);
+  ioFormatter->PutSpace();
+}
+
+static void PutField(StringFormatter *ioFormatter, char const *inValue, UInt32 inLen) {
+  if (inLen == 0)
+    ioFormatter->Put(sVoidField);
+  else
+    ioFormatter->Put(inValue, inLen);
+  ioFormatter->PutSpace();
+}
+
+static void PutField(StringFormatter *ioFormatter, StrPtrLen const &inValue) {
+  PutField(ioFormatter, inValue.Ptr, inValue.Len);
+}
+
+static void PutPlayerField(StringFormatter *ioFormatter, StrPtrLen const *inValue) {
+  if (inValue->Ptr == nullptr)
+    PutField(ioFormatter, nullptr, 0);
+  else
+    PutField(ioFormatter, inValue->Ptr, inValue->Len > kPlayerFieldSize ? (UInt32) kPlayerFieldSize : inValue->Len);
+}
+
+StrPtrLen QTSSAccessLogRecord::GetString(UInt32 inIndex) const {
+  Assert(inIndex < kNumStrings);
+  char *theString = (char *) this + sizeof(QTSSAccessLogRecord);
+  for (UInt32 i = 0; i < inIndex; i++)
+    theString += fStringLens[i];
+  return StrPtrLen(theString, fStringLens[inIndex]);
+}
+
+void QTSSAccessLogRecord::FormatW3C(StringFormatter *ioFormatter, bool logTimeInGMT) const {
+  char theDateBuffer[QTSSRollingLog::kMaxDateBufferSizeInBytes];
+  if (!QTSSRollingLog::FormatDate(theDateBuffer, logTimeInGMT, (time_t) fLogTime))
+    theDateBuffer[0] = '\0';
+
+  char theUserAgentBuffer[kEscapedStringSize];
+  StrPtrLen theUserAgent(theUserAgentBuffer, EscapeSpaces(this->GetString(kUserAgent), theUserAgentBuffer, sizeof(theUserAgentBuffer)));
+  UserAgentParser theUserAgentParser(&theUserAgent);
+
+  char theUserNameBuffer[kEscapedStringSize];
+  UInt32 theUserNameLen = EscapeSpaces(this->GetString(kUserName), theUserNameBuffer, sizeof(theUserNameBuffer));
+
+  char theRealmBuffer[kEscapedStringSize];
+  UInt32 theRealmLen = EscapeSpaces(this->GetString(kRealm), theRealmBuffer, sizeof(theRealmBuffer));
+
+  PutField(ioFormatter, this->GetString(kRemoteAddr));                 //c-ip*
+  PutField(ioFormatter, theDateBuffer, (UInt32) ::strlen(theDateBuffer)); //date* time*
+  PutField(ioFormatter, this->GetString(kRemoteDNS));                  //c-dns
+  PutField(ioFormatter, this->GetString(kURL));                        //cs-uri-stem*
+  PutNumber(ioFormatter, fStartPlayTime);                              //c-starttime
+  PutNumber(ioFormatter, fDuration);                                   //x-duration*
+  PutNumber(ioFormatter, 1);                                           //c-rate
+  PutNumber(ioFormatter, fStatusCode);                                 //c-status*
+  PutField(ioFormatter, this->GetString(kPlayerID));                   //c-playerid*
+  PutPlayerField(ioFormatter, theUserAgentParser.GetUserVersion());    //c-playerversion
+  PutPlayerField(ioFormatter, theUserAgentParser.GetUserLanguage());   //c-playerlanguage*
+  PutField(ioFormatter, theUserAgent);                                 //cs(User-Agent)
+  PutPlayerField(ioFormatter, theUserAgentParser.GetrUserOS());        //c-os*
+  PutPlayerField(ioFormatter, theUserAgentParser.GetUserOSVersion());  //c-osversion
+  PutPlayerField(ioFormatter, theUserAgentParser.GetUserCPU());        //c-cpu*
+  PutNumber(ioFormatter, fMovieDuration > 0 ? (UInt64) (fMovieDuration + 0.5) : 0); //filelength in secs*
+  PutNumber(ioFormatter, fMovieSize);                                  //filesize in bytes*
+  PutNumber(ioFormatter, fAvgBitRate);                                 //avgbandwidth in bits per second
+  PutField(ioFormatter, "RTP", 3);                                     //protocol
+  if (fTransport == kTransportTCP)                                     //transport
+    PutField(ioFormatter, "TCP", 3);
+  else if (fTransport == kTransportUDP)
+    PutField(ioFormatter, "UDP", 3);
+  else
+    PutField(ioFormatter, nullptr, 0);
+  PutField(ioFormatter, this->GetString(kAudioCodec));                 //audiocodec*
+  PutField(ioFormatter, this->GetString(kVideoCodec));                 //videocodec*
+  PutNumber(ioFormatter, fRTPBytesSent);                               //sc-bytes*
+  PutNumber(ioFormatter, fRTCPBytesRecv);                              //cs-bytes*
+  PutNumber(ioFormatter, fClientBytesRecv);                            //c-bytes
+  PutNumber(ioFormatter, fRTPPacketsSent);                             //s-pkts-sent*
+  PutNumber(ioFormatter, fClientPacketsRecv);                          //c-pkts-recieved
+  PutNumber(ioFormatter, fClientPacketsLost);                          //c-pkts-lost-client*
+  PutNumber(ioFormatter, 1);                                           //c-buffercount
+  PutNumber(ioFormatter, fClientBufferTime);                           //c-totalbuffertime*
+  PutNumber(ioFormatter, fQuality);                                    //c-quality
+  PutField(ioFormatter, this->GetString(kLocalAddr));                  //s-ip
+  PutField(ioFormatter, this->GetString(kLocalDNS));                   //s-dns
+  PutNumber(ioFormatter, fNumCurClients);                              //s-totalclients
+  PutNumber(ioFormatter, fCPUUtilized);                                //s-cpu-util
+  PutField(ioFormatter, this->GetString(kQuery));                      //cs-uri-query
+  PutField(ioFormatter, theUserNameBuffer, theUserNameLen);            //c-username
+  PutField(ioFormatter, theRealmBuffer, theRealmLen);                  //sc(Realm)
+  ioFormatter->PutChar('\n');
+}
+
+QTSSAccessLogRecord const *QTSSAccessLogRecord::Parse(char const *inData, UInt32 inLen) {
+  if (inLen < sizeof(QTSSAccessLogRecord))
+    return nullptr;
+
+  auto const *theRecord = reinterpret_cast<QTSSAccessLogRecord const *>(inData);
+  if (theRecord->fMagic != kMagic || theRecord->fVersion != kVersion)
+    return nullptr;
+  if (theRecord->fLen < sizeof(QTSSAccessLogRecord) || theRecord->fLen > inLen)
+    return nullptr;
+
+  UInt32 theStringsLen = 0;
+  for (UInt32 i = 0; i < kNumStrings; i++)
+    theStringsLen += theRecord->fStringLens[i];
+  if (sizeof(QTSSAccessLogRecord) + theStringsLen > theRecord->fLen)
+    return nullptr;
+
+  return theRecord;
+}
+
+QTSSAccessLogRecordBuilder::QTSSAccessLogRecordBuilder()
+    : fNextString(0),
+      fStringsEnd(sizeof(QTSSAccessLogRecord)) {
+  ::memset(fBuffer, 0, sizeof(QTSSAccessLogRecord));
+  QTSSAccessLogRecord *theRecord = this->GetRecord();
+  theRecord->fMagic = QTSSAccessLogRecord::kMagic;
+  theRecord->fVersion = QTSSAccessLogRecord::kVersion;
+  theRecord->fLen = sizeof(QTSSAccessLogRecord);
+}
+
+StrPtrLen QTSSAccessLogRecordBuilder::GetStringSpace(UInt32 inIndex) {
+  Assert(inIndex >= fNextString && inIndex < QTSSAccessLogRecord::kNumStrings);
+  return StrPtrLen(fBuffer + fStringsEnd, QTSSAccessLogRecord::kMaxStringLen);
+}
+
+void QTSSAccessLogRecordBuilder::CommitString(UInt32 inIndex, UInt32 inLen) {
+  Assert(inIndex >= fNextString && inIndex < QTSSAccessLogRecord::kNumStrings);
+  if (inIndex < fNextString || inIndex >= QTSSAccessLogRecord::kNumStrings)
+    return;
+
+  // QTSS_GetValue counts the terminator of some string attributes
+  char *theString = fBuffer + fStringsEnd;
+  if (inLen > QTSSAccessLogRecord::kMaxStringLen)
+    inLen = QTSSAccessLogRecord::kMaxStringLen;
+  while (inLen > 0 && theString[inLen - 1] == '\0')
+    inLen--;
+
+  QTSSAccessLogRecord *theRecord = this->GetRecord();
+  theRecord->fStringLens[inIndex] = (UInt16) inLen;
+  fNextString = inIndex + 1;
+  fStringsEnd += inLen;
+  theRecord->fLen = (fStringsEnd + 7) & ~7U;
+  ::memset(fBuffer + fStringsEnd, 0, theRecord->fLen - fStringsEnd);
+}
+
+void QTSSAccessLogRecordBuilder::PutString(UInt32 inIndex, char const *inString, UInt32 inLen) {
+  StrPtrLen theSpace = this->GetStringSpace(inIndex);
+  if (inLen > theSpace.Len)
+    inLen = theSpace.Len;
+  if (inLen > 0)
+    ::memcpy(theSpace.Ptr, inString, inLen);
+  this->CommitString(inIndex, inLen);
+}
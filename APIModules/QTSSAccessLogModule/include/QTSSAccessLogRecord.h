@@ -0,0 +1,131 @@
+/*
+    File:       QTSSAccessLogRecord.h
+
+    Contains:   A compact binary access log record.
+
+                LogRequest fills one record per closing session: the numbers
+                as typed fields, the strings packed after them, each copied
+                once from its attribute. Rendering the W3C line (user agent
+                parsing, escaping, number and date formatting) is left to the
+                access log formatter task.
+
+                In binary mode the records are written as they are, in host
+                byte order. Text lines starting with '#' (file header, startup
+                and shutdown remarks) may appear between records.
+*/
+
+#ifndef __QTSS_ACCESS_LOG_RECORD_H__
+#define __QTSS_ACCESS_LOG_RECORD_H__
+
+#include <CF/Types.h>
+#include <CF/StrPtrLen.h>
+#include <CF/StringFormatter.h>
+
+struct QTSSAccessLogRecord {
+
+  enum {
+    kMagic = 0x4c41,      //UInt16, "AL" in little endian
+    kVersion = 1,         //UInt16
+    kMaxStringLen = 255,  //UInt32, longer values are truncated
+  };
+
+  // the strings, in the order they are packed
+  enum {
+    kRemoteAddr = 0,  //c-ip
+    kRemoteDNS,       //c-dns
+    kURL,             //cs-uri-stem
+    kPlayerID,        //c-playerid
+    kUserAgent,       //cs(User-Agent), as sent, parsed by the formatter
+    kAudioCodec,      //audiocodec
+    kVideoCodec,      //videocodec
+    kLocalAddr,       //s-ip
+    kLocalDNS,        //s-dns
+    kQuery,           //cs-uri-query
+    kUserName,        //c-username
+    kRealm,           //sc(Realm)
+    kNumStrings
+  };
+
+  enum {
+    kTransportUnknown = 0,
+    kTransportUDP = 1,
+    kTransportTCP = 2
+  };
+
+  UInt16 fMagic;
+  UInt16 fVersion;
+  UInt32 fLen;                // whole record, strings included
+
+  SInt64 fLogTime;            // secs since 1970
+  Float64 fMovieDuration;     // filelength
+  UInt64 fMovieSize;          // filesize
+
+  UInt32 fStartPlayTime;      // c-starttime
+  UInt32 fDuration;           // x-duration
+  UInt32 fStatusCode;         // c-status
+  UInt32 fAvgBitRate;         // avgbandwidth
+  UInt32 fRTPBytesSent;       // sc-bytes
+  UInt32 fRTCPBytesRecv;      // cs-bytes
+  UInt32 fClientBytesRecv;    // c-bytes
+  UInt32 fRTPPacketsSent;     // s-pkts-sent
+  UInt32 fClientPacketsRecv;  // c-pkts-received
+  UInt32 fClientPacketsLost;  // c-pkts-lost-client
+  UInt32 fClientBufferTime;   // c-totalbuffertime
+  UInt32 fQuality;            // c-quality
+  UInt32 fNumCurClients;      // s-totalclients
+  UInt32 fCPUUtilized;        // s-cpu-util
+
+  UInt8 fTransport;
+  UInt8 fUnused;
+  UInt16 fStringLens[kNumStrings];
+
+  // followed by the strings, not terminated, then padding up to a multiple of 8
+
+  //
+  // the i-th string, points into the record
+  CF::StrPtrLen GetString(UInt32 inIndex) const;
+
+  //
+  // one line in the W3C format of the log header, with the trailing '\n'
+  void FormatW3C(CF::StringFormatter *ioFormatter, bool logTimeInGMT) const;
+
+  //
+  // the record at the start of inData if it is whole, nullptr otherwise
+  static QTSSAccessLogRecord const *Parse(char const *inData, UInt32 inLen);
+};
+
+/**
+ * Fills a record in its own buffer. The strings must be added in their order,
+ * the ones not added are left empty.
+ */
+class QTSSAccessLogRecordBuilder {
+ public:
+
+  enum {
+    kMaxRecordSize = sizeof(QTSSAccessLogRecord) + QTSSAccessLogRecord::kNumStrings * QTSSAccessLogRecord::kMaxStringLen + 8
+  };
+
+  QTSSAccessLogRecordBuilder();
+
+  QTSSAccessLogRecord *GetRecord() { return reinterpret_cast<QTSSAccessLogRecord *>(fBuffer); }
+
+  //
+  // room for the next string, for QTSS_GetValue, then commit what was copied in
+  CF::StrPtrLen GetStringSpace(UInt32 inIndex);
+  void CommitString(UInt32 inIndex, UInt32 inLen);
+
+  void PutString(UInt32 inIndex, char const *inString, UInt32 inLen);
+
+  //
+  // the record, with fLen set
+  char *GetBuffer() { return fBuffer; }
+  UInt32 GetLen() { return this->GetRecord()->fLen; }
+
+ private:
+
+  alignas(8) char fBuffer[kMaxRecordSize];
+  UInt32 fNextString;
+  UInt32 fStringsEnd;
+};
+
+#endif // __QTSS_ACCESS_LOG_RECORD_H__
@@ -45,31 +45,26 @@
 
 #include "AccessChecker.h"
 #include "QTSSModuleUtils.h"
+#include "QTSSCredentialCache.h"
 
 using namespace CF;
 
 static StrPtrLen sAuthWord("realm", 5);
 
 // Constructor
-// Allocates no memory
 AccessChecker::AccessChecker() :
     fGroupsFilePath(NULL),
     fUsersFilePath(NULL),
     fUsersFileModDate(-1),
     fGroupsFileModDate(-1),
-    fProfiles(NULL),
-    fNumUsers(0),
-    fCurrentSize(0) {
+    fStore(std::make_shared<UserProfileStore const>()) {
 }
 
 // Destructor
-// Deletes the fUsersFilePath, fGroupsFilePath, 
-// and calls the function to delete the authRealm and all the profiles
+// Deletes the fUsersFilePath, fGroupsFilePath, the profiles go with the last reference to the store
 AccessChecker::~AccessChecker() {
   delete[] fGroupsFilePath;
   delete[] fUsersFilePath;
-
-  deleteProfilesAndRealm();
 }
 
 // Allocates memory for the fUsersFilePath and fGroupsFilePath
@@ -90,85 +85,205 @@ void AccessChecker::UpdateFilePaths(char const *inUsersFilePath,
 
   fGroupsFilePath = new char[strlen(inGroupsFilePath) + 1];
   ::strcpy(fGroupsFilePath, inGroupsFilePath);
+
+  // the dates were of the old files, read the new ones whatever their dates
+  fUsersFileModDate = -1;
+  fGroupsFileModDate = -1;
 }
 
-// Function to delete memory allocated for all the profiles, and the authRealm
-// For each profile, memory is allocated for
-//                                  username
-//                                  cryptPassword
-//                                  digestPassword
-//                                  each group that the user belongs to (array of group names)
-// All of the above are deleted
-void AccessChecker::deleteProfilesAndRealm() {
-  UInt32 i, j;
-
-  // delete the profiles
-  if (fProfiles != NULL) {
-    // For each profile
-    for (i = 0; i < fNumUsers; i++) {
-      UserProfile *profile = fProfiles[i];
-
-      // delete the username
-      if ((profile->username).Len != 0) {
-        delete (profile->username).Ptr;
-        (profile->username).Len = 0;
-      }
+// FNV-1a
+size_t AccessChecker::StrPtrLenHash::operator()(StrPtrLen const &inStr) const {
+  UInt32 theHash = 2166136261U;
+  for (UInt32 i = 0; i < inStr.Len; i++) {
+    theHash ^= (UInt8) inStr.Ptr[i];
+    theHash *= 16777619U;
+  }
+  return theHash;
+}
 
-      // delete cryptPassword
-      if ((profile->cryptPassword).Len != 0) {
-        delete (profile->cryptPassword).Ptr;
-        (profile->cryptPassword).Len = 0;
-      }
+// Parses the users file into a new table, which takes ownership of inUserData's data
+// The realm line should be the first line that isn't a comment,
+// every other line is "username:cryptPassword:digestPassword"
+std::shared_ptr<AccessChecker::UserTable const> AccessChecker::ParseUsersFile(StrPtrLen const &inUserData) {
+  std::shared_ptr<UserTable> theTable = std::make_shared<UserTable>();
+  theTable->fData = inUserData.Ptr;
 
-      // delete digestPassword
-      if ((profile->digestPassword).Len != 0) {
-        delete (profile->digestPassword).Ptr;
-        (profile->digestPassword).Len = 0;
-      }
+  StrPtrLen userData(inUserData);
+  StrPtrLen line;
+  StringParser userDataParser(&userData);
+
+  // check if the first line is "realm"
+  while (userDataParser.GetDataRemaining() != 0) {
+    StrPtrLen word;
+    userDataParser.GetThruEOL(&line);
+    StringParser authLineParser(&line);
+    // Skip over leading whitespace
+    authLineParser.ConsumeUntil(NULL, StringParser::sNonWhitespaceMask);
+    // Skip over comments and blank lines
+    if ((authLineParser.GetDataRemaining() == 0) || (authLineParser[0] == '#') || (authLineParser[0] == '\0'))
+      continue;
+    authLineParser.ConsumeWord(&word);
+    if (sAuthWord.Equal(word)) {
+      authLineParser.ConsumeWhitespace();
+      authLineParser.ConsumeUntil(&word, StringParser::sEOLMask);
+      theTable->fAuthRealm = word;
+    } else {
+      // This shouldn't happen because it means that the realm line
+      // is not the first non-commented out line in the file
+      // Implies the users file is corrupted!
+      theTable->fErr |= kBadUsersFileErr;
 
-      // delete each group name
-      for (j = 0; j < profile->numGroups; j++) {
-        delete[] profile->groups[j];
+      // Create a new user profile for the first username
+      UserProfile profile;
+      profile.username = word;
+      // Get the crypted password
+      if (authLineParser.Expect(':')) {
+        authLineParser.ConsumeUntil(&word, ':');
+        profile.cryptPassword = word;
+        // Get the digest password
+        authLineParser.GetThruEOL(&word);
+        profile.digestPassword = word;
       }
-      // delete the array of pointers to the group names
-      delete[] profile->groups;
-
-      profile->groups = NULL;
-      profile->maxGroupNameLen = 0;
-      profile->numGroups = 0;
-      profile->groupsSize = 0;
-      delete profile;
+      profile.index = 0;
+      theTable->fProfiles.push_back(profile);
     }
+    break;
+  }
+
+  while (userDataParser.GetDataRemaining() != 0) {
+    // Read each line
+    userDataParser.GetThruEOL(&line);
+    StringParser userLineParser(&line);
+    //parse the line
+    //skip over leading whitespace
+    userLineParser.ConsumeUntil(NULL, StringParser::sNonWhitespaceMask);
+
+    //skip over comments and blank lines
+    if ((userLineParser.GetDataRemaining() == 0) || (userLineParser[0] == '#')
+        || (userLineParser[0] == '\0'))
+      continue;
 
-    // delete the array of profile pointers
-    delete[] fProfiles;
-    fProfiles = NULL;
+    // Create a new user profile for each username found
+    UserProfile profile;
+    StrPtrLen word;
+    userLineParser.ConsumeUntil(&word, ':');
+    profile.username = word;
+    // Get the crypted password
+    if (userLineParser.Expect(':')) {
+      userLineParser.ConsumeUntil(&word, ':');
+      profile.cryptPassword = word;
+      if (userLineParser.Expect(':')) {
+        // Get the digest password
+        userLineParser.GetThruEOL(&word);
+        profile.digestPassword = word;
+      }
+    }
+    profile.index = (UInt32) theTable->fProfiles.size();
+    theTable->fProfiles.push_back(profile);
   }
 
-  // delete the fAuthRealm field
-  if (fAuthRealm.Len != 0) {
-    delete fAuthRealm.Ptr;
-    fAuthRealm.Len = 0;
+  // a name listed twice resolves to its first line, as the old linear search did
+  theTable->fIndex.reserve(theTable->fProfiles.size());
+  for (UserProfile const &profile : theTable->fProfiles)
+    theTable->fIndex.emplace(profile.username, profile.index);
+
+  return theTable;
+}
+
+// Every line of the groups file is "groupname: user1 user2 ..."
+// A group is numbered by its first line, a user's groups are a bitset of these numbers
+AccessChecker::UserProfileStore::UserProfileStore(std::shared_ptr<UserTable const> const &inUsers,
+                                                  StrPtrLen const &inGroupData)
+    : fUsers(inUsers), fGroupData(inGroupData.Ptr), fGroupWords(0) {
+  if (fUsers == nullptr || inGroupData.Len == 0)
+    return;
+
+  std::unordered_map<StrPtrLen, UInt32, StrPtrLenHash, StrPtrLenEqual> groupIndex;
+  std::vector<std::pair<UInt32, UInt32> > memberships; // user, group
+
+  StrPtrLen groupData(inGroupData);
+  StrPtrLen line;
+  StringParser groupDataParser(&groupData);
+  while (groupDataParser.GetDataRemaining() != 0) {
+    // Read each line
+    groupDataParser.GetThruEOL(&line);
+    StringParser groupLineParser(&line);
+    //parse the line
+    //skip over leading whitespace
+    groupLineParser.ConsumeUntil(NULL, StringParser::sNonWhitespaceMask);
+
+    //skip over comments and blank lines
+    if ((groupLineParser.GetDataRemaining() == 0)
+        || (groupLineParser[0] == '#') || (groupLineParser[0] == '\0'))
+      continue;
+
+    //parse the groupname
+    StrPtrLen groupName;
+    groupLineParser.ConsumeUntil(&groupName, ':');
+
+    if (groupLineParser.Expect(':')) {
+      auto theGroup = groupIndex.emplace(groupName, (UInt32) fGroupNames.size());
+      if (theGroup.second)
+        fGroupNames.push_back(groupName);
+
+      StrPtrLen groupUser;
+      while (groupLineParser.GetDataRemaining() != 0) {
+        groupLineParser.ConsumeWhitespace();
+        groupLineParser.ConsumeUntilWhitespace(&groupUser);
+        auto theUser = fUsers->fIndex.find(groupUser);
+        if (theUser != fUsers->fIndex.end())
+          memberships.emplace_back(theUser->second, theGroup.first->second);
+      }
+    }
   }
 
-  fNumUsers = 0;
-  fCurrentSize = 0;
+  fGroupWords = (UInt32) ((fGroupNames.size() + 63) / 64);
+  fGroupBits.assign(fUsers->fProfiles.size() * fGroupWords, 0);
+  for (auto const &membership : memberships)
+    fGroupBits[membership.first * fGroupWords + membership.second / 64] |= (UInt64) 1 << (membership.second % 64);
+}
+
+// No memory is allocated
+AccessChecker::UserProfile const *AccessChecker::UserProfileStore::RetrieveUserProfile(StrPtrLen const *inUserName) const {
+  if (fUsers == nullptr)
+    return NULL;
+
+  auto theUser = fUsers->fIndex.find(*inUserName);
+  if (theUser == fUsers->fIndex.end())
+    return NULL;
+  return &fUsers->fProfiles[theUser->second];
+}
+
+StrPtrLen const *AccessChecker::UserProfileStore::GetAuthRealm() const {
+  static StrPtrLen sNoRealm;
+  return fUsers != nullptr ? &fUsers->fAuthRealm : &sNoRealm;
 }
 
-// Memory is allocated for each username record found in the users file
-// Memory is also allocated for each group name found in the groups file per user
-// All this memory must be deleted if the profiles are deleted, before parsing
-// the file again
+void AccessChecker::UserProfileStore::GetGroups(UserProfile const *inProfile, std::vector<StrPtrLen> *outGroups) const {
+  outGroups->clear();
+  if (fGroupWords == 0)
+    return;
+
+  UInt64 const *theBits = &fGroupBits[inProfile->index * fGroupWords];
+  for (UInt32 word = 0; word < fGroupWords; word++) {
+    for (UInt64 bits = theBits[word]; bits != 0; bits &= bits - 1) {
+      UInt32 bit = 0;
+      while ((bits & ((UInt64) 1 << bit)) == 0)
+        bit++;
+      outGroups->push_back(fGroupNames[word * 64 + bit]);
+    }
+  }
+}
+
+// Reads the users and groups files if they changed since the last call and swaps in a store
+// built from them. The user table is parsed again only when the users file changed,
+// a change of the groups file alone rebuilds the group bits over the current table.
 UInt32 AccessChecker::UpdateUserProfiles() {
 
-  UInt32 index = 0;
-  UInt32 i = 0, j = 0;
   UInt32 resultErr = kNoErr;
   bool groupFileErrors = true;
   bool userFileErrors = true;
 
-  StrPtrLen line;
-
   QTSS_TimeVal oldUsersFileModDate = fUsersFileModDate;
   QTSS_TimeVal oldGroupsFileModDate = fGroupsFileModDate;
 
@@ -208,179 +323,54 @@ UInt32 AccessChecker::UpdateUserProfiles() {
     fGroupsFileModDate = newModDate;
 
   if (userFileErrors) {
-    // delete user profiles and exit
-    deleteProfilesAndRealm();
+    // no users file, no users
+    delete[] userData.Ptr;
+    delete[] groupData.Ptr;
+    if (GetProfileStore()->GetUserTable() != nullptr) {
+      std::atomic_store(&fStore, std::make_shared<UserProfileStore const>());
+      QTSSCredentialCache::Invalidate();
+    }
     return resultErr;
   }
 
-  if ((fUsersFileModDate == oldUsersFileModDate) && (fGroupsFileModDate == oldGroupsFileModDate))
+  bool usersChanged = (fUsersFileModDate != oldUsersFileModDate);
+  if (!usersChanged && (fGroupsFileModDate == oldGroupsFileModDate)) {
+    delete[] userData.Ptr;
+    delete[] groupData.Ptr;
     return resultErr;
-
-  // If either the users or groups file has changed
-  // the old profiles and the old realm should be deleted
-  // before a new array of profiles is created and a new realm from the users file is read
-  deleteProfilesAndRealm();
-
-  // Since one or both of the files has changed, reread the files and create user profiles
-  if (userData.Len == 0)
-    (void) QTSSModuleUtils::ReadEntireFile(fUsersFilePath, &userData, -1, NULL);
-  if (groupData.Len == 0 && !groupFileErrors)
-    (void) QTSSModuleUtils::ReadEntireFile(fGroupsFilePath, &groupData, -1, NULL);
-
-
-  // This will delete the memory allocated for userData when we return from this function
-  CharArrayDeleter userDataPtrDeleter(userData.Ptr);
-  // This will delete the memory allocated for groupData when we return from this function
-  CharArrayDeleter groupDataPtrDeleter(groupData.Ptr);
-
-  // Create the fProfiles array of size kDefaultNumProfiles
-  fProfiles = new UserProfile *[kDefaultNumProfiles];
-  fCurrentSize = kDefaultNumProfiles;
-
-  StringParser userDataParser(&userData);
-  // check if the first line is "realm"
-  while (true) {
-    StrPtrLen word;
-    userDataParser.GetThruEOL(&line);
-    StringParser authLineParser(&line);
-    // Skip over leading whitespace
-    authLineParser.ConsumeUntil(NULL, StringParser::sNonWhitespaceMask);
-    // Skip over comments and blank lines
-    if ((authLineParser.GetDataRemaining() == 0) || (authLineParser[0] == '#') || (authLineParser[0] == '\0'))
-      continue;
-    authLineParser.ConsumeWord(&word);
-    if (sAuthWord.Equal(word)) {
-      authLineParser.ConsumeWhitespace();
-      authLineParser.ConsumeUntil(&word, StringParser::sEOLMask);
-      fAuthRealm.Set(word.GetAsCString(), word.Len);
-    } else {
-      // This shouldn't happen because it means that the realm line
-      // is not the first non-commented out line in the file
-      // Implies the users file is corrupted!
-      resultErr |= kBadUsersFileErr;
-
-      // Create a new user profile for the first username
-      UserProfile *profile = new UserProfile;
-      profile->groups = new char *[kDefaultNumGroups];
-      profile->maxGroupNameLen = 0;
-      profile->numGroups = 0;
-      profile->groupsSize = kDefaultNumGroups;
-      (profile->username).Set(word.GetAsCString(), word.Len);
-      // Get the crypted password
-      if (authLineParser.Expect(':')) {
-        authLineParser.ConsumeUntil(&word, ':');
-        (profile->cryptPassword).Set(word.GetAsCString(), word.Len);
-        // Get the digest password
-        authLineParser.GetThruEOL(&word);
-        (profile->digestPassword).Set(word.GetAsCString(), word.Len);
-      }
-
-      fProfiles[index] = profile;
-      index++;
-    }
-    break;
   }
 
-  while (userDataParser.GetDataRemaining() != 0) {
-    // Read each line
-    userDataParser.GetThruEOL(&line);
-    StringParser userLineParser(&line);
-    //parse the line
-    //skip over leading whitespace
-    userLineParser.ConsumeUntil(NULL, StringParser::sNonWhitespaceMask);
-
-    //skip over comments and blank lines
-    if ((userLineParser.GetDataRemaining() == 0) || (userLineParser[0] == '#')
-        || (userLineParser[0] == '\0'))
-      continue;
-
-    // Create a new user profile for each username found
-    UserProfile *profile = new UserProfile;
-    profile->groups = new char *[kDefaultNumGroups];
-    profile->maxGroupNameLen = 0;
-    profile->numGroups = 0;
-    profile->groupsSize = kDefaultNumGroups;
-    StrPtrLen word;
-    userLineParser.ConsumeUntil(&word, ':');
-    (profile->username).Set(word.GetAsCString(), word.Len);
-    // Get the crypted password
-    if (userLineParser.Expect(':')) {
-      userLineParser.ConsumeUntil(&word, ':');
-      (profile->cryptPassword).Set(word.GetAsCString(), word.Len);
-      if (userLineParser.Expect(':')) {
-        // Get the digest password
-        userLineParser.GetThruEOL(&word);
-        (profile->digestPassword).Set(word.GetAsCString(), word.Len);
-      }
-    }
-
-    if (index >= fCurrentSize) {
-      UserProfile **oldProfiles = fProfiles;
-      fProfiles = new UserProfile *[fCurrentSize * 2];
-      for (i = 0; i < fCurrentSize; i++) {
-        fProfiles[i] = oldProfiles[i];
-      }
-      fCurrentSize *= 2;
-      delete[] oldProfiles;
+  // Since one or both of the files has changed, reread what is needed
+  std::shared_ptr<UserTable const> theUsers;
+  if (usersChanged) {
+    if (userData.Len == 0) {
+      delete[] userData.Ptr;
+      (void) QTSSModuleUtils::ReadEntireFile(fUsersFilePath, &userData, -1, NULL);
     }
+    theUsers = ParseUsersFile(userData); // owns userData now
+  } else {
+    delete[] userData.Ptr;
+    theUsers = GetProfileStore()->GetUserTable();
+  }
+  if (theUsers != nullptr)
+    resultErr |= theUsers->fErr;
 
-    fProfiles[index] = profile;
-    index++;
+  if (groupData.Len == 0 && !groupFileErrors) {
+    delete[] groupData.Ptr;
+    (void) QTSSModuleUtils::ReadEntireFile(fGroupsFilePath, &groupData, -1, NULL);
   }
-  fNumUsers = index;
-
-  if (!groupFileErrors) {
-    StringParser groupDataParser(&groupData);
-    while (groupDataParser.GetDataRemaining() != 0) {
-      // Read each line
-      groupDataParser.GetThruEOL(&line);
-      StringParser groupLineParser(&line);
-      //parse the line
-      //skip over leading whitespace
-      groupLineParser.ConsumeUntil(NULL, StringParser::sNonWhitespaceMask);
-
-      //skip over comments and blank lines
-      if ((groupLineParser.GetDataRemaining() == 0)
-          || (groupLineParser[0] == '#') || (groupLineParser[0] == '\0'))
-        continue;
-
-      //parse the groupname
-      StrPtrLen groupName;
-      groupLineParser.ConsumeUntil(&groupName, ':');
-
-      if (groupLineParser.Expect(':')) {
-        StrPtrLen groupUser;
-        UInt32 nameLen = groupName.Len + 1;
-
-        while (groupLineParser.GetDataRemaining() != 0) {
-          groupLineParser.ConsumeWhitespace();
-          groupLineParser.ConsumeUntilWhitespace(&groupUser);
-          for (i = 0; i < fNumUsers; i++) {
-            if (fProfiles[i]->username.Equal(groupUser)) {
-              UInt32 grpSize = fProfiles[i]->groupsSize;
-              if (fProfiles[i]->numGroups >= grpSize) {
-                char **oldGroups = fProfiles[i]->groups;
-                fProfiles[i]->groups = new char *[grpSize * 2];
-                for (j = 0; j < grpSize; j++) {
-                  fProfiles[i]->groups[j] = oldGroups[j];
-                }
-                fProfiles[i]->groupsSize *= 2;
-                delete[] oldGroups;
-              }
-
-              fProfiles[i]->groups[fProfiles[i]->numGroups] =
-                  groupName.GetAsCString();
-              if (nameLen > fProfiles[i]->maxGroupNameLen)
-                fProfiles[i]->maxGroupNameLen = nameLen;
-              fProfiles[i]->numGroups++;
-              break;
-            }
-          }
-        }
-      }
-    }
+  if (groupFileErrors) { // users without groups
+    delete[] groupData.Ptr;
+    groupData.Set(NULL, 0);
   }
 
+  // the old store stays with whoever holds it
+  std::atomic_store(&fStore, std::make_shared<UserProfileStore const>(theUsers, groupData));
+
+  // the passwords checked so far were of the old users file
+  if (usersChanged)
+    QTSSCredentialCache::Invalidate();
+
   return resultErr;
 }
 
@@ -393,14 +383,3 @@ bool AccessChecker::HaveFilePathsChanged(char const *inUsersFilePath, char const
   }
   return changed;
 }
-
-// No memory is allocated
-AccessChecker::UserProfile *AccessChecker::RetrieveUserProfile(const StrPtrLen *inUserName) {
-  UInt32 index = 0;
-  for (index = 0; index < fNumUsers; index++) {
-    if (fProfiles[index]->username.Equal(*inUserName))
-      return fProfiles[index];
-  }
-  return NULL;
-}
-
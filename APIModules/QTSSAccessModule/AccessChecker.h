@@ -32,6 +32,10 @@
 #ifndef _QTSSACCESSCHECKER_H_
 #define _QTSSACCESSCHECKER_H_
 
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
 #include <CF/StrPtrLen.h>
 
 #include "QTSS.h"
@@ -56,22 +60,70 @@ class AccessChecker {
               If not found,
                   deny access
 
-      ToDo:
-          would probably be a good idea to do some caching of ".qtaccess" data to avoid
-          multiple directory walks
+      The ".qtaccess" found for a directory is cached by QTAccessFileCache, so the
+      directories are walked once, until a ".qtaccess" on the way changes
   */
 
  public:
   struct UserProfile {
     StrPtrLen username;
     StrPtrLen cryptPassword;
-    StrPtrLen digestPassword;
-    char **groups;
-    UInt32 maxGroupNameLen;
-    UInt32 numGroups;
-    UInt32 groupsSize;
+    StrPtrLen digestPassword;   // MD5(username:realm:password) in hex, the HA1 as qtpasswd stores it
+    UInt32 index;               // row of the user in the group bits
+  };
+
+  struct StrPtrLenHash {
+    size_t operator()(StrPtrLen const &inStr) const;
   };
 
+  struct StrPtrLenEqual {
+    bool operator()(StrPtrLen const &inStr1, StrPtrLen const &inStr2) const { return inStr1.Equal(inStr2); }
+  };
+
+  //
+  // The users of a users file, indexed by name. The strings point into fData.
+  // Shared by the stores built from the same users file.
+  struct UserTable {
+    UserTable() : fData(NULL), fErr(kNoErr) {}
+    ~UserTable() { delete[] fData; }
+
+    char *fData;
+    StrPtrLen fAuthRealm;
+    std::vector<UserProfile> fProfiles;
+    std::unordered_map<StrPtrLen, UInt32, StrPtrLenHash, StrPtrLenEqual> fIndex; // first profile of a name
+    UInt32 fErr;  // kBadUsersFileErr if the realm line isn't first
+  };
+
+  //
+  // The users with their groups. Immutable once built, an update builds a new one
+  // and swaps it in, so a store got from GetProfileStore stays whole while it is held.
+  class UserProfileStore {
+   public:
+    UserProfileStore() : fGroupData(NULL), fGroupWords(0) {}
+    // takes ownership of inGroupData's data
+    UserProfileStore(std::shared_ptr<UserTable const> const &inUsers, StrPtrLen const &inGroupData);
+    UserProfileStore(UserProfileStore const &) = delete;
+    ~UserProfileStore() { delete[] fGroupData; }
+
+    // No memory is allocated; the profile lives as long as the store
+    UserProfile const *RetrieveUserProfile(StrPtrLen const *inUserName) const;
+    StrPtrLen const *GetAuthRealm() const;
+
+    // the groups of inProfile, in the order of the groups file
+    void GetGroups(UserProfile const *inProfile, std::vector<StrPtrLen> *outGroups) const;
+
+    std::shared_ptr<UserTable const> const &GetUserTable() const { return fUsers; }
+
+   private:
+    std::shared_ptr<UserTable const> fUsers;  // NULL if there are no users
+    char *fGroupData;                         // the groups file, fGroupNames point into it
+    std::vector<StrPtrLen> fGroupNames;
+    UInt32 fGroupWords;                       // UInt64 per user in fGroupBits
+    std::vector<UInt64> fGroupBits;           // bit i of a user's row: member of fGroupNames[i]
+  };
+
+  typedef std::shared_ptr<UserProfileStore const> StoreRef;
+
   AccessChecker();
   virtual ~AccessChecker();
 
@@ -81,12 +133,12 @@ class AccessChecker {
 
   bool HaveFilePathsChanged(char const *inUsersFilePath,
                             char const *inGroupsFilePath);
-  UserProfile *RetrieveUserProfile(const StrPtrLen *inUserName);
-  inline StrPtrLen *GetAuthRealm() { return &fAuthRealm; }
+
+  // the current users, may be read without the lock UpdateUserProfiles is called with
+  StoreRef GetProfileStore() const { return std::atomic_load(&fStore); }
   inline char *GetUsersFilePathPtr() { return fUsersFilePath; }
   inline char *GetGroupsFilePathPtr() { return fGroupsFilePath; }
 
-  enum { kDefaultNumProfiles = 10, kDefaultNumGroups = 2 };
   enum {
     kNoErr = 0x00000000,
     kUsersFileNotFoundErr = 0x00000001,
@@ -102,17 +154,14 @@ class AccessChecker {
   char *fUsersFilePath;
   QTSS_TimeVal fUsersFileModDate;
   QTSS_TimeVal fGroupsFileModDate;
-  StrPtrLen fAuthRealm;
 
-  UserProfile **fProfiles;
-  UInt32 fNumUsers;
-  UInt32 fCurrentSize;
+  StoreRef fStore; // replaced with std::atomic_store
 
   static char const *kDefaultUsersFilePath;
   static char const *kDefaultGroupsFilePath;
 
  private:
-  void deleteProfilesAndRealm();
+  static std::shared_ptr<UserTable const> ParseUsersFile(StrPtrLen const &inUserData);
 };
 
 #endif //_QTSSACCESSCHECKER_H_
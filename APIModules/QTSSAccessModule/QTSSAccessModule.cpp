@@ -39,6 +39,7 @@
 
 #include "AccessChecker.h"
 #include "QTAccessFile.h"
+#include "QTAccessFileCache.h"
 #include "QTSSModuleUtils.h"
 
 #ifndef __Win32__
@@ -344,8 +345,6 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params *inParams) {
   QTSS_RTSPRequestObject theRTSPRequest = inParams->inRTSPRequest;
   UInt32 fileErr;
 
-  CF::Core::MutexLocker locker(sUserMutex);
-
   if ((NULL == inParams) || (NULL == inParams->inRTSPRequest))
     return QTSS_RequestFailed;
 
@@ -375,10 +374,9 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params *inParams) {
   CharArrayDeleter movieRootDeleter(movieRootDirStr);
   if (NULL == movieRootDirStr)
     return QTSS_RequestFailed;
-  // Now get the access file path
-  char *accessFilePath =
-      QTAccessFile::GetAccessFile_Copy(movieRootDirStr, pathBuffStr);
-  CharArrayDeleter accessFilePathDeleter(accessFilePath);
+  // Now get the access file, resolved once per directory
+  QTAccessFileCache::PolicyRef accessPolicy =
+      QTAccessFileCache::GetPolicy(movieRootDirStr, pathBuffStr);
   // Parse the access file for the AuthUserFile and AuthGroupFile keywords
   char *usersFilePath = NULL;
   char *groupsFilePath = NULL;
@@ -397,14 +395,17 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params *inParams) {
 
   // Allocates memory for usersFilePath and groupsFilePath
   QTSS_AuthScheme authScheme =
-      QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(accessFilePath,
-                                                         action,
+      accessPolicy->FindUsersAndGroupsFilesAndAuthScheme(action,
                                                          &usersFilePath,
                                                          &groupsFilePath);
 
   if ((usersFilePath != NULL) || (groupsFilePath != NULL))
     defaultPaths = false;
 
+  // The checkers and the default paths are shared (RereadPrefs replaces them),
+  // the users got from a checker are read without the lock
+  sUserMutex->Lock();
+
   if (usersFilePath == NULL)
     usersFilePath = strdup(sUsersFilePath);
 
@@ -484,6 +485,8 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params *inParams) {
   // Before retrieving the user profile information
   // check if the groups/users files have been modified and update them otherwise
   fileErr = currentChecker->UpdateUserProfiles();
+  AccessChecker::StoreRef profileStore = currentChecker->GetProfileStore();
+  sUserMutex->Unlock();
 
   /*
   // This is for logging the errors if users file and/or the groups file is not found or corrupted
@@ -533,7 +536,7 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params *inParams) {
   // This should be used for digest auth scheme, and if no realm is found in the qtaccess file, then
   // it should be used for basic auth scheme.
   // No memory is allocated; just a pointer is returned
-  StrPtrLen *authRealm = currentChecker->GetAuthRealm();
+  StrPtrLen const *authRealm = profileStore->GetAuthRealm();
   (void) QTSS_SetValue(theUserProfile,
                        qtssUserRealm,
                        0,
@@ -549,9 +552,9 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params *inParams) {
   if (theErr != QTSS_NoErr)
     return theErr;
 
-  // No memory is allocated; just a pointer to the profile is returned
-  AccessChecker::UserProfile
-      *profile = currentChecker->RetrieveUserProfile(&username);
+  // No memory is allocated; just a pointer to the profile is returned, valid while profileStore is held
+  AccessChecker::UserProfile const
+      *profile = profileStore->RetrieveUserProfile(&username);
 
   if (profile == NULL)
     return QTSS_NoErr;
@@ -573,26 +576,26 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params *inParams) {
 
 
   // Set the multivalued qtssUserGroups attr to the groups the user belongs to, if any
-  UInt32 maxLen = profile->maxGroupNameLen;
-  for (index = 0; index < profile->numGroups; index++) {
-    UInt32 curLen = ::strlen(profile->groups[index]);
-    if (curLen < maxLen) {
-      char *groupWithPaddedZeros = new char[maxLen];  // memory allocated
-      ::memcpy(groupWithPaddedZeros, profile->groups[index], curLen);
-      ::memset(groupWithPaddedZeros + curLen, '\0', maxLen - curLen);
-      (void) QTSS_SetValue(theUserProfile,
-                           qtssUserGroups,
-                           index,
-                           (void *) groupWithPaddedZeros,
-                           maxLen);
-      delete[] groupWithPaddedZeros;                 // memory deleted
-    } else {
-      (void) QTSS_SetValue(theUserProfile,
-                           qtssUserGroups,
-                           index,
-                           (void *) (profile->groups[index]),
-                           maxLen);
-    }
+  std::vector<StrPtrLen> groups;
+  profileStore->GetGroups(profile, &groups);
+
+  UInt32 maxLen = 0;
+  for (index = 0; index < groups.size(); index++) {
+    if (groups[index].Len + 1 > maxLen)
+      maxLen = groups[index].Len + 1;
+  }
+
+  // every value padded with zeros to the longest name and its terminator
+  char *groupWithPaddedZeros = maxLen > 0 ? new char[maxLen] : NULL;  // memory allocated
+  CharArrayDeleter groupDeleter(groupWithPaddedZeros);                // memory deleted
+  for (index = 0; index < groups.size(); index++) {
+    ::memcpy(groupWithPaddedZeros, groups[index].Ptr, groups[index].Len);
+    ::memset(groupWithPaddedZeros + groups[index].Len, '\0', maxLen - groups[index].Len);
+    (void) QTSS_SetValue(theUserProfile,
+                         qtssUserGroups,
+                         index,
+                         (void *) groupWithPaddedZeros,
+                         maxLen);
   }
 
   return QTSS_NoErr;
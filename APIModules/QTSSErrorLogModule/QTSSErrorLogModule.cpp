@@ -188,6 +188,13 @@ QTSS_Error Register(QTSS_Register_Params *inParams) {
 
 QTSS_Error Shutdown() {
   WriteShutdownMessage();
+
+  // the log task won't run again, write out what it hasn't
+  {
+    Core::MutexLocker locker(sLogMutex);
+    if (sErrorLog != NULL)
+      sErrorLog->Flush();
+  }
   if (sErrorLogCheckTask != NULL) {
     // sErrorLogCheckTask is a task object, so don't delete it directly
     // instead we signal it to kill itself.
@@ -300,7 +307,11 @@ QTSS_Error LogError(QTSS_RoleParamPtr inParamBlock) {
     tempBuffer[sizeof(tempBuffer) - 2] = '\n'; //make sure the entry has a line feed before the \0 terminator
     tempBuffer[sizeof(tempBuffer) - 1] = '\0'; //make sure it is 0 terminated.
 
-    sErrorLog->WriteToLog(tempBuffer, kAllowLogToRoll);
+    // a fatal error is likely the last thing the process does, don't leave it queued
+    if (verbLvl == qtssFatalVerbosity)
+      sErrorLog->WriteToLogNow(tempBuffer, (UInt32) ::strlen(tempBuffer), kAllowLogToRoll);
+    else
+      sErrorLog->WriteToLog(tempBuffer, kAllowLogToRoll);
   }
   return QTSS_NoErr;
 }
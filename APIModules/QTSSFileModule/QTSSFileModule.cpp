@@ -0,0 +1,618 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2008 Apple Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/**
+ * @file QTSSFileModule.cpp
+ *
+ * Implementation of QTSSFileModule.
+ *
+ * 点播模块: 每个客户端会话持有一个 QTRTPFile, 在 QTSS_RTPSendPackets_Role 中按发送时间逐包取出写给 RTPStream。
+ * QTRTPFile::Initialize 通过文件缓存 (AddFileToCache/FindAndRefcountFileCacheEntry) 打开影片,
+ * 同一文件的所有观看者共享一个解析好的 QTFile, 各自只保存播放位置。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <CF/ArrayObjectDeleter.h>
+
+#include "QTSSFileModule.h"
+#include "QTSSModuleUtils.h"
+#include "QTSSMemoryDeleter.h"
+#include "SDPSourceInfo.h"
+#include "SDPUtils.h"
+
+#include "QTRTPFile.h"
+#include "QTFile.h"
+
+using namespace CF;
+
+class FileSession {
+ public:
+
+  FileSession()
+      : fSourceInfo(nullptr),
+        fSDPLen(0),
+        fPacketLen(0),
+        fStream(nullptr),
+        fLastPacketTime(0.0),
+        fStopTime(-1.0),
+        fSpeed(1.0),
+        fAdjustedPlayTime(0),
+        fPaused(false) {
+    ::memset(&fPacketStruct, 0, sizeof(fPacketStruct));
+  }
+
+  ~FileSession() { delete fSourceInfo; }
+
+  QTRTPFile fFile;
+  SDPSourceInfo *fSourceInfo;  // stream info parsed from the movie's SDP, for SETUP
+  int fSDPLen;
+
+  // the packet that couldn't be written yet
+  QTSS_PacketStruct fPacketStruct;
+  int fPacketLen;
+  QTSS_RTPStreamObject fStream;
+
+  Float64 fLastPacketTime;  // movie time of the last packet fetched, a PLAY without Range resumes here
+  Float64 fStopTime;        // -1 if the range is open
+  Float32 fSpeed;
+  SInt64 fAdjustedPlayTime; // wall clock of movie time 0 at fSpeed
+  bool fPaused;
+};
+
+// ATTRIBUTES
+
+static QTSS_AttributeID sFileSessionAttr = qtssIllegalAttrID;
+static QTSS_AttributeID sFileNotHintedErr = qtssIllegalAttrID;
+static QTSS_AttributeID sBadTrackIDErr = qtssIllegalAttrID;
+static QTSS_AttributeID sSeekToNonexistentTimeErr = qtssIllegalAttrID;
+static QTSS_AttributeID sExpectedDigitFilenameErr = qtssIllegalAttrID;
+
+// STATIC DATA
+
+static QTSS_PrefsObject sServerPrefs = nullptr;
+static QTSS_ModulePrefsObject sPrefs = nullptr;
+static const StrPtrLen kCacheControlHeader("no-cache");
+static StrPtrLen sSDPSuffix(".sdp");
+
+//
+// Prefs
+static UInt32 sFlowControlProbeInterval = 10;
+static UInt32 sDefaultFlowControlProbeInterval = 10;
+
+static Float32 sMaxAllowedSpeed = 4;
+static Float32 sDefaultMaxAllowedSpeed = 4;
+
+static Float64 sMaxBackupTime = 3.0;
+static Float64 sDefaultMaxBackupTime = 3.0;
+
+// start every seek on a key frame of the video track, instead of backing up at most max_seek_backup_time
+static bool sSeekToSyncSample = true;
+static bool sDefaultSeekToSyncSample = true;
+
+static bool sUseMappedReads = false;
+static bool sDefaultUseMappedReads = false;
+
+static bool sPlayerCompatibility = true;
+static bool sDefaultPlayerCompatibility = true;
+
+static UInt32 sAdjustMediaBandwidthPercent = 50;
+static UInt32 sAdjustMediaBandwidthPercentDefault = 50;
+
+// thinning levels handed to the RTPStream, kKeyFramesPlusOneP isn't part of the ordered range
+static const UInt32 sNumQualityLevels = QTRTPFile::kKeyFramesOnly + 1;
+
+// FUNCTION PROTOTYPES
+
+static QTSS_Error QTSSFileModuleDispatch(QTSS_Role inRole, QTSS_RoleParamPtr inParams);
+
+static QTSS_Error Register(QTSS_Register_Params *inParams);
+
+static QTSS_Error Initialize(QTSS_Initialize_Params *inParams);
+
+static QTSS_Error RereadPrefs();
+
+static QTSS_Error ProcessRTSPRequest(QTSS_StandardRTSP_Params *inParams);
+
+static QTSS_Error DoDescribe(QTSS_StandardRTSP_Params *inParams);
+
+static QTSS_Error DoSetup(QTSS_StandardRTSP_Params *inParams);
+
+static QTSS_Error DoPlay(QTSS_StandardRTSP_Params *inParams, FileSession *inFile);
+
+static QTSS_Error SendPackets(QTSS_RTPSendPackets_Params *inParams);
+
+static QTSS_Error DestroySession(QTSS_ClientSessionClosing_Params *inParams);
+
+static QTSS_Error CreateFileSession(QTSS_StandardRTSP_Params *inParams, QTSS_AttributeID inPathType, FileSession **outFile);
+
+static FileSession *GetFileSession(QTSS_ClientSessionObject inClientSession);
+
+// FUNCTION IMPLEMENTATIONS
+
+QTSS_Error QTSSFileModule_Main(void *inPrivateArgs) {
+  return _stublibrary_main(inPrivateArgs, QTSSFileModuleDispatch);
+}
+
+QTSS_Error QTSSFileModuleDispatch(QTSS_Role inRole, QTSS_RoleParamPtr inParams) {
+  switch (inRole) {
+    case QTSS_Register_Role:             return Register(&inParams->regParams);
+    case QTSS_Initialize_Role:           return Initialize(&inParams->initParams);
+    case QTSS_RereadPrefs_Role:          return RereadPrefs();
+    case QTSS_RTSPPreProcessor_Role:     return ProcessRTSPRequest(&inParams->rtspRequestParams);
+    case QTSS_RTPSendPackets_Role:       return SendPackets(&inParams->rtpSendPacketsParams);
+    case QTSS_ClientSessionClosing_Role: return DestroySession(&inParams->clientSessionClosingParams);
+    default:break;
+  }
+  return QTSS_NoErr;
+}
+
+QTSS_Error Register(QTSS_Register_Params *inParams) {
+  // Do role & attribute setup
+  (void) QTSS_AddRole(QTSS_Initialize_Role);
+  (void) QTSS_AddRole(QTSS_RTSPPreProcessor_Role);
+  (void) QTSS_AddRole(QTSS_RTPSendPackets_Role);
+  (void) QTSS_AddRole(QTSS_ClientSessionClosing_Role);
+  (void) QTSS_AddRole(QTSS_RereadPrefs_Role);
+
+  // Add text messages attributes
+  static const char *sFileNotHintedName = "QTSSFileModuleFileNotHinted";
+  static const char *sBadTrackIDErrName = "QTSSFileModuleBadTrackID";
+  static const char *sSeekToNonexistentTimeName = "QTSSFileModuleSeekToNonexistentTime";
+  static const char *sExpectedDigitFilenameName = "QTSSFileModuleExpectedDigitFilename";
+
+  (void) QTSS_AddStaticAttribute(qtssTextMessagesObjectType, sFileNotHintedName, nullptr, qtssAttrDataTypeCharArray);
+  (void) QTSS_IDForAttr(qtssTextMessagesObjectType, sFileNotHintedName, &sFileNotHintedErr);
+
+  (void) QTSS_AddStaticAttribute(qtssTextMessagesObjectType, sBadTrackIDErrName, nullptr, qtssAttrDataTypeCharArray);
+  (void) QTSS_IDForAttr(qtssTextMessagesObjectType, sBadTrackIDErrName, &sBadTrackIDErr);
+
+  (void) QTSS_AddStaticAttribute(qtssTextMessagesObjectType, sSeekToNonexistentTimeName, nullptr, qtssAttrDataTypeCharArray);
+  (void) QTSS_IDForAttr(qtssTextMessagesObjectType, sSeekToNonexistentTimeName, &sSeekToNonexistentTimeErr);
+
+  (void) QTSS_AddStaticAttribute(qtssTextMessagesObjectType, sExpectedDigitFilenameName, nullptr, qtssAttrDataTypeCharArray);
+  (void) QTSS_IDForAttr(qtssTextMessagesObjectType, sExpectedDigitFilenameName, &sExpectedDigitFilenameErr);
+
+  // Add an RTP session attribute for tracking FileSession objects
+  static const char *sFileSessionName = "QTSSFileModuleSession";
+  (void) QTSS_AddStaticAttribute(qtssClientSessionObjectType, sFileSessionName, nullptr, qtssAttrDataTypeVoidPointer);
+  (void) QTSS_IDForAttr(qtssClientSessionObjectType, sFileSessionName, &sFileSessionAttr);
+
+  // Tell the server our name!
+  static const char *sModuleName = "QTSSFileModule";
+  ::strcpy(inParams->outModuleName, sModuleName);
+
+  return QTSS_NoErr;
+}
+
+QTSS_Error Initialize(QTSS_Initialize_Params *inParams) {
+  // Setup module utils
+  QTSSModuleUtils::Initialize(inParams->inMessages, inParams->inServer, inParams->inErrorLogStream);
+  QTRTPFile::Initialize();
+
+  sServerPrefs = inParams->inPrefs;
+  sPrefs = QTSSModuleUtils::GetModulePrefsObject(inParams->inModule);
+
+  // Report to the server that this module handles DESCRIBE, SETUP, PLAY, PAUSE, and TEARDOWN
+  static QTSS_RTSPMethod sSupportedMethods[] = {
+      qtssDescribeMethod, qtssSetupMethod, qtssTeardownMethod, qtssPlayMethod, qtssPauseMethod
+  };
+  QTSSModuleUtils::SetupSupportedMethods(inParams->inServer, sSupportedMethods, 5);
+
+  return RereadPrefs();
+}
+
+QTSS_Error RereadPrefs() {
+  QTSSModuleUtils::GetAttribute(sPrefs, "flow_control_probe_interval", qtssAttrDataTypeUInt32,
+                                &sFlowControlProbeInterval, &sDefaultFlowControlProbeInterval, sizeof(sFlowControlProbeInterval));
+  QTSSModuleUtils::GetAttribute(sPrefs, "max_allowed_speed", qtssAttrDataTypeFloat32,
+                                &sMaxAllowedSpeed, &sDefaultMaxAllowedSpeed, sizeof(sMaxAllowedSpeed));
+  QTSSModuleUtils::GetAttribute(sPrefs, "max_seek_backup_time", qtssAttrDataTypeFloat64,
+                                &sMaxBackupTime, &sDefaultMaxBackupTime, sizeof(sMaxBackupTime));
+  QTSSModuleUtils::GetAttribute(sPrefs, "seek_to_sync_sample", qtssAttrDataTypeBool16,
+                                &sSeekToSyncSample, &sDefaultSeekToSyncSample, sizeof(sSeekToSyncSample));
+  QTSSModuleUtils::GetAttribute(sPrefs, "use_mapped_reads", qtssAttrDataTypeBool16,
+                                &sUseMappedReads, &sDefaultUseMappedReads, sizeof(sUseMappedReads));
+  QTSSModuleUtils::GetAttribute(sPrefs, "enable_player_compatibility", qtssAttrDataTypeBool16,
+                                &sPlayerCompatibility, &sDefaultPlayerCompatibility, sizeof(sPlayerCompatibility));
+  QTSSModuleUtils::GetAttribute(sPrefs, "compatibility_adjust_sdp_media_bandwidth_percent", qtssAttrDataTypeUInt32,
+                                &sAdjustMediaBandwidthPercent, &sAdjustMediaBandwidthPercentDefault, sizeof(sAdjustMediaBandwidthPercent));
+
+  if (sAdjustMediaBandwidthPercent > 100)
+    sAdjustMediaBandwidthPercent = 100;
+  if (sAdjustMediaBandwidthPercent < 1)
+    sAdjustMediaBandwidthPercent = 1;
+
+  if (sMaxAllowedSpeed < 1)
+    sMaxAllowedSpeed = 1;
+
+  // only movies opened from now on are affected, the cached ones keep their mode
+  QTFile::SetUseMappedReads(sUseMappedReads);
+
+  return QTSS_NoErr;
+}
+
+FileSession *GetFileSession(QTSS_ClientSessionObject inClientSession) {
+  FileSession **theFile = nullptr;
+  UInt32 theLen = 0;
+  QTSS_Error theErr = QTSS_GetValuePtr(inClientSession, sFileSessionAttr, 0, (void **) &theFile, &theLen);
+  if (theErr != QTSS_NoErr || theLen != sizeof(FileSession *) || theFile == nullptr)
+    return nullptr;
+  return *theFile;
+}
+
+QTSS_Error ProcessRTSPRequest(QTSS_StandardRTSP_Params *inParams) {
+  QTSS_RTSPMethod *theMethod = nullptr;
+  UInt32 theLen = 0;
+  if ((QTSS_GetValuePtr(inParams->inRTSPRequest, qtssRTSPReqMethod, 0, (void **) &theMethod, &theLen) != QTSS_NoErr) ||
+      (theLen != sizeof(QTSS_RTSPMethod))) {
+    Assert(0);
+    return QTSS_RequestFailed;
+  }
+
+  if (*theMethod == qtssDescribeMethod) return DoDescribe(inParams);
+  if (*theMethod == qtssSetupMethod) return DoSetup(inParams);
+
+  // the other methods are ours only if the session streams a movie
+  FileSession *theFile = GetFileSession(inParams->inClientSession);
+  if (theFile == nullptr)
+    return QTSS_RequestFailed;
+
+  switch (*theMethod) {
+    case qtssPlayMethod:
+      return DoPlay(inParams, theFile);
+    case qtssTeardownMethod:
+      // Tell the server that this session should be killed, and send a TEARDOWN response
+      (void) QTSS_Teardown(inParams->inClientSession);
+      (void) QTSS_SendStandardRTSPResponse(inParams->inRTSPRequest, inParams->inClientSession, 0);
+      break;
+    case qtssPauseMethod:
+      theFile->fPaused = true;
+      (void) QTSS_Pause(inParams->inClientSession);
+      (void) QTSS_SendStandardRTSPResponse(inParams->inRTSPRequest, inParams->inClientSession, 0);
+      break;
+    default:break;
+  }
+  return QTSS_NoErr;
+}
+
+/**
+ * 打开请求路径对应的影片并解析其 SDP
+ *
+ * @return QTSS_RequestFailed without a response if the path isn't a movie, leaving the request to other modules
+ */
+QTSS_Error CreateFileSession(QTSS_StandardRTSP_Params *inParams, QTSS_AttributeID inPathType, FileSession **outFile) {
+  StrPtrLen thePath;
+  CharArrayDeleter thePathDeleter(QTSSModuleUtils::GetFullPath(inParams->inRTSPRequest, inPathType, &thePath.Len, nullptr));
+  thePath.Ptr = thePathDeleter.GetObject();
+  if (thePath.Ptr == nullptr || thePath.Len == 0)
+    return QTSS_RequestFailed;
+
+  // .sdp urls belong to the reflector
+  if (thePath.Len > sSDPSuffix.Len) {
+    StrPtrLen theSuffix(&thePath.Ptr[thePath.Len - sSDPSuffix.Len], sSDPSuffix.Len);
+    if (theSuffix.EqualIgnoreCase(sSDPSuffix.Ptr, sSDPSuffix.Len))
+      return QTSS_RequestFailed;
+  }
+
+  auto *theFile = new FileSession();
+  QTRTPFile::ErrorCode theErr = theFile->fFile.Initialize(thePath.Ptr);
+  if (theErr != QTRTPFile::errNoError) {
+    delete theFile;
+    if (theErr == QTRTPFile::errNoHintTracks)
+      return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssUnsupportedMediaType, sFileNotHintedErr);
+    if (theErr == QTRTPFile::errInvalidQuickTimeFile)
+      return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssUnsupportedMediaType, 0);
+    return QTSS_RequestFailed; // not found, maybe a live stream of another module
+  }
+
+  char *theSDP = theFile->fFile.GetSDPFile(&theFile->fSDPLen);
+  if (theSDP == nullptr || theFile->fSDPLen <= 0) {
+    delete theFile;
+    return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssUnsupportedMediaType, sFileNotHintedErr);
+  }
+  theFile->fSourceInfo = new SDPSourceInfo(theSDP, (UInt32) theFile->fSDPLen);
+
+  // Tell the session about the movie, for logging and so the server can size the TCP buffer
+  Float64 theDuration = theFile->fFile.GetMovieDuration();
+  (void) QTSS_SetValue(inParams->inClientSession, qtssCliSesMovieDurationInSecs, 0, &theDuration, sizeof(theDuration));
+  UInt64 theMovieSize = theFile->fFile.GetAddedTracksRTPBytes();
+  (void) QTSS_SetValue(inParams->inClientSession, qtssCliSesMovieSizeInBytes, 0, &theMovieSize, sizeof(theMovieSize));
+  UInt32 theBitRate = theFile->fFile.GetBytesPerSecond() * 8;
+  (void) QTSS_SetValue(inParams->inClientSession, qtssCliSesMovieAverageBitRate, 0, &theBitRate, sizeof(theBitRate));
+
+  (void) QTSS_SetValue(inParams->inClientSession, sFileSessionAttr, 0, &theFile, sizeof(theFile));
+  *outFile = theFile;
+  return QTSS_NoErr;
+}
+
+QTSS_Error DoDescribe(QTSS_StandardRTSP_Params *inParams) {
+  // If there already was a movie attached to this Client Session, destroy it.
+  FileSession *theFile = GetFileSession(inParams->inClientSession);
+  if (theFile != nullptr) {
+    delete theFile;
+    theFile = nullptr;
+    (void) QTSS_SetValue(inParams->inClientSession, sFileSessionAttr, 0, &theFile, sizeof(theFile));
+  }
+
+  QTSS_Error theErr = CreateFileSession(inParams, qtssRTSPReqFilePath, &theFile);
+  if (theErr != QTSS_NoErr)
+    return theErr;
+
+  StrPtrLen theSDPData(theFile->fSourceInfo->GetSDPData()->Ptr, theFile->fSourceInfo->GetSDPData()->Len);
+
+  // ------------ Check the headers
+
+  SDPContainer checkedSDPContainer;
+  checkedSDPContainer.SetSDPBuffer(&theSDPData);
+  if (!checkedSDPContainer.IsSDPBufferValid())
+    return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssUnsupportedMediaType, sFileNotHintedErr);
+
+  // ------------ Put SDP header lines in correct order
+  Float32 adjustMediaBandwidthPercent = 1.0;
+  if (sPlayerCompatibility && QTSSModuleUtils::HavePlayerProfile(sServerPrefs, inParams, QTSSModuleUtils::kAdjustBandwidth))
+    adjustMediaBandwidthPercent = (Float32) (sAdjustMediaBandwidthPercent / 100.0);
+
+  SDPLineSorter sortedSDP(&checkedSDPContainer, adjustMediaBandwidthPercent);
+
+  // ------------ Write the SDP
+
+  iovec theDescribeVec[3] = {{0}};
+  UInt32 sessLen = sortedSDP.GetSessionHeaders()->Len;
+  UInt32 mediaLen = sortedSDP.GetMediaHeaders()->Len;
+  theDescribeVec[1].iov_base = sortedSDP.GetSessionHeaders()->Ptr;
+  theDescribeVec[1].iov_len = sessLen;
+
+  theDescribeVec[2].iov_base = sortedSDP.GetMediaHeaders()->Ptr;
+  theDescribeVec[2].iov_len = mediaLen;
+
+  (void) QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssCacheControlHeader, kCacheControlHeader.Ptr, kCacheControlHeader.Len);
+  QTSSModuleUtils::SendDescribeResponse(inParams->inRTSPRequest, inParams->inClientSession, &theDescribeVec[0], 3, sessLen + mediaLen);
+
+  return QTSS_NoErr;
+}
+
+QTSS_Error DoSetup(QTSS_StandardRTSP_Params *inParams) {
+  // a client may SETUP without DESCRIBE
+  FileSession *theFile = GetFileSession(inParams->inClientSession);
+  if (theFile == nullptr) {
+    QTSS_Error theErr = CreateFileSession(inParams, qtssRTSPReqFilePathTrunc, &theFile);
+    if (theErr != QTSS_NoErr)
+      return theErr;
+  }
+
+  // unless there is a digit at the end of this path (representing trackID), don't
+  // even bother with the request
+  char *theDigitStr = nullptr;
+  (void) QTSS_GetValueAsString(inParams->inRTSPRequest, qtssRTSPReqFileDigit, 0, &theDigitStr);
+  QTSSCharArrayDeleter theDigitStrDeleter(theDigitStr);
+  if (theDigitStr == nullptr)
+    return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssClientBadRequest, sExpectedDigitFilenameErr);
+  auto theTrackID = static_cast<UInt32>(::strtol(theDigitStr, nullptr, 10));
+
+  SourceInfo::StreamInfo *theStreamInfo = theFile->fSourceInfo->GetStreamInfoByTrackID(theTrackID);
+  if (theStreamInfo == nullptr || theFile->fFile.AddTrack(theTrackID, true) != QTRTPFile::errNoError)
+    return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssClientBadRequest, sBadTrackIDErr);
+
+  QTSS_RTPStreamObject newStream = nullptr;
+  QTSS_Error theErr = QTSS_AddRTPStream(inParams->inClientSession, inParams->inRTSPRequest, &newStream, 0);
+  if (theErr != QTSS_NoErr)
+    return theErr;
+
+  // Set up dictionary items for this stream
+  UInt32 theTimeScale = theFile->fFile.GetTrackTimeScale(theTrackID);
+  StrPtrLen *thePayloadName = &theStreamInfo->fPayloadName;
+  QTSS_RTPPayloadType thePayloadType = theStreamInfo->fPayloadType;
+
+  theErr = QTSS_SetValue(newStream, qtssRTPStrPayloadName, 0, thePayloadName->Ptr, thePayloadName->Len);
+  Assert(theErr == QTSS_NoErr);
+  theErr = QTSS_SetValue(newStream, qtssRTPStrPayloadType, 0, &thePayloadType, sizeof(thePayloadType));
+  Assert(theErr == QTSS_NoErr);
+  theErr = QTSS_SetValue(newStream, qtssRTPStrTrackID, 0, &theTrackID, sizeof(theTrackID));
+  Assert(theErr == QTSS_NoErr);
+  theErr = QTSS_SetValue(newStream, qtssRTPStrTimescale, 0, &theTimeScale, sizeof(theTimeScale));
+  Assert(theErr == QTSS_NoErr);
+  theErr = QTSS_SetValue(newStream, qtssRTPStrNumQualityLevels, 0, &sNumQualityLevels, sizeof(sNumQualityLevels));
+  Assert(theErr == QTSS_NoErr);
+
+  // the file writes the stream's SSRC into its packets, and hands the stream back with each packet
+  UInt32 *theSSRC = nullptr;
+  UInt32 theLen = 0;
+  if (QTSS_GetValuePtr(newStream, qtssRTPStrSSRC, 0, (void **) &theSSRC, &theLen) == QTSS_NoErr && theLen == sizeof(UInt32))
+    theFile->fFile.SetTrackSSRC(theTrackID, *theSSRC);
+  theFile->fFile.SetTrackCookies(theTrackID, newStream, 0);
+
+  // x-RTP-Meta-Info: answer with the fields we support, and have the file build meta info packets
+  StrPtrLen theMetaInfoHeader;
+  theErr = QTSS_GetValuePtr(inParams->inRTSPHeaders, qtssXRTPMetaInfoHeader, 0, (void **) &theMetaInfoHeader.Ptr, &theMetaInfoHeader.Len);
+  if (theErr == QTSS_NoErr && theMetaInfoHeader.Len > 0) {
+    RTPMetaInfoPacket::FieldID theFieldArray[RTPMetaInfoPacket::kNumFields];
+    ::memcpy(theFieldArray, QTRTPFile::GetSupportedRTPMetaInfoFields(), sizeof(theFieldArray));
+
+    (void) QTSSModuleUtils::AppendRTPMetaInfoHeader(inParams->inRTSPRequest, &theMetaInfoHeader, theFieldArray);
+    theFile->fFile.SetTrackRTPMetaInfo(theTrackID, theFieldArray, thePayloadType == qtssVideoPayloadType);
+  }
+
+  // send the setup response
+  (void) QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssCacheControlHeader, kCacheControlHeader.Ptr, kCacheControlHeader.Len);
+  (void) QTSS_SendStandardRTSPResponse(inParams->inRTSPRequest, newStream, 0);
+
+  return QTSS_NoErr;
+}
+
+QTSS_Error DoPlay(QTSS_StandardRTSP_Params *inParams, FileSession *inFile) {
+  UInt32 theLen = sizeof(Float64);
+
+  // Range: npt=start-stop, a PLAY without it resumes where the session paused
+  Float64 theStartTime = -1;
+  (void) QTSS_GetValue(inParams->inRTSPRequest, qtssRTSPReqStartTime, 0, &theStartTime, &theLen);
+  theLen = sizeof(Float64);
+  Float64 theStopTime = -1;
+  (void) QTSS_GetValue(inParams->inRTSPRequest, qtssRTSPReqStopTime, 0, &theStopTime, &theLen);
+  theLen = sizeof(Float32);
+  Float32 theSpeed = 1;
+  (void) QTSS_GetValue(inParams->inRTSPRequest, qtssRTSPReqSpeed, 0, &theSpeed, &theLen);
+
+  if (theSpeed <= 0)
+    theSpeed = 1;
+  if (theSpeed > sMaxAllowedSpeed)
+    theSpeed = sMaxAllowedSpeed;
+
+  // resuming a pause continues where the client left off, it already has the key frame
+  bool isResume = theStartTime < 0 && inFile->fPaused;
+  if (theStartTime < 0)
+    theStartTime = inFile->fPaused ? inFile->fLastPacketTime : 0;
+
+  // drop the packet held for the old position
+  inFile->fPacketStruct.packetData = nullptr;
+  inFile->fStream = nullptr;
+
+  QTRTPFile::SeekMode theSeekMode =
+      (sSeekToSyncSample && !isResume) ? QTRTPFile::kSeekToSyncSample : QTRTPFile::kSeekWithinBackupTime;
+  if (inFile->fFile.Seek(theStartTime, sMaxBackupTime, theSeekMode) != QTRTPFile::errNoError)
+    return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssClientBadRequest, sSeekToNonexistentTimeErr);
+
+  inFile->fStopTime = theStopTime;
+  inFile->fSpeed = theSpeed;
+  inFile->fPaused = false;
+
+  // RTP-Info: the first sequence number and timestamp after the seek
+  QTSS_RTPStreamObject *theStream = nullptr;
+  for (UInt32 theIndex = 0;
+       QTSS_GetValuePtr(inParams->inClientSession, qtssCliSesStreamObjects, theIndex, (void **) &theStream, &theLen) == QTSS_NoErr;
+       theIndex++) {
+    UInt32 *theTrackID = nullptr;
+    (void) QTSS_GetValuePtr(*theStream, qtssRTPStrTrackID, 0, (void **) &theTrackID, &theLen);
+    if (theTrackID == nullptr)
+      continue;
+
+    UInt16 theSeqNum = inFile->fFile.GetNextTrackSequenceNumber(*theTrackID);
+    UInt32 theTimestamp = inFile->fFile.GetSeekTimestamp(*theTrackID);
+    (void) QTSS_SetValue(*theStream, qtssRTPStrFirstSeqNumber, 0, &theSeqNum, sizeof(theSeqNum));
+    (void) QTSS_SetValue(*theStream, qtssRTPStrFirstTimestamp, 0, &theTimestamp, sizeof(theTimestamp));
+  }
+
+  QTSS_Error theErr = QTSS_Play(inParams->inClientSession, inParams->inRTSPRequest, qtssPlayFlagsSendRTCP);
+  if (theErr != QTSS_NoErr)
+    return theErr;
+
+  // packets are timed from the first one after the seek, which may be before the requested time
+  SInt64 *thePlayTime = nullptr;
+  (void) QTSS_GetValuePtr(inParams->inClientSession, qtssCliSesPlayTimeInMsec, 0, (void **) &thePlayTime, &theLen);
+  SInt64 theFirstPacketTime = (SInt64) (inFile->fFile.GetFirstPacketTransmitTime() * 1000 / theSpeed);
+  inFile->fAdjustedPlayTime = (thePlayTime != nullptr ? *thePlayTime : 0) - theFirstPacketTime;
+
+  char theRangeHeader[64];
+  if (theStopTime >= 0)
+    ::sprintf(theRangeHeader, "npt=%.5f-%.5f", inFile->fFile.GetActualSeekTime(), theStopTime);
+  else
+    ::sprintf(theRangeHeader, "npt=%.5f-%.5f", inFile->fFile.GetActualSeekTime(), inFile->fFile.GetMovieDuration());
+  (void) QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssRangeHeader, theRangeHeader, (UInt32) ::strlen(theRangeHeader));
+
+  if (theSpeed != 1) {
+    char theSpeedHeader[32];
+    ::sprintf(theSpeedHeader, "%.2f", theSpeed);
+    (void) QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssSpeedHeader, theSpeedHeader, (UInt32) ::strlen(theSpeedHeader));
+  }
+
+  (void) QTSS_SendStandardRTSPResponse(inParams->inRTSPRequest, inParams->inClientSession, qtssPlayRespWriteTrackInfo);
+  return QTSS_NoErr;
+}
+
+/**
+ * 由 RTPSession::Run 调用, 写出所有已到发送时间的包
+ *
+ * 写不出去的包留在 fPacketStruct 中, 按 RTPStream 建议的时间 (或流控探测间隔) 再次调用。
+ */
+QTSS_Error SendPackets(QTSS_RTPSendPackets_Params *inParams) {
+  FileSession *theFile = GetFileSession(inParams->inClientSession);
+  if (theFile == nullptr || theFile->fPaused) {
+    inParams->outNextPacketTime = qtssDontCallSendPacketsAgain;
+    return QTSS_NoErr;
+  }
+
+  while (true) {
+    if (theFile->fPacketStruct.packetData == nullptr) {
+      char *thePacket = nullptr;
+      Float64 theTransmitTime = theFile->fFile.GetNextPacket(&thePacket, &theFile->fPacketLen);
+
+      if (thePacket == nullptr) { // end of the movie
+        inParams->outNextPacketTime = qtssDontCallSendPacketsAgain;
+        return QTSS_NoErr;
+      }
+
+      if (theFile->fStopTime >= 0 && theTransmitTime > theFile->fStopTime) {
+        theFile->fPaused = true;
+        (void) QTSS_Pause(inParams->inClientSession);
+        inParams->outNextPacketTime = qtssDontCallSendPacketsAgain;
+        return QTSS_NoErr;
+      }
+
+      QTRTPFile::RTPTrackListEntry *theTrack = theFile->fFile.GetLastPacketTrack();
+      Assert(theTrack != nullptr);
+      theFile->fStream = (QTSS_RTPStreamObject) theTrack->Cookie1;
+      theFile->fLastPacketTime = theTransmitTime;
+
+      theFile->fPacketStruct.packetData = thePacket;
+      theFile->fPacketStruct.packetTransmitTime =
+          theFile->fAdjustedPlayTime + (SInt64) (theTransmitTime * 1000 / theFile->fSpeed);
+
+      // thin the next samples of the track to the level the stream picked from the client's reports
+      UInt32 *theQualityLevel = nullptr;
+      UInt32 theLen = 0;
+      if (QTSS_GetValuePtr(theFile->fStream, qtssRTPStrQualityLevel, 0, (void **) &theQualityLevel, &theLen) == QTSS_NoErr &&
+          theQualityLevel != nullptr && theLen == sizeof(UInt32))
+        theFile->fFile.SetTrackQualityLevel(theTrack, *theQualityLevel);
+    }
+
+    QTSS_Error theErr = QTSS_Write(theFile->fStream, &theFile->fPacketStruct, (UInt32) theFile->fPacketLen, nullptr,
+                                   qtssWriteFlagsIsRTP);
+    if (theErr == QTSS_WouldBlock) {
+      // not its time yet, or the connection is flow controlled
+      if (theFile->fPacketStruct.suggestedWakeupTime == -1)
+        inParams->outNextPacketTime = sFlowControlProbeInterval;
+      else
+        inParams->outNextPacketTime = theFile->fPacketStruct.suggestedWakeupTime - inParams->inCurrentTime;
+      if (inParams->outNextPacketTime < 0)
+        inParams->outNextPacketTime = 0;
+      return QTSS_NoErr;
+    }
+
+    // sent or dropped, go on with the next one
+    theFile->fPacketStruct.packetData = nullptr;
+  }
+}
+
+QTSS_Error DestroySession(QTSS_ClientSessionClosing_Params *inParams) {
+  FileSession *theFile = GetFileSession(inParams->inClientSession);
+  if (theFile == nullptr)
+    return QTSS_NoErr;
+
+  // the QTFile stays in the file cache while other viewers use it
+  delete theFile;
+  theFile = nullptr;
+  (void) QTSS_SetValue(inParams->inClientSession, sFileSessionAttr, 0, &theFile, sizeof(theFile));
+  return QTSS_NoErr;
+}
@@ -0,0 +1,44 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2008 Apple Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       QTSSFileModule.h
+
+    Contains:   Streams hinted QuickTime/MP4 movies on demand. Each client session
+                drives its own QTRTPFile, the parsed QTFile of a movie is shared
+                by every viewer of the file through the QTRTPFile file cache.
+
+*/
+
+#ifndef _QTSSFILEMODULE_H_
+#define _QTSSFILEMODULE_H_
+
+#include "QTSS.h"
+
+extern "C"
+{
+EXPORT QTSS_Error QTSSFileModule_Main(void *inPrivateArgs);
+}
+
+#endif //_QTSSFILEMODULE_H_
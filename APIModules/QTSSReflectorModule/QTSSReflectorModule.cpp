@@ -91,7 +91,9 @@ static QTSS_AttributeID sRTPInfoWaitTimeAttr = qtssIllegalAttrID;
 // STATIC DATA
 
 // ref to the prefs dictionary object
-static RefTable *sSessionMap = nullptr;
+static ShardedRefTable *sSessionMap = nullptr;
+// serializes the module's session setup/teardown, the map itself is locked per shard
+static Core::Mutex sSessionMutex;
 static const StrPtrLen kCacheControlHeader("no-cache");
 static QTSS_PrefsObject sServerPrefs = nullptr;
 static QTSS_ServerObject sServer = nullptr;
@@ -631,49 +633,58 @@ QTSS_Error ProcessRTPData(QTSS_IncomingData_Params *inParams) {
      * @see RTSPSession::HandleIncomingDataPacket
      *
      */
+    // RTSPSession 一次交来同一个 session 的若干连续 Interleaved Frame，
+    // 属于同一个 ReflectorStream 同一个 socket 的连续包整批交给 PushPackets
     char *packetData = inParams->inPacketData;
 
-    UInt8 packetChannel;
-    packetChannel = (UInt8) packetData[1];
+    StrPtrLen thePackets[ReflectorStream::kMaxPushPackets];
+    UInt32 theNumPackets = 0;
+    ReflectorStream *theBatchStream = nullptr;
+    bool theBatchIsRTCP = false;
 
-    UInt16 rtpPacketLen;
-    memcpy(&rtpPacketLen, &packetData[2], 2);
-    rtpPacketLen = ntohs(rtpPacketLen);
+    for (UInt32 theOffset = 0; theOffset + 4 <= inParams->inPacketLen;) {
+      UInt8 packetChannel;
+      packetChannel = (UInt8) packetData[theOffset + 1];
 
-    char *rtpPacket = &packetData[4]; // 剥离 Interleaved Header
+      UInt16 rtpPacketLen;
+      memcpy(&rtpPacketLen, &packetData[theOffset + 2], 2);
+      rtpPacketLen = ntohs(rtpPacketLen);
 
-    DEBUG_LOG(DEBUG_REFLECTOR_MODULE,
-              "QTSSReflectorModule.cpp:ProcessRTPData channel=%u theSoureInfo=%" _U32BITARG_ " packetLen=%" _U32BITARG_ " packetDatalen=%u\n",
-              (UInt16) packetChannel, theSoureInfo, inParams->inPacketLen, rtpPacketLen);
+      char *rtpPacket = &packetData[theOffset + 4]; // 剥离 Interleaved Header
+      theOffset += 4 + rtpPacketLen;
+      if (theOffset > inParams->inPacketLen) break;
 
-    UInt32 inIndex = packetChannel >> 1U; // one stream per every 2 channels rtcp channel handled below
-    if (inIndex < numStreams) {
-      ReflectorStream *theStream = theSession->GetStreamByIndex(inIndex);
-      if (theStream == nullptr) return QTSS_Unimplemented;
-      auto isRTCP = static_cast<bool>(packetChannel & 1U);
+      DEBUG_LOG(DEBUG_REFLECTOR_MODULE,
+                "QTSSReflectorModule.cpp:ProcessRTPData channel=%u theSoureInfo=%" _U32BITARG_ " packetLen=%" _U32BITARG_ " packetDatalen=%u\n",
+                (UInt16) packetChannel, theSoureInfo, inParams->inPacketLen, rtpPacketLen);
 
-      if (1) {
-        SourceInfo::StreamInfo *theStreamInfo = theStream->GetStreamInfo();
-        UInt16 serverReceivePort = theStreamInfo->fPort;
+      UInt32 inIndex = packetChannel >> 1U; // one stream per every 2 channels rtcp channel handled below
+      if (inIndex >= numStreams) continue;
 
-        if (isRTCP) serverReceivePort++;
+      ReflectorStream *theStream = theSession->GetStreamByIndex(inIndex);
+      if (theStream == nullptr) continue;
+      auto isRTCP = static_cast<bool>(packetChannel & 1U);
 
-        // TODO(james): localServerAddr
-        DEBUG_LOG(0,
-                  "QTSSReflectorModule.cpp:ProcessRTPData Send RTSP packet channel=%u to UDP localServerAddr=%" _U32BITARG_ " serverReceivePort=%" _U32BITARG_ " packetDataLen=%u \n",
-                  (UInt16) packetChannel, theStream->GetSocketPair()->GetSocketA()->GetLocalAddr(), serverReceivePort, rtpPacketLen);
+      if (theStream != theBatchStream || isRTCP != theBatchIsRTCP || theNumPackets == ReflectorStream::kMaxPushPackets) {
+        if (theNumPackets > 0)
+          theBatchStream->PushPackets(thePackets, theNumPackets, theBatchIsRTCP);
+        theBatchStream = theStream;
+        theBatchIsRTCP = isRTCP;
+        theNumPackets = 0;
       }
-
-      // 将 packet 转交给 ReflectorStream，随后跟 ReflectorSocket 的处理逻辑归并为一
-      theStream->PushPacket(rtpPacket, rtpPacketLen, isRTCP);
+      thePackets[theNumPackets++].Set(rtpPacket, rtpPacketLen);
     }
+
+    // 将 packet 转交给 ReflectorStream，随后跟 ReflectorSocket 的处理逻辑归并为一
+    if (theNumPackets > 0)
+      theBatchStream->PushPackets(thePackets, theNumPackets, theBatchIsRTCP);
   }
 
   return theErr;
 }
 
 QTSS_Error ProcessRTSPRequest(QTSS_StandardRTSP_Params *inParams) {
-  Core::MutexLocker locker(sSessionMap->GetMutex()); //operating on sOutputAttr
+  Core::MutexLocker locker(&sSessionMutex); //operating on sOutputAttr
 
   DEBUG_LOG(DEBUG_REFLECTOR_MODULE,
             "QTSSReflectorModule:ProcessRTSPRequest inClientSession=%p\n",
@@ -1283,7 +1294,7 @@ ReflectorSession *FindOrCreateSession(StrPtrLen *inName, QTSS_StandardRTSP_Param
             "QTSSReflectorModule:FindOrCreateSession inClientSession=%p isPash=%d\n",
             inParams->inClientSession, isPush);
 
-  Core::MutexLocker locker(sSessionMap->GetMutex());
+  Core::MutexLocker locker(&sSessionMutex);
   DEBUG_LOG(DEBUG_REFLECTOR_MODULE,
             "QTSSReflectorModule:FindOrCreateSession lock sSessionMap success\n");
 
@@ -1463,11 +1474,12 @@ QTSS_Error AddRTPStream(ReflectorSession *theSession, QTSS_StandardRTSP_Params *
   // stream queue, we need to make sure that each ReflectorStream is not reflecting to this
   // session while we call QTSS_AddRTPStream. One brutal way to do this is to grab each
   // ReflectorStream's mutex, which will stop every reflector stream from running.
+  // A partitioned stream also reflects on its partitions, LockOutputs stops them as well.
   Assert(newStreamPtr != nullptr);
 
   if (theSession != nullptr)
     for (UInt32 x = 0; x < theSession->GetNumStreams(); x++)
-      theSession->GetStreamByIndex(x)->GetMutex()->Lock();
+      theSession->GetStreamByIndex(x)->LockOutputs();
 
   //
   // Turn off reliable UDP transport, because we are not yet equipped to do overbuffering.
@@ -1475,7 +1487,7 @@ QTSS_Error AddRTPStream(ReflectorSession *theSession, QTSS_StandardRTSP_Params *
 
   if (theSession != nullptr)
     for (UInt32 y = 0; y < theSession->GetNumStreams(); y++)
-      theSession->GetStreamByIndex(y)->GetMutex()->Unlock();
+      theSession->GetStreamByIndex(y)->UnlockOutputs();
 
   return theErr;
 }
@@ -1867,24 +1879,29 @@ bool KillSession(StrPtrLen *sdpPathStr, bool killClients) {
 void KillCommandPathInList() {
   char filePath[128] = "";
   ResizeableStringFormatter commandPath((char *) filePath, sizeof(filePath)); // ResizeableStringFormatter is safer and more efficient than StringFormatter for most paths.
-  Core::MutexLocker locker(sSessionMap->GetMutex());
-
-  for (RefHashTableIter theIter(sSessionMap->GetHashTable()); !theIter.IsDone(); theIter.Next()) {
-    Ref *theRef = theIter.GetCurrent();
-    if (theRef == nullptr) continue;
-
-    commandPath.Reset();
-    commandPath.Put(*(theRef->GetString()));
-    commandPath.Put(sSDPKillSuffix);
-    commandPath.PutTerminator();
-
-    char *theCommandPath = commandPath.GetBufPtr();
-    QTSS_Object outFileObject;
-    QTSS_Error err = QTSS_OpenFileObject(theCommandPath, qtssOpenFileNoFlags, &outFileObject);
-    if (err == QTSS_NoErr) {
-      (void) QTSS_CloseFileObject(outFileObject);
-      ::unlink(theCommandPath);
-      KillSession(theRef->GetString(), true);
+  Core::MutexLocker locker(&sSessionMutex);
+
+  for (UInt32 theShard = 0; theShard < sSessionMap->GetNumShards(); theShard++) {
+    RefTable *theTable = sSessionMap->GetShard(theShard);
+    Core::MutexLocker shardLocker(theTable->GetMutex());
+
+    for (RefHashTableIter theIter(theTable->GetHashTable()); !theIter.IsDone(); theIter.Next()) {
+      Ref *theRef = theIter.GetCurrent();
+      if (theRef == nullptr) continue;
+
+      commandPath.Reset();
+      commandPath.Put(*(theRef->GetString()));
+      commandPath.Put(sSDPKillSuffix);
+      commandPath.PutTerminator();
+
+      char *theCommandPath = commandPath.GetBufPtr();
+      QTSS_Object outFileObject;
+      QTSS_Error err = QTSS_OpenFileObject(theCommandPath, qtssOpenFileNoFlags, &outFileObject);
+      if (err == QTSS_NoErr) {
+        (void) QTSS_CloseFileObject(outFileObject);
+        ::unlink(theCommandPath);
+        KillSession(theRef->GetString(), true);
+      }
     }
   }
 }
@@ -1894,7 +1911,7 @@ QTSS_Error DestroySession(QTSS_ClientSessionClosing_Params *inParams) {
   ReflectorOutput *outputPtr = nullptr;
   ReflectorSession *theSession = nullptr;
 
-  Core::MutexLocker locker(sSessionMap->GetMutex());
+  Core::MutexLocker locker(&sSessionMutex);
 
   UInt32 theLen = sizeof(theSession);
   QTSS_Error theErr = QTSS_GetValue(inParams->inClientSession, sClientBroadcastSessionAttr, 0, &theSession, &theLen);
@@ -2172,7 +2189,7 @@ QTSS_Error GetDeviceStream(Easy_GetDeviceStream_Params *inParams) {
 
   if (inParams->inDevice && inParams->inStreamType == easyRTSPType) {
 
-    Core::MutexLocker locker(sSessionMap->GetMutex());
+    Core::MutexLocker locker(&sSessionMutex);
 
     char theStreamName[QTSS_MAX_NAME_LENGTH] = {0};
     sprintf(theStreamName, "%s%s%d", inParams->inDevice, EASY_KEY_SPLITER, inParams->inChannel);
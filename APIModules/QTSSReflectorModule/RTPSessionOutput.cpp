@@ -79,9 +79,24 @@ RTPSessionOutput::RTPSessionOutput(QTSS_ClientSessionObject inClientSession, Ref
       fIsUDP(false),
       fTransportInitialized(false),
       fMustSynch(true),
-      fPreFilter(true) {
+      fPreFilter(true),
+      fStreamStates(nullptr),
+      fNumStreamStates(0) {
   // create a bookmark for each stream we'll reflect
   this->InitializeBookmarks(inReflectorSession->GetNumStreams());
+
+  // and the state of each stream, bound to its RTPStream on the first packet
+  fNumStreamStates = inReflectorSession->GetNumStreams();
+  fStreamStates = new StreamState[fNumStreamStates];
+  for (UInt32 i = 0; i < fNumStreamStates; i++) {
+    fStreamStates[i].fStream = nullptr;
+    fStreamStates[i].fStreamCookie = nullptr;
+    this->ResetStreamState(&fStreamStates[i]);
+  }
+}
+
+RTPSessionOutput::~RTPSessionOutput() {
+  delete[] fStreamStates;
 }
 
 void RTPSessionOutput::Register() {
@@ -111,7 +126,7 @@ void RTPSessionOutput::Register() {
   static char *sStreamPacketCount = "qtssReflectorStreamPacketCount";
   static char *sStreamByteCount = "qtssReflectorStreamByteCount";
 
-  (void) QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sLastRTCPTransmit, NULL, qtssAttrDataTypeUInt16);
+  (void) QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sLastRTCPTransmit, NULL, qtssAttrDataTypeSInt64);
   (void) QTSS_IDForAttr(qtssRTPStreamObjectType, sLastRTCPTransmit, &sLastRTCPTransmitAttr);
 
   (void) QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sNextSeqNum, NULL, qtssAttrDataTypeUInt16);
@@ -187,11 +202,131 @@ void RTPSessionOutput::InitializeStreams() {
   QTSS_RTPStreamObject *theStreamPtr = nullptr;
   UInt32 packetCountInitValue = 0;
 
+  Core::MutexLocker locker(&fMutex);
+
+  for (UInt32 z = 0; z < fNumStreamStates; z++)
+    fStreamStates[z].fPacketCount = 0;
+
   for (UInt32 z = 0; QTSS_GetValuePtr(fClientSession, qtssCliSesStreamObjects, z, (void **) &theStreamPtr, &theLen) == QTSS_NoErr; z++) {
     (void) QTSS_SetValue(*theStreamPtr, sStreamPacketCountAttr, 0, &packetCountInitValue, sizeof(UInt32));
   }
 }
 
+/**
+ * 返回 inStreamCookie 对应的 StreamState，第一次调用时查找对应的 RTPStream 并绑定
+ *
+ * @return nullptr if no stream of the client session is reflecting inStreamCookie
+ */
+RTPSessionOutput::StreamState *RTPSessionOutput::GetStreamState(void *inStreamCookie) {
+  StreamState *theFreeState = nullptr;
+  for (UInt32 i = 0; i < fNumStreamStates; i++) {
+    if (fStreamStates[i].fStreamCookie == inStreamCookie)
+      return &fStreamStates[i];
+    if (theFreeState == nullptr && fStreamStates[i].fStreamCookie == nullptr)
+      theFreeState = &fStreamStates[i];
+  }
+
+  if (theFreeState == nullptr)
+    return nullptr;
+
+  // 找到和 ReflectorStream 相关联的 RTPStream 对象
+  // RTPStream 对象在 QTSSReflectorModule::DoSetup 调用的 QTSS_AddRTPStream 函数里创建。
+  QTSS_RTPStreamObject *theStreamPtr = nullptr;
+  UInt32 theLen = 0;
+  for (UInt32 z = 0; QTSS_GetValuePtr(fClientSession, qtssCliSesStreamObjects, z, (void **) &theStreamPtr, &theLen) == QTSS_NoErr; z++) {
+    if (this->PacketMatchesStream(inStreamCookie, theStreamPtr)) {
+      theFreeState->fStream = *theStreamPtr;
+      theFreeState->fStreamCookie = inStreamCookie;
+      return theFreeState;
+    }
+  }
+
+  return nullptr;
+}
+
+RTPSessionOutput::StreamState *RTPSessionOutput::FindStreamState(QTSS_RTPStreamObject inStream) {
+  for (UInt32 i = 0; i < fNumStreamStates; i++) {
+    if (fStreamStates[i].fStreamCookie != nullptr && fStreamStates[i].fStream == inStream)
+      return &fStreamStates[i];
+  }
+  return nullptr;
+}
+
+void RTPSessionOutput::ResetStreamState(StreamState *ioState) {
+  ioState->fPacketCount = 0;
+  ioState->fByteCount = 0;
+  ioState->fLastRTPPacketID = 0;
+  ioState->fLastRTCPPacketID = 0;
+  ioState->fHasLastRTPPacketID = false;
+  ioState->fHasLastRTCPPacketID = false;
+  ioState->fLastRTCPTransmit = 0;
+
+  ioState->fTimeScale = 0;
+  ioState->fHasFirstRTP = false;
+  ioState->fSSRC = 0;
+  ioState->fFirstRTPTimeStamp = 0;
+  ioState->fFirstRTPArrivalTime = 0;
+  ioState->fFirstRTPCurrentTime = 0;
+  ioState->fHasBaseRTPTimeStamp = false;
+  ioState->fBaseRTPTimeStamp = 0;
+
+  ioState->fNextSeqNum = 0;
+  ioState->fSeqNumOffset = 0;
+  ioState->fLastQualityChange = 0;
+
+  ioState->fLastSyncTime = 0;
+}
+
+void RTPSessionOutput::SyncStreamAttributes() {
+  Core::MutexLocker locker(&fMutex);
+
+  SInt64 currentTime = Core::Time::Milliseconds();
+  for (UInt32 i = 0; i < fNumStreamStates; i++) {
+    if (fStreamStates[i].fStreamCookie != nullptr)
+      this->SyncStreamAttributes(&fStreamStates[i], currentTime);
+  }
+}
+
+/**
+ * 将 StreamState 写入 RTPStream 的字典属性
+ */
+void RTPSessionOutput::SyncStreamAttributes(StreamState *inState, SInt64 inCurrentTime) {
+  QTSS_RTPStreamObject theStream = inState->fStream;
+  inState->fLastSyncTime = inCurrentTime;
+
+  (void) QTSS_SetValue(theStream, sStreamPacketCountAttr, 0, &inState->fPacketCount, sizeof(UInt32));
+  (void) QTSS_SetValue(theStream, sStreamByteCountAttr, 0, &inState->fByteCount, sizeof(UInt32));
+
+  if (inState->fHasLastRTPPacketID)
+    (void) QTSS_SetValue(theStream, sLastRTPPacketIDAttr, 0, &inState->fLastRTPPacketID, sizeof(UInt64));
+  if (inState->fHasLastRTCPPacketID) {
+    (void) QTSS_SetValue(theStream, sLastRTCPPacketIDAttr, 0, &inState->fLastRTCPPacketID, sizeof(UInt64));
+    (void) QTSS_SetValue(theStream, sLastRTCPTransmitAttr, 0, &inState->fLastRTCPTransmit, sizeof(SInt64));
+  }
+
+  if (inState->fHasFirstRTP) {
+    (void) QTSS_SetValue(theStream, sStreamSSRCAttr, 0, &inState->fSSRC, sizeof(UInt32));
+    (void) QTSS_SetValue(theStream, sFirstRTPTimeStampAttr, 0, &inState->fFirstRTPTimeStamp, sizeof(UInt32));
+    (void) QTSS_SetValue(theStream, sFirstRTPArrivalTimeAttr, 0, &inState->fFirstRTPArrivalTime, sizeof(SInt64));
+    (void) QTSS_SetValue(theStream, sFirstRTPCurrentTimeAttr, 0, &inState->fFirstRTPCurrentTime, sizeof(SInt64));
+  } else {
+    (void) QTSS_RemoveValue(theStream, sFirstRTPArrivalTimeAttr, 0);
+    (void) QTSS_RemoveValue(theStream, sFirstRTPTimeStampAttr, 0);
+    (void) QTSS_RemoveValue(theStream, sFirstRTPCurrentTimeAttr, 0);
+  }
+
+  if (inState->fHasBaseRTPTimeStamp) {
+    (void) QTSS_SetValue(theStream, sBaseRTPTimeStampAttr, 0, &inState->fBaseRTPTimeStamp, sizeof(UInt32));
+    (void) QTSS_SetValue(theStream, sBaseArrivalTimeStampAttr, 0, &fBaseArrivalTime, sizeof(SInt64));
+  }
+
+  if (inState->fLastQualityChange != 0) {
+    (void) QTSS_SetValue(theStream, sNextSeqNumAttr, 0, &inState->fNextSeqNum, sizeof(UInt16));
+    (void) QTSS_SetValue(theStream, sSeqNumOffsetAttr, 0, &inState->fSeqNumOffset, sizeof(UInt16));
+    (void) QTSS_SetValue(theStream, sLastQualityChangeAttr, 0, &inState->fLastQualityChange, sizeof(SInt64));
+  }
+}
+
 bool RTPSessionOutput::IsUDP() {
   if (fTransportInitialized)
     return fIsUDP;
@@ -225,21 +360,17 @@ bool RTPSessionOutput::IsUDP() {
  * 根据 seq 过滤 packet
  * @return  true if the packet will be drop, otherwise is false.
  */
-bool RTPSessionOutput::FilterPacket(QTSS_RTPStreamObject *theStreamPtr, StrPtrLen *inPacket) {
-  UInt32 *packetCountPtr = nullptr;
-  UInt32 theLen = 0;
-
+bool RTPSessionOutput::FilterPacket(StreamState *inState, StrPtrLen *inPacket) {
   // see if we started sending and if so then just keep sending (reset on a play)
-  QTSS_Error writeErr = QTSS_GetValuePtr(*theStreamPtr, sStreamPacketCountAttr, 0, (void **) &packetCountPtr, &theLen);
-  if (writeErr == QTSS_NoErr && theLen > 0 && *packetCountPtr > 0)
+  if (inState->fPacketCount > 0)
     return false;
 
-  Assert(theStreamPtr);
+  Assert(inState);
   Assert(inPacket);
 
   UInt16 firstSeqNum = 0;
-  theLen = sizeof(firstSeqNum);
-  if (QTSS_NoErr != QTSS_GetValue(*theStreamPtr, qtssRTPStrFirstSeqNumber, 0, &firstSeqNum, &theLen))
+  UInt32 theLen = sizeof(firstSeqNum);
+  if (QTSS_NoErr != QTSS_GetValue(inState->fStream, qtssRTPStrFirstSeqNumber, 0, &firstSeqNum, &theLen))
     return true;
 
   UInt16 seqnum = this->GetPacketSeqNumber(inPacket);
@@ -257,24 +388,22 @@ bool RTPSessionOutput::FilterPacket(QTSS_RTPStreamObject *theStreamPtr, StrPtrLe
 /**
  * 根据 包号 过滤 packet
  */
-bool RTPSessionOutput::PacketAlreadySent(QTSS_RTPStreamObject *theStreamPtr, UInt32 inFlags, UInt64 *packetIDPtr) {
-  Assert(theStreamPtr);
-  Assert(packetIDPtr);
+bool RTPSessionOutput::PacketAlreadySent(StreamState *inState, UInt32 inFlags, UInt64 *packetIDPtr) {
+  Assert(inState);
+
+  if (packetIDPtr == nullptr)
+    return false;
 
-  UInt32 theLen = 0;
-  UInt64 *lastPacketIDPtr = nullptr;
   bool packetSent = false;
 
   if (inFlags & qtssWriteFlagsIsRTP) {
-    if ((QTSS_NoErr == QTSS_GetValuePtr(*theStreamPtr, sLastRTPPacketIDAttr, 0, (void **) &lastPacketIDPtr, &theLen)) &&
-        (*packetIDPtr <= *lastPacketIDPtr)) {
+    if (inState->fHasLastRTPPacketID && (*packetIDPtr <= inState->fLastRTPPacketID)) {
       //printf("RTPSessionOutput::WritePacket Don't send RTP packet id =%qu\n", *packetIDPtr);
       packetSent = true;
     }
   } else if (inFlags & qtssWriteFlagsIsRTCP) {
-    if (QTSS_NoErr == QTSS_GetValuePtr(*theStreamPtr, sLastRTCPPacketIDAttr, 0, (void **) &lastPacketIDPtr, &theLen) &&
-        (*packetIDPtr <= *lastPacketIDPtr)) {
-      //printf("RTPSessionOutput::WritePacket Don't send RTCP packet id =%qu last packet sent id =%qu\n", *packetIDPtr,*lastPacketIDPtr);
+    if (inState->fHasLastRTCPPacketID && (*packetIDPtr <= inState->fLastRTCPPacketID)) {
+      //printf("RTPSessionOutput::WritePacket Don't send RTCP packet id =%qu last packet sent id =%qu\n", *packetIDPtr, inState->fLastRTCPPacketID);
       packetSent = true;
     }
   }
@@ -282,142 +411,98 @@ bool RTPSessionOutput::PacketAlreadySent(QTSS_RTPStreamObject *theStreamPtr, UIn
   return packetSent;
 }
 
-bool RTPSessionOutput::PacketReadyToSend(QTSS_RTPStreamObject *theStreamPtr, SInt64 *currentTimePtr, UInt32 inFlags,
+bool RTPSessionOutput::PacketReadyToSend(StreamState *inState, SInt64 *currentTimePtr, UInt32 inFlags,
                                          UInt64 *packetIDPtr, SInt64 *timeToSendThisPacketAgainPtr) {
   return true;
 }
 
 QTSS_Error RTPSessionOutput::
-TrackRTCPBaseTime(QTSS_RTPStreamObject *theStreamPtr, StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags,
+TrackRTCPBaseTime(StreamState *inState, StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags,
                   SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr) {
-  bool haveBaseTime = false;
   bool haveAllFirstRTPs = true;
 
-  UInt32 streamTimeScale = 0;
-  UInt32 theLen = sizeof(streamTimeScale);
-  QTSS_Error writeErr = QTSS_GetValue(*theStreamPtr, qtssRTPStrTimescale, 0, (void *) &streamTimeScale, &theLen);
-  Assert(writeErr == QTSS_NoErr);
-
-  UInt32 baseTimeStamp = 0;
-  theLen = sizeof(baseTimeStamp);
-  if (!fMustSynch || QTSS_NoErr == QTSS_GetValue(*theStreamPtr, sBaseRTPTimeStampAttr, 0, (void *) &baseTimeStamp, &theLen)) { // we need a starting stream time that is synched
-    haveBaseTime = true;
-  } else {
-    UInt64 earliestArrivalTime = ~(UInt64) 0; //max value
-    UInt32 firstStreamTime = 0;
-    SInt64 firstStreamArrivalTime = 0;
-    QTSS_RTPStreamObject *findStream = NULL;
-
-    if (fMustSynch || QTSS_NoErr != QTSS_GetValuePtr(*theStreamPtr, sBaseArrivalTimeStampAttr, 0, (void **) &fBaseArrivalTime, &theLen)) {   // we don't have a base arrival time for the session see if we can set one now.
-
-      for (SInt32 z = 0; QTSS_GetValuePtr(fClientSession, qtssCliSesStreamObjects, z, (void **) &findStream, &theLen) == QTSS_NoErr; z++) {
-        SInt64 *firstArrivalTimePtr = NULL;
-        if (QTSS_NoErr != QTSS_GetValuePtr(*findStream, sFirstRTPArrivalTimeAttr, 0, (void **) &firstArrivalTimePtr, &theLen)) {// no packet on this stream yet
-          haveAllFirstRTPs = false; // not enough info to calc a base time
-          break;
-        } else { // we have an arrival time see if it is the first for all streams
-          if ((UInt64) *firstArrivalTimePtr < earliestArrivalTime) {
-            earliestArrivalTime = *firstArrivalTimePtr;
-          }
-        }
+  if (inState->fTimeScale == 0) {
+    UInt32 theLen = sizeof(inState->fTimeScale);
+    QTSS_Error theErr = QTSS_GetValue(inState->fStream, qtssRTPStrTimescale, 0, (void *) &inState->fTimeScale, &theLen);
+    Assert(theErr == QTSS_NoErr);
+  }
 
-      }
+  if (!fMustSynch || inState->fHasBaseRTPTimeStamp) // we need a starting stream time that is synched
+    return QTSS_NoErr;
 
-      if (haveAllFirstRTPs) { // we can now create a base arrival time and base stream time from that
-        writeErr = QTSS_SetValue(*theStreamPtr, sBaseArrivalTimeStampAttr, 0, &earliestArrivalTime, sizeof(SInt64));
-        Assert(writeErr == QTSS_NoErr);
-        fBaseArrivalTime = (SInt64) earliestArrivalTime;
-      }
-    }
+  // we don't have a base arrival time for the session see if we can set one now.
+  UInt64 earliestArrivalTime = ~(UInt64) 0; //max value
+  QTSS_RTPStreamObject *findStream = nullptr;
+  UInt32 theLen = 0;
 
-    if (haveAllFirstRTPs) { //sBaseRTPTimeStamp
-      // we don't have a base stream time but we have a base session time so calculate the base stream time.
-      theLen = sizeof(firstStreamTime);
-      if (QTSS_NoErr != QTSS_GetValue(*theStreamPtr, sFirstRTPTimeStampAttr, 0, (void *) &firstStreamTime, &theLen))
-        return QTSS_NoErr;
-
-      theLen = sizeof(firstStreamArrivalTime);
-      if (QTSS_NoErr != QTSS_GetValue(*theStreamPtr, sFirstRTPArrivalTimeAttr, 0, (void *) &firstStreamArrivalTime, &theLen))
-        return QTSS_NoErr;
-
-      SInt64 arrivalTimeDiffMSecs = (firstStreamArrivalTime -
-          fBaseArrivalTime);// + fBufferDelayMSecs;//add the buffer delay !! not sure about faster than real time arrival times....
-      UInt32 timeDiffStreamTime =
-          (UInt32) (((Float64) arrivalTimeDiffMSecs / (Float64) 1000.0) *
-              (Float64) streamTimeScale);
-      baseTimeStamp = firstStreamTime - timeDiffStreamTime;
-      if (QTSS_NoErr == QTSS_SetValue(*theStreamPtr, sBaseRTPTimeStampAttr, 0, (void *) &baseTimeStamp, sizeof(baseTimeStamp)))
-        haveBaseTime = true;
-
-      (void) QTSS_SetValue(*theStreamPtr, qtssRTPStrFirstTimestamp, 0, &baseTimeStamp, sizeof(baseTimeStamp));
-
-      fMustSynch = false;
-      //printf("fBaseArrivalTime =%qd baseTimeStamp %"   _U32BITARG_   " streamStartTime=%qd diff =%qd\n", fBaseArrivalTime, baseTimeStamp, firstStreamArrivalTime, arrivalTimeDiffMSecs);
+  for (SInt32 z = 0; QTSS_GetValuePtr(fClientSession, qtssCliSesStreamObjects, z, (void **) &findStream, &theLen) == QTSS_NoErr; z++) {
+    StreamState *theState = this->FindStreamState(*findStream);
+    if (theState == nullptr || !theState->fHasFirstRTP) { // no packet on this stream yet
+      haveAllFirstRTPs = false; // not enough info to calc a base time
+      break;
+    } else if ((UInt64) theState->fFirstRTPArrivalTime < earliestArrivalTime) { // we have an arrival time see if it is the first for all streams
+      earliestArrivalTime = (UInt64) theState->fFirstRTPArrivalTime;
     }
   }
 
-  return writeErr;
-
-}
+  if (!haveAllFirstRTPs)
+    return QTSS_NoErr;
 
-QTSS_Error
-RTPSessionOutput::RewriteRTCP(QTSS_RTPStreamObject *theStreamPtr, StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags,
-                              SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr) {
-  UInt32 theLen;
+  // we can now create a base arrival time and base stream time from that
+  fBaseArrivalTime = (SInt64) earliestArrivalTime;
 
-  SInt64 firstRTPCurrentTime = 0;
-  theLen = sizeof(firstRTPCurrentTime);
-  QTSS_GetValue(*theStreamPtr, sFirstRTPCurrentTimeAttr, 0, (void *) &firstRTPCurrentTime, &theLen);
+  // we don't have a base stream time but we have a base session time so calculate the base stream time.
+  SInt64 arrivalTimeDiffMSecs = (inState->fFirstRTPArrivalTime -
+      fBaseArrivalTime);// + fBufferDelayMSecs;//add the buffer delay !! not sure about faster than real time arrival times....
+  UInt32 timeDiffStreamTime =
+      (UInt32) (((Float64) arrivalTimeDiffMSecs / (Float64) 1000.0) *
+          (Float64) inState->fTimeScale);
+  inState->fBaseRTPTimeStamp = inState->fFirstRTPTimeStamp - timeDiffStreamTime;
+  inState->fHasBaseRTPTimeStamp = true;
 
-  SInt64 firstRTPArrivalTime = 0;
-  theLen = sizeof(firstRTPArrivalTime);
-  QTSS_GetValue(*theStreamPtr, sFirstRTPArrivalTimeAttr, 0, (void *) &firstRTPArrivalTime, &theLen);
+  (void) QTSS_SetValue(inState->fStream, qtssRTPStrFirstTimestamp, 0, &inState->fBaseRTPTimeStamp, sizeof(UInt32));
+  this->SyncStreamAttributes(inState, *currentTimePtr);
 
-  UInt32 rtpTime = 0;
-  theLen = sizeof(rtpTime);
-  QTSS_GetValue(*theStreamPtr, sFirstRTPTimeStampAttr, 0, (void *) &rtpTime, &theLen);
+  fMustSynch = false;
+  //printf("fBaseArrivalTime =%qd baseTimeStamp %"   _U32BITARG_   " streamStartTime=%qd diff =%qd\n", fBaseArrivalTime, inState->fBaseRTPTimeStamp, inState->fFirstRTPArrivalTime, arrivalTimeDiffMSecs);
 
-  UInt32 *theReport = (UInt32 *) inPacketStrPtr->Ptr;
-  theReport += 2; // point to the NTP time stamp
-  SInt64 *theNTPTimestampP = (SInt64 *) theReport;
-  *theNTPTimestampP = Utils::HostToNetworkSInt64(Core::Time::TimeMilli_To_1900Fixed64Secs(*currentTimePtr)); // time now
+  return QTSS_NoErr;
+}
 
-  UInt32 baseTimeStamp = 0;
-  theLen = sizeof(baseTimeStamp);
-  (void) QTSS_GetValue(*theStreamPtr, sBaseRTPTimeStampAttr, 0, (void *) &baseTimeStamp, &theLen); // we need a starting stream time that is synched
+QTSS_Error
+RTPSessionOutput::RewriteRTCP(StreamState *inState, StrPtrLen *inPacketStrPtr, StrPtrLen *ioHeader, SInt64 *currentTimePtr, UInt32 inFlags,
+                              SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr) {
+  // the SR in inPacketStrPtr is shared by all outputs, rewrite the sender info into our own header
+  if (inPacketStrPtr->Len < kMaxRewriteHeaderSize)
+    return QTSS_NoErr;
+  this->CopyHeaderForRewrite(inPacketStrPtr, ioHeader, kMaxRewriteHeaderSize);
 
-  UInt32 streamTimeScale = 0;
-  theLen = sizeof(streamTimeScale);
-  QTSS_GetValue(*theStreamPtr, qtssRTPStrTimescale, 0, (void *) &streamTimeScale, &theLen);
+  RTCPPacketView theReport(ioHeader->Ptr, ioHeader->Len);
+  RTCPSenderInfoWriter theWriter(ioHeader->Ptr);
+  theWriter.SetNTPTimestamp(Core::Time::TimeMilli_To_1900Fixed64Secs(*currentTimePtr)); // time now
 
   SInt64 packetOffset = *currentTimePtr - fBaseArrivalTime; // real time that has passed
-  packetOffset -= (firstRTPCurrentTime - firstRTPArrivalTime); // less the initial buffer delay for this stream
+  packetOffset -= (inState->fFirstRTPCurrentTime - inState->fFirstRTPArrivalTime); // less the initial buffer delay for this stream
   if (packetOffset < 0)
     packetOffset = 0;
 
   Float64 rtpTimeFromStart = (Float64) packetOffset / (Float64) 1000.0;
-  UInt32 rtpTimeFromStartInScale = (UInt32) (Float64) ((Float64) streamTimeScale * rtpTimeFromStart);
+  UInt32 rtpTimeFromStartInScale = (UInt32) (Float64) ((Float64) inState->fTimeScale * rtpTimeFromStart);
   //printf("rtptime offset time =%f in scale =%"   _U32BITARG_   "\n", rtpTimeFromStart, rtpTimeFromStartInScale );
 
-  theReport += 2; // point to the rtp time stamp of "now" synched and scaled in stream time
-  *theReport = htonl(baseTimeStamp + rtpTimeFromStartInScale);
+  // the rtp time stamp of "now" synched and scaled in stream time
+  theWriter.SetRTPTimestamp(inState->fBaseRTPTimeStamp + rtpTimeFromStartInScale);
 
-  theLen = sizeof(UInt32);
-  UInt32 packetCount = 0;
-  (void) QTSS_GetValue(*theStreamPtr, sStreamPacketCountAttr, 0, &packetCount, &theLen);
-  theReport += 1; // point to the rtp packets sent
-  *theReport = htonl(ntohl(*theReport) * 2);
-
-  UInt32 byteCount = 0;
-  (void) QTSS_GetValue(*theStreamPtr, sStreamByteCountAttr, 0, &byteCount, &theLen);
-  theReport += 1; // point to the rtp payload bytes sent
-  *theReport = htonl(ntohl(*theReport) * 2);
+  // the rtp packets and payload bytes sent
+  theWriter.SetPacketCount(theReport.GetPacketCount() * 2);
+  theWriter.SetOctetCount(theReport.GetOctetCount() * 2);
 
   return QTSS_NoErr;
 }
 
-QTSS_Error RTPSessionOutput::TrackRTCPPackets(QTSS_RTPStreamObject *theStreamPtr,
+QTSS_Error RTPSessionOutput::TrackRTCPPackets(StreamState *inState,
                                               StrPtrLen *inPacketStrPtr,
+                                              StrPtrLen *ioHeader,
                                               SInt64 *currentTimePtr,
                                               UInt32 inFlags,
                                               SInt64 *packetLatenessInMSec,
@@ -431,7 +516,7 @@ QTSS_Error RTPSessionOutput::TrackRTCPPackets(QTSS_RTPStreamObject *theStreamPtr
   if (!(inFlags & qtssWriteFlagsIsRTCP))
     return -1;
 
-  this->TrackRTCPBaseTime(theStreamPtr,
+  this->TrackRTCPBaseTime(inState,
                           inPacketStrPtr,
                           currentTimePtr,
                           inFlags,
@@ -440,8 +525,9 @@ QTSS_Error RTPSessionOutput::TrackRTCPPackets(QTSS_RTPStreamObject *theStreamPtr
                           packetIDPtr,
                           arrivalTimeMSecPtr);
 
-  this->RewriteRTCP(theStreamPtr,
+  this->RewriteRTCP(inState,
                     inPacketStrPtr,
+                    ioHeader,
                     currentTimePtr,
                     inFlags,
                     packetLatenessInMSec,
@@ -453,7 +539,7 @@ QTSS_Error RTPSessionOutput::TrackRTCPPackets(QTSS_RTPStreamObject *theStreamPtr
 }
 
 QTSS_Error
-RTPSessionOutput::TrackRTPPackets(QTSS_RTPStreamObject *theStreamPtr,
+RTPSessionOutput::TrackRTPPackets(StreamState *inState,
                                   StrPtrLen *inPacketStrPtr,
                                   SInt64 *currentTimePtr,
                                   UInt32 inFlags,
@@ -461,86 +547,63 @@ RTPSessionOutput::TrackRTPPackets(QTSS_RTPStreamObject *theStreamPtr,
                                   SInt64 *timeToSendThisPacketAgain,
                                   UInt64 *packetIDPtr,
                                   SInt64 *arrivalTimeMSecPtr) {
-  QTSS_Error writeErr = QTSS_NoErr;
-
   Assert(inFlags & qtssWriteFlagsIsRTP);
 
   if (!(inFlags & qtssWriteFlagsIsRTP))
     return QTSS_NoErr;
 
-  ReflectorPacket packetContainer;
-  packetContainer.SetPacketData(inPacketStrPtr->Ptr, inPacketStrPtr->Len, false);
-  SInt64 *theTimePtr = NULL;
-  UInt32 theLen = 0;
-
-  if (QTSS_NoErr != QTSS_GetValuePtr(*theStreamPtr, sFirstRTPArrivalTimeAttr, 0, (void **) &theTimePtr, &theLen)) {
-    UInt32 theSSRC = packetContainer.GetSSRC();
-    (void) QTSS_SetValue(*theStreamPtr, sStreamSSRCAttr, 0, &theSSRC, sizeof(theSSRC));
-
-    UInt32 rtpTime = packetContainer.GetPacketRTPTime();
-    writeErr = QTSS_SetValue(*theStreamPtr, sFirstRTPTimeStampAttr, 0, &rtpTime, sizeof(rtpTime));
-    Assert(writeErr == QTSS_NoErr);
-
-    writeErr = QTSS_SetValue(*theStreamPtr, sFirstRTPArrivalTimeAttr, 0, arrivalTimeMSecPtr, sizeof(SInt64));
-    Assert(writeErr == QTSS_NoErr);
-
-    writeErr = QTSS_SetValue(*theStreamPtr, sFirstRTPCurrentTimeAttr, 0, currentTimePtr, sizeof(SInt64));
-    Assert(writeErr == QTSS_NoErr);
+  // read the header in place, the packet data is shared and must not be copied
+  RTPPacketView rtpPacket(inPacketStrPtr->Ptr, inPacketStrPtr->Len);
+  if (!rtpPacket.IsValid())
+    return QTSS_NoErr;
 
-    UInt32 initValue = 0;
-    writeErr = QTSS_SetValue(*theStreamPtr, sStreamByteCountAttr, 0, &initValue, sizeof(UInt32));
-    Assert(writeErr == QTSS_NoErr);
+  if (!inState->fHasFirstRTP) {
+    inState->fHasFirstRTP = true;
+    inState->fSSRC = rtpPacket.GetSSRC();
+    inState->fFirstRTPTimeStamp = rtpPacket.GetTimestamp();
+    inState->fFirstRTPArrivalTime = *arrivalTimeMSecPtr;
+    inState->fFirstRTPCurrentTime = *currentTimePtr;
+    inState->fByteCount = 0;
+    this->SyncStreamAttributes(inState, *currentTimePtr);
 
-    //printf("first rtp on stream stream=%"   _U32BITARG_   " ssrc=%"   _U32BITARG_   " rtpTime=%"   _U32BITARG_   " arrivalTimeMSecPtr=%qd currentTime=%qd\n",(UInt32) theStreamPtr, theSSRC, rtpTime, *arrivalTimeMSecPtr, *currentTimePtr);
+    //printf("first rtp on stream stream=%"   _U32BITARG_   " ssrc=%"   _U32BITARG_   " rtpTime=%"   _U32BITARG_   " arrivalTimeMSecPtr=%qd currentTime=%qd\n",(UInt32) inState->fStream, inState->fSSRC, inState->fFirstRTPTimeStamp, *arrivalTimeMSecPtr, *currentTimePtr);
 
   } else {
-    UInt32 *packetCountPtr = NULL;
-    UInt32 *byteCountPtr = NULL;
-    UInt32 theLen = 0;
+    inState->fByteCount += inPacketStrPtr->Len - 12;// 12 header bytes
 
-    writeErr = QTSS_GetValuePtr(*theStreamPtr, sStreamByteCountAttr, 0, (void **) &byteCountPtr, &theLen);
-    if (writeErr == QTSS_NoErr && theLen > 0)
-      *byteCountPtr += inPacketStrPtr->Len - 12;// 12 header bytes
+    if (inState->fSSRC != rtpPacket.GetSSRC()) {
+      //printf("found different ssrc =%"   _U32BITARG_   " packetssrc=%"   _U32BITARG_   "\n", inState->fSSRC, rtpPacket.GetSSRC());
 
-
-    UInt32 *theSSRCPtr = 0;
-    (void) QTSS_GetValuePtr(*theStreamPtr, sStreamSSRCAttr, 0, (void **) &theSSRCPtr, &theLen);
-    if (*theSSRCPtr != packetContainer.GetSSRC()) {
-
-      (void) QTSS_RemoveValue(*theStreamPtr, sFirstRTPArrivalTimeAttr, 0);
-      (void) QTSS_RemoveValue(*theStreamPtr, sFirstRTPTimeStampAttr, 0);
-      (void) QTSS_RemoveValue(*theStreamPtr, sFirstRTPCurrentTimeAttr, 0);
-      (void) QTSS_RemoveValue(*theStreamPtr, sStreamPacketCountAttr, 0);
-      (void) QTSS_RemoveValue(*theStreamPtr, sStreamByteCountAttr, 0);
+      inState->fHasFirstRTP = false;
+      inState->fPacketCount = 0;
+      inState->fByteCount = 0;
+      inState->fHasBaseRTPTimeStamp = false;
+      this->SyncStreamAttributes(inState, *currentTimePtr);
       fMustSynch = true;
-
-      //printf("found different ssrc =%"   _U32BITARG_   " packetssrc=%"   _U32BITARG_   "\n",*theSSRCPtr, packetContainer.GetSSRC(packetContainer.fIsRTCP));
-
     }
-
   }
 
-  return writeErr;
-
+  return QTSS_NoErr;
 }
 
 QTSS_Error
-RTPSessionOutput::TrackPackets(QTSS_RTPStreamObject *theStreamPtr, StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags,
+RTPSessionOutput::TrackPackets(StreamState *inState, StrPtrLen *inPacketStrPtr, StrPtrLen *ioHeader, SInt64 *currentTimePtr, UInt32 inFlags,
                                SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr) {
   if (this->IsUDP())
     return QTSS_NoErr;
 
   if (inFlags & qtssWriteFlagsIsRTCP)
-    (void) this->TrackRTCPPackets(theStreamPtr, inPacketStrPtr, currentTimePtr, inFlags, packetLatenessInMSec, timeToSendThisPacketAgain, packetIDPtr, arrivalTimeMSecPtr);
+    (void) this->TrackRTCPPackets(inState, inPacketStrPtr, ioHeader, currentTimePtr, inFlags, packetLatenessInMSec, timeToSendThisPacketAgain, packetIDPtr, arrivalTimeMSecPtr);
   else if (inFlags & qtssWriteFlagsIsRTP)
-    (void) this->TrackRTPPackets(theStreamPtr, inPacketStrPtr, currentTimePtr, inFlags, packetLatenessInMSec, timeToSendThisPacketAgain, packetIDPtr, arrivalTimeMSecPtr);
+    (void) this->TrackRTPPackets(inState, inPacketStrPtr, currentTimePtr, inFlags, packetLatenessInMSec, timeToSendThisPacketAgain, packetIDPtr, arrivalTimeMSecPtr);
 
   return QTSS_NoErr;
 }
 
 QTSS_Error RTPSessionOutput::
 WritePacket(StrPtrLen *inPacket, void *inStreamCookie, UInt32 inFlags, SInt64 packetLatenessInMSec,
-            SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr, bool firstPacket) {
+            SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr, bool firstPacket,
+            PacketBuffer *inBuffer) {
   QTSS_RTPSessionState *theState = nullptr;
   UInt32 theLen = 0;
   QTSS_Error writeErr = QTSS_NoErr;
@@ -555,105 +618,114 @@ WritePacket(StrPtrLen *inPacket, void *inStreamCookie, UInt32 inFlags, SInt64 pa
     return QTSS_WouldBlock;
   }
 
-  // make sure all RTP streams with this ID see this packet
-  QTSS_RTPStreamObject *theStreamPtr = nullptr;
-
-  for (UInt32 z = 0; QTSS_GetValuePtr(fClientSession, qtssCliSesStreamObjects, z, (void **) &theStreamPtr, &theLen) == QTSS_NoErr; z++) {
-    // 找到和 ReflectorStream 相关联的 RTPStream 对象
-    // RTPStream 对象在 QTSSReflectorModule::DoSetup 调用的 QTSS_AddRTPStream 函数里创建。
-    if (this->PacketMatchesStream(inStreamCookie, theStreamPtr)) {
-      if ((inFlags & qtssWriteFlagsIsRTP) && this->FilterPacket(theStreamPtr, inPacket))
-        return QTSS_NoErr; // keep looking at packets
-
-      if (this->PacketAlreadySent(theStreamPtr, inFlags, packetIDPtr))
-        return QTSS_NoErr; // keep looking at packets
-
-      if (!this->PacketReadyToSend(theStreamPtr, &currentTime, inFlags, packetIDPtr, timeToSendThisPacketAgain)) {
-        //s_printf("QTSS_WouldBlock\n");
-        return QTSS_WouldBlock; // stop not ready to send packets now
-      }
+  // the RTP stream that reflects this ReflectorStream, looked up once and then cached
+  StreamState *theStreamState = this->GetStreamState(inStreamCookie);
+  if (theStreamState == nullptr)
+    return QTSS_NoErr;
 
+  if ((inFlags & qtssWriteFlagsIsRTP) && this->FilterPacket(theStreamState, inPacket))
+    return QTSS_NoErr; // keep looking at packets
 
-      // TrackPackets below is for re-writing the rtcps we don't use it right now-- shouldn't need to
-      // (void) this->TrackPackets(theStreamPtr, inPacket, &currentTime,inFlags,  &packetLatenessInMSec, timeToSendThisPacketAgain, packetIDPtr,arrivalTimeMSecPtr);
+  if (this->PacketAlreadySent(theStreamState, inFlags, packetIDPtr))
+    return QTSS_NoErr; // keep looking at packets
 
-      QTSS_PacketStruct thePacket;
-      thePacket.packetData = inPacket->Ptr;
-      thePacket.packetTransmitTime = (currentTime - packetLatenessInMSec);
+  if (!this->PacketReadyToSend(theStreamState, &currentTime, inFlags, packetIDPtr, timeToSendThisPacketAgain)) {
+    //s_printf("QTSS_WouldBlock\n");
+    return QTSS_WouldBlock; // stop not ready to send packets now
+  }
 
-      // add buffer time where oldest buffered packet as now == 0 and newest is entire buffer time in the future.
-      if (fBufferDelayMSecs > 0) {
-        SInt64 delayMSecs = fBufferDelayMSecs - (currentTime - *arrivalTimeMSecPtr);
-        thePacket.packetTransmitTime += delayMSecs;
-      }
+  // inPacket is shared by all outputs of the stream, never write into it.
+  // per-output rewrites (seq offset, RTCP sender info) go into theHeader, which
+  // RTPStream::Write sends in place of the first theHeader.Len bytes of the packet.
+  char theHeaderBuf[kMaxRewriteHeaderSize];
+  StrPtrLen theHeader(theHeaderBuf, 0);
+
+  // TrackPackets below is for re-writing the rtcps we don't use it right now-- shouldn't need to
+  // (void) this->TrackPackets(theStreamState, inPacket, &theHeader, &currentTime,inFlags,  &packetLatenessInMSec, timeToSendThisPacketAgain, packetIDPtr,arrivalTimeMSecPtr);
+
+  QTSS_PacketStruct thePacket;
+  thePacket.packetData = inPacket->Ptr;
+  thePacket.packetTransmitTime = (currentTime - packetLatenessInMSec);
+  thePacket.packetHeader = theHeader.Len > 0 ? theHeader.Ptr : nullptr;
+  thePacket.packetHeaderLen = theHeader.Len;
+  thePacket.packetBuffer = inBuffer;
+
+  // add buffer time where oldest buffered packet as now == 0 and newest is entire buffer time in the future.
+  if (fBufferDelayMSecs > 0) {
+    SInt64 delayMSecs = fBufferDelayMSecs - (currentTime - *arrivalTimeMSecPtr);
+    thePacket.packetTransmitTime += delayMSecs;
+  }
 
-      // 实际上调用的是 RTPStream::Write 函数, 通过 UDP Socket 发送音视频流。
-      writeErr = QTSS_Write(*theStreamPtr, &thePacket, inPacket->Len, nullptr, inFlags | qtssWriteFlagsWriteBurstBegin);
-      if (writeErr == QTSS_WouldBlock) {
-        //s_printf("QTSS_Write == QTSS_WouldBlock\n");
-        //
-        // We are flow controlled. See if we know when flow control will be lifted and report that
-        *timeToSendThisPacketAgain = thePacket.suggestedWakeupTime;
-
-        if (firstPacket) {
-          fBufferDelayMSecs = static_cast<UInt32>(currentTime - *arrivalTimeMSecPtr);
-          //s_printf("firstPacket fBufferDelayMSecs =%lu \n", fBufferDelayMSecs);
-        }
-      } else {
-        fLastIntervalMilliSec = currentTime - fLastPacketTransmitTime;
-        if (fLastIntervalMilliSec > 100) //reset interval maybe first packet or it has been blocked for awhile
-          fLastIntervalMilliSec = 5;
-        fLastPacketTransmitTime = currentTime;
-
-        if (inFlags & qtssWriteFlagsIsRTP) {
-          (void) QTSS_SetValue(*theStreamPtr, sLastRTPPacketIDAttr, 0, packetIDPtr, sizeof(UInt64));
-        } else if (inFlags & qtssWriteFlagsIsRTCP) {
-          (void) QTSS_SetValue(*theStreamPtr, sLastRTCPPacketIDAttr, 0, packetIDPtr, sizeof(UInt64));
-          (void) QTSS_SetValue(*theStreamPtr, sLastRTCPTransmitAttr, 0, &currentTime, sizeof(UInt64));
-        }
-
-        { // increment packet counts
-          UInt32 *packetCountPtr = nullptr;
-          UInt32 theLen2 = 0;
-
-          (void) QTSS_GetValuePtr(*theStreamPtr, sStreamPacketCountAttr, 0, (void **) &packetCountPtr, &theLen2);
-          if (theLen2 > 0) {
-            *packetCountPtr += 1;
-            //printf("SET sStreamPacketCountAttr =%lu\n", *packetCountPtr);
-          }
-        }
+  // 实际上调用的是 RTPStream::Write 函数, 通过 UDP Socket 发送音视频流。
+  writeErr = QTSS_Write(theStreamState->fStream, &thePacket, inPacket->Len, nullptr, inFlags | qtssWriteFlagsWriteBurstBegin);
+  if (writeErr == QTSS_WouldBlock) {
+    //s_printf("QTSS_Write == QTSS_WouldBlock\n");
+    //
+    // We are flow controlled. See if we know when flow control will be lifted and report that
+    *timeToSendThisPacketAgain = thePacket.suggestedWakeupTime;
+
+    if (firstPacket) {
+      fBufferDelayMSecs = static_cast<UInt32>(currentTime - *arrivalTimeMSecPtr);
+      //s_printf("firstPacket fBufferDelayMSecs =%lu \n", fBufferDelayMSecs);
+    }
+  } else {
+    fLastIntervalMilliSec = currentTime - fLastPacketTransmitTime;
+    if (fLastIntervalMilliSec > 100) //reset interval maybe first packet or it has been blocked for awhile
+      fLastIntervalMilliSec = 5;
+    fLastPacketTransmitTime = currentTime;
+
+    if (packetIDPtr != nullptr) {
+      if (inFlags & qtssWriteFlagsIsRTP) {
+        theStreamState->fLastRTPPacketID = *packetIDPtr;
+        theStreamState->fHasLastRTPPacketID = true;
+      } else if (inFlags & qtssWriteFlagsIsRTCP) {
+        theStreamState->fLastRTCPPacketID = *packetIDPtr;
+        theStreamState->fHasLastRTCPPacketID = true;
+        theStreamState->fLastRTCPTransmit = currentTime;
       }
     }
 
-    if (writeErr != QTSS_NoErr)
-      break;
+    // increment packet counts
+    theStreamState->fPacketCount += 1;
+
+    if (currentTime - theStreamState->fLastSyncTime >= kAttributeSyncIntervalMSec)
+      this->SyncStreamAttributes(theStreamState, currentTime);
   }
 
   return writeErr;
 }
 
 UInt16 RTPSessionOutput::GetPacketSeqNumber(StrPtrLen *inPacket) {
-  if (inPacket->Len < 4) return 0;
+  return RTPPacketView(inPacket->Ptr, inPacket->Len).GetSeqNumber();
+}
 
-  //The RTP seq number is the second short of the packet
-  auto *rtpHeader = reinterpret_cast<RTPFixedHeader *>(inPacket->Ptr);
-  return ntohs(rtpHeader->seq);
+/**
+ * copy the first inLen bytes of the shared packet into the per-output header, if not yet copied
+ */
+void RTPSessionOutput::CopyHeaderForRewrite(StrPtrLen *inPacket, StrPtrLen *ioHeader, UInt32 inLen) {
+  Assert(inLen <= kMaxRewriteHeaderSize);
+  Assert(inLen <= inPacket->Len);
+
+  if (ioHeader->Len >= inLen) return;
+
+  ::memcpy(ioHeader->Ptr + ioHeader->Len, inPacket->Ptr + ioHeader->Len, inLen - ioHeader->Len);
+  ioHeader->Len = inLen;
 }
 
-void RTPSessionOutput::SetPacketSeqNumber(StrPtrLen *inPacket, UInt16 inSeqNumber) {
-  if (inPacket->Len < 4) return;
+void RTPSessionOutput::SetPacketSeqNumber(StrPtrLen *inPacket, StrPtrLen *ioHeader, UInt16 inSeqNumber) {
+  if (inPacket->Len < RTPPacketView::kFixedHeaderSize) return;
+
+  this->CopyHeaderForRewrite(inPacket, ioHeader, RTPPacketView::kFixedHeaderSize);
 
-  //The RTP seq number is the second short of the packet
-  auto *rtpHeader = reinterpret_cast<RTPFixedHeader *>(inPacket->Ptr);
-  rtpHeader->seq = htons(inSeqNumber);
+  RTPHeaderWriter(ioHeader->Ptr).SetSeqNumber(inSeqNumber);
 }
 
 // this routine is not used
-bool RTPSessionOutput::PacketShouldBeThinned(QTSS_RTPStreamObject inStream,
-                                             StrPtrLen *inPacket) {
+bool RTPSessionOutput::PacketShouldBeThinned(StreamState *inState,
+                                             StrPtrLen *inPacket,
+                                             StrPtrLen *ioHeader) {
   return false; // function is disabled.
 
-  static UInt16 sZero = 0;
   //This function determines whether the packet should be dropped.
   //It also adjusts the sequence number if necessary
 
@@ -662,103 +734,52 @@ bool RTPSessionOutput::PacketShouldBeThinned(QTSS_RTPStreamObject inStream,
 
   UInt16 curSeqNum = this->GetPacketSeqNumber(inPacket);
   UInt32 *curQualityLevel = NULL;
-  UInt16 *nextSeqNum = NULL;
-  UInt16 *theSeqNumOffset = NULL;
-  SInt64 *lastChangeTime = NULL;
 
   UInt32 theLen = 0;
-  (void) QTSS_GetValuePtr(inStream,
+  (void) QTSS_GetValuePtr(inState->fStream,
                           qtssRTPStrQualityLevel,
                           0,
                           (void **) &curQualityLevel,
                           &theLen);
   if ((curQualityLevel == NULL) || (theLen != sizeof(UInt32)))
     return false;
-  (void) QTSS_GetValuePtr(inStream,
-                          sNextSeqNumAttr,
-                          0,
-                          (void **) &nextSeqNum,
-                          &theLen);
-  if ((nextSeqNum == NULL) || (theLen != sizeof(UInt16))) {
-    nextSeqNum = &sZero;
-    (void) QTSS_SetValue(inStream,
-                         sNextSeqNumAttr,
-                         0,
-                         nextSeqNum,
-                         sizeof(UInt16));
-  }
-  (void) QTSS_GetValuePtr(inStream,
-                          sSeqNumOffsetAttr,
-                          0,
-                          (void **) &theSeqNumOffset,
-                          &theLen);
-  if ((theSeqNumOffset == NULL) || (theLen != sizeof(UInt16))) {
-    theSeqNumOffset = &sZero;
-    (void) QTSS_SetValue(inStream,
-                         sSeqNumOffsetAttr,
-                         0,
-                         theSeqNumOffset,
-                         sizeof(UInt16));
-  }
-  UInt16 newSeqNumOffset = *theSeqNumOffset;
 
-  (void) QTSS_GetValuePtr(inStream,
-                          sLastQualityChangeAttr,
-                          0,
-                          (void **) &lastChangeTime,
-                          &theLen);
-  if ((lastChangeTime == NULL) || (theLen != sizeof(SInt64))) {
-    static SInt64 startTime = 0;
-    lastChangeTime = &startTime;
-    (void) QTSS_SetValue(inStream,
-                         sLastQualityChangeAttr,
-                         0,
-                         lastChangeTime,
-                         sizeof(SInt64));
-  }
+  UInt16 newSeqNumOffset = inState->fSeqNumOffset;
 
   SInt64 timeNow = Core::Time::Milliseconds();
-  if (*lastChangeTime == 0 || *curQualityLevel == 0)
-    *lastChangeTime = timeNow;
+  if (inState->fLastQualityChange == 0 || *curQualityLevel == 0)
+    inState->fLastQualityChange = timeNow;
 
   if (*curQualityLevel > 0
-      && ((*lastChangeTime + 30000) < timeNow)) // 30 seconds between reductions
+      && ((inState->fLastQualityChange + 30000) < timeNow)) // 30 seconds between reductions
   {
     *curQualityLevel -=
         1; // reduce quality value.  If we quality doesn't change then we may have hit some steady state which we can't get out of without thinning or increasing the quality
-    *lastChangeTime = timeNow;
+    inState->fLastQualityChange = timeNow;
     //s_printf("RTPSessionOutput set quality to %"   _U32BITARG_   "\n",*curQualityLevel);
   }
 
   //Check to see if we need to drop to audio only
   if ((*curQualityLevel >= ReflectorSession::kAudioOnlyQuality) &&
-      (*nextSeqNum == 0)) {
+      (inState->fNextSeqNum == 0)) {
 #if REFLECTOR_THINNING_DEBUGGING || RTP_SESSION_DEBUGGING
     s_printf(" *** Reflector Dropping to audio only *** \n");
 #endif
     //All we need to do in this case is mark the sequence number of the first dropped packet
-    (void) QTSS_SetValue(inStream,
-                         sNextSeqNumAttr,
-                         0,
-                         &curSeqNum,
-                         sizeof(UInt16));
-    *lastChangeTime = timeNow;
+    inState->fNextSeqNum = curSeqNum;
+    inState->fLastQualityChange = timeNow;
   }
 
 
   //Check to see if we can reinstate video
   if ((*curQualityLevel == ReflectorSession::kNormalQuality)
-      && (*nextSeqNum != 0)) {
+      && (inState->fNextSeqNum != 0)) {
     //Compute the offset amount for each subsequent sequence number. This offset will
     //alter the sequence numbers so that they increment normally (providing the illusion to the
     //client that there are no missing packets)
-    newSeqNumOffset = (*theSeqNumOffset) + (curSeqNum - (*nextSeqNum));
-    (void) QTSS_SetValue(inStream,
-                         sSeqNumOffsetAttr,
-                         0,
-                         &newSeqNumOffset,
-                         sizeof(UInt16));
-    (void) QTSS_SetValue(inStream, sNextSeqNumAttr, 0, &sZero, sizeof(UInt16));
+    newSeqNumOffset = inState->fSeqNumOffset + (curSeqNum - inState->fNextSeqNum);
+    inState->fSeqNumOffset = newSeqNumOffset;
+    inState->fNextSeqNum = 0;
   }
 
   //tell the caller whether to drop this packet or not.
@@ -767,12 +788,14 @@ bool RTPSessionOutput::PacketShouldBeThinned(QTSS_RTPStreamObject inStream,
   else {
     //Adjust the sequence number of the current packet based on the offset, if any
     curSeqNum -= newSeqNumOffset;
-    this->SetPacketSeqNumber(inPacket, curSeqNum);
+    this->SetPacketSeqNumber(inPacket, ioHeader, curSeqNum);
     return false;
   }
 }
 
 void RTPSessionOutput::TearDown() {
+  this->SyncStreamAttributes();
+
   QTSS_CliSesTeardownReason reason = qtssCliSesTearDownBroadcastEnded;
   (void) QTSS_SetValue(fClientSession,
                        qtssCliTeardownReason,
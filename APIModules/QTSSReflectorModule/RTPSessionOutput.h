@@ -47,7 +47,7 @@ class RTPSessionOutput : public ReflectorOutput {
   static void Register();
 
   RTPSessionOutput(QTSS_ClientSessionObject inRTPSession, ReflectorSession *inReflectorSession, QTSS_Object serverPrefs, QTSS_AttributeID inCookieAddrID);
-  ~RTPSessionOutput() override = default;
+  ~RTPSessionOutput() override;
 
   ReflectorSession *GetReflectorSession() { return fReflectorSession; }
   void InitializeStreams();
@@ -56,7 +56,8 @@ class RTPSessionOutput : public ReflectorOutput {
   // If this function returns QTSS_WouldBlock, timeToSendThisPacketAgain will
   // be set to # of msec in which the packet can be sent, or -1 if unknown
   QTSS_Error WritePacket(CF::StrPtrLen *inPacketData, void *inStreamCookie, UInt32 inFlags, SInt64 packetLatenessInMSec,
-                         SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSec, bool firstPacket) override;
+                         SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSec, bool firstPacket,
+                         PacketBuffer *inBuffer = nullptr) override;
   void TearDown() override;
 
   SInt64 GetReflectorSessionInitTime() { return fReflectorSession->GetInitTimeMS(); }
@@ -67,8 +68,51 @@ class RTPSessionOutput : public ReflectorOutput {
 
   void SetBufferDelay(UInt32 delay) { fBufferDelayMSecs = delay; }
 
+  // copy the per-stream state into the QTSS_RTPStreamObject attributes now
+  void SyncStreamAttributes();
+
  private:
 
+  /**
+   * 每个 RTPStream 的发送状态
+   *
+   * 逐包读写的状态保存在这里，不再通过 QTSS_GetValue/QTSS_SetValue 访问 RTPStream 的字典属性
+   * (每次都要加字典锁并查找属性)。字典属性只在状态变化时、按 kAttributeSyncIntervalMSec
+   * 间隔以及 TearDown 时同步，供 admin/日志等模块读取。
+   *
+   * @note 与 bookmark 一样由 fMutex 保护
+   */
+  struct StreamState {
+    QTSS_RTPStreamObject fStream;
+    void *fStreamCookie;      // the ReflectorStream of fStream, nullptr for a free slot
+
+    // bookmark
+    UInt32 fPacketCount;
+    UInt32 fByteCount;
+    UInt64 fLastRTPPacketID;
+    UInt64 fLastRTCPPacketID;
+    bool fHasLastRTPPacketID;
+    bool fHasLastRTCPPacketID;
+    SInt64 fLastRTCPTransmit;
+
+    // timing
+    UInt32 fTimeScale;
+    bool fHasFirstRTP;
+    UInt32 fSSRC;
+    UInt32 fFirstRTPTimeStamp;
+    SInt64 fFirstRTPArrivalTime;
+    SInt64 fFirstRTPCurrentTime;
+    bool fHasBaseRTPTimeStamp;
+    UInt32 fBaseRTPTimeStamp;
+
+    // thinning
+    UInt16 fNextSeqNum;
+    UInt16 fSeqNumOffset;
+    SInt64 fLastQualityChange;
+
+    SInt64 fLastSyncTime;     // last time the attributes were written, 0 if never
+  };
+
   QTSS_ClientSessionObject fClientSession;
   ReflectorSession *fReflectorSession;
   QTSS_AttributeID fCookieAttrID; // is sStreamCookieAttr that defined in QTSSReflectorModule
@@ -79,20 +123,34 @@ class RTPSessionOutput : public ReflectorOutput {
   bool fMustSynch;
   bool fPreFilter;
 
+  StreamState *fStreamStates; // one per stream of fReflectorSession
+  UInt32 fNumStreamStates;
+
+  enum {
+    kMaxRewriteHeaderSize = RTCPPacketView::kSenderReportSize, // RTCP SR header + sender info, larger than the RTP fixed header
+    kAttributeSyncIntervalMSec = 1000,
+  };
+
+  StreamState *GetStreamState(void *inStreamCookie);
+  StreamState *FindStreamState(QTSS_RTPStreamObject inStream);
+  void ResetStreamState(StreamState *ioState);
+  void SyncStreamAttributes(StreamState *inState, SInt64 inCurrentTime);
+
   UInt16 GetPacketSeqNumber(CF::StrPtrLen *inPacket);
-  void SetPacketSeqNumber(CF::StrPtrLen *inPacket, UInt16 inSeqNumber);
-  bool PacketShouldBeThinned(QTSS_RTPStreamObject inStream, CF::StrPtrLen *inPacket);
-  bool FilterPacket(QTSS_RTPStreamObject *theStreamPtr, CF::StrPtrLen *inPacket);
+  void CopyHeaderForRewrite(CF::StrPtrLen *inPacket, CF::StrPtrLen *ioHeader, UInt32 inLen);
+  void SetPacketSeqNumber(CF::StrPtrLen *inPacket, CF::StrPtrLen *ioHeader, UInt16 inSeqNumber);
+  bool PacketShouldBeThinned(StreamState *inState, CF::StrPtrLen *inPacket, CF::StrPtrLen *ioHeader);
+  bool FilterPacket(StreamState *inState, CF::StrPtrLen *inPacket);
 
   UInt32 GetPacketRTPTime(CF::StrPtrLen *packetStrPtr);
   inline bool PacketMatchesStream(void *inStreamCookie, QTSS_RTPStreamObject *theStreamPtr);
-  bool PacketReadyToSend(QTSS_RTPStreamObject *theStreamPtr, SInt64 *currentTimePtr, UInt32 inFlags, UInt64 *packetIDPtr, SInt64 *timeToSendThisPacketAgainPtr);
-  bool PacketAlreadySent(QTSS_RTPStreamObject *theStreamPtr, UInt32 inFlags, UInt64 *packetIDPtr);
-  QTSS_Error TrackRTCPBaseTime(QTSS_RTPStreamObject *theStreamPtr, CF::StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
-  QTSS_Error RewriteRTCP(QTSS_RTPStreamObject *theStreamPtr, CF::StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
-  QTSS_Error TrackRTPPackets(QTSS_RTPStreamObject *theStreamPtr, CF::StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
-  QTSS_Error TrackRTCPPackets(QTSS_RTPStreamObject *theStreamPtr, CF::StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
-  QTSS_Error TrackPackets(QTSS_RTPStreamObject *theStreamPtr, CF::StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
+  bool PacketReadyToSend(StreamState *inState, SInt64 *currentTimePtr, UInt32 inFlags, UInt64 *packetIDPtr, SInt64 *timeToSendThisPacketAgainPtr);
+  bool PacketAlreadySent(StreamState *inState, UInt32 inFlags, UInt64 *packetIDPtr);
+  QTSS_Error TrackRTCPBaseTime(StreamState *inState, CF::StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
+  QTSS_Error RewriteRTCP(StreamState *inState, CF::StrPtrLen *inPacketStrPtr, CF::StrPtrLen *ioHeader, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
+  QTSS_Error TrackRTPPackets(StreamState *inState, CF::StrPtrLen *inPacketStrPtr, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
+  QTSS_Error TrackRTCPPackets(StreamState *inState, CF::StrPtrLen *inPacketStrPtr, CF::StrPtrLen *ioHeader, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
+  QTSS_Error TrackPackets(StreamState *inState, CF::StrPtrLen *inPacketStrPtr, CF::StrPtrLen *ioHeader, SInt64 *currentTimePtr, UInt32 inFlags, SInt64 *packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain, UInt64 *packetIDPtr, SInt64 *arrivalTimeMSecPtr);
 };
 
 bool RTPSessionOutput::PacketMatchesStream(void *inStreamCookie, QTSS_RTPStreamObject *theStreamPtr) {
@@ -0,0 +1,147 @@
+/*
+    File:       ReflectorGOPCache.cpp
+
+    Contains:   Implementation of class defined in ReflectorGOPCache.h
+*/
+
+#include <string.h>
+
+#include "ReflectorGOPCache.h"
+
+using namespace CF;
+
+ReflectorGOPCache::ReflectorGOPCache(UInt32 inMaxBytes)
+    : fEntries(nullptr),
+      fNumEntries(0),
+      fMaxEntries(0),
+      fNumBytes(0),
+      fMaxBytes(inMaxBytes),
+      fKeyFrameRTPTime(0),
+      fNumParameterSets(0),
+      fLastWasParameterSet(false) {
+  ::memset(fParameterSets, 0, sizeof(fParameterSets));
+}
+
+ReflectorGOPCache::~ReflectorGOPCache() {
+  this->Clear();
+  delete[] fEntries;
+}
+
+void ReflectorGOPCache::Put(PacketBuffer *inBuffer, UInt64 inPacketID, SInt64 inTimeArrived,
+                            UInt32 inRTPTime, PacketKind inKind) {
+  Core::MutexLocker locker(&fMutex);
+
+  switch (inKind) {
+    case kParameterSet: {
+      // a parameter set after frame data starts a new run, and replaces the old one
+      if (!fLastWasParameterSet) {
+        for (UInt32 i = 0; i < fNumParameterSets; i++)
+          fParameterSets[i].fBuffer->Release();
+        fNumParameterSets = 0;
+      }
+
+      if (fNumParameterSets == kMaxParameterSets) {
+        fParameterSets[0].fBuffer->Release();
+        ::memmove(&fParameterSets[0], &fParameterSets[1], sizeof(Entry) * (kMaxParameterSets - 1));
+        fNumParameterSets--;
+      }
+
+      Entry &theSet = fParameterSets[fNumParameterSets++];
+      theSet.fBuffer = inBuffer;
+      theSet.fPacketID = inPacketID;
+      theSet.fTimeArrived = inTimeArrived;
+
+      // in band parameter sets belong to the open GOP as well
+      if (this->IsValid()) {
+        inBuffer->Retain();
+        (void) this->Append(inBuffer, inPacketID, inTimeArrived);
+      }
+      break;
+    }
+
+    case kKeyFrameStart: {
+      // the other slices of the same key frame
+      if (this->IsValid() && inRTPTime == fKeyFrameRTPTime) {
+        (void) this->Append(inBuffer, inPacketID, inTimeArrived);
+        break;
+      }
+
+      // a new GOP: the latest parameter sets, then the key frame
+      this->ReleaseEntries();
+      fKeyFrameRTPTime = inRTPTime;
+
+      for (UInt32 i = 0; i < fNumParameterSets; i++) {
+        fParameterSets[i].fBuffer->Retain();
+        if (!this->Append(fParameterSets[i].fBuffer, fParameterSets[i].fPacketID, fParameterSets[i].fTimeArrived)) {
+          inBuffer->Release();
+          fLastWasParameterSet = false;
+          return;
+        }
+      }
+
+      (void) this->Append(inBuffer, inPacketID, inTimeArrived);
+      break;
+    }
+
+    default: {
+      if (this->IsValid())
+        (void) this->Append(inBuffer, inPacketID, inTimeArrived);
+      else
+        inBuffer->Release(); // wait for the next key frame
+      break;
+    }
+  }
+
+  fLastWasParameterSet = (inKind == kParameterSet);
+}
+
+void ReflectorGOPCache::Clear() {
+  Core::MutexLocker locker(&fMutex);
+
+  this->ReleaseEntries();
+
+  for (UInt32 i = 0; i < fNumParameterSets; i++)
+    fParameterSets[i].fBuffer->Release();
+  fNumParameterSets = 0;
+  fLastWasParameterSet = false;
+}
+
+/**
+ * append to the GOP, drop the whole GOP if it outgrows the cache
+ *
+ * @return false if the GOP has been dropped
+ */
+bool ReflectorGOPCache::Append(PacketBuffer *inBuffer, UInt64 inPacketID, SInt64 inTimeArrived) {
+  if (fNumBytes + inBuffer->GetLen() > fMaxBytes || fNumEntries == kMaxEntries) {
+    inBuffer->Release();
+    this->ReleaseEntries();
+    return false;
+  }
+
+  if (fNumEntries == fMaxEntries) {
+    UInt32 theMaxEntries = fMaxEntries == 0 ? (UInt32) kMinEntries : fMaxEntries * 2;
+    if (theMaxEntries > kMaxEntries)
+      theMaxEntries = kMaxEntries;
+
+    auto *theEntries = new Entry[theMaxEntries];
+    if (fNumEntries > 0)
+      ::memcpy(theEntries, fEntries, sizeof(Entry) * fNumEntries);
+    delete[] fEntries;
+    fEntries = theEntries;
+    fMaxEntries = theMaxEntries;
+  }
+
+  Entry &theEntry = fEntries[fNumEntries++];
+  theEntry.fBuffer = inBuffer;
+  theEntry.fPacketID = inPacketID;
+  theEntry.fTimeArrived = inTimeArrived;
+  fNumBytes += inBuffer->GetLen();
+  return true;
+}
+
+void ReflectorGOPCache::ReleaseEntries() {
+  for (UInt32 i = 0; i < fNumEntries; i++)
+    fEntries[i].fBuffer->Release();
+  fNumEntries = 0;
+  fNumBytes = 0;
+}
@@ -0,0 +1,191 @@
+/*
+    File:       ReflectorOutputWheel.cpp
+
+    Contains:   Implementation of class defined in ReflectorOutputWheel.h
+*/
+
+#include <string.h>
+
+#include "ReflectorOutputWheel.h"
+
+ReflectorOutputWheel::ReflectorOutputWheel()
+    : fEntries(nullptr),
+      fMaxEntries(0),
+      fNumEntries(0),
+      fFreeEntries(kNoEntry),
+      fCurrentTick(0) {
+  for (UInt32 i = 0; i < kNumSlots; i++) {
+    fLevel0[i] = kNoEntry;
+    fLevel1[i] = kNoEntry;
+  }
+}
+
+ReflectorOutputWheel::~ReflectorOutputWheel() {
+  delete[] fEntries;
+}
+
+void ReflectorOutputWheel::Schedule(ReflectorOutput *inOutput, UInt32 inBucketIndex, UInt32 inMemberIndex,
+                                    SInt64 inDueTime) {
+  SInt32 theEntry = this->AllocateEntry();
+  fEntries[theEntry].fOutput = inOutput;
+  fEntries[theEntry].fBucketIndex = inBucketIndex;
+  fEntries[theEntry].fMemberIndex = inMemberIndex;
+  fEntries[theEntry].fDueTime = inDueTime;
+  this->Insert(theEntry);
+}
+
+void ReflectorOutputWheel::Clear() {
+  if (fNumEntries == 0)
+    return;
+
+  for (UInt32 i = 0; i < kNumSlots; i++) {
+    fLevel0[i] = kNoEntry;
+    fLevel1[i] = kNoEntry;
+  }
+
+  // every entry goes back to the free list
+  fFreeEntries = kNoEntry;
+  for (UInt32 i = fMaxEntries; i > 0; i--) {
+    fEntries[i - 1].fNext = fFreeEntries;
+    fFreeEntries = (SInt32) (i - 1);
+  }
+  fNumEntries = 0;
+}
+
+/**
+ * 放入到期时间所在的槽：本轮的放入第 0 层，之后 kNumSlots 轮内的放入第 1 层，更远的放入第 1 层最后一个槽，
+ * 在转入第 0 层时重新放置
+ */
+void ReflectorOutputWheel::Insert(SInt32 inEntry) {
+  Entry &theEntry = fEntries[inEntry];
+  SInt64 theDueTick = theEntry.fDueTime / kTickMSecs;
+  if (theDueTick < fCurrentTick)
+    theDueTick = fCurrentTick; // already due
+
+  SInt64 theCurrentTurn = fCurrentTick / kNumSlots;
+  SInt64 theDueTurn = theDueTick / kNumSlots;
+
+  SInt32 *theSlot;
+  if (theDueTurn == theCurrentTurn)
+    theSlot = &fLevel0[theDueTick % kNumSlots];
+  else if (theDueTurn - theCurrentTurn < kNumSlots)
+    theSlot = &fLevel1[theDueTurn % kNumSlots];
+  else
+    theSlot = &fLevel1[(theCurrentTurn + kNumSlots - 1) % kNumSlots];
+
+  theEntry.fNext = *theSlot;
+  *theSlot = inEntry;
+}
+
+/**
+ * 将时间轮推进到 inCurrentTime，摘下到期的条目
+ *
+ * @return the chain of the expired entries
+ */
+SInt32 ReflectorOutputWheel::CollectExpired(SInt64 inCurrentTime) {
+  SInt64 theNowTick = inCurrentTime / kTickMSecs;
+  if (fNumEntries == 0 || theNowTick < fCurrentTick) {
+    if (theNowTick > fCurrentTick)
+      fCurrentTick = theNowTick;
+    return kNoEntry;
+  }
+
+  SInt32 thePending = kNoEntry;
+
+  if (theNowTick - fCurrentTick >= kNumSlots) {
+    // a long sleep: take everything out, due entries expire and the rest are placed again
+    for (UInt32 i = 0; i < kNumSlots; i++) {
+      this->TakeSlot(&fLevel0[i], &thePending);
+      this->TakeSlot(&fLevel1[i], &thePending);
+    }
+  } else {
+    for (SInt64 theTick = fCurrentTick; theTick <= theNowTick; theTick++) {
+      // entering a new level 0 turn, cascade its level 1 slot
+      if (theTick % kNumSlots == 0 && theTick != fCurrentTick)
+        this->TakeSlot(&fLevel1[(theTick / kNumSlots) % kNumSlots], &thePending);
+
+      this->TakeSlot(&fLevel0[theTick % kNumSlots], &thePending);
+    }
+  }
+
+  // the current tick stays pending, entries due later in it are placed back into its slot
+  fCurrentTick = theNowTick;
+
+  SInt32 theExpired = kNoEntry;
+  while (thePending != kNoEntry) {
+    SInt32 theEntry = thePending;
+    thePending = fEntries[theEntry].fNext;
+
+    if (fEntries[theEntry].fDueTime <= inCurrentTime) {
+      fEntries[theEntry].fNext = theExpired;
+      theExpired = theEntry;
+    } else {
+      this->Insert(theEntry);
+    }
+  }
+
+  return theExpired;
+}
+
+void ReflectorOutputWheel::TakeSlot(SInt32 *ioSlot, SInt32 *ioChain) {
+  while (*ioSlot != kNoEntry) {
+    SInt32 theEntry = *ioSlot;
+    *ioSlot = fEntries[theEntry].fNext;
+    fEntries[theEntry].fNext = *ioChain;
+    *ioChain = theEntry;
+  }
+}
+
+SInt64 ReflectorOutputWheel::GetNextDueTime() {
+  if (fNumEntries == 0)
+    return 0;
+
+  SInt64 theDueTime = 0;
+
+  // the rest of the current level 0 turn, then the level 1 turns in order
+  for (SInt64 theTick = fCurrentTick; theTick / kNumSlots == fCurrentTick / kNumSlots && theDueTime == 0; theTick++) {
+    for (SInt32 theEntry = fLevel0[theTick % kNumSlots]; theEntry != kNoEntry; theEntry = fEntries[theEntry].fNext) {
+      if (theDueTime == 0 || fEntries[theEntry].fDueTime < theDueTime)
+        theDueTime = fEntries[theEntry].fDueTime;
+    }
+  }
+
+  for (UInt32 i = 1; i <= kNumSlots && theDueTime == 0; i++) {
+    SInt64 theTurn = fCurrentTick / kNumSlots + i;
+    for (SInt32 theEntry = fLevel1[theTurn % kNumSlots]; theEntry != kNoEntry; theEntry = fEntries[theEntry].fNext) {
+      if (theDueTime == 0 || fEntries[theEntry].fDueTime < theDueTime)
+        theDueTime = fEntries[theEntry].fDueTime;
+    }
+  }
+
+  return theDueTime;
+}
+
+SInt32 ReflectorOutputWheel::AllocateEntry() {
+  if (fFreeEntries == kNoEntry) {
+    UInt32 theMaxEntries = fMaxEntries == 0 ? (UInt32) kMinEntries : fMaxEntries * 2;
+
+    auto *theEntries = new Entry[theMaxEntries];
+    if (fMaxEntries > 0)
+      ::memcpy(theEntries, fEntries, sizeof(Entry) * fMaxEntries);
+    delete[] fEntries;
+    fEntries = theEntries;
+
+    for (UInt32 i = theMaxEntries; i > fMaxEntries; i--) {
+      fEntries[i - 1].fNext = fFreeEntries;
+      fFreeEntries = (SInt32) (i - 1);
+    }
+    fMaxEntries = theMaxEntries;
+  }
+
+  SInt32 theEntry = fFreeEntries;
+  fFreeEntries = fEntries[theEntry].fNext;
+  fNumEntries++;
+  return theEntry;
+}
+
+void ReflectorOutputWheel::FreeEntry(SInt32 inEntry) {
+  fEntries[inEntry].fNext = fFreeEntries;
+  fFreeEntries = inEntry;
+  fNumEntries--;
+}
@@ -31,11 +31,17 @@
 #include <CF/Net/Socket/SocketUtils.h>
 
 #include "ReflectorStream.h"
-#include "H264Packet.h"
 #include "QTSSModuleUtils.h"
 #include "RTCPPacket.h"
 #include "ReflectorSession.h"
 
+#if __linux__
+#include <sys/socket.h>
+#define REFLECTOR_USE_RECVMMSG 1
+#else
+#define REFLECTOR_USE_RECVMMSG 0
+#endif
+
 #ifndef DEBUG_REFLECTOR_STREAM
 #define DEBUG_REFLECTOR_STREAM 0
 #else
@@ -58,6 +64,16 @@ static UInt32 sDefaultBucketDelayInMsec = 73;
 static bool sDefaultUsePacketReceiveTime = false;
 static UInt32 sDefaultMaxFuturePacketTimeSec = 60;
 static UInt32 sDefaultFirstPacketOffsetMsec = 500;
+static UInt32 sDefaultRecvBatchSize = 32;
+static bool sDefaultBatchUDPSend = true;
+static bool sDefaultBatchTCPSend = true;
+static UInt32 sDefaultPacketRingSize = 16384;
+static bool sDefaultGOPCacheEnabled = true;
+static UInt32 sDefaultGOPCacheMaxKBytes = 2048;
+static bool sDefaultRecordAnnexB = false;
+static char sDefaultRecordDir[] = ".";
+static UInt32 sDefaultNumOutputPartitions = 4;
+static UInt32 sDefaultPartitionMinOutputs = 256;
 
 UInt32 ReflectorStream::sBucketSize = 16;
 UInt32 ReflectorStream::sOverBufferInMsec = 10000; // more or less what the client over buffer will be
@@ -72,6 +88,17 @@ UInt32 ReflectorStream::sFirstPacketOffsetMsec = 500;
 
 UInt32 ReflectorStream::sRelocatePacketAgeMSec = 1000;
 
+UInt32 ReflectorStream::sRecvBatchSize = 32; // datagrams per recvmmsg, 1 or less reads one packet per RecvFrom
+bool   ReflectorStream::sBatchUDPSend = true;  // queue UDP writes of a ReflectPackets pass and send them with sendmmsg
+bool   ReflectorStream::sBatchTCPSend = true;  // queue interleaved writes of a pass per RTSP session and send them with one writev
+UInt32 ReflectorStream::sPacketRingSize = 16384; // packets buffered per sender, the oldest packet is evicted when it is full
+bool   ReflectorStream::sGOPCacheEnabled = true;  // burst the last GOP of a video stream to new outputs
+UInt32 ReflectorStream::sGOPCacheMaxKBytes = 2048; // a bigger GOP is not cached
+bool   ReflectorStream::sRecordAnnexB = false; // record H.264 streams to <reflector_record_dir>/<stream>_<track>.264
+char  *ReflectorStream::sRecordDir = nullptr;
+UInt32 ReflectorStream::sNumOutputPartitions = 4;  // task threads the outputs of a big stream are split across, 1 or less disables
+UInt32 ReflectorStream::sPartitionMinOutputs = 256; // outputs a stream needs before it is partitioned
+
 void ReflectorStream::Register() {
   // Add text messages attributes
   static const char *sCantBindReflectorSocket = "QTSSReflectorModuleCantBindReflectorSocket";
@@ -106,6 +133,48 @@ void ReflectorStream::Initialize(QTSS_ModulePrefsObject inPrefs) {
                                 &ReflectorStream::sFirstPacketOffsetMsec, &sDefaultFirstPacketOffsetMsec,
                                 sizeof(sDefaultFirstPacketOffsetMsec));
 
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_recv_batch_size", qtssAttrDataTypeUInt32,
+                                &ReflectorStream::sRecvBatchSize, &sDefaultRecvBatchSize,
+                                sizeof(sDefaultRecvBatchSize));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_batch_udp_send", qtssAttrDataTypeBool16,
+                                &ReflectorStream::sBatchUDPSend, &sDefaultBatchUDPSend,
+                                sizeof(sDefaultBatchUDPSend));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_batch_tcp_send", qtssAttrDataTypeBool16,
+                                &ReflectorStream::sBatchTCPSend, &sDefaultBatchTCPSend,
+                                sizeof(sDefaultBatchTCPSend));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_packet_ring_size", qtssAttrDataTypeUInt32,
+                                &ReflectorStream::sPacketRingSize, &sDefaultPacketRingSize,
+                                sizeof(sDefaultPacketRingSize));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_gop_cache", qtssAttrDataTypeBool16,
+                                &ReflectorStream::sGOPCacheEnabled, &sDefaultGOPCacheEnabled,
+                                sizeof(sDefaultGOPCacheEnabled));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_gop_cache_max_kbytes", qtssAttrDataTypeUInt32,
+                                &ReflectorStream::sGOPCacheMaxKBytes, &sDefaultGOPCacheMaxKBytes,
+                                sizeof(sDefaultGOPCacheMaxKBytes));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_record_annexb", qtssAttrDataTypeBool16,
+                                &ReflectorStream::sRecordAnnexB, &sDefaultRecordAnnexB,
+                                sizeof(sDefaultRecordAnnexB));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_output_partitions", qtssAttrDataTypeUInt32,
+                                &ReflectorStream::sNumOutputPartitions, &sDefaultNumOutputPartitions,
+                                sizeof(sDefaultNumOutputPartitions));
+
+  QTSSModuleUtils::GetAttribute(inPrefs, "reflector_partition_min_outputs", qtssAttrDataTypeUInt32,
+                                &ReflectorStream::sPartitionMinOutputs, &sDefaultPartitionMinOutputs,
+                                sizeof(sDefaultPartitionMinOutputs));
+
+  if (ReflectorStream::sNumOutputPartitions > kMaxNumPartitions)
+    ReflectorStream::sNumOutputPartitions = kMaxNumPartitions;
+
+  delete[] ReflectorStream::sRecordDir;
+  ReflectorStream::sRecordDir = QTSSModuleUtils::GetStringAttribute(inPrefs, "reflector_record_dir", sDefaultRecordDir);
+
   ReflectorStream::sOverBufferInMsec = sOverBufferInSec * 1000;
   ReflectorStream::sMaxFuturePacketMSec = sMaxFuturePacketSec * 1000;
   ReflectorStream::sMaxPacketAgeMSec = (UInt32) (sOverBufferInMsec * 10); // allow a little time before deleting.
@@ -120,15 +189,17 @@ void ReflectorStream::GenerateSourceID(SourceInfo::StreamInfo *inInfo, char *ioB
 }
 
 ReflectorStream::ReflectorStream(SourceInfo::StreamInfo *inInfo)
-    : fPacketCount(0),
-      fSockets(nullptr),
+    : fSockets(nullptr),
       fRTPSender(nullptr, qtssWriteFlagsIsRTP),
       fRTCPSender(nullptr, qtssWriteFlagsIsRTCP),
       fOutputArray(nullptr),
       fStreamFormat(kStreamFormatUnknown),
+      fKeyFrameDetector(nullptr),
       fNumBuckets(kMinNumBuckets),
       fNumElements(0),
       fBucketMutex(),
+      fPartitions(nullptr),
+      fNumPartitions(0),
 
       fDestRTCPAddr(0),
       fDestRTCPPort(0),
@@ -146,7 +217,9 @@ ReflectorStream::ReflectorStream(SourceInfo::StreamInfo *inInfo)
       fFirst_RTCP_RTP_Time(0),
       fFirst_RTCP_Arrival_Time(0),
       fTransportType(qtssRTPTransportTypeTCP),
-      fMyReflectorSession(NULL) {
+      fMyReflectorSession(NULL),
+      fGOPCache(sGOPCacheMaxKBytes * 1024),
+      fRecorder(nullptr) {
 
   // 构造函数初始化列表中不能引用this指针
   fRTPSender.fStream = this;
@@ -275,8 +348,6 @@ ReflectorStream::ReflectorStream(SourceInfo::StreamInfo *inInfo)
     fDestRTCPAddr = fStreamInfo.fDestIPAddr;
     fDestRTCPPort = static_cast<UInt16>(fStreamInfo.fPort + 1);
   }
-
-  pkeyFrameCache = new CKeyFrameCache(MAX_CACHE_SIZE);
 }
 
 ReflectorStream::~ReflectorStream() {
@@ -302,12 +373,17 @@ ReflectorStream::~ReflectorStream() {
       sSocketPool.DestructUDPSocketPair(fSockets);
   }
 
-  // 释放关键帧缓冲区
-  if (pkeyFrameCache) {
-    delete pkeyFrameCache;
-    pkeyFrameCache = nullptr;
+  // 录制文件由录制线程写完后关闭
+  if (fRecorder != nullptr) {
+    fRecorder->Close();
+    fRecorder = nullptr;
   }
 
+  // 分区 Task 可能正在分发，等它结束后再释放
+  for (UInt32 x = 0; x < fNumPartitions; x++)
+    fPartitions[x]->Detach();
+  delete[] fPartitions;
+
   //delete every client Bucket
   for (UInt32 y = 0; y < fNumBuckets; y++)
     delete[] fOutputArray[y];
@@ -315,6 +391,10 @@ ReflectorStream::~ReflectorStream() {
 }
 
 void ReflectorStream::AllocateBucketArray(UInt32 inNumBuckets) {
+  // the partitions walk the array without fBucketMutex
+  for (UInt32 x = 0; x < fNumPartitions; x++)
+    fPartitions[x]->GetMutex()->Lock();
+
   Bucket *oldArray = fOutputArray;
   // allocate the 2-dimensional array
   fOutputArray = new Bucket[inNumBuckets];
@@ -333,6 +413,9 @@ void ReflectorStream::AllocateBucketArray(UInt32 inNumBuckets) {
     delete[] oldArray;
   }
   fNumBuckets = inNumBuckets;
+
+  for (UInt32 x = fNumPartitions; x > 0; x--)
+    fPartitions[x - 1]->GetMutex()->Unlock();
 }
 
 SInt32 ReflectorStream::FindBucket() {
@@ -372,6 +455,9 @@ SInt32 ReflectorStream::AddOutput(ReflectorOutput *inOutput, SInt32 putInThisBuc
   if (fNumBuckets <= (UInt32) putInThisBucket)
     this->AllocateBucketArray(putInThisBucket * 2);
 
+  ReflectorPartition *thePartition = this->GetPartition((UInt32) putInThisBucket);
+  Core::MutexLocker partitionLocker(thePartition != nullptr ? thePartition->GetMutex() : nullptr);
+
   for (UInt32 y = 0; y < sBucketSize; y++) {
     if (fOutputArray[putInThisBucket][y] == nullptr) {
       fOutputArray[putInThisBucket][y] = inOutput;
@@ -381,6 +467,18 @@ SInt32 ReflectorStream::AddOutput(ReflectorOutput *inOutput, SInt32 putInThisBuc
                 inOutput, this, putInThisBucket, y, fNumBuckets, sBucketSize);
 
       fNumElements++;
+
+      // the partition reads from the first packet for new outputs in its next pass, RemoveOldPackets
+      // runs under fBucketMutex and can't pop it before
+      if (thePartition != nullptr) {
+        thePartition->PinSeq(&fRTPSender, fRTPSender.GetFirstPacketSeqForNewOutput());
+        thePartition->PinSeq(&fRTCPSender, fRTCPSender.GetFirstPacketSeqForNewOutput());
+      }
+
+      // a big audience: from now on the buckets are reflected by the partitions
+      if (fNumPartitions == 0 && fEnableBuffer && sNumOutputPartitions > 1 && fNumElements >= sPartitionMinOutputs)
+        this->CreatePartitions();
+
       return putInThisBucket;
     }
   }
@@ -397,6 +495,9 @@ void ReflectorStream::RemoveOutput(ReflectorOutput *inOutput) {
     for (UInt32 y = 0; y < sBucketSize; y++) {
       //The array may have blank spaces!
       if (fOutputArray[x][y] == inOutput) {
+        // the output may be deleted when we return, wait until its partition is done with it
+        ReflectorPartition *thePartition = this->GetPartition(x);
+        Core::MutexLocker partitionLocker(thePartition != nullptr ? thePartition->GetMutex() : nullptr);
         fOutputArray[x][y] = nullptr;//just clear out the pointer
 
         DEBUG_LOG(DEBUG_REFLECTOR_STREAM,
@@ -431,6 +532,65 @@ void ReflectorStream::TearDownAllOutputs() {
   }
 }
 
+void ReflectorStream::LockOutputs() {
+  fBucketMutex.Lock();
+  for (UInt32 x = 0; x < fNumPartitions; x++)
+    fPartitions[x]->GetMutex()->Lock();
+}
+
+void ReflectorStream::UnlockOutputs() {
+  for (UInt32 x = fNumPartitions; x > 0; x--)
+    fPartitions[x - 1]->GetMutex()->Unlock();
+  fBucketMutex.Unlock();
+}
+
+/**
+ * 创建输出分区，调用者持有 fBucketMutex，此时 ReflectPackets 不在运行
+ */
+void ReflectorStream::CreatePartitions() {
+  UInt32 theNumPartitions = sNumOutputPartitions;
+  auto **thePartitions = new ReflectorPartition *[theNumPartitions];
+  for (UInt32 x = 0; x < theNumPartitions; x++) {
+    thePartitions[x] = new ReflectorPartition(this, x);
+
+    // the bookmarks of the existing outputs were pinned by fNeededByOutput,
+    // keep the packets until the partition has published its own lowest seq
+    thePartitions[x]->SetLowestSeq(&fRTPSender, fRTPSender.fPacketRing.GetHeadSeq());
+    thePartitions[x]->SetLowestSeq(&fRTCPSender, fRTCPSender.fPacketRing.GetHeadSeq());
+  }
+
+  fPartitions = thePartitions;
+  fNumPartitions = theNumPartitions;
+
+  // the partitions schedule the blocked outputs again in their first full pass
+  fRTPSender.fBlockedOutputs.Clear();
+  fRTCPSender.fBlockedOutputs.Clear();
+
+  DEBUG_LOG(DEBUG_REFLECTOR_STREAM,
+            "ReflectorStream(%p) reflects %" _U32BITARG_ " outputs with %" _U32BITARG_ " partitions\n",
+            this, fNumElements, fNumPartitions);
+}
+
+UInt64 ReflectorStream::GetPartitionsLowestSeq(ReflectorSender *inSender) {
+  UInt64 theLowestSeq = 0;
+  for (UInt32 x = 0; x < fNumPartitions; x++) {
+    UInt64 theSeq = fPartitions[x]->GetLowestSeq(inSender);
+    if (theSeq != 0 && (theLowestSeq == 0 || theSeq < theLowestSeq))
+      theLowestSeq = theSeq;
+  }
+  return theLowestSeq;
+}
+
+UInt64 ReflectorStream::GetPartitionsPassEpoch(ReflectorSender *inSender) {
+  UInt64 theOldestEpoch = 0;
+  for (UInt32 x = 0; x < fNumPartitions; x++) {
+    UInt64 theEpoch = fPartitions[x]->GetPassEpoch(inSender);
+    if (theEpoch != 0 && (theOldestEpoch == 0 || theEpoch < theOldestEpoch))
+      theOldestEpoch = theEpoch;
+  }
+  return theOldestEpoch;
+}
+
 QTSS_Error ReflectorStream::
 BindSockets(QTSS_StandardRTSP_Params *inParams, UInt32 inReflectorSessionFlags, bool filterState, UInt32 timeout) {
   // If the incoming data is RTSP interleaved, we don't need to do anything here
@@ -544,6 +704,30 @@ BindSockets(QTSS_StandardRTSP_Params *inParams, UInt32 inReflectorSessionFlags,
   return QTSS_NoErr;
 }
 
+/**
+ * 录制文件名为 <reflector_record_dir>/<stream name>_<track id>.264
+ */
+void ReflectorStream::CreateRecorder() {
+  char theName[256];
+  StrPtrLen *theStreamName = fMyReflectorSession != nullptr ? fMyReflectorSession->GetStreamName() : nullptr;
+  if (theStreamName != nullptr && theStreamName->Len > 0) {
+    UInt32 theLen = theStreamName->Len < 128 ? theStreamName->Len : 128;
+    ::memcpy(theName, theStreamName->Ptr, theLen);
+    theName[theLen] = '\0';
+    for (UInt32 i = 0; i < theLen; i++) {
+      if (theName[i] == '/' || theName[i] == '\\' || theName[i] == ':')
+        theName[i] = '_';
+    }
+  } else {
+    ::snprintf(theName, sizeof(theName), "stream_%p", this);
+  }
+
+  char thePath[512];
+  ::snprintf(thePath, sizeof(thePath), "%s/%s_%" _U32BITARG_ ".264",
+             sRecordDir != nullptr ? sRecordDir : sDefaultRecordDir, theName, fStreamInfo.fTrackID);
+  fRecorder = AnnexBRecorder::Create(thePath);
+}
+
 /**
  * 检测流的负载格式
  */
@@ -551,9 +735,14 @@ void ReflectorStream::DetectStreamFormat() {
   if (fStreamInfo.fPayloadType == qtssVideoPayloadType) {
     if (fStreamInfo.fPayloadName.Equal("H264/90000")) {  // h.264 payload 固定为 H264/90000
       fStreamFormat = kStreamFormatVideoH264;
+    } else if (fStreamInfo.fPayloadName.Equal("H265/90000")) {  // rfc7798
+      fStreamFormat = kStreamFormatVideoH265;
+    } else if (fStreamInfo.fPayloadName.Equal("AV1/90000")) {
+      fStreamFormat = kStreamFormatVideoAV1;
     } else {
       fStreamFormat = kStreamFormatVideo;
     }
+    fKeyFrameDetector = KeyFrameDetector::Find(fStreamInfo.fPayloadName);
   } else if (fStreamInfo.fPayloadType == qtssAudioPayloadType) {
     fStreamFormat = kStreamFormatAudio;
   }
@@ -581,7 +770,15 @@ void ReflectorStream::SendReceiverReport() {
  * 将 Packet 转发给相应的 ReflectorSocket 进行处理
  */
 void ReflectorStream::PushPacket(char *packet, UInt32 packetLen, bool isRTCP) {
-  if (packetLen <= 0) return;
+  StrPtrLen thePacket(packet, packetLen);
+  this->PushPackets(&thePacket, 1, isRTCP);
+}
+
+/**
+ * 将同一个 socket 的一批 Packet 转发给相应的 ReflectorSocket，整批只加一次锁、唤醒一次
+ */
+void ReflectorStream::PushPackets(StrPtrLen *inPackets, UInt32 inNumPackets, bool isRTCP) {
+  if (inNumPackets == 0) return;
 
   ReflectorSocket *theSocket;
   if (isRTCP) {
@@ -590,27 +787,42 @@ void ReflectorStream::PushPacket(char *packet, UInt32 packetLen, bool isRTCP) {
     theSocket = (ReflectorSocket *) fSockets->GetSocketA();
   }
 
-  //s_printf("ReflectorStream::PushPacket %s packetlen = %"   _U32BITARG_   "\n", isRTCP ? "RTCP" : "RTP", packetLen);
-  ReflectorPacket *thePacket = theSocket->GetPacket();
-  if (thePacket == nullptr) {
-    //s_printf("ReflectorStream::PushPacket %s GetPacket() is NULL\n", isRTCP ? "RTCP" : "RTP");
-    return;
+  //s_printf("ReflectorStream::PushPackets %s numPackets = %"   _U32BITARG_   "\n", isRTCP ? "RTCP" : "RTP", inNumPackets);
+  bool hasPackets = false;
+  {
+    Core::MutexLocker locker(theSocket->GetDemuxer()->GetMutex());
+    SInt64 theMilliseconds = Core::Time::Milliseconds();
+    for (UInt32 i = 0; i < inNumPackets; i++) {
+      if (inPackets[i].Len == 0) continue;
+
+      ReflectorPacket *thePacket = theSocket->GetPacket();
+      if (thePacket == nullptr) {
+        //s_printf("ReflectorStream::PushPackets %s GetPacket() is NULL\n", isRTCP ? "RTCP" : "RTP");
+        break;
+      }
+
+      thePacket->SetPacketData(inPackets[i].Ptr, inPackets[i].Len, isRTCP);
+      theSocket->ProcessPacket(theMilliseconds, thePacket, 0, 0);
+      hasPackets = true;
+    }
   }
 
-  Core::MutexLocker locker(theSocket->GetDemuxer()->GetMutex());
-  thePacket->SetPacketData(packet, packetLen, isRTCP);
-  theSocket->ProcessPacket(Core::Time::Milliseconds(), thePacket, 0, 0);
-  theSocket->Signal(Thread::Task::kIdleEvent);
+  if (hasPackets)
+    theSocket->Signal(Thread::Task::kIdleEvent);
 }
 
 ReflectorSender::ReflectorSender(ReflectorStream *inStream, UInt32 inWriteFlag)
     : fStream(inStream),
       fWriteFlag(inWriteFlag),
-      fFirstNewPacketInQueue(nullptr),
-      fFirstPacketInQueueForNewOutput(nullptr),
-      fKeyFrameStartPacketElementPointer(nullptr),
+      fPacketRing(ReflectorStream::sPacketRingSize),
+      fFirstNewPacketSeq(0),
+      fKeyFrameStartPacketSeq(0),
+      fNumEvictedPackets(0),
+      fRetiredPackets(),
+      fTrimEpoch(1),
       fHasNewPackets(false),
       fNextTimeToRun(0),
+      fLastFullPassTime(0),
       fLastRRTime(0),
       fSocketQueueElem() {
   fSocketQueueElem.SetEnclosingObject(this);
@@ -618,10 +830,10 @@ ReflectorSender::ReflectorSender(ReflectorStream *inStream, UInt32 inWriteFlag)
 
 ReflectorSender::~ReflectorSender() {
   // dequeue and delete every buffer
-  while (fPacketQueue.GetLength() > 0) {
-    auto *packet = (ReflectorPacket *) fPacketQueue.DeQueue()->GetEnclosingObject();
+  while (ReflectorPacket *packet = fPacketRing.Pop())
     delete packet;
-  }
+  while (fRetiredPackets.GetLength() > 0)
+    delete (ReflectorPacket *) fRetiredPackets.DeQueue()->GetEnclosingObject();
 }
 
 /**
@@ -648,11 +860,8 @@ UInt32 ReflectorSender::GetOldestPacketRTPTime(bool *foundPtr) {
   if (foundPtr != nullptr)
     *foundPtr = false;
   Core::MutexLocker locker(&fStream->fBucketMutex);
-  QueueElem *packetElem = this->GetClientBufferStartPacket();
-  if (packetElem == nullptr)
-    return 0;
-
-  auto thePacket = (ReflectorPacket *) packetElem->GetEnclosingObject();
+  UInt64 packetSeq = this->GetClientBufferStartPacket();
+  ReflectorPacket *thePacket = fPacketRing.Peek(packetSeq);
   if (thePacket == nullptr)
     return 0;
 
@@ -668,12 +877,9 @@ UInt16 ReflectorSender::GetFirstPacketRTPSeqNum(bool *foundPtr) {
 
   UInt16 resultSeqNum = 0;
   Core::MutexLocker locker(&fStream->fBucketMutex);
-  QueueElem *packetElem = this->GetClientBufferStartPacket();
+  UInt64 packetSeq = this->GetClientBufferStartPacket();
 
-  if (packetElem == nullptr)
-    return 0;
-
-  auto *thePacket = (ReflectorPacket *) packetElem->GetEnclosingObject();
+  ReflectorPacket *thePacket = fPacketRing.Peek(packetSeq);
   if (thePacket == nullptr)
     return 0;
 
@@ -685,51 +891,39 @@ UInt16 ReflectorSender::GetFirstPacketRTPSeqNum(bool *foundPtr) {
   return resultSeqNum;
 }
 
-QueueElem *ReflectorSender::GetClientBufferNextPacketTime(UInt32 inRTPTime) {
-
-  QueueIter qIter(&fPacketQueue);// start at oldest packet in q
-  QueueElem *requestedPacket = nullptr;
-  QueueElem *elem = nullptr;
-
-  while (!qIter.IsDone()) { // start at oldest packet in q
-    elem = qIter.GetCurrent();
-
-    if (requestedPacket == nullptr)
-      requestedPacket = elem;
-
-    if (requestedPacket == nullptr)
-      break;
+/**
+ * 查找第一个 RTP 时间晚于 inRTPTime 的包，RTP 时间不保证有序，只能顺序查找
+ *
+ * @return the oldest packet if none is later, 0 if the ring is empty
+ */
+UInt64 ReflectorSender::GetClientBufferNextPacketTime(UInt32 inRTPTime) {
+  UInt64 theHead = fPacketRing.GetHeadSeq();
+  UInt64 theTail = fPacketRing.GetTailSeq();
+  if (theHead == theTail)
+    return 0;
 
-    auto *thePacket = (ReflectorPacket *) elem->GetEnclosingObject();
-    Assert(thePacket);
+  for (UInt64 seq = theHead; seq < theTail; seq++) { // start at oldest packet in ring
+    ReflectorPacket *thePacket = fPacketRing.Peek(seq);
+    if (thePacket == nullptr) // evicted meanwhile
+      continue;
 
-    if (thePacket->GetPacketRTPTime() > inRTPTime) {
-      requestedPacket = elem; // return the first packet we have that has a later time
-      break; // found the packet we need: done processing
-    }
-    qIter.Next();
+    if (thePacket->GetPacketRTPTime() > inRTPTime)
+      return seq; // return the first packet we have that has a later time
   }
 
-  return requestedPacket;
+  return theHead;
 }
 
 bool ReflectorSender::GetFirstRTPTimePacket(UInt16 *outSeqNumPtr, UInt32 *outRTPTimePtr, SInt64 *outArrivalTimePtr) {
   Core::MutexLocker locker(&fStream->fBucketMutex);
-  QueueElem *packetElem =
-      this->GetClientBufferStartPacketOffset(ReflectorStream::sFirstPacketOffsetMsec);
-
-  if (packetElem == nullptr)
-    return false;
+  UInt64 packetSeq = this->GetClientBufferStartPacketOffset(ReflectorStream::sFirstPacketOffsetMsec);
 
-  auto *thePacket = (ReflectorPacket *) packetElem->GetEnclosingObject();
+  ReflectorPacket *thePacket = fPacketRing.Peek(packetSeq);
   if (thePacket == nullptr)
     return false;
 
-  packetElem = GetClientBufferNextPacketTime(thePacket->GetPacketRTPTime());
-  if (packetElem == nullptr)
-    return false;
-
-  thePacket = (ReflectorPacket *) packetElem->GetEnclosingObject();
+  packetSeq = GetClientBufferNextPacketTime(thePacket->GetPacketRTPTime());
+  thePacket = fPacketRing.Peek(packetSeq);
   if (thePacket == nullptr)
     return false;
 
@@ -747,12 +941,18 @@ bool ReflectorSender::GetFirstRTPTimePacket(UInt16 *outSeqNumPtr, UInt32 *outRTP
 
 bool ReflectorSender::GetFirstPacketInfo(UInt16 *outSeqNumPtr, UInt32 *outRTPTimePtr, SInt64 *outArrivalTimePtr) {
   Core::MutexLocker locker(&fStream->fBucketMutex);
-  QueueElem *packetElem = this->GetClientBufferStartPacketOffset(ReflectorStream::sFirstPacketOffsetMsec);
-
-  if (packetElem == NULL) return false;
+  UInt64 packetSeq = this->GetClientBufferStartPacketOffset(ReflectorStream::sFirstPacketOffsetMsec);
+
+  // 新 Output 会先收到 GOP 缓存，RTP-Info 要从缓存的第一个包算起
+  if (fWriteFlag == qtssWriteFlagsIsRTP && ReflectorStream::sGOPCacheEnabled) {
+    Core::MutexLocker cacheLocker(fStream->fGOPCache.GetMutex());
+    UInt64 cacheFirstSeq = fStream->fGOPCache.GetFirstPacketID();
+    if (fPacketRing.IsValid(cacheFirstSeq) && (packetSeq == 0 || cacheFirstSeq < packetSeq))
+      packetSeq = cacheFirstSeq;
+  }
 
-  auto *thePacket = (ReflectorPacket *) packetElem->GetEnclosingObject();
-  if (thePacket == NULL) return false;
+  ReflectorPacket *thePacket = fPacketRing.Peek(packetSeq);
+  if (thePacket == nullptr) return false;
 
   if (outSeqNumPtr) *outSeqNumPtr = thePacket->GetPacketRTPSeqNum();
   if (outRTPTimePtr) *outRTPTimePtr = thePacket->GetPacketRTPTime();
@@ -765,12 +965,7 @@ bool ReflectorSender::GetFirstPacketInfo(UInt16 *outSeqNumPtr, UInt32 *outRTPTim
 
 #if DEBUG_REFLECTOR_STREAM
 static UInt16 DGetPacketSeqNumber(StrPtrLen *inPacket) {
-  if (inPacket->Len < 4)
-    return 0;
-
-  //The RTP seq number is the second short of the packet
-  auto *seqNumPtr = (UInt16 *) inPacket->Ptr;
-  return ntohs(seqNumPtr[1]);
+  return RTPPacketView(inPacket->Ptr, inPacket->Len).GetSeqNumber();
 }
 
 #endif
@@ -798,7 +993,7 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
     fStream->SendReceiverReport();
 #if DEBUG_REFLECTOR_STREAM > 2
     printQueueLenOnExit = true;
-    printf("fPacketQueue len %li\n", (SInt32)fPacketQueue.GetLength());
+    printf("fPacketRing len %li\n", (SInt32)fPacketRing.GetLength());
 #endif
   }
 
@@ -826,40 +1021,16 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
       ReflectorOutput *theOutput = fStream->fOutputArray[bucketIndex][bucketMemberIndex];
 
       if (theOutput != NULL) {
-        SInt32 availBookmarksPosition = -1;    // -1 == invalid position
-        QueueElem *packetElem = NULL;
-        UInt32 curBookmark = 0;
-
-        Assert(curBookmark < theOutput->fNumBookmarks);
-
         // see if we've bookmarked a held packet for this Sender in this Output
-        while (curBookmark < theOutput->fNumBookmarks) {
-          QueueElem *bookmarkedElem = theOutput->fBookmarkedPacketsElemsArray[curBookmark];
-
-          if (bookmarkedElem) {   // there may be holes in this array
-            if (bookmarkedElem->IsMember(fPacketQueue)) {
-              // this packet was previously bookmarked for this specific queue
-              // remove if from the bookmark list and use it
-              // to jump ahead into the Sender's over all packet queue
-              theOutput->fBookmarkedPacketsElemsArray[curBookmark] = NULL;
-              availBookmarksPosition = curBookmark;
-              packetElem = bookmarkedElem;
-              break;
-            }
-
-          } else {
-            availBookmarksPosition = curBookmark;
-          }
-
-          curBookmark++;
+        UInt64 packetSeq = theOutput->GetBookMarkedPacket(&fPacketRing);
+        if (!fPacketRing.IsValid(packetSeq))
+          packetSeq = 0;
 
-        }
-
-        Assert(availBookmarksPosition != -1);
+        Assert(theOutput->fAvailPosition != -1);
 
 #if DEBUG_REFLECTOR_STREAM > 1
-        if (packetElem)	{ // show 'em what we got johnny
-            ReflectorPacket* 	thePacket = (ReflectorPacket*)packetElem->GetEnclosingObject();
+        if (packetSeq != 0)	{ // show 'em what we got johnny
+            ReflectorPacket* 	thePacket = fPacketRing.Get(packetSeq);
             printf("Bookmarked packet time: %li, packetSeq %i\n", (SInt32)thePacket->fTimeArrived, DGetPacketSeqNumber(&thePacket->fPacketPtr));
         }
 #endif
@@ -868,12 +1039,12 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
         // so show it the first new packet we have in this sender.
         // ( since TCP flow control may delay the sending of packets, this may not
         // be the same as the first packet in the queue
-        if (packetElem == NULL) {
-          packetElem = fFirstNewPacketInQueue;
+        if (packetSeq == 0) {
+          packetSeq = fFirstNewPacketSeq;
 
 #if DEBUG_REFLECTOR_STREAM > 1
-          if (packetElem) { // show 'em what we got johnny
-              ReflectorPacket* 	thePacket = (ReflectorPacket*)packetElem->GetEnclosingObject();
+          if (fPacketRing.IsValid(packetSeq)) { // show 'em what we got johnny
+              ReflectorPacket* 	thePacket = fPacketRing.Get(packetSeq);
               printf("1st new packet from Sender sess 0x%lx time: %li, packetSeq %i\n", (SInt32)theOutput, (SInt32)thePacket->fTimeArrived, DGetPacketSeqNumber(&thePacket->fPacketPtr));
           } else {
               printf("no new packets\n");
@@ -881,14 +1052,17 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
 #endif
         }
 
-        QueueIter qIter(&fPacketQueue, packetElem);  // starts from beginning if packetElem == NULL, else from packetElem
+        // starts from the oldest packet if there is no valid start
+        if (!fPacketRing.IsValid(packetSeq))
+          packetSeq = fPacketRing.GetHeadSeq();
 
         bool dodBookmarkPacket = false;
+        UInt64 theTail = fPacketRing.GetTailSeq();
 
-        while (!qIter.IsDone()) {
-          packetElem = qIter.GetCurrent();
-
-          ReflectorPacket *thePacket = (ReflectorPacket *) packetElem->GetEnclosingObject();
+        for (; packetSeq < theTail; packetSeq++) {
+          ReflectorPacket *thePacket = fPacketRing.Peek(packetSeq);
+          if (thePacket == nullptr) // evicted by ProcessPacket, the rest may be too
+            break;
           QTSS_Error err = QTSS_NoErr;
 
 #if DEBUG_REFLECTOR_STREAM > 2
@@ -906,7 +1080,8 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
 #endif
 
             SInt64 timeToSendPacket = -1;
-            err = theOutput->WritePacket(&thePacket->fPacketPtr, fStream, fWriteFlag, packetLateness, &timeToSendPacket, NULL, NULL, false);
+            err = theOutput->WritePacket(&thePacket->fPacketPtr, fStream, fWriteFlag, packetLateness, &timeToSendPacket, NULL, NULL, false,
+                                         thePacket->GetBuffer());
 
             if (err == QTSS_WouldBlock) {
 #if DEBUG_REFLECTOR_STREAM > 2
@@ -915,9 +1090,8 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
               // tag it and bookmark it
               thePacket->fNeededByOutput = true;
 
-              Assert(availBookmarksPosition != -1);
-              if (availBookmarksPosition != -1)
-                theOutput->fBookmarkedPacketsElemsArray[availBookmarksPosition] = packetElem;
+              Assert(theOutput->fAvailPosition != -1);
+              (void) theOutput->SetBookMarkPacket(&fPacketRing, packetSeq);
 
               dodBookmarkPacket = true;
 
@@ -933,8 +1107,6 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
               break;
             thePacket->fNeededByOutput = true;
           }
-
-          qIter.Next();
         }
 
       }
@@ -942,30 +1114,21 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
   }
 
   // reset our first new packet bookmark
-  fFirstNewPacketInQueue = nullptr;
-
-  // iterate one more through the senders queue to clear out
-  // the unneeded packets
-  QueueIter removeIter(&fPacketQueue);
-  while (!removeIter.IsDone()) {
-    QueueElem *elem = removeIter.GetCurrent();
-    Assert(elem);
-
-    //at this point, move onto the next queue element, because we may be altering
-    //the queue itself in the code below
-    removeIter.Next();
-
-    auto *thePacket = (ReflectorPacket *) elem->GetEnclosingObject();
-    Assert(thePacket);
-
-    if (!thePacket->fNeededByOutput) {
-      thePacket->fNeededByOutput = true;
-      fPacketQueue.Remove(elem);
-      inFreeQueue->EnQueue(elem);
-    } else {   // reset for next call to ReflectPackets
-      thePacket->fNeededByOutput = false;
-    }
+  fFirstNewPacketSeq = 0;
+
+  // iterate one more through the senders ring to clear out the unneeded packets.
+  // the ring can only shrink from the oldest end, so stop at the first needed packet
+  Core::MutexLocker trimLocker(&fTrimMutex);
+  while (!fPacketRing.IsEmpty() && !fPacketRing.Get(fPacketRing.GetHeadSeq())->fNeededByOutput) {
+    ReflectorPacket *thePacket = fPacketRing.Pop();
+    thePacket->Reset();
+    inFreeQueue->EnQueue(&thePacket->fQueueElem);
   }
+  this->FreeRetiredPackets(inFreeQueue); // evicted by ProcessPacket
+
+  // reset for next call to ReflectPackets
+  for (UInt64 seq = fPacketRing.GetHeadSeq(), theTail = fPacketRing.GetTailSeq(); seq < theTail; seq++)
+    fPacketRing.Get(seq)->fNeededByOutput = false;
 
   //Don't forget that the caller also wants to know when we next want to run
   if (*ioWakeupTime == 0)
@@ -977,7 +1140,7 @@ void ReflectorSender::ReflectRelayPackets(SInt64 *ioWakeupTime, Queue *inFreeQue
 
 #if DEBUG_REFLECTOR_STREAM > 2
   if (printQueueLenOnExit)
-      printf("EXIT fPacketQueue len %li\n", (SInt32)fPacketQueue.GetLength());
+      printf("EXIT fPacketRing len %li\n", (SInt32)fPacketRing.GetLength());
 #endif
 }
 
@@ -1009,15 +1172,10 @@ void ReflectorSender::ReflectPackets(SInt64 *ioWakeupTime, Queue *inFreeQueue) {
 
   SInt64 currentTime = Core::Time::Milliseconds();
 
-  // make sure to reset these state variables
-  fHasNewPackets = false;
-
-  // we set fWriteFlag in ReflectorStream constructor:
-  //   fRTPSender: qtssWriteFlagsIsRTP, fRTCPSender: qtssWriteFlagsIsRTCP
-  if (fWriteFlag == qtssWriteFlagsIsRTCP)
-    fNextTimeToRun = 999;  // in fact, it is 1000
-  else
-    fNextTimeToRun = 1000; // init to 1 secs
+  // new packets have to be shown to every output. without them, only the blocked outputs that are due
+  // are polled, with a full pass now and then for the outputs that have just started playing
+  // make sure to reset these state variables, a packet arriving from now on runs us again
+  bool isFullPass = fHasNewPackets.exchange(false) || (currentTime - fLastFullPassTime >= kFullPassInterval);
 
   // determine if we need to send a receiver report to the multicast source
   if ((fWriteFlag == qtssWriteFlagsIsRTCP) && (currentTime > (fLastRRTime + kRRInterval))) {
@@ -1032,279 +1190,542 @@ void ReflectorSender::ReflectPackets(SInt64 *ioWakeupTime, Queue *inFreeQueue) {
   // Check to see if we should update the session's bit-rate average
   fStream->UpdateBitRate(currentTime);
 
-  // 视频数据流，最好直接定位到第一个关键帧起始包这样出视频的时间会更快一些
-  if (fKeyFrameStartPacketElementPointer) {
-    fFirstPacketInQueueForNewOutput = fKeyFrameStartPacketElementPointer;
+  if (fStream->fNumPartitions > 0) {
+    // the partitions reflect the new packets on their own task threads and retry
+    // their blocked outputs on their own timers, only the ring is maintained here
+    if (isFullPass) {
+      for (UInt32 x = 0; x < fStream->fNumPartitions; x++)
+        fStream->fPartitions[x]->NotifyNewPackets();
+    }
   } else {
-    // where to start new clients in the q
-    fFirstPacketInQueueForNewOutput = this->GetClientBufferStartPacketOffset(0);
+    if (isFullPass) {
+      fBlockedOutputs.Clear(); // the outputs still blocked are scheduled again
+      this->ReflectBuckets(nullptr, currentTime, &fBlockedOutputs);
+    } else {
+      this->ReflectBlockedOutputs(nullptr, currentTime, &fBlockedOutputs);
+    }
+
+    // 本轮以 qtssWriteFlagsBatchUDP/qtssWriteFlagsBatchTCP 写出的数据必须在 RemoveOldPackets 释放包之前发送，
+    // 持有 fBucketMutex 期间 Output 不会被移除，其 RTSP 会话也就不会被释放
+    if (ReflectorStream::sBatchUDPSend || ReflectorStream::sBatchTCPSend)
+      QTSS_FlushWriteBatch();
+  }
+
+  if (isFullPass) {
+    this->RemoveOldPackets(inFreeQueue);
+    fFirstNewPacketSeq = 0;
+    fLastFullPassTime = currentTime;
   }
 
-#if (0) //test code 
-  if (NULL != fFirstPacketInQueueForNewOutput)
-      printf("ReflectorSender::ReflectPackets SET first packet fFirstPacketInQueueForNewOutput %d \n", DGetPacketSeqNumber(&((ReflectorPacket*)(fFirstPacketInQueueForNewOutput->GetEnclosingObject()))->fPacketPtr));
+  // the next full pass, or the first blocked output that is due
+  fNextTimeToRun = fLastFullPassTime + kFullPassInterval - currentTime;
+  SInt64 theDueTime = fBlockedOutputs.GetNextDueTime();
+  if (theDueTime != 0 && theDueTime - currentTime < fNextTimeToRun)
+    fNextTimeToRun = theDueTime > currentTime ? theDueTime - currentTime : 1;
+
+  // Don't forget that the caller also wants to know when we next want to run
+  // ReflectorSocket::Run 根据 *ioWakeupTime 来决定 idleTimer 的值。
+  if (*ioWakeupTime == 0)
+    *ioWakeupTime = fNextTimeToRun;
+  else if ((fNextTimeToRun > 0) && (*ioWakeupTime > fNextTimeToRun))
+    *ioWakeupTime = fNextTimeToRun;
+
+  // exit with fNextTimeToRun in real time, not relative time.
+  fNextTimeToRun += currentTime;
+
+  // s_printf("SetNextTimeToRun fNextTimeToRun=%qd + currentTime=%qd\n", fNextTimeToRun, currentTime);
+  // s_printf("ReflectorSender::ReflectPackets *ioWakeupTime = %qd\n", *ioWakeupTime);
+}
 
-  ReflectorPacket* thePacket = NULL;
-  if (fFirstPacketInQueueForNewOutput != NULL)
-      thePacket = (ReflectorPacket*)fFirstPacketInQueueForNewOutput->GetEnclosingObject();
-  if (thePacket == NULL) {
-      printf("fFirstPacketInQueueForNewOutput is NULL \n");
+/**
+ * 新 Output 的起始包
+ */
+UInt64 ReflectorSender::GetFirstPacketSeqForNewOutput() {
+  // 视频数据流，最好直接定位到第一个关键帧起始包这样出视频的时间会更快一些
+  UInt64 firstPacketSeqForNewOutput = fKeyFrameStartPacketSeq;
+  if (!fPacketRing.IsValid(firstPacketSeqForNewOutput)) {
+    // where to start new clients in the q
+    firstPacketSeqForNewOutput = this->GetClientBufferStartPacketOffset(0);
   }
+
+#if (0) //test code
+  if (fPacketRing.IsValid(firstPacketSeqForNewOutput))
+      printf("ReflectorSender::GetFirstPacketSeqForNewOutput SET first packet %d \n", DGetPacketSeqNumber(&fPacketRing.Get(firstPacketSeqForNewOutput)->fPacketPtr));
+  else
+      printf("firstPacketSeqForNewOutput is invalid \n");
 #endif
 
-  bool firstPacket;
+  return firstPacketSeqForNewOutput;
+}
+
+/**
+ * 把包环中的新包分发给一组桶中的 Output
+ *
+ * @param inPartition  walk the buckets of this partition, and publish its lowest bookmark;
+ *                     nullptr walks every bucket and pins the bookmarked packets with fNeededByOutput
+ * @param inBlockedOutputs  where the outputs that block are scheduled for a retry
+ */
+void ReflectorSender::ReflectBuckets(ReflectorPartition *inPartition, SInt64 currentTime,
+                                     ReflectorOutputWheel *inBlockedOutputs) {
+  UInt64 firstPacketSeqForNewOutput = this->GetFirstPacketSeqForNewOutput();
+
+  UInt32 firstBucket = 0;
+  UInt32 bucketStride = 1;
+  if (inPartition != nullptr) {
+    firstBucket = inPartition->GetIndex();
+    bucketStride = fStream->fNumPartitions;
+  }
+
+  UInt64 lowestSeq = 0;
 
   // 我们在 QTSSReflectorModule::DoSetup 里面看到, 对于一个 ReflectorSession 的每一个
   // ReflectorStream, 都调用了 AddOutput 添加了一个 RTPSessionOutput 对象。
   // 在开启 n 个窗口同时播放同一个 sdp 文件的情况下, 会有 n 个 theOutput 对应 n 个 RTPStream,
   // 依次通过这 n 个 theOutput 发送 RTP 数据。
-  for (UInt32 bucketIndex = 0; bucketIndex < fStream->fNumBuckets; bucketIndex++) {
+  for (UInt32 bucketIndex = firstBucket; bucketIndex < fStream->fNumBuckets; bucketIndex += bucketStride) {
     for (UInt32 bucketMemberIndex = 0; bucketMemberIndex < ReflectorStream::sBucketSize; bucketMemberIndex++) {
       ReflectorOutput *theOutput = fStream->fOutputArray[bucketIndex][bucketMemberIndex];
       if (theOutput == nullptr || !theOutput->IsPlaying()) continue;
 
-      {
-        Core::MutexLocker locker2(&theOutput->fMutex);
-
-        // 返回既在 fBookmarkedPacketsElemsArray 数组，同时属于 fPacketQueue 的成员
-        QueueElem *packetElem = theOutput->GetBookMarkedPacket(&fPacketQueue);
-        if (packetElem == nullptr) { // should only be a new output
-          // everybody starts at the oldest packet in the buffer delay or uses a bookmark
-          packetElem = fFirstPacketInQueueForNewOutput;
-          firstPacket = true;
-          theOutput->setNewFlag(false); // how use?
-        } else {
-          firstPacket = false;
-        }
+      UInt64 bookmarkSeq = this->ReflectOutput(theOutput, bucketIndex, bucketMemberIndex, firstPacketSeqForNewOutput,
+                                               inPartition != nullptr, currentTime, inBlockedOutputs);
+      if (bookmarkSeq != 0 && (lowestSeq == 0 || bookmarkSeq < lowestSeq))
+        lowestSeq = bookmarkSeq;
+    }
+  }
 
-        // sBucketDelayInMsec 对应于配置文件中的 reflector_bucket_offset_delay_msec, 缺省值为 73.
-        SInt64 bucketDelay = ReflectorStream::sBucketDelayInMsec * (SInt64) bucketIndex;
-        packetElem = this->SendPacketsToOutput(theOutput, packetElem, currentTime, bucketDelay, firstPacket);
-        if (packetElem) { // 理论上不为 NULL
-          QueueElem *newElem = NeedRelocateBookMark(packetElem);
+  // published to RemoveOldPackets
+  if (inPartition != nullptr)
+    inPartition->SetLowestSeq(this, lowestSeq);
+}
 
-          auto *thePacket = (ReflectorPacket *) newElem->GetEnclosingObject();
-          thePacket->fNeededByOutput = true;               // flag to prevent removal in RemoveOldPackets
-          (void) theOutput->SetBookMarkPacket(newElem);    // store a reference to the packet
-        }
+/**
+ * 只重试到期的阻塞 Output
+ *
+ * A partition keeps the lowest seq of its last full pass, bookmarks only move forward.
+ */
+void ReflectorSender::ReflectBlockedOutputs(ReflectorPartition *inPartition, SInt64 currentTime,
+                                            ReflectorOutputWheel *inBlockedOutputs) {
+  if (inBlockedOutputs->IsEmpty())
+    return;
+
+  UInt64 firstPacketSeqForNewOutput = this->GetFirstPacketSeqForNewOutput();
+
+  inBlockedOutputs->Expire(currentTime, [&](const ReflectorOutputWheel::Entry &inEntry) {
+    // the output may have been removed since it was scheduled
+    if (inEntry.fBucketIndex >= fStream->fNumBuckets ||
+        fStream->fOutputArray[inEntry.fBucketIndex][inEntry.fMemberIndex] != inEntry.fOutput ||
+        !inEntry.fOutput->IsPlaying())
+      return;
+
+    (void) this->ReflectOutput(inEntry.fOutput, inEntry.fBucketIndex, inEntry.fMemberIndex,
+                               firstPacketSeqForNewOutput, inPartition != nullptr, currentTime, inBlockedOutputs);
+  });
+}
+
+UInt64 ReflectorSender::ReflectOutput(ReflectorOutput *theOutput, UInt32 bucketIndex, UInt32 bucketMemberIndex,
+                                      UInt64 firstPacketSeqForNewOutput, bool isPartitioned, SInt64 currentTime,
+                                      ReflectorOutputWheel *inBlockedOutputs) {
+  Core::MutexLocker locker(&theOutput->fMutex);
+
+  bool firstPacket;
+  SInt64 retryTime = 0;
+
+  // 书签是该 Output 在本 Sender 包环中的序号，已被清理的序号视为无书签
+  UInt64 packetSeq = theOutput->GetBookMarkedPacket(&fPacketRing);
+  if (!fPacketRing.IsValid(packetSeq)) { // should only be a new output
+    // everybody starts at the oldest packet in the buffer delay or uses a bookmark
+    packetSeq = firstPacketSeqForNewOutput;
+
+    // 分区与收流线程的清理并发进行，不能从可能正在被清理的最老的包开始，等新包到达
+    if (isPartitioned && !fPacketRing.IsValid(packetSeq))
+      return 0;
+
+    firstPacket = true;
+    theOutput->setNewFlag(false); // how use?
+
+    // 视频流先把 GOP 缓存整体发给新 Output，再从缓存末尾的包接着走正常流程
+    if (fWriteFlag == qtssWriteFlagsIsRTP && ReflectorStream::sGOPCacheEnabled) {
+      bool isBlocked = false;
+      UInt64 lastPacketID = this->SendGOPCacheToOutput(theOutput, currentTime, &isBlocked, &retryTime);
+      if (isBlocked) {
+        // no bookmark, the burst is retried
+        inBlockedOutputs->Schedule(theOutput, bucketIndex, bucketMemberIndex, retryTime);
+        return 0;
+      }
+
+      if (fPacketRing.IsValid(lastPacketID)) {
+        packetSeq = lastPacketID;
+        firstPacket = false;
       }
     }
+  } else {
+    firstPacket = false;
   }
 
-  this->RemoveOldPackets(inFreeQueue);
-  fFirstNewPacketInQueue = nullptr;
+  // sBucketDelayInMsec 对应于配置文件中的 reflector_bucket_offset_delay_msec, 缺省值为 73.
+  SInt64 bucketDelay = ReflectorStream::sBucketDelayInMsec * (SInt64) bucketIndex;
+  packetSeq = this->SendPacketsToOutput(theOutput, packetSeq, currentTime, bucketDelay, firstPacket, &retryTime);
+  if (retryTime != 0)
+    inBlockedOutputs->Schedule(theOutput, bucketIndex, bucketMemberIndex, retryTime);
 
-  // Don't forget that the caller also wants to know when we next want to run
-  // ReflectorSocket::Run 根据 *ioWakeupTime 来决定 idleTimer 的值。
-  if (*ioWakeupTime == 0)
-    *ioWakeupTime = fNextTimeToRun;
-  else if ((fNextTimeToRun > 0) && (*ioWakeupTime > fNextTimeToRun))
-    *ioWakeupTime = fNextTimeToRun;
+  if (!fPacketRing.IsValid(packetSeq)) // 理论上有效，除非已被挤出包环(见 EvictOldestPacket)
+    return 0;
 
-  // exit with fNextTimeToRun in real time, not relative time.
-  fNextTimeToRun += currentTime;
+  UInt64 newSeq = NeedRelocateBookMark(packetSeq);
+  if (!isPartitioned) {
+    ReflectorPacket *thePacket = fPacketRing.Peek(newSeq);
+    if (thePacket == nullptr) // evicted
+      return 0;
+    thePacket->fNeededByOutput = true; // flag to prevent removal in RemoveOldPackets
+  }
 
-  // s_printf("SetNextTimeToRun fNextTimeToRun=%qd + currentTime=%qd\n", fNextTimeToRun, currentTime);
-  // s_printf("ReflectorSender::ReflectPackets *ioWakeupTime = %qd\n", *ioWakeupTime);
+  (void) theOutput->SetBookMarkPacket(&fPacketRing, newSeq); // store the seq of the packet
+  return newSeq;
 }
 
 /**
  * 将 Packet 序列写入 ReflectorOutput，直到队列为空或阻塞
+ *
+ * @param currentSeq  the first packet to send, the oldest packet if it is not valid
+ * @param outRetryTime  set to the time the output should be retried at if it blocked, unchanged otherwise
+ * @return the seq of the packet that blocked, or of the last packet in the ring; 0 if the ring is empty
+ *         or the packets were evicted while they were sent
  */
-QueueElem *ReflectorSender::SendPacketsToOutput(ReflectorOutput *theOutput, QueueElem *currentPacket,
-                                                SInt64 currentTime, SInt64 bucketDelay, bool firstPacket) {
-  QueueElem *lastPacket = currentPacket;
-  QueueIter qIter(&fPacketQueue, currentPacket); // starts from beginning if currentPacket == NULL, else from currentPacket
+UInt64 ReflectorSender::SendPacketsToOutput(ReflectorOutput *theOutput, UInt64 currentSeq, SInt64 currentTime,
+                                            SInt64 bucketDelay, bool firstPacket, SInt64 *outRetryTime) {
+  if (!fPacketRing.IsValid(currentSeq))
+    currentSeq = fPacketRing.GetHeadSeq(); // starts from beginning if currentSeq is not in the ring
+
+  UInt64 lastSeq = 0;
+  UInt64 theTail = fPacketRing.GetTailSeq();
 
   UInt32 count = 0;
   QTSS_Error err = QTSS_NoErr;
-  while (!qIter.IsDone()) {
-    currentPacket = qIter.GetCurrent();
-    lastPacket = currentPacket;
 
-    auto *thePacket = (ReflectorPacket *) currentPacket->GetEnclosingObject();
+  // UDP 数据报先放入本线程的发送批次，interleaved 包放入各 RTSP 会话的发送队列，由 ReflectPackets 在遍历完所有 Output 后统一发送
+  UInt32 theWriteFlags = fWriteFlag;
+  if (ReflectorStream::sBatchUDPSend)
+    theWriteFlags |= qtssWriteFlagsBatchUDP;
+  if (ReflectorStream::sBatchTCPSend)
+    theWriteFlags |= qtssWriteFlagsBatchTCP;
+
+  for (; currentSeq < theTail; currentSeq++) {
+    lastSeq = currentSeq;
+
+    ReflectorPacket *thePacket = fPacketRing.Peek(currentSeq);
+    if (thePacket == nullptr) { // evicted under us, the output starts again like a new one
+      lastSeq = 0;
+      break;
+    }
     SInt64 packetLateness = bucketDelay;
     SInt64 timeToSendPacket = -1;
 
     //printf("packetLateness %qd, seq# %li\n", packetLateness, (SInt32) DGetPacketSeqNumber( &thePacket->fPacketPtr ) );
 
     // 实际上是调用 RTPSessionOutput::WritePacket
-    err = theOutput->WritePacket(&thePacket->fPacketPtr, fStream, fWriteFlag, packetLateness, &timeToSendPacket,
-                                 &thePacket->fStreamCountID, &thePacket->fTimeArrived, firstPacket);
+    err = theOutput->WritePacket(&thePacket->fPacketPtr, fStream, theWriteFlags, packetLateness, &timeToSendPacket,
+                                 &thePacket->fStreamCountID, &thePacket->fTimeArrived, firstPacket, thePacket->GetBuffer());
 
     if (err == QTSS_WouldBlock) { // call us again in # ms to retry on an EAGAIN
+      *outRetryTime = this->GetBlockedOutputRetryTime(theOutput, currentTime, timeToSendPacket);
+      break;
+    }
 
-      if ((timeToSendPacket > 0) && ((fNextTimeToRun + currentTime) > timeToSendPacket)) // blocked but we are scheduled to wake up later
-        fNextTimeToRun = timeToSendPacket - currentTime;
-
-      if (theOutput->fLastIntervalMilliSec < 5)
-        theOutput->fLastIntervalMilliSec = 5;
-
-      if (timeToSendPacket < 0) { // blocked and we are behind
-        //s_printf("fNextTimeToRun = theOutput->fLastIntervalMilliSec=%qd;\n", theOutput->fLastIntervalMilliSec); // Use the last packet interval
-        this->SetNextTimeToRun(theOutput->fLastIntervalMilliSec);
-      }
+    count++;
+  }
 
-      if (fNextTimeToRun > 100) { // don't wait that long
-        //s_printf("fNextTimeToRun = %qd now 100;\n", fNextTimeToRun);
-        this->SetNextTimeToRun(100);
-      }
+  // 如果 WritePacket 返回为 QTSS_WouldBlock, 则 lastSeq 为阻塞的包
+  return lastSeq;
+}
 
-      if (fNextTimeToRun < 5) { // wait longer
-        //s_printf("fNextTimeToRun = 5;\n");
-        this->SetNextTimeToRun(5);
-      }
+/**
+ * 将 GOP 缓存一次性写入新加入的 ReflectorOutput，不做分桶延时
+ *
+ * @param outBlocked set if the output blocked before the end of the cache
+ * @param outRetryTime  set to the time the output should be retried at if it blocked
+ * @return the id of the last cached packet, 0 if the cache is empty or blocked
+ */
+UInt64 ReflectorSender::SendGOPCacheToOutput(ReflectorOutput *theOutput, SInt64 currentTime, bool *outBlocked,
+                                             SInt64 *outRetryTime) {
+  ReflectorGOPCache *theCache = &fStream->fGOPCache;
+
+  *outBlocked = false;
+
+  // 复制缓存的条目(持有缓冲区的引用)后即释放锁，收流线程 Put 时不必等慢的 output 写完
+  ReflectorGOPCache::Entry *theEntries = NULL;
+  UInt32 theNumEntries = 0;
+  {
+    Core::MutexLocker locker(theCache->GetMutex());
+    if (!theCache->IsValid())
+      return 0;
+
+    theNumEntries = theCache->GetNumEntries();
+    theEntries = new ReflectorGOPCache::Entry[theNumEntries];
+    for (UInt32 index = 0; index < theNumEntries; index++) {
+      theEntries[index] = *theCache->GetEntry(index);
+      theEntries[index].fBuffer->Retain();
+    }
+  }
 
-      if (theOutput->fLastIntervalMilliSec >= 100) // allow up to 1 second max -- allow some time for the socket to clear and don't go into a tight loop if the client is gone.
-        theOutput->fLastIntervalMilliSec = 100;
-      else
-        theOutput->fLastIntervalMilliSec *= 2; // scale upwards over time
+  UInt32 theWriteFlags = fWriteFlag;
+  if (ReflectorStream::sBatchUDPSend)
+    theWriteFlags |= qtssWriteFlagsBatchUDP;
+  if (ReflectorStream::sBatchTCPSend)
+    theWriteFlags |= qtssWriteFlagsBatchTCP;
 
-      //s_printf ( "Blocked ReflectorSender::SendPacketsToOutput timeToSendPacket=%qd fLastIntervalMilliSec=%qd fNextTimeToRun=%qd \n", timeToSendPacket, theOutput->fLastIntervalMilliSec, fNextTimeToRun);
+  UInt64 lastPacketID = 0;
+  for (UInt32 index = 0; index < theNumEntries; index++) {
+    ReflectorGOPCache::Entry *theEntry = &theEntries[index];
+    StrPtrLen thePacket(theEntry->fBuffer->GetData(), theEntry->fBuffer->GetLen());
+    SInt64 timeToSendPacket = -1;
 
+    // packets sent by an earlier, blocked burst are skipped by id
+    QTSS_Error err = theOutput->WritePacket(&thePacket, fStream, theWriteFlags, 0, &timeToSendPacket,
+                                            &theEntry->fPacketID, &theEntry->fTimeArrived, true, theEntry->fBuffer);
+    if (err == QTSS_WouldBlock) {
+      *outRetryTime = this->GetBlockedOutputRetryTime(theOutput, currentTime, timeToSendPacket);
+      *outBlocked = true;
+      lastPacketID = 0;
       break;
     }
 
-    count++;
-    qIter.Next();
+    lastPacketID = theEntry->fPacketID;
   }
 
-  // 如果 WritePacket 返回为 QTSS_WouldBlock,则 lastPacket 不为空。
-  return lastPacket;
+  for (UInt32 index = 0; index < theNumEntries; index++)
+    theEntries[index].fBuffer->Release();
+  delete[] theEntries;
+
+  return lastPacketID;
+}
+
+/**
+ * Output 阻塞时，计算它下一次重试的时间
+ *
+ * The delay is the time the output asked for, or its last interval doubled (from 5 up to 100 ms)
+ * when it is behind; it only applies to this output.
+ *
+ * @return the absolute retry time
+ */
+SInt64 ReflectorSender::GetBlockedOutputRetryTime(ReflectorOutput *theOutput, SInt64 currentTime,
+                                                  SInt64 timeToSendPacket) {
+  if (theOutput->fLastIntervalMilliSec < 5)
+    theOutput->fLastIntervalMilliSec = 5;
+
+  SInt64 retryDelay;
+  if (timeToSendPacket > 0) // blocked, the output knows when it can send again
+    retryDelay = timeToSendPacket - currentTime;
+  else // blocked and we are behind, use the last packet interval
+    retryDelay = theOutput->fLastIntervalMilliSec;
+
+  if (retryDelay > 100) // don't wait that long
+    retryDelay = 100;
+
+  if (retryDelay < 5) // wait longer
+    retryDelay = 5;
+
+  if (theOutput->fLastIntervalMilliSec >= 100) // allow up to 1 second max -- allow some time for the socket to clear and don't go into a tight loop if the client is gone.
+    theOutput->fLastIntervalMilliSec = 100;
+  else
+    theOutput->fLastIntervalMilliSec *= 2; // scale upwards over time
+
+  //s_printf ( "Blocked ReflectorSender::SendPacketsToOutput timeToSendPacket=%qd fLastIntervalMilliSec=%qd retryDelay=%qd \n", timeToSendPacket, theOutput->fLastIntervalMilliSec, retryDelay);
+  return currentTime + retryDelay;
 }
 
 /**
  * 查找处于缓存期内，最早到达的数据包
  *
+ * 包按到达顺序入环，本地到达时间单调不减，因此可以二分查找；reflector_use_packet_receive_time
+ * 打开时 fTimeArrived 取自推流端的时间戳(且被截断)，不再有序，只能顺序查找
+ *
  * @param offsetMsec 缓冲期缩短偏移
+ * @return 0 if no packet is in the client buffer time
  */
-QueueElem *ReflectorSender::GetClientBufferStartPacketOffset(SInt64 offsetMsec, bool needKeyFrameFirstPacket) {
-  QueueIter qIter(&fPacketQueue);// start at oldest packet in q
+UInt64 ReflectorSender::GetClientBufferStartPacketOffset(SInt64 offsetMsec, bool needKeyFrameFirstPacket) {
   SInt64 theCurrentTime = Core::Time::Milliseconds();
-  QueueElem *oldestPacketInClientBufferTime = nullptr;
 
   // 这里的 sOverBufferInSec 对应配置文件中的 reflector_buffer_size_sec*1000
   if (offsetMsec > ReflectorStream::sOverBufferInMsec)
     offsetMsec = ReflectorStream::sOverBufferInMsec;
 
-  while (!qIter.IsDone()) { // start at oldest packet in q
-    QueueElem *elem = qIter.GetCurrent();
-    Assert(elem);
-    qIter.Next();
-
-    auto *thePacket = (ReflectorPacket *) elem->GetEnclosingObject();
-    Assert(thePacket);
-
-    SInt64 packetDelay = theCurrentTime - thePacket->fTimeArrived;
-    if (packetDelay <= (ReflectorStream::sOverBufferInMsec - offsetMsec)) {
-      oldestPacketInClientBufferTime = &thePacket->fQueueElem;
-      break; // found the packet we need: done processing
+  SInt64 maxPacketDelay = ReflectorStream::sOverBufferInMsec - offsetMsec;
+  auto isInClientBufferTime = [&](ReflectorPacket *thePacket) {
+    return theCurrentTime - thePacket->fTimeArrived <= maxPacketDelay;
+  };
+
+  UInt64 theTail = fPacketRing.GetTailSeq();
+  UInt64 oldestPacketInClientBufferTime = theTail;
+  if (ReflectorStream::sUsePacketReceiveTime) {
+    for (UInt64 seq = fPacketRing.GetHeadSeq(); seq < theTail; seq++) {
+      ReflectorPacket *thePacket = fPacketRing.Peek(seq);
+      if (thePacket != nullptr && isInClientBufferTime(thePacket)) {
+        oldestPacketInClientBufferTime = seq;
+        break;
+      }
     }
+  } else {
+    oldestPacketInClientBufferTime = fPacketRing.LowerBound(fPacketRing.GetHeadSeq(), theTail, isInClientBufferTime);
   }
 
+  if (oldestPacketInClientBufferTime == theTail)
+    return 0;
+
   return oldestPacketInClientBufferTime;
 }
 
 /**
- * Iterate through the senders queue to clear out packets.
+ * Iterate through the senders ring to clear out packets.
  * Start at the oldest packet and walk forward to the newest packet
  */
 void ReflectorSender::RemoveOldPackets(Queue *inFreeQueue) {
-  QueueIter removeIter(&fPacketQueue);
+  Core::MutexLocker locker(&fTrimMutex);
   SInt64 theCurrentTime = Core::Time::Milliseconds();
 
   // sMaxPacketAgeMSec 对应于配置文件中 reflector_buffer_size_sec*10000, 缺省为 10s
   SInt64 currentMaxPacketDelay = ReflectorStream::sMaxPacketAgeMSec;
 
-  // walk q and remove packets that are too old
-  while (!removeIter.IsDone()) {
-    QueueElem *elem = removeIter.GetCurrent();
-    Assert(elem);
+  // the partitions don't flag packets, they publish the oldest one they still read
+  UInt64 theLowestSeq = fStream->GetPartitionsLowestSeq(this);
 
-    // at this point, move onto the next queue element, because we may be altering
-    // the queue itself in the code below
-    removeIter.Next();
+  // the ring can only shrink from the oldest end, so a packet pinned by a slow output holds back
+  // every packet after it. once the ring is that full, the pins don't keep a packet past its age:
+  // the output loses its bookmark and starts again like a new output
+  bool isUnderPressure = fPacketRing.GetLength() > fPacketRing.GetCapacity() / 4 * 3;
 
-    auto *thePacket = (ReflectorPacket *) elem->GetEnclosingObject();
-    Assert(thePacket);
-    //printf("ReflectorSender::RemoveOldPackets Packet %d in queue is %qd milliseconds old\n", DGetPacketSeqNumber( &thePacket->fPacketPtr ) ,theCurrentTime - thePacket->fTimeArrived);
+  // pop packets that are too old
+  while (!fPacketRing.IsEmpty()) {
+    UInt64 theHead = fPacketRing.GetHeadSeq();
+    ReflectorPacket *thePacket = fPacketRing.Get(theHead);
+    //printf("ReflectorSender::RemoveOldPackets Packet %d in ring is %qd milliseconds old\n", DGetPacketSeqNumber( &thePacket->fPacketPtr ) ,theCurrentTime - thePacket->fTimeArrived);
 
-    SInt64 packetDelay = theCurrentTime - thePacket->fTimeArrived;
+    if (theCurrentTime - thePacket->fTimeArrived <= currentMaxPacketDelay)
+      break;
 
     // delete based on late tolerance and whether a client is blocked on the packet
-    if (!thePacket->fNeededByOutput && packetDelay > currentMaxPacketDelay) {
-      // not needed and older than our required buffer
-      thePacket->Reset();
-      fPacketQueue.Remove(elem);
-      inFreeQueue->EnQueue(elem);
-    } else {
-      // we want to keep all of these but we should reset the ones that should be aged out unless marked
-      // as need the next time through reflect packets.
+    // 关键帧不能被清理(环将满时除外，新 Output 仍从 GOP 缓存开始)
+    if (!isUnderPressure &&
+        (thePacket->fNeededByOutput || theHead == fKeyFrameStartPacketSeq ||
+            (theLowestSeq != 0 && theHead >= theLowestSeq)))
+      break;
 
-      if (fKeyFrameStartPacketElementPointer) { // 关键帧不能被清理
-        auto *keyPacket = (ReflectorPacket *) (fKeyFrameStartPacketElementPointer->GetEnclosingObject());
-        if (keyPacket == thePacket) break;
-      }
+    // not needed and older than our required buffer
+    (void) fPacketRing.Pop();
+    this->RetirePacket(thePacket);
+  }
 
-      // 被 mark 的 packet 仅在本轮不会被清理，下一轮照常清理
-      thePacket->fNeededByOutput = false; // mark not needed.. will be set next time through reflect packets
+  this->FreeRetiredPackets(inFreeQueue);
 
-      // this packet is going to be kept around as well as the ones that follow.
-      if (packetDelay <= currentMaxPacketDelay) break;
-    }
+  // we want to keep all of these but we should reset the ones that should be aged out unless marked
+  // as need the next time through reflect packets.
+  for (UInt64 seq = fPacketRing.GetHeadSeq(), theTail = fPacketRing.GetTailSeq(); seq < theTail; seq++) {
+    if (seq == fKeyFrameStartPacketSeq) break;
+
+    ReflectorPacket *thePacket = fPacketRing.Get(seq);
+
+    // this packet is going to be kept around as well as the ones that follow.
+    if (theCurrentTime - thePacket->fTimeArrived <= currentMaxPacketDelay) break;
+
+    // 被 mark 的 packet 仅在本轮不会被清理，下一轮照常清理
+    thePacket->fNeededByOutput = false; // mark not needed.. will be set next time through reflect packets
+  }
+}
+
+/**
+ * 出环的包可能正被分区读取(书签校验之后、写出之前)，先记下当前的清理纪元再放入待回收队列
+ */
+void ReflectorSender::RetirePacket(ReflectorPacket *thePacket) {
+  thePacket->fRetiredEpoch = fTrimEpoch.load();
+  fRetiredPackets.EnQueue(&thePacket->fQueueElem);
+}
+
+/**
+ * 包环已满时由收流一方调用，与 RemoveOldPackets 以 fTrimMutex 互斥，最老的包不论是否被 Output 或关键帧锁定都出环，
+ * 书签失效的 Output 下一轮按新 Output 重新定位
+ */
+void ReflectorSender::EvictOldestPacket() {
+  Core::MutexLocker locker(&fTrimMutex);
+  ReflectorPacket *thePacket = fPacketRing.Pop();
+  if (thePacket == nullptr)
+    return;
+
+  fNumEvictedPackets++;
+  this->RetirePacket(thePacket); // freed by the next pass of ReflectPackets
+}
+
+/**
+ * 在某纪元出环的包，只可能被在该纪元或更早开始的分发读到。
+ * 没有这样的分发在运行时回收到 inFreeQueue，分区之外(未分区的流)立即回收
+ */
+void ReflectorSender::FreeRetiredPackets(Queue *inFreeQueue) {
+  if (fRetiredPackets.GetLength() == 0)
+    return;
+
+  // a pass that starts from now on sees the ring without the retired packets
+  UInt64 theRetiredEpoch = fTrimEpoch.fetch_add(1);
+  UInt64 theOldestPassEpoch = fStream->GetPartitionsPassEpoch(this);
+
+  while (fRetiredPackets.GetLength() > 0) {
+    auto *thePacket = (ReflectorPacket *) fRetiredPackets.GetTail()->GetEnclosingObject();
+    if (theOldestPassEpoch != 0 && thePacket->fRetiredEpoch >= theOldestPassEpoch)
+      break;
+
+    Assert(thePacket->fRetiredEpoch <= theRetiredEpoch);
+    (void) fRetiredPackets.DeQueue();
+    thePacket->Reset();
+    inFreeQueue->EnQueue(&thePacket->fQueueElem);
   }
 }
 
 /**
  * if current packet over max packetAgeTime, we need relocate the BookMark to
- * the new fKeyFrameStartPacketElementPointer
+ * the new fKeyFrameStartPacketSeq
  *
  * @note
  *   1. 判断当前 Packet 是否已经超过了最大缓冲周期时间(不判断音/视频、I/P帧)
- *   2. 当时间超过了阀值, 查找最新的 fKeyFrameStartPacketElementPointer
- *   3. 返回最新的 fKeyFrameStartPacketElementPointer 做为最新的 BookMark
+ *   2. 当时间超过了阀值, 查找最新的 fKeyFrameStartPacketSeq
+ *   3. 返回最新的 fKeyFrameStartPacketSeq 做为最新的 BookMark
  */
-QueueElem *ReflectorSender::NeedRelocateBookMark(QueueElem *elem) {
-  Assert(elem);
+UInt64 ReflectorSender::NeedRelocateBookMark(UInt64 currentSeq) {
   SInt64 theCurrentTime = Core::Time::Milliseconds();
   SInt64 packetDelay = 0;
   SInt64 currentMaxPacketDelay = ReflectorStream::sRelocatePacketAgeMSec;
 
-  auto *thePacket = (ReflectorPacket *) elem->GetEnclosingObject();
-  Assert(thePacket);
+  ReflectorPacket *thePacket = fPacketRing.Peek(currentSeq);
+  if (thePacket == nullptr) // evicted, nothing to relocate to
+    return currentSeq;
 
   packetDelay = theCurrentTime - thePacket->fTimeArrived;
   if (packetDelay > currentMaxPacketDelay) {
     // fStream->fStreamFormat == ReflectorStream::kStreamFormatVideoH264 && IsKeyFrameFirstPacket(thePacket)
-    if (fKeyFrameStartPacketElementPointer) {
-      auto *keyPacket = (ReflectorPacket *) (fKeyFrameStartPacketElementPointer->GetEnclosingObject());
-      if (keyPacket->fTimeArrived > thePacket->fTimeArrived) {
-//        this->fStream->GetMyReflectorSession()->SetHasVideoKeyFrameUpdate(true);
-        return fKeyFrameStartPacketElementPointer;
-      }
+    UInt64 keyFrameStartPacketSeq = fKeyFrameStartPacketSeq;
+    if (fPacketRing.IsValid(keyFrameStartPacketSeq) && keyFrameStartPacketSeq > currentSeq) {
+//      this->fStream->GetMyReflectorSession()->SetHasVideoKeyFrameUpdate(true);
+      return keyFrameStartPacketSeq;
     }
   }
 
-  return elem;
+  return currentSeq;
 }
 
-QueueElem *ReflectorSender:: GetNewestKeyFrameFirstPacket(QueueElem *currentElem, SInt64 offsetMsec) {
+UInt64 ReflectorSender::GetNewestKeyFrameFirstPacket(UInt64 currentSeq, SInt64 offsetMsec) {
   //printf("[geyijun] GetNewestKeyFrameFirstPacket---------------->1\n");
   SInt64 theCurrentTime = Core::Time::Milliseconds();
   SInt64 packetDelay = 0;
-  QueueElem *requestedPacket = nullptr;
-  QueueIter qIter(&fPacketQueue, currentElem);
-  while (!qIter.IsDone()) { // start at oldest packet in q
-    QueueElem *elem = qIter.GetCurrent();
-    Assert(elem);
-    qIter.Next();
+  UInt64 requestedPacket = 0;
+
+  if (!fPacketRing.IsValid(currentSeq))
+    currentSeq = fPacketRing.GetHeadSeq();
 
-    auto *thePacket = (ReflectorPacket *) elem->GetEnclosingObject();
-    if (thePacket == nullptr) break;
+  for (UInt64 theTail = fPacketRing.GetTailSeq(); currentSeq < theTail; currentSeq++) {
+    ReflectorPacket *thePacket = fPacketRing.Peek(currentSeq);
+    if (thePacket == nullptr)
+      continue;
 
     if (IsKeyFrameFirstPacket(thePacket)) {
-      requestedPacket = &thePacket->fQueueElem;
-      //printf("[geyijun]Maybe,GetNewestKeyFrameFirstPacket --->[%#x]\n",requestedPacket);
+      requestedPacket = currentSeq;
+      //printf("[geyijun]Maybe,GetNewestKeyFrameFirstPacket --->[%llu]\n",requestedPacket);
 
       //
       packetDelay = theCurrentTime - thePacket->fTimeArrived;
@@ -1315,73 +1736,126 @@ QueueElem *ReflectorSender:: GetNewestKeyFrameFirstPacket(QueueElem *currentElem
       }
     }
   }
-  if (requestedPacket == NULL) {
+  if (requestedPacket == 0) {
     printf("[geyijun]GetNewestKeyFrameFirstPacket --->[NotFound]\n");
   } else {
-    printf("[geyijun]Final,GetNewestKeyFrameFirstPacket --->[%#x]\n", requestedPacket);
+    printf("[geyijun]Final,GetNewestKeyFrameFirstPacket --->[%llu]\n", (unsigned long long) requestedPacket);
   }
   return requestedPacket;
 }
 
 
 /**
- * 判断当前RTP包是否为H.264 关键帧的第一个RTP包
- * 下面的写法可能不太严谨(仅针对H264 的情况，未考虑其他格式)
+ * 判断当前RTP包是否为视频关键帧(含参数集)的第一个RTP包
  */
 bool ReflectorSender::IsKeyFrameFirstPacket(ReflectorPacket *thePacket) {
+  return this->GetPacketKind(thePacket) != KeyFrameDetector::kFramePacket;
+}
+
+/**
+ * 用流的编码对应的 KeyFrameDetector 识别包的类型，分片包仅起始包有效
+ */
+KeyFrameDetector::PacketKind ReflectorSender::GetPacketKind(ReflectorPacket *thePacket) {
   Assert(thePacket);
-  if (thePacket == nullptr) return false;
-  if ((thePacket->fPacketPtr.Ptr != nullptr) && (thePacket->fPacketPtr.Len >= 20)) {
-    auto *rtpHeader = reinterpret_cast<RTPFixedHeader*>(thePacket->fPacketPtr.Ptr);
-    UInt32 rtpHeaderLen = sizeof(RTPFixedHeader) + rtpHeader->cc * sizeof(UInt32);
-    auto *nalHeader = reinterpret_cast<NALUHeader*>(&thePacket->fPacketPtr.Ptr[rtpHeaderLen]);
-    UInt8 naluType = 0;
-    if (nalHeader->type >= 1 && nalHeader->type <= 23) { // 单一包
-      naluType = nalHeader->type;
-    } else if (nalHeader->type == 24) { // STAP-A
-      // rtp header + STAP-A nal header + nalu size
-      UInt32 naluOffset = rtpHeaderLen + sizeof(NALUHeader) + sizeof(UInt16);
-      if (thePacket->fPacketPtr.Len > naluOffset) {
-        auto *naluHeader = reinterpret_cast<NALUHeader*>(&thePacket->fPacketPtr.Ptr[naluOffset]);
-        naluType = naluHeader->type;
-      }
-    } else if (nalHeader->type == 25) { // STAP-B
-      // rtp header + STAP-B nal header + DON + nalu size
-      UInt32 naluOffset = rtpHeaderLen  + sizeof(NALUHeader) + sizeof(UInt16) + sizeof(UInt16);
-      if (thePacket->fPacketPtr.Len > naluOffset) {
-        auto *naluHeader = reinterpret_cast<NALUHeader*>(&thePacket->fPacketPtr.Ptr[naluOffset]);
-        naluType = naluHeader->type;
-      }
-    } else if (nalHeader->type == 26) { // MTAP16
-      // rtp header + MTAP16 nal header + DONB + nalu size + nalu DOND + nalu TS offset(16 bits)
-      UInt32 naluOffset = rtpHeaderLen + sizeof(NALUHeader) + sizeof(UInt16) + sizeof(UInt16) + sizeof(UInt8) + 2;
-      if (thePacket->fPacketPtr.Len > naluOffset) {
-        auto *naluHeader = reinterpret_cast<NALUHeader*>(&thePacket->fPacketPtr.Ptr[naluOffset]);
-        naluType = naluHeader->type;
-      }
-    } else if (nalHeader->type == 27) { // MTAP24
-      // rtp header + MTAP16 nal header + DONB + nalu size + nalu DOND + nalu TS offset(24 bits)
-      UInt32 naluOffset = rtpHeaderLen + sizeof(NALUHeader) + sizeof(UInt16) + sizeof(UInt16) + sizeof(UInt8) + 3;
-      if (thePacket->fPacketPtr.Len > naluOffset) {
-        auto *naluHeader = reinterpret_cast<NALUHeader*>(&thePacket->fPacketPtr.Ptr[naluOffset]);
-        naluType = naluHeader->type;
-      }
-    } else if (nalHeader->type == 28 || nalHeader->type == 29) { // FU-A/B
-      // rtp header + FU indicator
-      UInt32 fuOffset = rtpHeaderLen + sizeof(FUIndicator);
-      if (thePacket->fPacketPtr.Len > fuOffset) {
-        auto *fuHeader = reinterpret_cast<FUHeader*>(&thePacket->fPacketPtr.Ptr[fuOffset]);
-        if (fuHeader->s) { // 起始包
-          naluType = fuHeader->type;
-        }
-      }
-    }
+  if (thePacket == nullptr || fStream->fKeyFrameDetector == nullptr)
+    return KeyFrameDetector::kFramePacket;
+  return fStream->fKeyFrameDetector->ClassifyRTPPacket(thePacket->fPacketPtr.Ptr, thePacket->fPacketPtr.Len);
+}
+
+ReflectorPartition::ReflectorPartition(ReflectorStream *inStream, UInt32 inIndex)
+    : IdleTask(), fStream(inStream), fIndex(inIndex), fMutex() {
+  this->SetTaskName("ReflectorPartition");
+  fLowestSeq[0] = 0;
+  fLowestSeq[1] = 0;
+  fPassEpoch[0] = 0;
+  fPassEpoch[1] = 0;
+  fHasNewPackets = false;
+}
+
+ReflectorOutputWheel *ReflectorPartition::GetBlockedOutputs(ReflectorSender *inSender) {
+  return &fBlockedOutputs[inSender->fWriteFlag == qtssWriteFlagsIsRTCP ? 1 : 0];
+}
+
+void ReflectorPartition::NotifyNewPackets() {
+  fHasNewPackets = true;
+  this->Signal(kIdleEvent);
+}
+
+UInt64 ReflectorPartition::GetLowestSeq(ReflectorSender *inSender) {
+  return fLowestSeq[inSender->fWriteFlag == qtssWriteFlagsIsRTCP ? 1 : 0].load(std::memory_order_acquire);
+}
 
-    if ((naluType == 5) || (naluType == 7) || (naluType == 8)) { // IDR/SPS/PPS
-      return true;
+void ReflectorPartition::SetLowestSeq(ReflectorSender *inSender, UInt64 inSeq) {
+  fLowestSeq[inSender->fWriteFlag == qtssWriteFlagsIsRTCP ? 1 : 0].store(inSeq, std::memory_order_release);
+}
+
+void ReflectorPartition::PinSeq(ReflectorSender *inSender, UInt64 inSeq) {
+  UInt64 theLowestSeq = this->GetLowestSeq(inSender);
+  if (inSeq != 0 && (theLowestSeq == 0 || inSeq < theLowestSeq))
+    this->SetLowestSeq(inSender, inSeq);
+}
+
+UInt64 ReflectorPartition::GetPassEpoch(ReflectorSender *inSender) {
+  return fPassEpoch[inSender->fWriteFlag == qtssWriteFlagsIsRTCP ? 1 : 0].load();
+}
+
+void ReflectorPartition::Detach() {
+  {
+    Core::MutexLocker locker(&fMutex);
+    fStream = nullptr;
+  }
+  this->Signal(kKillEvent);
+}
+
+/**
+ * 由 ReflectorSender::ReflectPackets 在新包到达时唤醒，或由阻塞 Output 的重试定时器唤醒
+ */
+SInt64 ReflectorPartition::Run() {
+  this->CancelTimeout();
+
+  EventFlags theEvents = this->GetEvents();
+  if (theEvents & kKillEvent) return -1;
+
+  Core::MutexLocker locker(&fMutex);
+  if (fStream == nullptr) return 0;
+
+  SInt64 theCurrentTime = Core::Time::Milliseconds();
+  bool isFullPass = fHasNewPackets.exchange(false);
+
+  SInt64 theDueTime = 0;
+  ReflectorSender *theSenders[] = {&fStream->fRTPSender, &fStream->fRTCPSender};
+
+  // the packets the senders pop from now on are not freed until this pass is done, see FreeRetiredPackets.
+  // published before the ring is read
+  for (ReflectorSender *theSender : theSenders)
+    fPassEpoch[theSender->fWriteFlag == qtssWriteFlagsIsRTCP ? 1 : 0].store(theSender->fTrimEpoch.load());
+
+  for (ReflectorSender *theSender : theSenders) {
+    ReflectorOutputWheel *theBlockedOutputs = this->GetBlockedOutputs(theSender);
+    if (isFullPass) {
+      theBlockedOutputs->Clear(); // the outputs still blocked are scheduled again
+      theSender->ReflectBuckets(this, theCurrentTime, theBlockedOutputs);
+    } else {
+      theSender->ReflectBlockedOutputs(this, theCurrentTime, theBlockedOutputs);
     }
+
+    SInt64 theSenderDueTime = theBlockedOutputs->GetNextDueTime();
+    if (theSenderDueTime != 0 && (theDueTime == 0 || theSenderDueTime < theDueTime))
+      theDueTime = theSenderDueTime;
   }
-  return false;
+
+  // the batches hold the buffers of their packets
+  fPassEpoch[0] = 0;
+  fPassEpoch[1] = 0;
+
+  if (ReflectorStream::sBatchUDPSend || ReflectorStream::sBatchTCPSend)
+    QTSS_FlushWriteBatch();
+
+  // sleep until new packets arrive, or the first blocked output is due
+  if (theDueTime != 0)
+    this->SetIdleTimer(theDueTime > theCurrentTime ? theDueTime - theCurrentTime : 1);
+
+  return 0;
 }
 
 void ReflectorSocketPool::SetUDPSocketOptions(Net::UDPSocketPair *inPair) {
@@ -1422,6 +1896,16 @@ void ReflectorSocketPool::DestructUDPSocketPair(Net::UDPSocketPair *inPair) {
   delete inPair;
 }
 
+#if REFLECTOR_USE_RECVMMSG
+struct ReflectorSocket::RecvBatch {
+  ReflectorPacket *fPackets[kMaxRecvBatchSize]; // owned by the batch until received into
+  struct mmsghdr fMsgs[kMaxRecvBatchSize];
+  struct iovec fIovs[kMaxRecvBatchSize];
+  struct sockaddr_in fAddrs[kMaxRecvBatchSize];
+};
+
+#endif
+
 ReflectorSocket::ReflectorSocket()
     : IdleTask(),
 #if STREAM_USE_ET
@@ -1439,7 +1923,8 @@ ReflectorSocket::ReflectorSocket()
       fHasReceiveTime(false),
       fFirstReceiveTime(0),
       fFirstArrivalTime(0),
-      fCurrentSSRC(0) {
+      fCurrentSSRC(0),
+      fRecvBatch(nullptr) {
 
   this->SetTaskName("ReflectorSocket");
   this->SetTask(this);
@@ -1458,9 +1943,18 @@ ReflectorSocket::~ReflectorSocket() {
     auto *packet = (ReflectorPacket *) fFreeQueue.DeQueue()->GetEnclosingObject();
     delete packet;
   }
+
+#if REFLECTOR_USE_RECVMMSG
+  if (fRecvBatch != nullptr) {
+    for (auto &packet : fRecvBatch->fPackets)
+      delete packet;
+    delete fRecvBatch;
+  }
+#endif
 }
 
 void ReflectorSocket::AddSender(ReflectorSender *inSender) {
+  Core::MutexLocker reflectLocker(&fReflectMutex);
   Core::MutexLocker locker(this->GetDemuxer()->GetMutex());
   QTSS_Error err = this->GetDemuxer()->RegisterTask(inSender->fStream->fStreamInfo.fSrcIPAddr, 0, inSender);
   Assert(err == QTSS_NoErr);
@@ -1468,6 +1962,7 @@ void ReflectorSocket::AddSender(ReflectorSender *inSender) {
 }
 
 void ReflectorSocket::RemoveSender(ReflectorSender *inSender) {
+  Core::MutexLocker reflectLocker(&fReflectMutex); // waits for the running ReflectPackets
   Core::MutexLocker locker(this->GetDemuxer()->GetMutex());
   fSenderQueue.Remove(&inSender->fSocketQueueElem);
   QTSS_Error err = this->GetDemuxer()->UnregisterTask(inSender->fStream->fStreamInfo.fSrcIPAddr, 0, inSender);
@@ -1479,7 +1974,7 @@ void ReflectorSocket::RemoveSender(ReflectorSender *inSender) {
  * 当 ReflectorSocket 接收到推流上来的数据后，会启动 Task。
  * 在 ReflectorSocket::Run() 中，遍历 fSenderQueue，并调用每个 Sender 的 ReflectPackets()
  * 在 ReflectorSender::ReflectPackets() 中，遍历与 fStream 相关联的 ReflectorOutput，并对 Output 调用 SendPacketsToOutput()
- * 在 ReflectorSender::SendPacketsToOutput() 中，遍历 fPacketQueue，并对每个 Packet 调用 Output 的 WritePacket()
+ * 在 ReflectorSender::SendPacketsToOutput() 中，遍历 fPacketRing，并对每个 Packet 调用 Output 的 WritePacket()
  * 在 RTPSessionOutput::WritePacket() 中，通过 StreamCookie 在与 Output 对应的 ClientSession 中找到正确的 RTPStream，
  *     调用 QTSS_Write() 将 Packet 通过 RTPStream 发送出去
  */
@@ -1495,10 +1990,11 @@ SInt64 ReflectorSocket::Run() {
   //if we have been told to delete ourselves, do so.
   if (theEvents & kKillEvent) return -1;
 
-  Core::MutexLocker locker(this->GetDemuxer()->GetMutex());
   SInt64 theMilliseconds = Core::Time::Milliseconds();
 
-  // Only check for data on the socket if we've actually been notified to that effect
+  // Only check for data on the socket if we've actually been notified to that effect.
+  // GetIncomingData holds the demuxer mutex while it receives, the senders reflect without it,
+  // so ingest (here or in ReflectorStream::PushPackets) never waits for the fan-out
   if (theEvents & kReadEvent)
     this->GetIncomingData(theMilliseconds);
 
@@ -1515,12 +2011,23 @@ SInt64 ReflectorSocket::Run() {
 
   fSleepTime = 0;
 
+  // the senders are not removed while they reflect
+  Core::MutexLocker locker(&fReflectMutex);
+
   // Now that we've gotten all available packets, have the streams reflect
+  Queue theFreeQueue;
   for (QueueIter iter(&fSenderQueue); !iter.IsDone(); iter.Next()) {
     auto *theSender = (ReflectorSender *) iter.GetCurrent()->GetEnclosingObject();
     // 根据 fNextTimeToRun 和当前时间判断是否马上进行 Reflect.
     if (theSender != nullptr && theSender->ShouldReflectNow(theMilliseconds, &fSleepTime))
-        theSender->ReflectPackets(&fSleepTime, &fFreeQueue);
+        theSender->ReflectPackets(&fSleepTime, &theFreeQueue);
+  }
+
+  // fFreeQueue belongs to the receiving side
+  if (theFreeQueue.GetLength() > 0) {
+    Core::MutexLocker freeLocker(this->GetDemuxer()->GetMutex());
+    while (theFreeQueue.GetLength() > 0)
+      fFreeQueue.EnQueue(theFreeQueue.DeQueue());
   }
 
 #if DEBUG
@@ -1585,26 +2092,47 @@ bool ReflectorSocket::FilterInvalidSSRCs(ReflectorPacket *thePacket) {
 
 void ReflectorSocket::BufferKeyFrame(ReflectorSender *theSender, ReflectorPacket *thePacket) {
   //
-  // 对H264视频RTP包进行关键帧过滤，保存最新关键帧首个RTP包指针
-
-  // 1. 判断是否为视频 H.264 RTP
-  if (theSender->fStream->fStreamFormat == ReflectorStream::kStreamFormatVideoH264) {
+  // 对视频RTP包进行关键帧过滤，保存最新关键帧首个RTP包指针
+
+  // 1. 判断是否为可以识别关键帧的视频 RTP(H.264/H.265/AV1)
+  if (theSender->fStream->fKeyFrameDetector != nullptr) {
+    KeyFrameDetector::PacketKind thePacketKind = theSender->GetPacketKind(thePacket);
+    bool isKeyFrameFirstPacket = thePacketKind != KeyFrameDetector::kFramePacket; // 关键帧/参数集
+    UInt64 keyFrameStartPacketSeq = thePacket->fStreamCountID;
+
+    // Annex-B 录制只把包放入录制队列，解包和写盘都在录制线程中完成，仅支持 H.264
+    if (ReflectorStream::sRecordAnnexB && theSender->fStream->fStreamFormat == ReflectorStream::kStreamFormatVideoH264) {
+      if (theSender->fStream->fRecorder == nullptr)
+        theSender->fStream->CreateRecorder();
+      if (theSender->fStream->fRecorder != nullptr)
+        (void) theSender->fStream->fRecorder->PutPacket(thePacket->ShareBuffer());
+    }
 
-    // 2. 在这里判断上面插入的thePacket是否为关键帧起始RTP包，如果是，则记录thePacket->fQueueElem
-    if (theSender->IsKeyFrameFirstPacket(thePacket)) {
+    // GOP 缓存共享包的缓冲区
+    if (ReflectorStream::sGOPCacheEnabled) {
+      ReflectorGOPCache *theCache = &theSender->fStream->fGOPCache;
+      ReflectorGOPCache::PacketKind theKind = ReflectorGOPCache::kFramePacket;
+      if (thePacketKind == KeyFrameDetector::kParameterSet)
+        theKind = ReflectorGOPCache::kParameterSet;
+      else if (thePacketKind == KeyFrameDetector::kKeyFrameStart)
+        theKind = ReflectorGOPCache::kKeyFrameStart;
+
+      theCache->Put(thePacket->ShareBuffer(), thePacket->fStreamCountID, thePacket->fTimeArrived,
+                    thePacket->GetPacketRTPTime(), theKind);
+
+      // 新 Output 从 GOP 的第一个包(参数集)开始，而不是从关键帧开始
+      if (thePacketKind == KeyFrameDetector::kKeyFrameStart && theCache->IsValid() &&
+          theSender->fPacketRing.IsValid(theCache->GetFirstPacketID()))
+        keyFrameStartPacketSeq = theCache->GetFirstPacketID();
+    }
 
-      // 3. 取消原来的fKeyFrameStartPacketElementPointer
-      if (theSender->fKeyFrameStartPacketElementPointer) {
-        auto *oldKeyFramePacket = (ReflectorPacket *)
-            theSender->fKeyFrameStartPacketElementPointer->GetEnclosingObject();
-        oldKeyFramePacket->fNeededByOutput = false;
-      }
+    // 2. 在这里判断上面插入的thePacket是否为关键帧起始RTP包，如果是，则记录thePacket的包序号
+    if (isKeyFrameFirstPacket) {
 
-      // 4. 设置最新的fKeyFrameStartPacketElementPointer
-      thePacket->fNeededByOutput = true; // 锁定关键帧不会被Remove
-      theSender->fKeyFrameStartPacketElementPointer = &thePacket->fQueueElem; // 更新最新的关键帧开始包
+      // 3. 设置最新的fKeyFrameStartPacketSeq，RemoveOldPackets 按序号锁定它，不在这里标记包(清理与收流并发)
+      theSender->fKeyFrameStartPacketSeq = keyFrameStartPacketSeq; // 更新最新的关键帧开始包
 
-      // 5. 设置ReflectorSession标志位，Notify有新视频关键帧，提醒音频队列更新
+      // 4. 设置ReflectorSession标志位，Notify有新视频关键帧，提醒音频队列更新
       theSender->fStream->GetMyReflectorSession()->SetHasVideoKeyFrameUpdate(true);
     }
   }
@@ -1616,18 +2144,10 @@ void ReflectorSocket::BufferKeyFrame(ReflectorSender *theSender, ReflectorPacket
   else if ((theSender->fStream->fStreamFormat & ReflectorStream::kStreamFormatAudio) &&
       (theSender->fStream->GetMyReflectorSession()->HasVideoKeyFrameUpdate())) {
 
-    // 2. 取消原来音频的fKeyFrameStartPacketElementPointer
-    if (theSender->fKeyFrameStartPacketElementPointer) {
-      auto *oldKeyFramePacket = (ReflectorPacket *)
-          theSender->fKeyFrameStartPacketElementPointer->GetEnclosingObject();
-      oldKeyFramePacket->fNeededByOutput = false;
-    }
-
-    // 4. 设置最新的音频fKeyFrameStaretElementPointer
-    thePacket->fNeededByOutput = true; // 锁定关键帧不会被Remove
-    theSender->fKeyFrameStartPacketElementPointer = &thePacket->fQueueElem; // 更新最新的关键帧开始包
+    // 2. 设置最新的音频fKeyFrameStartPacketSeq，同样由 RemoveOldPackets 按序号锁定
+    theSender->fKeyFrameStartPacketSeq = thePacket->fStreamCountID; // 更新最新的关键帧开始包
 
-    // 5. 设置ReflectorSession标志位，Notify有新视频关键帧，提醒音频队列更新
+    // 3. 设置ReflectorSession标志位，Notify有新视频关键帧，提醒音频队列更新
     theSender->fStream->GetMyReflectorSession()->SetHasVideoKeyFrameUpdate(false);
   }
 }
@@ -1719,34 +2239,11 @@ ProcessPacket(const SInt64 &inMilliseconds, ReflectorPacket *thePacket, UInt32 t
   }
 #endif //NAT_WORKAROUND
 
-  thePacket->fStreamCountID = ++(theSender->fStream->fPacketCount); // start from 1
   thePacket->fBucketsSeenThisPacket = 0;
   thePacket->fTimeArrived = inMilliseconds;
 
-  // Push to sender's packet queue
-  theSender->fPacketQueue.EnQueue(&thePacket->fQueueElem);
-  if (theSender->fFirstNewPacketInQueue == nullptr)
-    theSender->fFirstNewPacketInQueue = &thePacket->fQueueElem;
-  theSender->fHasNewPackets = true;
-
-  if (!thePacket->IsRTCP()) {
-    // 关键帧缓冲 for h.264
-    BufferKeyFrame(theSender, thePacket);
-
-    // don't check for duplicate packets, they may be needed to keep in sync.
-    // Because this is an RTP packet, make sure to atomic add this because
-    // multiple sockets can be adding to this variable simultaneously
-    theSender->fStream->fBytesSentInThisInterval.fetch_add(thePacket->fPacketPtr.Len);
-
-    //printf("ReflectorSocket::ProcessPacket received RTP id=%qu\n", thePacket->fStreamCountID);
-    theSender->fStream->SetHasFirstRTP(true);
-  } else {
-    //printf("ReflectorSocket::ProcessPacket received RTCP id=%qu\n", thePacket->fStreamCountID);
-    theSender->fStream->SetHasFirstRTCP(true);
-    theSender->fStream->SetFirst_RTCP_RTP_Time(thePacket->GetPacketRTPTime());
-    theSender->fStream->SetFirst_RTCP_Arrival_Time(thePacket->fTimeArrived);
-  }
-
+  // strip the receive time trailer and fix the arrival time before the packet is published,
+  // the GOP cache and the outputs see the packet as it is sent
   if (ReflectorStream::sUsePacketReceiveTime && thePacket->fPacketPtr.Len > 12) { // default is false
     UInt32 offset = thePacket->fPacketPtr.Len;
     char *theTag = thePacket->fPacketPtr.Ptr + offset - 12;
@@ -1777,22 +2274,60 @@ ProcessPacket(const SInt64 &inMilliseconds, ReflectorPacket *thePacket, UInt32 t
     }
   }
 
+  // Push to sender's packet ring, the ring seq is the packet id (start from 1)
+  thePacket->fStreamCountID = theSender->fPacketRing.Push(thePacket);
+  if (thePacket->fStreamCountID == 0) {
+    // the ring is full: some output is that far behind, it loses the oldest packet rather than
+    // everybody losing the new one
+    theSender->EvictOldestPacket();
+    thePacket->fStreamCountID = theSender->fPacketRing.Push(thePacket);
+    Assert(thePacket->fStreamCountID != 0);
+  }
+  UInt64 theNoFirstNewPacket = 0;
+  (void) theSender->fFirstNewPacketSeq.compare_exchange_strong(theNoFirstNewPacket, thePacket->fStreamCountID);
+  theSender->fHasNewPackets = true;
+
+  if (!thePacket->IsRTCP()) {
+    // 关键帧缓冲 for h.264
+    BufferKeyFrame(theSender, thePacket);
+
+    // don't check for duplicate packets, they may be needed to keep in sync.
+    // Because this is an RTP packet, make sure to atomic add this because
+    // multiple sockets can be adding to this variable simultaneously
+    theSender->fStream->fBytesSentInThisInterval.fetch_add(thePacket->fPacketPtr.Len);
+
+    //printf("ReflectorSocket::ProcessPacket received RTP id=%qu\n", thePacket->fStreamCountID);
+    theSender->fStream->SetHasFirstRTP(true);
+  } else {
+    //printf("ReflectorSocket::ProcessPacket received RTCP id=%qu\n", thePacket->fStreamCountID);
+    theSender->fStream->SetHasFirstRTCP(true);
+    theSender->fStream->SetFirst_RTCP_RTP_Time(thePacket->GetPacketRTPTime());
+    theSender->fStream->SetFirst_RTCP_Arrival_Time(thePacket->fTimeArrived);
+  }
+
   DEBUG_LOG(0,
             "ReflectorSocket::ProcessPacket %s#%" _U64BITARG_ " from time=%qd src addr=%x src port=%u packetlen=%" _U32BITARG_ "\n",
             thePacket->IsRTCP() ? "RTCP" : "RTP", thePacket->fStreamCountID, inMilliseconds, theRemoteAddr, theRemotePort, thePacket->fPacketPtr.Len);
 
   if (0) {//turn on / off buffer size checking --  pref can go here if we find we need to adjust this
     const UInt32 maxQSize = 4000;
-    if (theSender->fPacketQueue.GetLength() > maxQSize) { //don't grow memory too big
+    if (theSender->fPacketRing.GetLength() > maxQSize) { //don't grow memory too big
       char outMessage[256];
       sprintf(outMessage, "Packet Queue for port=%d qsize = %" _S32BITARG_ " hit max qSize=%" _U32BITARG_ "",
-              theRemotePort, theSender->fPacketQueue.GetLength(), maxQSize);
+              theRemotePort, theSender->fPacketRing.GetLength(), maxQSize);
       WarnV(false, outMessage);
     }
   }
 }
 
 void ReflectorSocket::GetIncomingData(const SInt64 &inMilliseconds) {
+#if REFLECTOR_USE_RECVMMSG
+  if (ReflectorStream::sRecvBatchSize > 1) {
+    this->GetIncomingDataBatch(inMilliseconds);
+    return;
+  }
+#endif
+
   Core::MutexLocker locker(this->GetDemuxer()->GetMutex());
   UInt32 theRemoteAddr = 0;
   UInt16 theRemotePort = 0;
@@ -1809,6 +2344,7 @@ void ReflectorSocket::GetIncomingData(const SInt64 &inMilliseconds) {
     OS_Error theErr = this->RecvFrom(&theRemoteAddr, &theRemotePort, thePacket->fPacketPtr.Ptr,
                                      ReflectorPacket::kMaxReflectorPacketSize, &thePacket->fPacketPtr.Len);
     if (theErr != OS_NoErr) {
+      fFreeQueue.EnQueue(&thePacket->fQueueElem);
       if (theErr == EAGAIN) {
         DEBUG_LOG(0, "ReflectorSocket@%p::GetIncomingData no more packets on this socket!\n", this);
         break;  // no more packets on this socket!
@@ -1834,7 +2370,7 @@ void ReflectorSocket::GetIncomingData(const SInt64 &inMilliseconds) {
               this, thePacket->GetSSRC(), thePacket->GetPacketRTPSeqNum(), thePacket->GetPacketRTPTime());
 
     // 获取 Socket 对应的 Sender,对 Sender、thePacket 进行一系列设置,最终将 thePacket
-    // 挂入 Sender 的 fPacketQueue
+    // 挂入 Sender 的 fPacketRing
     this->ProcessPacket(inMilliseconds, thePacket, theRemoteAddr, theRemotePort);
   }
 
@@ -1843,6 +2379,90 @@ void ReflectorSocket::GetIncomingData(const SInt64 &inMilliseconds) {
 #endif
 }
 
+#if REFLECTOR_USE_RECVMMSG
+
+/**
+ * 批量接收：一次 recvmmsg 读取多个数据报，整批在同一次加锁内交给 ProcessPacket
+ */
+void ReflectorSocket::GetIncomingDataBatch(const SInt64 &inMilliseconds) {
+  Core::MutexLocker locker(this->GetDemuxer()->GetMutex());
+
+  DEBUG_LOG(0, "ReflectorSocket@%p::GetIncomingDataBatch\n", this);
+
+  if (fRecvBatch == nullptr) {
+    fRecvBatch = new RecvBatch;
+    ::memset(fRecvBatch, 0, sizeof(RecvBatch));
+  }
+
+  UInt32 theBatchSize = ReflectorStream::sRecvBatchSize;
+  if (theBatchSize > kMaxRecvBatchSize)
+    theBatchSize = kMaxRecvBatchSize;
+
+  // if the port number of this socket is odd, this packet is an RTCP packet.
+  bool isRTCP = static_cast<bool>(this->GetLocalPort() & 1U);
+
+  for (;;) {
+    // refill the batch, we already hold the demuxer mutex so take packets off the free queue directly
+    for (UInt32 i = 0; i < theBatchSize; i++) {
+      ReflectorPacket *thePacket = fRecvBatch->fPackets[i];
+      if (thePacket == nullptr) {
+        if (fFreeQueue.GetLength() == 0)
+          thePacket = new ReflectorPacket();
+        else
+          thePacket = (ReflectorPacket *) fFreeQueue.DeQueue()->GetEnclosingObject();
+        fRecvBatch->fPackets[i] = thePacket;
+      }
+
+      fRecvBatch->fIovs[i].iov_base = thePacket->fPacketPtr.Ptr;
+      fRecvBatch->fIovs[i].iov_len = ReflectorPacket::kMaxReflectorPacketSize;
+
+      struct msghdr &theHdr = fRecvBatch->fMsgs[i].msg_hdr;
+      theHdr.msg_name = &fRecvBatch->fAddrs[i];
+      theHdr.msg_namelen = sizeof(struct sockaddr_in);
+      theHdr.msg_iov = &fRecvBatch->fIovs[i];
+      theHdr.msg_iovlen = 1;
+      theHdr.msg_control = nullptr;
+      theHdr.msg_controllen = 0;
+      theHdr.msg_flags = 0;
+      fRecvBatch->fMsgs[i].msg_len = 0;
+    }
+
+    int theNumRecv = ::recvmmsg(this->GetSocketFD(), fRecvBatch->fMsgs, theBatchSize, MSG_DONTWAIT, nullptr);
+    if (theNumRecv <= 0) {
+      DEBUG_LOG(0, "ReflectorSocket@%p::GetIncomingDataBatch no more packets on this socket! errno=%d\n",
+                this, Core::Thread::GetErrno());
+      break;  // EAGAIN, no more packets on this socket! (or a real error, wait for the next event)
+    }
+
+    for (int i = 0; i < theNumRecv; i++) {
+      ReflectorPacket *thePacket = fRecvBatch->fPackets[i];
+      fRecvBatch->fPackets[i] = nullptr;
+
+      thePacket->fPacketPtr.Len = fRecvBatch->fMsgs[i].msg_len;
+      if (thePacket->fPacketPtr.Len == 0) {
+        fFreeQueue.EnQueue(&thePacket->fQueueElem);
+        continue;
+      }
+
+      thePacket->fIsRTCP = isRTCP;
+      UInt32 theRemoteAddr = ntohl(fRecvBatch->fAddrs[i].sin_addr.s_addr);
+      UInt16 theRemotePort = ntohs(fRecvBatch->fAddrs[i].sin_port);
+
+      this->ProcessPacket(inMilliseconds, thePacket, theRemoteAddr, theRemotePort);
+    }
+
+    // a short batch means the socket is drained, a new datagram will trigger a new event
+    if ((UInt32) theNumRecv < theBatchSize)
+      break;
+  }
+
+#if !STREAM_USE_ET
+  this->RequestEvent(EV_REOS); // re watch EV_RE
+#endif
+}
+
+#endif // REFLECTOR_USE_RECVMMSG
+
 /**
  * pop from fFreeQueue or new one.
  */
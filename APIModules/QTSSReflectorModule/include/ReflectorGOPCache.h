@@ -0,0 +1,102 @@
+/*
+    File:       ReflectorGOPCache.h
+
+    Contains:   Per-stream cache of the current GOP of a video ReflectorStream.
+
+                The cache holds the packets from the last key frame (IDR) to
+                the live edge, prefixed by the most recent parameter sets
+                (SPS/PPS), so a new output can be bursted a decodable picture
+                at once instead of waiting for the next key frame.
+
+                Packets are not copied: each entry holds a reference on the
+                shared PacketBuffer of the ReflectorPacket. The cache is
+                bounded in bytes and entries, a GOP that outgrows the bound is
+                dropped and the cache stays empty until the next key frame.
+*/
+
+#ifndef __REFLECTOR_GOP_CACHE_H__
+#define __REFLECTOR_GOP_CACHE_H__
+
+#include <CF/Types.h>
+#include <CF/Core/Mutex.h>
+
+#include "PacketBuffer.h"
+
+class ReflectorGOPCache {
+ public:
+
+  enum PacketKind {
+    kFramePacket = 0,     // any other packet of the stream
+    kParameterSet = 1,    // SPS/PPS
+    kKeyFrameStart = 2,   // first packet of a slice of a key frame
+  };
+
+  enum {
+    kMaxParameterSets = 4,
+    kMinEntries = 64,
+    kMaxEntries = 16384,
+  };
+
+  struct Entry {
+    PacketBuffer *fBuffer;
+    UInt64 fPacketID;     // ReflectorPacket::fStreamCountID
+    SInt64 fTimeArrived;
+  };
+
+  explicit ReflectorGOPCache(UInt32 inMaxBytes);
+
+  ~ReflectorGOPCache();
+
+  ReflectorGOPCache(const ReflectorGOPCache &) = delete;
+  ReflectorGOPCache &operator=(const ReflectorGOPCache &) = delete;
+
+  /**
+   * add a packet of the stream, in arrival order
+   *
+   * @param inBuffer takes over a reference of the caller (see ReflectorPacket::ShareBuffer)
+   * @param inRTPTime slices of one key frame share the RTP time and belong to the same GOP
+   */
+  void Put(PacketBuffer *inBuffer, UInt64 inPacketID, SInt64 inTimeArrived, UInt32 inRTPTime, PacketKind inKind);
+
+  void Clear();
+
+  // the cache starts with a key frame and can be bursted
+  bool IsValid() { return fNumEntries > 0; }
+
+  // id of the first cached packet (a parameter set or the key frame), 0 if the cache is empty
+  UInt64 GetFirstPacketID() { return fNumEntries > 0 ? fEntries[0].fPacketID : 0; }
+
+  UInt32 GetNumEntries() { return fNumEntries; }
+
+  UInt32 GetNumBytes() { return fNumBytes; }
+
+  Entry *GetEntry(UInt32 inIndex) { return &fEntries[inIndex]; }
+
+  /**
+   * the cache is written by the ReflectorSocket that receives the stream and
+   * read by the ReflectPackets pass, take the lock to read it
+   */
+  CF::Core::Mutex *GetMutex() { return &fMutex; }
+
+ private:
+
+  bool Append(PacketBuffer *inBuffer, UInt64 inPacketID, SInt64 inTimeArrived);
+
+  void ReleaseEntries();
+
+  CF::Core::Mutex fMutex;
+
+  Entry *fEntries;
+  UInt32 fNumEntries;
+  UInt32 fMaxEntries;
+  UInt32 fNumBytes;
+  UInt32 fMaxBytes;
+  UInt32 fKeyFrameRTPTime;
+
+  // the latest run of consecutive parameter sets
+  Entry fParameterSets[kMaxParameterSets];
+  UInt32 fNumParameterSets;
+  bool fLastWasParameterSet;
+};
+
+#endif //__REFLECTOR_GOP_CACHE_H__
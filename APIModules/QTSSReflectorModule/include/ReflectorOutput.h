@@ -39,27 +39,32 @@
 
 #include <CF/Core/Mutex.h>
 #include <CF/StrPtrLen.h>
-#include <CF/Queue.h>
 
 #include "QTSS.h"
+#include "PacketBuffer.h"
 
 class ReflectorOutput {
  public:
 
   ReflectorOutput()
-      : fBookmarkedPacketsElemsArray(nullptr), fNumBookmarks(0), fAvailPosition(0),
+      : fBookmarks(nullptr), fNumBookmarks(0), fAvailPosition(0),
         fLastIntervalMilliSec(5), fLastPacketTransmitTime(0) {}
 
   virtual ~ReflectorOutput() {
-    if (fBookmarkedPacketsElemsArray) {
-      ::memset(fBookmarkedPacketsElemsArray, 0, sizeof(CF::QueueElem *) * fNumBookmarks);
-      delete[] fBookmarkedPacketsElemsArray;
-    }
+    delete[] fBookmarks;
   }
 
-  // an array of packet elements ( from fPacketQueue in ReflectorSender )
+  /**
+   * 书签：该 Output 在某个 ReflectorSender 的包环中下一次开始发送的包序号
+   */
+  struct Bookmark {
+    const void *fOwner; // the ReflectorSender's packet ring, nullptr for a free bookmark
+    UInt64 fSeq;
+  };
+
+  // an array of bookmarks ( into the packet rings of the ReflectorSenders )
   // possibly one for each ReflectorSender that sends data to this ReflectorOutput
-  CF::QueueElem **fBookmarkedPacketsElemsArray;
+  Bookmark *fBookmarks;
   UInt32 fNumBookmarks;
   SInt32 fAvailPosition;
   QTSS_TimeVal fLastIntervalMilliSec;
@@ -94,9 +99,9 @@ class ReflectorOutput {
   //end add
 
 
-  inline CF::QueueElem *GetBookMarkedPacket(CF::Queue *thePacketQueue);
+  inline UInt64 GetBookMarkedPacket(const void *inOwner);
 
-  inline bool SetBookMarkPacket(CF::QueueElem *thePacketElemPtr);
+  inline bool SetBookMarkPacket(const void *inOwner, UInt64 inSeq);
 
   /**
    * 将 Packet 通过 inStreamCookie 标记的 RTPStream 发送出去
@@ -105,13 +110,15 @@ class ReflectorOutput {
    * @param inStreamCookie  the cookie of the stream to which it will be written
    * @param inFlags  the QTSS API write flags (qtssWriteFlagsIsRTP or qtssWriteFlagsIsRTCP)
    * @param packetLatenessInMSec  how many MSec's late this packet is in being delivered (<0 if its early)
+   * @param inBuffer  the shared buffer holding inPacket, if any, so the packet can be kept without a copy
    *
    * @return QTSS_WouldBlock  timeToSendThisPacketAgain will be set to # of msec in which the packet can be sent
    * @return -1  unknown
    */
   virtual QTSS_Error WritePacket(CF::StrPtrLen *inPacket, void *inStreamCookie, UInt32 inFlags,
                                  SInt64 packetLatenessInMSec, SInt64 *timeToSendThisPacketAgain,
-                                 UInt64 *packetIDPtr, SInt64 *arrivalTimeMSec, bool firstPacket) = 0;
+                                 UInt64 *packetIDPtr, SInt64 *arrivalTimeMSec, bool firstPacket,
+                                 PacketBuffer *inBuffer = nullptr) = 0;
 
   virtual void TearDown() = 0;
 
@@ -129,22 +136,22 @@ class ReflectorOutput {
     // need 2 bookmarks for each stream ( include RTCPs )
     UInt32 numBookmarks = numStreams * 2;
 
-    fBookmarkedPacketsElemsArray = new CF::QueueElem *[numBookmarks];
-    ::memset(fBookmarkedPacketsElemsArray, 0, sizeof(CF::QueueElem *) * (numBookmarks));
+    fBookmarks = new Bookmark[numBookmarks];
+    ::memset(fBookmarks, 0, sizeof(Bookmark) * (numBookmarks));
 
-    //DT("fBookmarkedPacketsElemsArray[-1] %p= %p", &fBookmarkedPacketsElemsArray[-1], fBookmarkedPacketsElemsArray[-1]);
     fNumBookmarks = numBookmarks;
   }
 
 };
 
-bool ReflectorOutput::SetBookMarkPacket(CF::QueueElem *thePacketElemPtr) {
-  if (fAvailPosition != -1 && thePacketElemPtr) {
-    fBookmarkedPacketsElemsArray[fAvailPosition] = thePacketElemPtr;
+bool ReflectorOutput::SetBookMarkPacket(const void *inOwner, UInt64 inSeq) {
+  if (fAvailPosition != -1 && inSeq != 0) {
+    fBookmarks[fAvailPosition].fOwner = inOwner;
+    fBookmarks[fAvailPosition].fSeq = inSeq;
 
     // 定位到另一个的可用位置
     for (UInt32 i = 0; i < fNumBookmarks; i++) {
-      if (fBookmarkedPacketsElemsArray[i] == nullptr) {
+      if (fBookmarks[i].fOwner == nullptr) {
         fAvailPosition = i;
         return true;
       }
@@ -154,24 +161,30 @@ bool ReflectorOutput::SetBookMarkPacket(CF::QueueElem *thePacketElemPtr) {
   return false;
 }
 
-CF::QueueElem *ReflectorOutput::GetBookMarkedPacket(CF::Queue *thePacketQueue) {
-  Assert(thePacketQueue != nullptr);
+/**
+ * 取出 inOwner 的书签
+ *
+ * @return the bookmarked seq, 0 if this output has no bookmark for inOwner
+ */
+UInt64 ReflectorOutput::GetBookMarkedPacket(const void *inOwner) {
+  Assert(inOwner != nullptr);
 
-  CF::QueueElem *packetElem = nullptr;
+  UInt64 theSeq = 0;
 
   fAvailPosition = -1;
 
   // see if we've bookmarked a held packet for this Sender in this Output
   for (UInt32 curBookmark = 0; curBookmark < fNumBookmarks; curBookmark++) {
-    CF::QueueElem *bookmarkedElem = fBookmarkedPacketsElemsArray[curBookmark];
-    if (bookmarkedElem) {  // there may be holes in this array
-      if (bookmarkedElem->IsMember(*thePacketQueue)) {
-        // this packet was previously bookmarked for this specific queue
+    Bookmark &theBookmark = fBookmarks[curBookmark];
+    if (theBookmark.fOwner != nullptr) {  // there may be holes in this array
+      if (theBookmark.fOwner == inOwner) {
+        // this packet was previously bookmarked for this specific ring
         // remove if from the bookmark list and use it
-        // to jump ahead into the Sender's over all packet queue
-        fBookmarkedPacketsElemsArray[curBookmark] = nullptr;
+        // to jump ahead into the Sender's over all packet ring
+        theSeq = theBookmark.fSeq;
+        theBookmark.fOwner = nullptr;
+        theBookmark.fSeq = 0;
         fAvailPosition = curBookmark;
-        packetElem = bookmarkedElem;
         break;
       }
     } else {
@@ -179,7 +192,7 @@ CF::QueueElem *ReflectorOutput::GetBookMarkedPacket(CF::Queue *thePacketQueue) {
     }
   }
 
-  return packetElem;
+  return theSeq;
 }
 
 #endif //__REFLECTOR_OUTPUT_H__
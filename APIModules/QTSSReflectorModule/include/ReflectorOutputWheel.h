@@ -0,0 +1,107 @@
+/*
+    File:       ReflectorOutputWheel.h
+
+    Contains:   Hierarchical timer wheel of the flow-controlled ReflectorOutputs
+                of one reflect pass owner (a ReflectorSender, or one of the
+                partitions of its stream).
+
+                An output that blocks is scheduled alone at its own retry time,
+                and a timer wakeup only re-polls the outputs that are due,
+                instead of walking every bucket of the stream.
+
+                Level 0 has kNumSlots slots of kTickMSecs, level 1 has kNumSlots
+                slots of a whole level 0 turn; later retries are clamped to the
+                last level 1 slot. Entries don't own the output: they remember
+                its bucket position, and the caller checks that the output is
+                still there before using it.
+
+                Not thread safe, used under the lock of its owner.
+*/
+
+#ifndef __REFLECTOR_OUTPUT_WHEEL_H__
+#define __REFLECTOR_OUTPUT_WHEEL_H__
+
+#include <CF/Types.h>
+
+class ReflectorOutput;
+
+class ReflectorOutputWheel {
+ public:
+
+  enum {
+    kNumSlots = 64,         // per level
+    kTickMSecs = 4,         // level 0 resolution, a level 0 turn is 256 ms, a level 1 turn 16 s
+    kMinEntries = 16,
+  };
+
+  struct Entry {
+    ReflectorOutput *fOutput;
+    UInt32 fBucketIndex;
+    UInt32 fMemberIndex;
+    SInt64 fDueTime;
+    SInt32 fNext;
+  };
+
+  ReflectorOutputWheel();
+
+  ~ReflectorOutputWheel();
+
+  ReflectorOutputWheel(const ReflectorOutputWheel &) = delete;
+  ReflectorOutputWheel &operator=(const ReflectorOutputWheel &) = delete;
+
+  bool IsEmpty() { return fNumEntries == 0; }
+
+  UInt32 GetNumEntries() { return fNumEntries; }
+
+  void Schedule(ReflectorOutput *inOutput, UInt32 inBucketIndex, UInt32 inMemberIndex, SInt64 inDueTime);
+
+  // drop every entry, a full pass reschedules the outputs that are still blocked
+  void Clear();
+
+  /**
+   * remove the entries due at inCurrentTime and call inCallback(const Entry &) for each of them.
+   * inCallback may Schedule again.
+   */
+  template<typename Callback>
+  void Expire(SInt64 inCurrentTime, Callback inCallback) {
+    SInt32 theExpired = this->CollectExpired(inCurrentTime);
+    while (theExpired != kNoEntry) {
+      Entry theEntry = fEntries[theExpired];
+      this->FreeEntry(theExpired);
+      theExpired = theEntry.fNext;
+      inCallback(theEntry);
+    }
+  }
+
+  // the earliest time an entry may be due, at tick resolution; 0 if the wheel is empty
+  SInt64 GetNextDueTime();
+
+ private:
+
+  enum {
+    kNoEntry = -1,
+  };
+
+  SInt32 CollectExpired(SInt64 inCurrentTime);
+
+  void Insert(SInt32 inEntry);
+
+  // move the entries of a slot to the front of a chain
+  void TakeSlot(SInt32 *ioSlot, SInt32 *ioChain);
+
+  SInt32 AllocateEntry();
+
+  void FreeEntry(SInt32 inEntry);
+
+  Entry *fEntries;
+  UInt32 fMaxEntries;
+  UInt32 fNumEntries;
+  SInt32 fFreeEntries;
+
+  SInt32 fLevel0[kNumSlots];
+  SInt32 fLevel1[kNumSlots];
+
+  SInt64 fCurrentTick; // the level 0 tick the wheel has been advanced to
+};
+
+#endif //__REFLECTOR_OUTPUT_WHEEL_H__
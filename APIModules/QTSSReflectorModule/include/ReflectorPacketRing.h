@@ -0,0 +1,147 @@
+/*
+    File:       ReflectorPacketRing.h
+
+    Contains:   Fixed capacity packet ring of a ReflectorSender, replaces the
+                linked packet queue.
+
+                Every pushed packet gets the next sequence number (starting
+                from 1), and lives in slot (seq & mask) until it is popped.
+                Readers address packets by sequence number, so a bookmark is
+                just a number and can be validated with IsValid().
+
+                Single producer (the ReflectorSocket that receives the packets)
+                and single consumer (the ReflectPackets pass that ages them out):
+                head and tail are published with release/acquire, the producer
+                never waits for the consumer.
+                A push into a full ring fails, the caller pops the oldest
+                packet itself and pushes again; the pops are serialized by a
+                lock of the owner (ReflectorSender::fTrimMutex).
+
+                The slot of a popped packet can be filled by the next push at
+                once, so a reader that doesn't hold the consumer's lock must
+                use Peek(), which checks that the seq wasn't popped while the
+                slot was loaded, instead of IsValid() and Get().
+*/
+
+#ifndef __REFLECTOR_PACKET_RING_H__
+#define __REFLECTOR_PACKET_RING_H__
+
+#include <atomic>
+
+#include <CF/Types.h>
+
+template<typename T>
+class ReflectorPacketRing {
+ public:
+
+  enum {
+    kMinCapacity = 256,
+    kInvalidSeq = 0,  // no packet has this sequence number
+  };
+
+  explicit ReflectorPacketRing(UInt32 inCapacity)
+      : fSlots(nullptr), fMask(0), fHead(1), fTail(1) {
+    UInt32 theCapacity = kMinCapacity;
+    while (theCapacity < inCapacity && theCapacity < 0x80000000U)
+      theCapacity <<= 1U;
+
+    fSlots = new std::atomic<T *>[theCapacity];
+    fMask = theCapacity - 1;
+  }
+
+  ~ReflectorPacketRing() { delete[] fSlots; }
+
+  ReflectorPacketRing(const ReflectorPacketRing &) = delete;
+  ReflectorPacketRing &operator=(const ReflectorPacketRing &) = delete;
+
+  UInt32 GetCapacity() const { return fMask + 1; }
+
+  // seq of the oldest packet
+  UInt64 GetHeadSeq() const { return fHead.load(std::memory_order_acquire); }
+
+  // seq the next pushed packet will get, the newest packet is GetTailSeq() - 1
+  UInt64 GetTailSeq() const { return fTail.load(std::memory_order_acquire); }
+
+  UInt32 GetLength() const { return (UInt32) (GetTailSeq() - GetHeadSeq()); }
+
+  bool IsEmpty() const { return GetTailSeq() == GetHeadSeq(); }
+
+  bool IsValid(UInt64 inSeq) const { return inSeq >= GetHeadSeq() && inSeq < GetTailSeq(); }
+
+  // the packet of inSeq, which must be valid and stay so: the caller is the producer or the consumer
+  T *Get(UInt64 inSeq) const { return fSlots[inSeq & fMask].load(std::memory_order_acquire); }
+
+  /**
+   * any reader: the packet of inSeq, nullptr if it isn't in the ring
+   *
+   * The slot is loaded before the head is checked again: a packet pushed into the slot of a
+   * popped seq is only published after the pop, so it is never returned for the old seq.
+   */
+  T *Peek(UInt64 inSeq) const {
+    if (inSeq < GetHeadSeq() || inSeq >= GetTailSeq())
+      return nullptr;
+
+    T *theItem = fSlots[inSeq & fMask].load(std::memory_order_acquire);
+    if (inSeq < GetHeadSeq())
+      return nullptr;
+    return theItem;
+  }
+
+  /**
+   * producer: append inItem
+   *
+   * @return the seq of inItem, kInvalidSeq if the ring is full
+   */
+  UInt64 Push(T *inItem) {
+    UInt64 theTail = fTail.load(std::memory_order_relaxed);
+    if (theTail - fHead.load(std::memory_order_acquire) > fMask)
+      return kInvalidSeq;
+
+    fSlots[theTail & fMask].store(inItem, std::memory_order_release);
+    fTail.store(theTail + 1, std::memory_order_release);
+    return theTail;
+  }
+
+  /**
+   * consumer: remove the oldest packet
+   *
+   * @return nullptr if the ring is empty
+   */
+  T *Pop() {
+    UInt64 theHead = fHead.load(std::memory_order_relaxed);
+    if (theHead == fTail.load(std::memory_order_acquire))
+      return nullptr;
+
+    T *theItem = fSlots[theHead & fMask].load(std::memory_order_relaxed);
+    fHead.store(theHead + 1, std::memory_order_release);
+    return theItem;
+  }
+
+  /**
+   * the first seq in [inFirst, inLast) for which inIsAfter(packet) is true, inLast if none.
+   * inIsAfter must be false for a prefix of the range and true for the rest (e.g. arrival time order).
+   * A packet popped meanwhile counts as before, it is older than any packet still in the ring.
+   */
+  template<typename Pred>
+  UInt64 LowerBound(UInt64 inFirst, UInt64 inLast, Pred inIsAfter) const {
+    while (inFirst < inLast) {
+      UInt64 theMid = inFirst + (inLast - inFirst) / 2;
+      T *theItem = this->Peek(theMid);
+      if (theItem != nullptr && inIsAfter(theItem))
+        inLast = theMid;
+      else
+        inFirst = theMid + 1;
+    }
+    return inFirst;
+  }
+
+ private:
+
+  std::atomic<T *> *fSlots;
+  UInt32 fMask;
+
+  std::atomic<UInt64> fHead;
+  std::atomic<UInt64> fTail;
+};
+
+#endif //__REFLECTOR_PACKET_RING_H__
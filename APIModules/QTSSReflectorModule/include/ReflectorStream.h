@@ -46,11 +46,17 @@
 
 #include "RTCPSRPacket.h"
 #include "ReflectorOutput.h"
+#include "ReflectorPacketRing.h"
+#include "ReflectorGOPCache.h"
+#include "ReflectorOutputWheel.h"
 
 #include "RTPProtocol.h"
+#include "RTPPacketView.h"
+#include "PacketBuffer.h"
 
 /*fantasy add this*/
-#include "KeyFrameCache.h"
+#include "AnnexBRecorder.h"
+#include "KeyFrameDetector.h"
 
 #if EVENT_EDGE_TRIGGERED_SUPPORTED
 #define STREAM_USE_ET 1
@@ -60,7 +66,6 @@
 
 //This will add some printfs that are useful for checking the thinning
 #define REFLECTOR_THINNING_DEBUGGING 0
-#define MAX_CACHE_SIZE  (1024*1024*2)
 
 //Define to use new potential workaround for NAT problems
 #define NAT_WORKAROUND 1
@@ -68,6 +73,7 @@
 class ReflectorPacket;
 class ReflectorSender;
 class ReflectorStream;
+class ReflectorPartition;
 class RTPSessionOutput;
 class ReflectorSession;
 
@@ -75,7 +81,7 @@ class ReflectorSession;
 class ReflectorPacket {
  public:
 
-  ReflectorPacket() : fQueueElem() {
+  ReflectorPacket() : fQueueElem(), fBuffer(PacketBuffer::Create(kMaxReflectorPacketSize)) {
     fQueueElem.SetEnclosingObject(this);
     this->Reset();
   }
@@ -83,17 +89,27 @@ class ReflectorPacket {
   /**
    * make packet ready to reuse
    * @note fQueueElem is always point to this
+   * @note 如果缓冲区仍被其他模块持有，换一块新的缓冲区，已发布的负载永远不会被改写
    */
   void Reset() {
+    if (fBuffer->IsShared()) {
+      fBuffer->Release();
+      fBuffer = PacketBuffer::Create(kMaxReflectorPacketSize);
+    }
+
     fBucketsSeenThisPacket = 0;
     fTimeArrived = 0;
-    fPacketPtr.Set(fPacketData, 0);
+    fPacketPtr.Set(fBuffer->GetData(), 0);
     fIsRTCP = false;
     fStreamCountID = 0;
     fNeededByOutput = false;
+    fRetiredEpoch = 0;
   }
 
-  ~ReflectorPacket() = default;
+  ~ReflectorPacket() { fBuffer->Release(); }
+
+  ReflectorPacket(const ReflectorPacket &) = delete;
+  ReflectorPacket &operator=(const ReflectorPacket &) = delete;
 
   void SetPacketData(char *data, UInt32 len, bool isRTCP) {
     Assert(kMaxReflectorPacketSize > len);
@@ -109,6 +125,21 @@ class ReflectorPacket {
 
   bool IsRTCP() { return fIsRTCP; }
 
+  /**
+   * 共享包数据，调用者负责 Release
+   * @note 只能在包入队(发布)之后调用，此后负载只读
+   */
+  PacketBuffer *ShareBuffer() {
+    fBuffer->SetLen(fPacketPtr.Len);
+    fBuffer->Retain();
+    return fBuffer;
+  }
+
+  /**
+   * the buffer of the packet, without a new reference: only valid while the packet is in the ring
+   */
+  PacketBuffer *GetBuffer() { return fBuffer; }
+
   inline UInt32 GetPacketRTPTime();
   inline UInt16 GetPacketRTPSeqNum();
   inline UInt32 GetSSRC();
@@ -117,7 +148,7 @@ class ReflectorPacket {
  private:
 
   enum {
-    kMaxReflectorPacketSize = 2060    //jm 5/02 increased from 2048 by 12 bytes for test bytes appended to packets
+    kMaxReflectorPacketSize = PacketBuffer::kDefaultCapacity    //jm 5/02 increased from 2048 by 12 bytes for test bytes appended to packets
   };
 
   UInt64 fStreamCountID;
@@ -125,11 +156,12 @@ class ReflectorPacket {
   UInt32 fBucketsSeenThisPacket;
   bool fIsRTCP; // the first field we set at beginning of ReflectorSocket::ProcessPacket
   bool fNeededByOutput; // is this packet still needed for output?
+  UInt64 fRetiredEpoch; // ReflectorSender::fTrimEpoch when it was popped, see ReflectorSender::RetirePacket
 
   CF::QueueElem fQueueElem;
 
-  CF::StrPtrLen fPacketPtr;
-  char fPacketData[kMaxReflectorPacketSize];
+  CF::StrPtrLen fPacketPtr; // always point to fBuffer
+  PacketBuffer *fBuffer;
 
   friend class ReflectorSender;
   friend class ReflectorSocket;
@@ -137,53 +169,32 @@ class ReflectorPacket {
 };
 
 UInt32 ReflectorPacket::GetSSRC() {
-  if (fPacketPtr.Ptr == nullptr) return 0;
-
-  auto *theSsrcPtr = (UInt32 *) fPacketPtr.Ptr;
-
-  if (fIsRTCP) {
-    if (fPacketPtr.Len < 8) return 0;
-    return ntohl(theSsrcPtr[1]); // RTCP
-  } else {
-    if (fPacketPtr.Len < 12) return 0;
-    return ntohl(theSsrcPtr[2]); // RTP SSRC
-  }
+  if (fIsRTCP)
+    return RTCPPacketView(fPacketPtr.Ptr, fPacketPtr.Len).GetSSRC();
+  return RTPPacketView(fPacketPtr.Ptr, fPacketPtr.Len).GetSSRC();
 }
 
 UInt32 ReflectorPacket::GetPacketRTPTime() {
-  if (fPacketPtr.Ptr == nullptr) return 0;
-
-  auto *theTimestampPtr = (UInt32 *) fPacketPtr.Ptr;
-
-  if (!fIsRTCP) {
-    //The RTP timestamp number is the second long of the packet
-    if (fPacketPtr.Len < 8) return 0;
-    return ntohl(theTimestampPtr[1]);
-  } else {
-    if (fPacketPtr.Len < 20) return 0;
-    return ntohl(theTimestampPtr[4]);
-  }
+  if (fIsRTCP) // the RTP time of the sender report
+    return RTCPPacketView(fPacketPtr.Ptr, fPacketPtr.Len).GetRTPTimestamp();
+  return RTPPacketView(fPacketPtr.Ptr, fPacketPtr.Len).GetTimestamp();
 }
 
 UInt16 ReflectorPacket::GetPacketRTPSeqNum() {
   Assert(!fIsRTCP); // not a supported type
 
-  if (fPacketPtr.Ptr == nullptr || fPacketPtr.Len < 4 || fIsRTCP) return 0;
+  if (fIsRTCP) return 0;
 
-  return ntohs(((UInt16 *) fPacketPtr.Ptr)[1]); //The RTP sequenc number is the second short of the packet
+  return RTPPacketView(fPacketPtr.Ptr, fPacketPtr.Len).GetSeqNumber();
 }
 
 SInt64 ReflectorPacket::GetPacketNTPTime() {
   Assert(fIsRTCP); // not a supported type
 
-  if (fPacketPtr.Ptr == nullptr || fPacketPtr.Len < 16 || !fIsRTCP) return 0;
+  if (fPacketPtr.Ptr == nullptr || fPacketPtr.Len < RTCPPacketView::kRTPTimestampOffset || !fIsRTCP) return 0;
 
-  auto *theReport = (UInt32 *) fPacketPtr.Ptr;
-
-  SInt64 ntp = 0;
-  ::memcpy(&ntp, &theReport[2], sizeof(SInt64));
-
-  return CF::Core::Time::Time1900Fixed64Secs_To_TimeMilli(CF::Utils::NetworkToHostSInt64(ntp));
+  RTCPPacketView theReport(fPacketPtr.Ptr, fPacketPtr.Len);
+  return CF::Core::Time::Time1900Fixed64Secs_To_TimeMilli(theReport.GetNTPTimestamp());
 }
 
 /**
@@ -235,19 +246,26 @@ class ReflectorSocket
 
   void GetIncomingData(const SInt64 &inMilliseconds);
 
+  void GetIncomingDataBatch(const SInt64 &inMilliseconds);
+
   bool FilterInvalidSSRCs(ReflectorPacket *thePacket);
 
   //Number of packets to allocate when the socket is first created
   enum {
     kNumPreallocatedPackets = 20,   //UInt32
+    kMaxRecvBatchSize = 64,         // upper bound of reflector_recv_batch_size
     kRefreshBroadcastSessionIntervalMilliSecs = 10000,
     kSSRCTimeOut = 30000 // milliseconds before clearing the SSRC if no new ssrcs have come in
   };
   QTSS_ClientSessionObject fBroadcasterClientSession;
   SInt64 fLastBroadcasterTimeOutRefresh;
 
-  CF::Queue fFreeQueue;   // Queue of available ReflectorPackets
-  CF::Queue fSenderQueue; // Queue of senders
+  CF::Queue fFreeQueue;   // Queue of available ReflectorPackets, under the demuxer mutex
+  CF::Queue fSenderQueue; // Queue of senders, changed under both fReflectMutex and the demuxer mutex
+  CF::Core::Mutex fReflectMutex; // held by Run while the senders reflect, which the demuxer mutex isn't
+
+  struct RecvBatch;
+  RecvBatch *fRecvBatch;  // recvmmsg buffers, allocated on first batched receive
   SInt64 fSleepTime;
 
   UInt32 fValidSSRC;
@@ -273,6 +291,62 @@ class ReflectorSocketPool : public CF::Net::UDPSocketPool {
   void DestructUDPSocket(ReflectorSocket *socket);
 };
 
+/**
+ * 一个 ReflectorStream 的部分 Output 分桶，由独立的 Task 分发
+ *
+ * 第 i 个分区负责 bucketIndex % N == i 的桶，RTP/RTCP 两个 Sender 的分发都在它的 Run 中完成，
+ * 不同分区的 Task 运行在不同的任务线程上，因此一个观看人数很多的流不再只占用一个核。
+ * 分区在 fMutex 下独立遍历自己的桶、读取共享的包环、维护自己 Output 的书签；包环只由收流线程
+ * 在 ReflectorSender::ReflectPackets 中清理，清理不会越过任一分区公布的最小书签(包环将满时除外)，
+ * 分区读包用 Peek，已出环的序号读不到包。
+ * 每轮分发开始时分区公布 Sender 的清理纪元，清理出环的包要等到在此之前开始的分发都结束后才回收。
+ */
+class ReflectorPartition : public CF::Thread::IdleTask {
+ public:
+
+  ReflectorPartition(ReflectorStream *inStream, UInt32 inIndex);
+
+  ~ReflectorPartition() override = default;
+
+  SInt64 Run() override;
+
+  // the stream is going away: wait for the running pass, then kill the task
+  void Detach();
+
+  UInt32 GetIndex() { return fIndex; }
+
+  CF::Core::Mutex *GetMutex() { return &fMutex; }
+
+  // the oldest packet of inSender's ring that an output of this partition may still read, 0 if none
+  UInt64 GetLowestSeq(ReflectorSender *inSender);
+
+  void SetLowestSeq(ReflectorSender *inSender, UInt64 inSeq);
+
+  // a new output starts at inSeq, keep it in the ring until the next pass of the partition
+  void PinSeq(ReflectorSender *inSender, UInt64 inSeq);
+
+  // the trim epoch of inSender when the running pass started, 0 if none is running
+  UInt64 GetPassEpoch(ReflectorSender *inSender);
+
+  // called by ReflectorSender::ReflectPackets: the next run is a full pass
+  void NotifyNewPackets();
+
+ private:
+
+  ReflectorOutputWheel *GetBlockedOutputs(ReflectorSender *inSender);
+
+  ReflectorStream *fStream;
+  UInt32 fIndex;
+  CF::Core::Mutex fMutex;
+
+  std::atomic<UInt64> fLowestSeq[2]; // RTP, RTCP
+  std::atomic<UInt64> fPassEpoch[2]; // RTP, RTCP
+  std::atomic_bool fHasNewPackets;
+
+  // the blocked outputs of this partition, RTP, RTCP
+  ReflectorOutputWheel fBlockedOutputs[2];
+};
+
 /**
  * ReflectorSender 与 ReflectorStream.fStreamInfo.fSrcIPAddr 绑定
  */
@@ -299,8 +373,22 @@ class ReflectorSender : public CF::Net::UDPDemuxerTask {
   // this is the old way of doing reflect packets. It is only here until the relay code can be cleaned up.
   void ReflectRelayPackets(SInt64 *ioWakeupTime, CF::Queue *inFreeQueue);
 
-  CF::QueueElem *SendPacketsToOutput(ReflectorOutput *theOutput, CF::QueueElem *currentPacket,
-                                     SInt64 currentTime, SInt64 bucketDelay, bool firstPacket);
+  // Walks the buckets of inPartition, or of the whole stream if it is nullptr,
+  // and schedules the outputs that block into inBlockedOutputs.
+  // The caller holds the mutex of the partition, or fBucketMutex.
+  void ReflectBuckets(ReflectorPartition *inPartition, SInt64 currentTime, ReflectorOutputWheel *inBlockedOutputs);
+
+  // Only polls the blocked outputs that are due
+  void ReflectBlockedOutputs(ReflectorPartition *inPartition, SInt64 currentTime,
+                             ReflectorOutputWheel *inBlockedOutputs);
+
+  UInt64 SendPacketsToOutput(ReflectorOutput *theOutput, UInt64 currentSeq, SInt64 currentTime,
+                             SInt64 bucketDelay, bool firstPacket, SInt64 *outRetryTime);
+
+  UInt64 SendGOPCacheToOutput(ReflectorOutput *theOutput, SInt64 currentTime, bool *outBlocked,
+                              SInt64 *outRetryTime);
+
+  SInt64 GetBlockedOutputRetryTime(ReflectorOutput *theOutput, SInt64 currentTime, SInt64 timeToSendPacket);
 
   UInt32 GetOldestPacketRTPTime(bool *foundPtr);
 
@@ -308,33 +396,59 @@ class ReflectorSender : public CF::Net::UDPDemuxerTask {
 
   bool GetFirstPacketInfo(UInt16 *outSeqNumPtr, UInt32 *outRTPTimePtr, SInt64 *outArrivalTimePtr);
 
-  CF::QueueElem *GetClientBufferNextPacketTime(UInt32 inRTPTime);
+  UInt64 GetClientBufferNextPacketTime(UInt32 inRTPTime);
 
   bool GetFirstRTPTimePacket(UInt16 *outSeqNumPtr, UInt32 *outRTPTimePtr, SInt64 *outArrivalTimePtr);
 
   void RemoveOldPackets(CF::Queue *inFreeQueue);
 
-  CF::QueueElem *GetClientBufferStartPacketOffset(SInt64 offsetMsec, bool needKeyFrameFirstPacket = false);
+  // the ring is full: retire the oldest packet whoever still needs it, called by the producer under fTrimMutex
+  void EvictOldestPacket();
 
-  CF::QueueElem *GetClientBufferStartPacket() {
+  // a packet popped from the ring may still be read by a partition pass, it is freed by FreeRetiredPackets
+  void RetirePacket(ReflectorPacket *thePacket);
+
+  // free the retired packets that no running partition pass can read
+  void FreeRetiredPackets(CF::Queue *inFreeQueue);
+
+  UInt64 GetClientBufferStartPacketOffset(SInt64 offsetMsec, bool needKeyFrameFirstPacket = false);
+
+  UInt64 GetClientBufferStartPacket() {
     return this->GetClientBufferStartPacketOffset(0);
   };
 
   // ->geyijyn@20150427
   // 关键帧索引及丢帧方案
-  CF::QueueElem *NeedRelocateBookMark(CF::QueueElem *currentElem);
+  UInt64 NeedRelocateBookMark(UInt64 currentSeq);
 
-  CF::QueueElem *GetNewestKeyFrameFirstPacket(CF::QueueElem *currentElem, SInt64 offsetMsec);
+  UInt64 GetNewestKeyFrameFirstPacket(UInt64 currentSeq, SInt64 offsetMsec);
 
   bool IsKeyFrameFirstPacket(ReflectorPacket *thePacket);
 
+  KeyFrameDetector::PacketKind GetPacketKind(ReflectorPacket *thePacket);
+
+  UInt64 GetFirstPacketSeqForNewOutput();
+
+  // send what is new to one output, and schedule it if it blocks. returns its bookmark, 0 if none
+  UInt64 ReflectOutput(ReflectorOutput *theOutput, UInt32 bucketIndex, UInt32 bucketMemberIndex,
+                       UInt64 firstPacketSeqForNewOutput, bool isPartitioned, SInt64 currentTime,
+                       ReflectorOutputWheel *inBlockedOutputs);
+
   ReflectorStream *fStream;
   UInt32 fWriteFlag; // 标记 RTP/RTCP
 
-  CF::Queue fPacketQueue;
-  CF::QueueElem *fFirstNewPacketInQueue; // set in ReflectorSocket::ProcessPacket, and clear in ReflectorSender::ReflectPackets
-  CF::QueueElem *fFirstPacketInQueueForNewOutput;
-  CF::QueueElem *fKeyFrameStartPacketElementPointer; // 最新关键帧指针
+  // 包环，包序号即 ReflectorPacket::fStreamCountID
+  ReflectorPacketRing<ReflectorPacket> fPacketRing;
+  std::atomic<UInt64> fFirstNewPacketSeq; // set in ReflectorSocket::ProcessPacket, and clear in ReflectorSender::ReflectPackets
+  std::atomic<UInt64> fKeyFrameStartPacketSeq; // 最新关键帧的序号，分区不持锁读取
+  UInt32 fNumEvictedPackets; // old packets evicted for new ones because the ring was full
+
+  // 包环的消费一方：RemoveOldPackets 与收流线程的 EvictOldestPacket 都在它之下出环
+  CF::Core::Mutex fTrimMutex;
+
+  // 出环但可能仍被分区读取的包，按出环顺序排列
+  CF::Queue fRetiredPackets;
+  std::atomic<UInt64> fTrimEpoch; // bumped by each RemoveOldPackets that retires packets, starts at 1
 
   //these serve as an optimization, keeping track of when this
   //sender needs to run so it doesn't run unnecessarily
@@ -344,12 +458,18 @@ class ReflectorSender : public CF::Net::UDPDemuxerTask {
     //s_printf("SetNextTimeToRun =%"_64BITARG_"d\n", fNextTimeToRun);
   }
 
-  bool fHasNewPackets; // the flag of new packet arrived
+  std::atomic_bool fHasNewPackets; // the flag of new packet arrived, set without the lock of ReflectPackets
   SInt64 fNextTimeToRun; // real time
+  SInt64 fLastFullPassTime;
+
+  // outputs blocked by flow control, each is re-polled alone at its retry time.
+  // only used while the stream is not partitioned
+  ReflectorOutputWheel fBlockedOutputs;
 
   // how often to send RRs to the source
   enum {
-    kRRInterval = 5000      //SInt64 (every 5 seconds)
+    kRRInterval = 5000,     //SInt64 (every 5 seconds)
+    kFullPassInterval = 1000 // walk every output at least this often, even without new packets
   };
   SInt64 fLastRRTime;
 
@@ -420,6 +540,13 @@ class ReflectorStream {
 
   void PushPacket(char *packet, UInt32 packetLen, bool isRTCP);
 
+  // push consecutive packets of one socket with a single lock and wakeup
+  void PushPackets(CF::StrPtrLen *inPackets, UInt32 inNumPackets, bool isRTCP);
+
+  enum {
+    kMaxPushPackets = 64, // packets a caller of PushPackets batches at most
+  };
+
   //
   // ACCESSORS
   UInt32 GetBitRate() { return fCurrentBitRate; }
@@ -428,6 +555,11 @@ class ReflectorStream {
 
   CF::Core::Mutex *GetMutex() { return &fBucketMutex; }
 
+  // fBucketMutex and the mutexes of all partitions: no output of this stream is written until UnlockOutputs
+  void LockOutputs();
+
+  void UnlockOutputs();
+
   void *GetStreamCookie() { return this; }
 
   SInt16 GetRTPChannel() { return fRTPChannel; }
@@ -462,8 +594,6 @@ class ReflectorStream {
 
   UInt32 GetTimeScale() { return fStreamInfo.fTimeScale; }
 
-  UInt64 fPacketCount;
-
   void SetEnableBuffer(bool enableBuffer) { fEnableBuffer = enableBuffer; }
 
   bool BufferEnabled() { return fEnableBuffer; }
@@ -497,6 +627,8 @@ class ReflectorStream {
 
   void DetectStreamFormat();
 
+  void CreateRecorder();
+
   // Sends an RTCP receiver report to the broadcast source
   void SendReceiverReport();
 
@@ -504,6 +636,18 @@ class ReflectorStream {
 
   SInt32 FindBucket();
 
+  void CreatePartitions();
+
+  ReflectorPartition *GetPartition(UInt32 inBucketIndex) {
+    return fNumPartitions > 0 ? fPartitions[inBucketIndex % fNumPartitions] : nullptr;
+  }
+
+  // packets below this seq are not read by any partition, 0 if there is no limit
+  UInt64 GetPartitionsLowestSeq(ReflectorSender *inSender);
+
+  // the oldest trim epoch of inSender a running partition pass started in, 0 if none is running
+  UInt64 GetPartitionsPassEpoch(ReflectorSender *inSender);
+
   // Reflector sockets, retrieved from the socket pool
   CF::Net::UDPSocketPair *fSockets;
 
@@ -520,15 +664,19 @@ class ReflectorStream {
     kStreamFormatUnknown = 0x0000,
     kStreamFormatVideo   = 0x4000,
     kStreamFormatVideoH264,
+    kStreamFormatVideoH265,
+    kStreamFormatVideoAV1,
     kStreamFormatAudio   = 0x8000,
   };
 
   SInt32 fStreamFormat;
+  KeyFrameDetector *fKeyFrameDetector; // nullptr if key frames of the stream can't be detected
 
   enum {
     kReceiverReportSize = 16,            // RR(8) + SDES(8)
     kAppSize = 36,
     kMinNumBuckets = 16,
+    kMaxNumPartitions = 64,              // upper bound of reflector_output_partitions
     kBitRateAvgIntervalInMilSecs = 30000 // time between bit-rate averages
   };
 
@@ -542,6 +690,11 @@ class ReflectorStream {
   //Bucket array can't be modified while we are sending packets.
   CF::Core::Mutex fBucketMutex;
 
+  // 输出分区，Output 数达到 reflector_partition_min_outputs 后创建，之后由分区 Task 分发。
+  // 修改某个桶还需持有该桶所属分区的锁，扩容需持有所有分区的锁
+  ReflectorPartition **fPartitions;
+  UInt32 fNumPartitions; // 0 while the stream is reflected by the ReflectorSocket alone
+
   // RTCP RR information
   char fReceiverReportBuffer[kReceiverReportSize + RTCPSRPacket::kMaxCNameLen + kAppSize]; // contains 3 packets(RR,SDES,APP)
   UInt32 *fEyeLocation; // place in the buffer to write the eye information
@@ -571,6 +724,12 @@ class ReflectorStream {
 
   ReflectorSession *fMyReflectorSession;
 
+  // 最新 GOP 的缓存，用于能识别关键帧的视频流(H.264/H.265/AV1)
+  ReflectorGOPCache fGOPCache;
+
+  // H.264 视频流的 Annex-B 录制，reflector_record_annexb 打开时在收到第一个包时创建
+  AnnexBRecorder *fRecorder;
+
   static UInt32 sBucketSize;
   static UInt32 sMaxPacketAgeMSec;
   static UInt32 sMaxFuturePacketSec;
@@ -583,11 +742,20 @@ class ReflectorStream {
 
   static UInt32 sRelocatePacketAgeMSec;
 
+  static UInt32 sRecvBatchSize;
+  static UInt32 sPacketRingSize;
+  static bool sBatchUDPSend;
+  static bool sBatchTCPSend;
+  static bool sGOPCacheEnabled;
+  static UInt32 sGOPCacheMaxKBytes;
+  static bool sRecordAnnexB;
+  static char *sRecordDir;
+  static UInt32 sNumOutputPartitions;
+  static UInt32 sPartitionMinOutputs;
+
   friend class ReflectorSocket;
   friend class ReflectorSender;
-
- public:
-  CKeyFrameCache *pkeyFrameCache;
+  friend class ReflectorPartition;
 };
 
 /**
@@ -334,3 +334,7 @@ void QTSS_UnlockStdLib() {
 void *Easy_GetRTSPPushSessions() {
   return (void *) ((QTSS_CallbackPtrProcPtr) sCallbacks->addr[kGetRTSPPushSessionsCallback])();
 }
+
+void QTSS_FlushWriteBatch() {
+  (sCallbacks->addr[kFlushWriteBatchCallback])();
+}
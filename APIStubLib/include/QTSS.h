@@ -114,7 +114,9 @@ enum {
   qtssWriteFlagsIsRTP = 0x00000001,
   qtssWriteFlagsIsRTCP = 0x00000002,
   qtssWriteFlagsWriteBurstBegin = 0x00000004,
-  qtssWriteFlagsBufferData = 0x00000008
+  qtssWriteFlagsBufferData = 0x00000008,
+  qtssWriteFlagsBatchUDP = 0x00000010, // UDP datagrams may be queued until QTSS_FlushWriteBatch
+  qtssWriteFlagsBatchTCP = 0x00000020  // interleaved packets may be queued until QTSS_FlushWriteBatch
 };
 typedef UInt32 QTSS_WriteFlags;
 
@@ -2973,8 +2975,8 @@ typedef struct {
 typedef struct {
   QTSS_RTSPSessionObject inRTSPSession;
   QTSS_ClientSessionObject inClientSession;
-  char *inPacketData;
-  UInt32 inPacketLen;
+  char *inPacketData;   // one or more consecutive interleaved frames ($, channel, length, data) of inClientSession
+  UInt32 inPacketLen;   // total length of the frames
 
 } QTSS_IncomingData_Params;
 
@@ -3096,6 +3098,15 @@ typedef struct {
   void *packetData;
   QTSS_TimeVal packetTransmitTime;
   QTSS_TimeVal suggestedWakeupTime;
+  // Optional rewritten copy of the packet header. If packetHeaderLen > 0, these
+  // bytes are sent in place of the first packetHeaderLen bytes of packetData,
+  // so packetData may be shared between many streams and is never modified.
+  void *packetHeader;
+  UInt32 packetHeaderLen;
+  // Optional reference counted owner of packetData (a PacketBuffer, see
+  // StreamingBase). A stream that keeps the packet after the write, for
+  // reliable UDP re-transmits, takes a reference on it instead of a copy.
+  void *packetBuffer;
 } QTSS_PacketStruct;
 
 
@@ -3857,6 +3868,17 @@ void QTSS_UnlockStdLib();
 // Get HLS Sessions(json)
 void *Easy_GetRTSPPushSessions();
 
+/**
+ * QTSS_FlushWriteBatch
+ *
+ * Sends the RTP/RTCP datagrams and interleaved packets that QTSS_Write queued
+ * on the calling thread because of qtssWriteFlagsBatchUDP/qtssWriteFlagsBatchTCP.
+ * Call it on the same thread after the last batched write of a pass, while the
+ * written packet data and the RTP sessions written to are still valid. An RTSP
+ * session with queued interleaved packets stays locked until then.
+ */
+void QTSS_FlushWriteBatch();
+
 #ifdef QTSS_OLDROUTINENAMES
 
 // Legacy routines
@@ -119,7 +119,8 @@ QTAtom_stsc::QTAtom_stsc(QTFile *File,
                          bool Debug,
                          bool DeepDebug)
     : QTAtom(File, TOCEntry, Debug, DeepDebug),
-      fNumEntries(0), fSampleToChunkTable(NULL), fTableSize(0) {
+      fNumEntries(0), fSampleToChunkTable(NULL), fTableSize(0),
+      fSeekIndex(NULL), fNumSeekIndexEntries(0) {
 }
 
 QTAtom_stsc::~QTAtom_stsc() {
@@ -133,6 +134,7 @@ QTAtom_stsc::~QTAtom_stsc() {
     delete[] fSampleToChunkTable;
 #endif
 
+  delete[] fSeekIndex;
 }
 
 // -------------------------------------
@@ -170,11 +172,71 @@ bool QTAtom_stsc::Initialize() {
   ReadBytes(stscPos_SampleTable, fSampleToChunkTable, fNumEntries * 12);
 #endif
 
+  BuildSeekIndex();
+
   //
   // This atom has been successfully read in.
   return true;
 }
 
+void QTAtom_stsc::BuildSeekIndex() {
+  // General vars
+  UInt32 FirstChunk = 0, SamplesPerChunk = 0, SampleDescription = 0;
+  UInt32 CurSample = 1, LastFirstChunk = 1, LastSamplesPerChunk = 1,
+      LastSampleDescription = 0;
+
+  //
+  // Small tables are scanned quickly enough as they are.
+  if (fNumEntries <= kSeekIndexInterval)
+    return;
+
+  fNumSeekIndexEntries = (fNumEntries - 1) / kSeekIndexInterval;
+  fSeekIndex = new SeekIndexEntry[fNumSeekIndexEntries];
+
+  //
+  // Walk the table the same way SampleToChunkInfo does.
+  for (UInt32 CurEntry = 0; CurEntry < fNumEntries; CurEntry++) {
+    if ((CurEntry > 0) && ((CurEntry % kSeekIndexInterval) == 0)) {
+      SeekIndexEntry *IndexEntry = &fSeekIndex[(CurEntry / kSeekIndexInterval) - 1];
+      IndexEntry->fEntry = CurEntry;
+      IndexEntry->fCurSample = CurSample;
+      IndexEntry->fLastFirstChunk = LastFirstChunk;
+      IndexEntry->fLastSamplesPerChunk = LastSamplesPerChunk;
+      IndexEntry->fLastSampleDescription = LastSampleDescription;
+    }
+
+    memcpy(&FirstChunk, fSampleToChunkTable + (CurEntry * 12) + 0, 4);
+    FirstChunk = ntohl(FirstChunk);
+    memcpy(&SamplesPerChunk, fSampleToChunkTable + (CurEntry * 12) + 4, 4);
+    SamplesPerChunk = ntohl(SamplesPerChunk);
+    memcpy(&SampleDescription, fSampleToChunkTable + (CurEntry * 12) + 8, 4);
+    SampleDescription = ntohl(SampleDescription);
+
+    CurSample += (FirstChunk - LastFirstChunk) * LastSamplesPerChunk;
+    LastFirstChunk = FirstChunk;
+    LastSamplesPerChunk = SamplesPerChunk;
+    LastSampleDescription = SampleDescription;
+  }
+}
+
+//
+// Returns the last index entry whose previous table entry starts at or
+// before the given sample; the linear scan would have walked past every
+// table entry ahead of it without finding the sample.
+QTAtom_stsc::SeekIndexEntry *QTAtom_stsc::FindSeekIndexEntry(UInt32 SampleNumber) {
+  UInt32 Low = 0, High = fNumSeekIndexEntries;
+
+  while (Low < High) {
+    UInt32 Mid = Low + ((High - Low) / 2);
+    if (fSeekIndex[Mid].fCurSample <= SampleNumber)
+      Low = Mid + 1;
+    else
+      High = Mid;
+  }
+
+  return (Low > 0) ? &fSeekIndex[Low - 1] : NULL;
+}
+
 
 
 // -------------------------------------
@@ -448,6 +510,34 @@ bool QTAtom_stsc::SampleToChunkInfo(UInt32 SampleNumber,
   }
   //  s_printf("QTAtom_stsc::SampleToChunkInfo missed cache SampleNumber = %" _S32BITARG_ "\n",SampleNumber);
 
+  if (STCB->fCurSample_SampleToChunkInfo
+      > SampleNumber) // we missed the cache start over
+  {
+    missedCache = true;
+    //      s_printf("missed loop Cache!! STCB = %" _S32BITARG_ " STCB->fCurSample_SampleToChunkInfo = %" _S32BITARG_ "  > SampleNumber = %" _S32BITARG_ " \n",STCB, STCB->fCurSample_SampleToChunkInfo, SampleNumber);
+    STCB->fCurEntry_SampleToChunkInfo = 0;
+    STCB->fCurSample_SampleToChunkInfo = 1;
+    STCB->fLastFirstChunk_SampleToChunkInfo = 1;
+    STCB->fLastSamplesPerChunk_SampleToChunkInfo = 1;
+    STCB->fLastSampleDescription_SampleToChunkInfo = 0;
+  }
+
+  //
+  // Jump ahead through the seek index if the cursor is far behind.
+  {
+    SeekIndexEntry *IndexEntry = FindSeekIndexEntry(SampleNumber);
+    if ((IndexEntry != NULL)
+        && (IndexEntry->fEntry > STCB->fCurEntry_SampleToChunkInfo)) {
+      STCB->fCurEntry_SampleToChunkInfo = IndexEntry->fEntry;
+      STCB->fCurSample_SampleToChunkInfo = IndexEntry->fCurSample;
+      STCB->fLastFirstChunk_SampleToChunkInfo = IndexEntry->fLastFirstChunk;
+      STCB->fLastSamplesPerChunk_SampleToChunkInfo =
+          IndexEntry->fLastSamplesPerChunk;
+      STCB->fLastSampleDescription_SampleToChunkInfo =
+          IndexEntry->fLastSampleDescription;
+    }
+  }
+
   //
   // Assume that this sample came out of the last chunk.
   aChunkNumber = STCB->fLastFirstChunk_SampleToChunkInfo
@@ -472,18 +562,6 @@ bool QTAtom_stsc::SampleToChunkInfo(UInt32 SampleNumber,
   // Linear search through the sample table until we find the chunk
   // which contains the given sample.
 
-  if (STCB->fCurSample_SampleToChunkInfo
-      > SampleNumber) // we missed the cache start over
-  {
-    missedCache = true;
-    //      s_printf("missed loop Cache!! STCB = %" _S32BITARG_ " STCB->fCurSample_SampleToChunkInfo = %" _S32BITARG_ "  > SampleNumber = %" _S32BITARG_ " \n",STCB, STCB->fCurSample_SampleToChunkInfo, SampleNumber);
-    STCB->fCurEntry_SampleToChunkInfo = 0;
-    STCB->fCurSample_SampleToChunkInfo = 1;
-    STCB->fLastFirstChunk_SampleToChunkInfo = 1;
-    STCB->fLastSamplesPerChunk_SampleToChunkInfo = 1;
-    STCB->fLastSampleDescription_SampleToChunkInfo = 0;
-  }
-
   for (; STCB->fCurEntry_SampleToChunkInfo < fNumEntries;
          STCB->fCurEntry_SampleToChunkInfo++) {
     //
@@ -141,6 +141,25 @@ class QTAtom_stsc : public QTAtom {
   virtual void DumpTable();
 
  protected:
+  //
+  // Seek index: the SampleToChunkInfo cursor state on arriving at every
+  // kSeekIndexInterval'th table entry, that is the first sample, first
+  // chunk, samples per chunk and description of the entry before it.
+  enum {
+    kSeekIndexInterval = 64
+  };
+
+  struct SeekIndexEntry {
+    UInt32 fEntry;
+    UInt32 fCurSample;
+    UInt32 fLastFirstChunk;
+    UInt32 fLastSamplesPerChunk;
+    UInt32 fLastSampleDescription;
+  };
+
+  void BuildSeekIndex();
+  SeekIndexEntry *FindSeekIndexEntry(UInt32 SampleNumber);
+
   //
   // Protected member variables.
   UInt8 fVersion;
@@ -149,6 +168,9 @@ class QTAtom_stsc : public QTAtom {
   UInt32 fNumEntries;
   char *fSampleToChunkTable;
   UInt32 fTableSize;
+
+  SeekIndexEntry *fSeekIndex;
+  UInt32 fNumSeekIndexEntries;
 };
 
 #endif // QTAtom_stsc_H
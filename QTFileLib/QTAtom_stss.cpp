@@ -34,6 +34,9 @@
 #include <CF/Types.h>
 
 #include <stdlib.h>
+
+#include <algorithm>
+
 #if !__WinSock__
 #include <netinet/in.h>
 #endif
@@ -160,14 +163,11 @@ void QTAtom_stss::PreviousSyncSample(UInt32 SampleNumber,
   *SyncSampleNumber = SampleNumber;
 
   //
-  // Scan the table until we find a sample number greater than our current
-  // sample number; then return that.
-  for (UInt32 CurEntry = 0; CurEntry < fNumEntries; CurEntry++) {
-    //
-    // Take this entry if it is before (or equal to) our current entry.
-    if (fTable[CurEntry] <= SampleNumber)
-      *SyncSampleNumber = fTable[CurEntry];
-  }
+  // The table is sorted; take the last entry before (or equal to) our
+  // current entry.
+  UInt32 *Entry = std::upper_bound(fTable, fTable + fNumEntries, SampleNumber);
+  if (Entry != fTable)
+    *SyncSampleNumber = *(Entry - 1);
 }
 
 void QTAtom_stss::NextSyncSample(UInt32 SampleNumber,
@@ -177,16 +177,11 @@ void QTAtom_stss::NextSyncSample(UInt32 SampleNumber,
   *SyncSampleNumber = SampleNumber + 1;
 
   //
-  // Scan the table until we find a sample number greater than our current
-  // sample number; then return that.
-  for (UInt32 CurEntry = 0; CurEntry < fNumEntries; CurEntry++) {
-    //
-    // Take this entry if it is greater than our current entry.
-    if (fTable[CurEntry] > SampleNumber) {
-      *SyncSampleNumber = fTable[CurEntry];
-      break;
-    }
-  }
+  // The table is sorted; take the first entry greater than our current
+  // entry.
+  UInt32 *Entry = std::upper_bound(fTable, fTable + fNumEntries, SampleNumber);
+  if (Entry != fTable + fNumEntries)
+    *SyncSampleNumber = *Entry;
 }
 
 // -------------------------------------
@@ -92,7 +92,8 @@ QTAtom_stts::QTAtom_stts(QTFile *File,
                          bool Debug,
                          bool DeepDebug)
     : QTAtom(File, TOCEntry, Debug, DeepDebug),
-      fNumEntries(0), fTimeToSampleTable(nullptr), fTableSize(0) {
+      fNumEntries(0), fTimeToSampleTable(nullptr), fTableSize(0),
+      fSeekIndex(nullptr), fNumSeekIndexEntries(0) {
 }
 
 QTAtom_stts::~QTAtom_stts() {
@@ -106,6 +107,7 @@ QTAtom_stts::~QTAtom_stts() {
     delete[] fTimeToSampleTable;
 #endif
 
+  delete[] fSeekIndex;
 }
 
 // -------------------------------------
@@ -145,11 +147,76 @@ bool QTAtom_stts::Initialize() {
   ReadBytes(sttsPos_SampleTable, fTimeToSampleTable, fNumEntries * 8);
 #endif
 
+  BuildSeekIndex();
+
   //
   // This atom has been successfully read in.
   return true;
 }
 
+void QTAtom_stts::BuildSeekIndex() {
+  // General vars
+  UInt32 SampleCount, SampleDuration;
+  UInt32 CurMediaTime = 0, CurSample = 1;
+
+  //
+  // Small tables are scanned quickly enough as they are.
+  if (fNumEntries <= kSeekIndexInterval)
+    return;
+
+  fNumSeekIndexEntries = (fNumEntries - 1) / kSeekIndexInterval;
+  fSeekIndex = new SeekIndexEntry[fNumSeekIndexEntries];
+
+  for (UInt32 CurEntry = 0; CurEntry < fNumEntries; CurEntry++) {
+    if ((CurEntry > 0) && ((CurEntry % kSeekIndexInterval) == 0)) {
+      SeekIndexEntry *IndexEntry = &fSeekIndex[(CurEntry / kSeekIndexInterval) - 1];
+      IndexEntry->fEntry = CurEntry;
+      IndexEntry->fMediaTime = CurMediaTime;
+      IndexEntry->fSample = CurSample;
+    }
+
+    memcpy(&SampleCount, fTimeToSampleTable + (CurEntry * 8), 4);
+    SampleCount = ntohl(SampleCount);
+    memcpy(&SampleDuration, fTimeToSampleTable + (CurEntry * 8) + 4, 4);
+    SampleDuration = ntohl(SampleDuration);
+
+    CurMediaTime += SampleCount * SampleDuration;
+    CurSample += SampleCount;
+  }
+}
+
+//
+// Both return the last index entry which starts strictly before the given
+// media time/sample; every table entry ahead of it would have been skipped
+// by the linear scan anyway.
+QTAtom_stts::SeekIndexEntry *QTAtom_stts::FindSeekIndexEntryByMediaTime(UInt32 MediaTime) {
+  UInt32 Low = 0, High = fNumSeekIndexEntries;
+
+  while (Low < High) {
+    UInt32 Mid = Low + ((High - Low) / 2);
+    if (fSeekIndex[Mid].fMediaTime < MediaTime)
+      Low = Mid + 1;
+    else
+      High = Mid;
+  }
+
+  return (Low > 0) ? &fSeekIndex[Low - 1] : nullptr;
+}
+
+QTAtom_stts::SeekIndexEntry *QTAtom_stts::FindSeekIndexEntryBySample(UInt32 SampleNumber) {
+  UInt32 Low = 0, High = fNumSeekIndexEntries;
+
+  while (Low < High) {
+    UInt32 Mid = Low + ((High - Low) / 2);
+    if (fSeekIndex[Mid].fSample < SampleNumber)
+      Low = Mid + 1;
+    else
+      High = Mid;
+  }
+
+  return (Low > 0) ? &fSeekIndex[Low - 1] : nullptr;
+}
+
 // -------------------------------------
 // Accessors
 //
@@ -174,6 +241,14 @@ bool QTAtom_stts::MediaTimeToSampleNumber(UInt32 MediaTime,
     STCB->Reset();
   }
   //
+  // Jump ahead through the seek index if the cursor is far behind.
+  SeekIndexEntry *IndexEntry = FindSeekIndexEntryByMediaTime(MediaTime);
+  if ((IndexEntry != nullptr) && (IndexEntry->fEntry > STCB->fMTtSN_CurEntry)) {
+    STCB->fMTtSN_CurEntry = IndexEntry->fEntry;
+    STCB->fMTtSN_CurMediaTime = IndexEntry->fMediaTime;
+    STCB->fMTtSN_CurSample = IndexEntry->fSample;
+  }
+  //
   // Linearly search through the sample table until we find the sample
   // which fits inside the given media time.
   for (; STCB->fMTtSN_CurEntry < fNumEntries; STCB->fMTtSN_CurEntry++) {
@@ -236,6 +311,14 @@ bool QTAtom_stts::SampleNumberToMediaTime(UInt32 SampleNumber,
     STCB->Reset();
   }
   //
+  // Jump ahead through the seek index if the cursor is far behind.
+  SeekIndexEntry *IndexEntry = FindSeekIndexEntryBySample(SampleNumber);
+  if ((IndexEntry != nullptr) && (IndexEntry->fEntry > STCB->fSNtMT_CurEntry)) {
+    STCB->fSNtMT_CurEntry = IndexEntry->fEntry;
+    STCB->fSNtMT_CurMediaTime = IndexEntry->fMediaTime;
+    STCB->fSNtMT_CurSample = IndexEntry->fSample;
+  }
+  //
   // Linearly search through the sample table until we find the sample
   // which fits inside the given media time.
   for (; STCB->fSNtMT_CurEntry < fNumEntries; STCB->fSNtMT_CurEntry++) {
@@ -93,6 +93,25 @@ class QTAtom_stts : public QTAtom {
   virtual void DumpTable(void);
 
  protected:
+  //
+  // Seek index: the media time and sample number at the start of every
+  // kSeekIndexInterval'th table entry, built once in Initialize. Lookups
+  // that land far from the STCB cursor start at the closest index entry
+  // instead of rescanning the table from its beginning.
+  enum {
+    kSeekIndexInterval = 64
+  };
+
+  struct SeekIndexEntry {
+    UInt32 fEntry;
+    UInt32 fMediaTime;
+    UInt32 fSample;
+  };
+
+  void BuildSeekIndex();
+  SeekIndexEntry *FindSeekIndexEntryByMediaTime(UInt32 MediaTime);
+  SeekIndexEntry *FindSeekIndexEntryBySample(UInt32 SampleNumber);
+
   //
   // Protected member variables.
   UInt8 fVersion;
@@ -102,6 +121,9 @@ class QTAtom_stts : public QTAtom {
   char *fTimeToSampleTable;
   UInt32 fTableSize;
 
+  SeekIndexEntry *fSeekIndex;
+  UInt32 fNumSeekIndexEntries;
+
 };
 
 //
@@ -49,7 +49,9 @@
 
 #include "QTTrack.h"
 #include "QTHintTrack.h"
-#if MMAP_TABLES
+#if !__Win32__
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/mman.h>
 #endif
 
@@ -63,6 +65,8 @@
 #define DEBUG_PRINT(s) if(fDebug) s_printf s
 #define DEEP_DEBUG_PRINT(s) if(fDeepDebug) s_printf s
 
+bool QTFile::sUseMappedReads = false;
+
 // -------------------------------------
 // Constructors and destructors
 //
@@ -78,7 +82,9 @@ QTFile::QTFile(bool Debug, bool DeepDebug)
       fNumTracks(0),
       fFirstTrack(NULL), fLastTrack(NULL),
       fMovieHeaderAtom(NULL),
-      fFile(-1) {
+      fFile(-1),
+      fMappedFile(NULL),
+      fMappedLength(0) {
 }
 
 QTFile::~QTFile() {
@@ -131,8 +137,11 @@ QTFile::~QTFile() {
 #if DSS_USE_API_CALLBACKS
   (void) QTSS_CloseFileObject(fMovieFD);
 #endif
-#if MMAP_TABLES
-  ::close(fFile);
+#if !__Win32__
+  if (fMappedFile != NULL)
+    (void) ::munmap(fMappedFile, (size_t) fMappedLength);
+  if (fFile != -1)
+    ::close(fFile);
 #endif
 }
 
@@ -196,6 +205,11 @@ QTFile::ErrorCode QTFile::Open(char const *MoviePath) {
       return errFileNotFound;
 #endif
 
+  //
+  // Map it if asked to, reading through the file source otherwise
+  if (sUseMappedReads && !this->MapFile())
+    DEBUG_PRINT(("QTFile::Open - Mapping the movie failed, reading it.\n"));
+
   //
   // We have a file, generate the mod date str
   fModDateBuffer.Update(this->GetModDate());
@@ -301,6 +315,10 @@ void QTFile::AllocateBuffers(UInt32 inUnitSizeInK,
                              UInt32 inMaxBitRateBuffSizeInBlocks,
                              UInt32 inBitrate) {
 
+  // reads don't go through the file cache
+  if (fMappedFile != NULL)
+    return;
+
 #if DSS_USE_API_CALLBACKS
   if (fOSFileSourceFD != NULL) {
     if (!fCacheBuffersSet) {
@@ -598,6 +616,16 @@ bool QTFile::Read(UInt64 Offset,
                   char *const Buffer,
                   UInt32 Length,
                   QTFile_FileControlBlock *FCB) {
+  //
+  // An FCB with its own file reads another file (a data reference)
+  if ((fMappedFile != NULL) && (FCB == NULL || !FCB->IsValid())) {
+    char *theData = this->GetMappedData(Offset, Length);
+    if (theData == NULL)
+      return false;
+    ::memcpy(Buffer, theData, Length);
+    return true;
+  }
+
   // General vars
   CF::Core::MutexLocker ReadMutex(fReadMutex);
   bool rv = false;
@@ -916,6 +944,58 @@ lbl_SkipAtom:
   return true;
 }
 
+char *QTFile::GetMappedData(UInt64 Offset, UInt32 Length) {
+  if ((fMappedFile == NULL) || (Offset > fMappedLength) || (Length > fMappedLength - Offset))
+    return NULL;
+  return fMappedFile + Offset;
+}
+
+void QTFile::WillNeed(UInt64 Offset, UInt64 Length) {
+#if !__Win32__
+  if ((fMappedFile == NULL) || (Offset >= fMappedLength))
+    return;
+  if (Length > fMappedLength - Offset)
+    Length = fMappedLength - Offset;
+
+  // madvise wants a page aligned address
+  static const UInt64 sPageMask = (UInt64) ::sysconf(_SC_PAGESIZE) - 1;
+  UInt64 theStart = Offset & ~sPageMask;
+  (void) ::madvise(fMappedFile + theStart, (size_t) (Offset + Length - theStart), MADV_WILLNEED);
+#endif
+}
+
+//
+// Map the whole movie, the page cache is shared by every client of the file
+bool QTFile::MapFile() {
+#if !__Win32__
+  if (fFile == -1)
+    fFile = ::open(fMoviePath, O_RDONLY);
+  if (fFile == -1)
+    return false;
+
+  struct stat theStat;
+  if ((::fstat(fFile, &theStat) != 0) || (theStat.st_size <= 0))
+    return false;
+
+  // a 32 bits address space can't map big movies
+  if ((UInt64) theStat.st_size != (UInt64) (size_t) theStat.st_size)
+    return false;
+
+  void *theMem = ::mmap(NULL, (size_t) theStat.st_size, PROT_READ, MAP_SHARED, fFile, 0);
+  if (theMem == MAP_FAILED)
+    return false;
+
+  // each client reads around its own playhead, the read-ahead is driven by WillNeed
+  (void) ::madvise(theMem, (size_t) theStat.st_size, MADV_RANDOM);
+
+  fMappedFile = (char *) theMem;
+  fMappedLength = (UInt64) theStat.st_size;
+  return true;
+#else
+  return false;
+#endif
+}
+
 char *QTFile::MapFileToMem(UInt64 offset, UInt32 length) {
 #if MMAP_TABLES
   char*  mappedMem = (char *)mmap(NULL,
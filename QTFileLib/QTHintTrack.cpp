@@ -125,6 +125,7 @@ QTHintTrack_HintTrackControlBlock::QTHintTrack_HintTrackControlBlock(
 
       fCachedSampleNumber(0),
       fCachedSample(NULL),
+      fCachedSampleBuffer(NULL),
       fCachedSampleSize(0), fCachedSampleLength(0),
 
       fCachedHintTrackSampleNumber(0), fCachedHintTrackSampleOffset(0),
@@ -144,7 +145,7 @@ QTHintTrack_HintTrackControlBlock::QTHintTrack_HintTrackControlBlock(
 
 QTHintTrack_HintTrackControlBlock::~QTHintTrack_HintTrackControlBlock() {
   delete fMediaTrackSTSC_STCB;
-  delete[]fCachedSample;
+  delete[]fCachedSampleBuffer;
   delete[]fCachedHintTrackSample;
 
   delete[] fRTPMetaInfoFieldArray;
@@ -410,6 +411,31 @@ char *QTHintTrack::GetSDPFile(int *length) {
   return sdpBuffer;
 }
 
+QTTrack *QTHintTrack::GetSyncMediaTrack() {
+  if ((fHintTrackReferenceAtom == NULL) || (fTrackRefs == NULL))
+    return NULL;
+
+  UInt32 numTrackRefs = fHintTrackReferenceAtom->GetNumReferences();
+  for (UInt32 CurRef = 0; CurRef < numTrackRefs; CurRef++) {
+    QTTrack *track = fTrackRefs[CurRef];
+    if ((track == NULL) || (track == this))
+      continue;
+
+    //
+    // Media tracks are initialized lazily, see GetSampleData.
+    if (!track->IsInitialized()) {
+      CF::Core::MutexLocker theLocker(fFile->GetMutex());
+      if (!track->IsInitialized() && (track->Initialize() != QTTrack::errNoError))
+        continue;
+    }
+
+    if (track->HasSyncSampleTable())
+      return track;
+  }
+
+  return NULL;
+}
+
 
 
 // -------------------------------------
@@ -615,30 +641,47 @@ bool QTHintTrack::GetSamplePtr(UInt32 sampleNumber,
                            &htcb->fstscSTCB))
     return false;
 
+  //
+  // A mapped movie hands out the sample in place, and reads ahead of it.
+  char *mappedSample = this->GetMappedData(sampleDescriptionIndex, sampleOffset, newSampleLength);
+  if (mappedSample != NULL) {
+    UInt32 chunkNumber;
+    if (this->SampleToChunkInfo(sampleNumber, NULL, &chunkNumber, NULL, NULL, &htcb->fstscSTCB))
+      this->PrefetchChunks(this, chunkNumber, htcb->fHintPrefetch);
+
+    htcb->fCachedSampleNumber = sampleNumber;
+    htcb->fCachedSample = mappedSample;
+    htcb->fCachedSampleLength = newSampleLength;
+    *samplePtr = htcb->fCachedSample;
+    *length = htcb->fCachedSampleLength;
+    return true;
+  }
+
   //
   // Create a new (bigger) cache samplePtr if the sample wouldn't fit in the
   // old one.
-  if ((htcb->fCachedSample == NULL)
+  if ((htcb->fCachedSampleBuffer == NULL)
       || (htcb->fCachedSampleSize < newSampleLength)) {
     //
     // Free the old cache entry if we had one.
-    if (htcb->fCachedSample != NULL) {
-      htcb->fCachedSampleNumber = 0;
+    if (htcb->fCachedSampleBuffer != NULL) {
       htcb->fCachedSampleSize = 0;
-      delete[] htcb->fCachedSample;
+      delete[] htcb->fCachedSampleBuffer;
     }
 
     //
     // Create a new cache entry.
     htcb->fCachedSampleLength = htcb->fCachedSampleSize = newSampleLength;
-    htcb->fCachedSample = new char[htcb->fCachedSampleSize];
-    if (htcb->fCachedSample == NULL)
+    htcb->fCachedSampleBuffer = new char[htcb->fCachedSampleSize];
+    if (htcb->fCachedSampleBuffer == NULL)
       return false;
   }
 
 
   //
   // Read in the new sample.
+  htcb->fCachedSampleNumber = 0;
+  htcb->fCachedSample = htcb->fCachedSampleBuffer;
   htcb->fCachedSampleLength = newSampleLength;
 
   //- this did another GetSampleInfo and we already have that data...
@@ -922,6 +965,13 @@ QTTrack::ErrorCode QTHintTrack::GetSampleData(QTHintTrack_HintTrackControlBlock
                               mediaTrackSTSC_STCBPtr))
       return errInvalidQuickTimeFile;
 
+    // read ahead of the playhead in a mapped movie
+    if ((htcb->fMediaTrackRefIndex == trackRefIndex) && fFile->IsMapped()) {
+      UInt32 mediaChunkNumber;
+      if (track->SampleToChunkInfo(mediaSampleNumber, NULL, &mediaChunkNumber, NULL, NULL, mediaTrackSTSC_STCBPtr))
+        this->PrefetchChunks(track, mediaChunkNumber, htcb->fMediaPrefetch);
+    }
+
     if ((1 == samplesPerCompressionBlock) && (1 == bytesPerCompressionBlock))
       isOneForOne = true;
 
@@ -1197,6 +1247,51 @@ QTTrack::ErrorCode QTHintTrack::GetSampleData(QTHintTrack_HintTrackControlBlock
 
 }
 
+void QTHintTrack::PrefetchChunks(QTTrack *track,
+                                 UInt32 chunkNumber,
+                                 QTHintTrack_PrefetchState &prefetch) {
+  // still well inside what was advised last time
+  if ((chunkNumber >= prefetch.fFirstChunk) && (chunkNumber < prefetch.fNextChunk))
+    return;
+
+  UInt64 totalBytes = 0;
+  UInt64 rangeStart = 0, rangeEnd = 0;
+  bool haveRange = false;
+
+  prefetch.fFirstChunk = chunkNumber;
+  prefetch.fNextChunk = chunkNumber + 1;
+
+  for (UInt32 curChunk = chunkNumber;
+       (curChunk < chunkNumber + kMaxPrefetchChunks) && (totalBytes < kPrefetchBytes);
+       curChunk++) {
+    UInt64 chunkOffset;
+    UInt32 chunkSize;
+    if (!track->ChunkOffset(curChunk, &chunkOffset)
+        || !track->GetSizeOfSamplesInChunk(curChunk, &chunkSize, NULL, NULL, &prefetch.fstscSTCB))
+      break;
+
+    //
+    // Chunks of interleaved tracks are close to each other, advise them as one range
+    if (haveRange && (chunkOffset >= rangeStart) && (chunkOffset <= rangeEnd + kPrefetchMergeGap)) {
+      if (chunkOffset + chunkSize > rangeEnd)
+        rangeEnd = chunkOffset + chunkSize;
+    } else {
+      if (haveRange)
+        fFile->WillNeed(rangeStart, rangeEnd - rangeStart);
+      rangeStart = chunkOffset;
+      rangeEnd = chunkOffset + chunkSize;
+      haveRange = true;
+    }
+
+    totalBytes += chunkSize;
+    if (totalBytes <= kPrefetchBytes / 2)
+      prefetch.fNextChunk = curChunk + 1;
+  }
+
+  if (haveRange)
+    fFile->WillNeed(rangeStart, rangeEnd - rangeStart);
+}
+
 QTTrack::ErrorCode QTHintTrack::GetPacket(UInt32 sampleNumber,
                                           UInt16 packetNumber,
                                           char *buffer,
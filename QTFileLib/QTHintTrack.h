@@ -57,6 +57,20 @@ class QTHintTrackRTPHeaderData {
       tlvTimestampOffset; //'rtpo' TLV which is the timestamp offset for this packet
 };
 
+//
+// Read-ahead of one track of a mapped movie: the chunks from fFirstChunk on have been
+// advised to the OS, the next ones are advised when the playhead reaches fNextChunk.
+class QTHintTrack_PrefetchState {
+
+ public:
+  QTHintTrack_PrefetchState() : fFirstChunk(0), fNextChunk(0) {}
+
+  UInt32 fFirstChunk, fNextChunk;
+
+  // own sample table cache, walking ahead must not move the playhead's
+  QTAtom_stsc_SampleTableControlBlock fstscSTCB;
+};
+
 //
 // Class state cookie
 class QTHintTrack_HintTrackControlBlock {
@@ -93,11 +107,18 @@ class QTHintTrack_HintTrackControlBlock {
   QTAtom_stts_SampleTableControlBlock fsttsSTCB;
 
   //
-  // Sample cache
+  // Sample cache, fCachedSample points into fCachedSampleBuffer, or into
+  // the movie if it is mapped
   UInt32 fCachedSampleNumber;
   char *fCachedSample;
+  char *fCachedSampleBuffer;
   UInt32 fCachedSampleSize, fCachedSampleLength;
 
+  //
+  // Read-ahead of the hint track and of the media track it references
+  QTHintTrack_PrefetchState fHintPrefetch;
+  QTHintTrack_PrefetchState fMediaPrefetch;
+
   //
   // Sample (description) cache
   UInt32 fCachedHintTrackSampleNumber, fCachedHintTrackSampleOffset;
@@ -157,6 +178,11 @@ class QTHintTrack : public QTTrack {
     fAllowInvalidHintRefs = inAllowInvalidHintRefs;
   }
 
+  //
+  // The first referenced media track with a sync sample table (the video
+  // track of a video hint track), initialized. NULL if there is none.
+  QTTrack *GetSyncMediaTrack();
+
   //
   // Sample functions
   bool GetSamplePtr(UInt32 SampleNumber, char **Buffer, UInt32 *Length,
@@ -224,6 +250,12 @@ class QTHintTrack : public QTTrack {
     kMaxHintTrackRefs = 1024
   };
 
+  enum {
+    kPrefetchBytes = 1024 * 1024,   // read-ahead of a mapped track
+    kMaxPrefetchChunks = 256,
+    kPrefetchMergeGap = 64 * 1024   // advise neighbour chunks together
+  };
+
   //
   // Protected member variables.
   QTAtom_hinf *fHintInfoAtom;
@@ -255,6 +287,13 @@ class QTHintTrack : public QTTrack {
   inline void GetSamplePacketHeaderVars(char *samplePacketPtr,
                                         char *maxBuffPtr,
                                         QTHintTrackRTPHeaderData &hdrData);
+
+  //
+  // madvise(WILLNEED) about kPrefetchBytes of chunks from chunkNumber on, using
+  // the stco chunk offsets and the stsz sample sizes of track
+  void PrefetchChunks(QTTrack *track,
+                      UInt32 chunkNumber,
+                      QTHintTrack_PrefetchState &prefetch);
 };
 
 #endif // QTHintTrack_H
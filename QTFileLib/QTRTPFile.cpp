@@ -827,6 +827,10 @@ void QTRTPFile::AllocatePrivateBuffers(UInt32 inUnitSizeInK,
                                        UInt32 inNumBuffSizeUnits,
                                        UInt32 inMaxBitRateBuffSizeInBlocks) {
 
+  // reads are served from the mapping
+  if (fFile->IsMapped())
+    return;
+
   fFCB->EnableCacheBuffers(true);
   UInt32 bytesPerSecond = this->GetBytesPerSecond();
   UInt32 bitRate = bytesPerSecond * 8;
@@ -841,7 +845,8 @@ void QTRTPFile::AllocatePrivateBuffers(UInt32 inUnitSizeInK,
 // Packet functions
 //
 QTRTPFile::ErrorCode QTRTPFile::Seek(Float64 seekToTime,
-                                     Float64 maxBackupTime) {
+                                     Float64 maxBackupTime,
+                                     SeekMode seekMode) {
   //fHasRTPMetaInfoFieldArray = true;
   // General vars
   RTPTrackListEntry *listEntry = NULL;
@@ -875,6 +880,22 @@ QTRTPFile::ErrorCode QTRTPFile::Seek(Float64 seekToTime,
     if (!listEntry->IsTrackActive)
       continue;
 
+    //
+    // Hint tracks rarely carry their own sync samples; in sync sample mode
+    // go through the hint track reference to the media track's 'stss' so
+    // that playback starts on a key frame.
+    if (seekMode == kSeekToSyncSample) {
+      QTTrack *mediaTrack = listEntry->HintTrack->GetSyncMediaTrack();
+      if (mediaTrack != NULL) {
+        if (!SyncSampleTimeOfTrack(mediaTrack, seekToTime, &newSampleTime))
+          continue;
+
+        if (newSampleTime < syncToTime)
+          syncToTime = newSampleTime;
+        continue;
+      }
+    }
+
     //
     // Compute the media time and get the sample at that time.
     mediaTime = (SInt32) (seekToTime * listEntry->HintTrack->GetTimeScale());
@@ -938,7 +959,8 @@ QTRTPFile::ErrorCode QTRTPFile::Seek(Float64 seekToTime,
   //
   // Evaluate/Store the seek time
   fRequestedSeekTime = seekToTime;
-  if ((seekToTime - syncToTime) <= maxBackupTime)
+  if ((seekMode == kSeekToSyncSample)
+      || ((seekToTime - syncToTime) <= maxBackupTime))
     fSeekTime = syncToTime;
   else
     fSeekTime = seekToTime;
@@ -957,8 +979,11 @@ QTRTPFile::ErrorCode QTRTPFile::Seek(Float64 seekToTime,
 
     //
     // Compute the media time and get the sample at that time.
+    // (rounded in sync sample mode, so that float error doesn't land on
+    // the hint sample before the key frame)
     SInt32
-        mediaTime = (SInt32) (fSeekTime * listEntry->HintTrack->GetTimeScale());
+        mediaTime = (SInt32) (fSeekTime * listEntry->HintTrack->GetTimeScale()
+        + ((seekMode == kSeekToSyncSample) ? 0.5 : 0.0));
     mediaTime -= listEntry->HintTrack->GetFirstEditMediaTime();
     if (mediaTime < 0)
       mediaTime = 0;
@@ -1278,6 +1303,34 @@ Float64 QTRTPFile::GetNextPacket(char **outPacket, int *outPacketLength) {
 // -------------------------------------
 // Protected member functions
 //
+bool QTRTPFile::SyncSampleTimeOfTrack(QTTrack *track, Float64 time,
+                                      Float64 *syncSampleTime) {
+  // General vars
+  QTAtom_stts_SampleTableControlBlock sttsSTCB;
+  UInt32 sampleNumber, syncSampleNumber, syncSampleMediaTime;
+
+
+  //
+  // Compute the media time and get the sample at that time.
+  SInt32 mediaTime = (SInt32) (time * track->GetTimeScale());
+  mediaTime -= track->GetFirstEditMediaTime();
+  if (mediaTime < 0)
+    mediaTime = 0;
+
+  if (!track->GetSampleNumberFromMediaTime(mediaTime, &sampleNumber, &sttsSTCB))
+    return false;   // This track is probably done playing.
+
+  //
+  // Find the nearest (moving backwards in time) keyframe and its time.
+  track->GetPreviousSyncSample(sampleNumber, &syncSampleNumber);
+  if (!track->GetSampleMediaTime(syncSampleNumber, &syncSampleMediaTime, &sttsSTCB))
+    return false;
+
+  syncSampleMediaTime += track->GetFirstEditMediaTime();
+  *syncSampleTime = (Float64) syncSampleMediaTime * track->GetTimeScaleRecip();
+  return true;
+}
+
 bool QTRTPFile::FindTrackEntry(UInt32 trackID, RTPTrackListEntry **trackEntry) {
   // General vars
   RTPTrackListEntry *listEntry;
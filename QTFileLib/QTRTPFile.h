@@ -218,7 +218,14 @@ class QTRTPFile {
   void SetTrackQualityLevel(RTPTrackListEntry *inEntry, UInt32 inNewLevel);
   //
   // Packet functions
-  ErrorCode Seek(Float64 Time, Float64 MaxBackupTime = 3.0);
+  //
+  // How far Seek backs up from the requested time.
+  enum SeekMode {
+    kSeekWithinBackupTime = 0,  // to the previous hint sync sample, if it's within MaxBackupTime
+    kSeekToSyncSample = 1       // always to the previous sync sample of the referenced media track
+  };
+  ErrorCode Seek(Float64 Time, Float64 MaxBackupTime = 3.0,
+                 SeekMode Mode = kSeekWithinBackupTime);
   ErrorCode SeekToPacketNumber(UInt32 inTrackID, UInt64 inPacketNumber);
 
   UInt32 GetSeekTimestamp(UInt32 TrackID);
@@ -264,6 +271,8 @@ class QTRTPFile {
   bool PrefetchNextPacket(RTPTrackListEntry *TrackEntry, bool doSeek = false);
   ErrorCode ScanToCorrectSample();
   ErrorCode ScanToCorrectPacketNumber(UInt32 inTrackID, UInt64 inPacketNumber);
+  static bool SyncSampleTimeOfTrack(QTTrack *Track, Float64 Time,
+                                    Float64 *SyncSampleTime);
 
   //
   // Protected member variables.
@@ -200,6 +200,9 @@ class QTTrack {
     else *SyncSampleNumber = SampleNumber + 1;
   }
 
+  // a track without a sync sample table has only sync samples
+  inline bool HasSyncSampleTable() { return fSyncSampleAtom != NULL; }
+
   inline bool IsSyncSample(UInt32 SampleNumber, UInt32 SyncSampleCursor) {
     if (fSyncSampleAtom != NULL)
       return fSyncSampleAtom->IsSyncSample(SampleNumber,
@@ -217,6 +220,18 @@ class QTTrack {
         SampleDescriptionID), Offset, Buffer, Length, FCB);
   }
 
+  //
+  // Pointer to the data in the movie mapping, NULL if the file isn't mapped or
+  // the data is in another file.
+  inline char *GetMappedData(UInt32 SampleDescriptionID,
+                             UInt64 Offset,
+                             UInt32 Length) {
+    if (!fDataReferenceAtom->IsRefInThisFile(fSampleDescriptionAtom->SampleDescriptionToDataReference(
+        SampleDescriptionID)))
+      return NULL;
+    return fFile->GetMappedData(Offset, Length);
+  }
+
   inline bool GetSampleMediaTimeOffset(UInt32 SampleNumber,
                                        UInt32 *mediaTimeOffset,
                                        QTAtom_ctts_SampleTableControlBlock *STCB) {
@@ -152,6 +152,23 @@ class QTFile {
 
   inline bool ValidTOC();
 
+  //
+  // Memory-mapped reads. With it on, Open maps the whole movie read-only: Read copies
+  // straight out of the mapping without a system call or the FCB buffers, and
+  // GetMappedData hands out pointers into it. Set before Open, the files opened
+  // earlier keep their mode.
+  // The file must not be truncated while it is open (SIGBUS), so it is off by default.
+  static void SetUseMappedReads(bool inUseMappedReads) { sUseMappedReads = inUseMappedReads; }
+  static bool GetUseMappedReads() { return sUseMappedReads; }
+
+  inline bool IsMapped() { return fMappedFile != NULL; }
+
+  // NULL if the file isn't mapped or the range isn't in the file
+  char *GetMappedData(UInt64 Offset, UInt32 Length);
+
+  // madvise(WILLNEED): the range will be read soon, start reading it in now
+  void WillNeed(UInt64 Offset, UInt64 Length);
+
   char *MapFileToMem(UInt64 offset, UInt32 length);
 
   int UnmapMem(char *memPtr, UInt32 length);
@@ -165,6 +182,8 @@ class QTFile {
   // Protected member functions.
   bool GenerateAtomTOC();
 
+  bool MapFile();
+
   //
   // Protected member variables.
   bool fDebug, fDeepDebug;
@@ -191,6 +210,11 @@ class QTFile {
   CF::Core::Mutex *fReadMutex;
   int fFile;
 
+  char *fMappedFile;
+  UInt64 fMappedLength;
+
+  static bool sUseMappedReads;
+
 };
 
 bool QTFile::ValidTOC() {
@@ -0,0 +1,389 @@
+/**
+ * @file InterleavedWriteQueue.cpp
+ *
+ * Output queue of the RTP/RTCP packets interleaved on one RTSP connection, see InterleavedWriteQueue.h
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#if __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+#include <CF/Core/Mutex.h>
+
+#include "InterleavedWriteQueue.h"
+#include "RTSPSessionInterface.h"
+
+#if __linux__ && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define INTERLEAVED_ZERO_COPY 1
+#else
+#define INTERLEAVED_ZERO_COPY 0
+#endif
+
+struct PendingSessions {
+  RTSPSessionInterface *fSessions[InterleavedWriteQueue::kMaxPendingSessions];
+  UInt32 fNumSessions;
+};
+
+static PendingSessions *GetThreadPendingSessions() {
+  static thread_local PendingSessions sPendingSessions;
+  return &sPendingSessions;
+}
+
+#if INTERLEAVED_ZERO_COPY
+// queues of closed connections whose zero copy sends the kernel hasn't reported yet
+struct OrphanedQueues {
+  CF::Core::Mutex fMutex;
+  InterleavedWriteQueue *fFirst = nullptr;
+  std::atomic<UInt32> fNumQueues{0};
+};
+
+static OrphanedQueues *GetOrphanedQueues() {
+  static OrphanedQueues sOrphanedQueues;
+  return &sOrphanedQueues;
+}
+#endif
+
+/**
+ * 登记有待写数据的会话，会话在刷新前由 fObjectHolders 持有，不会被删除。调用者持有会话锁
+ */
+void InterleavedWriteQueue::AddPendingSession(RTSPSessionInterface *inSession) {
+  InterleavedWriteQueue *theQueue = inSession->GetInterleavedQueue();
+  if (theQueue == nullptr || theQueue->fIsPending)
+    return;
+
+  PendingSessions *thePending = GetThreadPendingSessions();
+  if (thePending->fNumSessions == kMaxPendingSessions)
+    FlushPendingSessions();
+
+  if (thePending->fNumSessions == kMaxPendingSessions) {
+    // still full of sessions busy with a request, write this one now
+    inSession->FlushInterleavedQueue();
+    return;
+  }
+
+  inSession->IncrementObjectHolderCount();
+  thePending->fSessions[thePending->fNumSessions++] = inSession;
+  theQueue->fIsPending = true;
+}
+
+/**
+ * 会话锁只在刷新时获取。与 InterleavedWrite 一样不能等待正在处理请求的会话，
+ * 取不到锁的会话交给持锁者，连同待写列表对它的持有：持锁者在 UnlockSessionMutex 中写出队列
+ */
+void InterleavedWriteQueue::FlushPendingSessions() {
+  PendingSessions *thePending = GetThreadPendingSessions();
+  for (UInt32 i = 0; i < thePending->fNumSessions; i++) {
+    RTSPSessionInterface *theSession = thePending->fSessions[i];
+    InterleavedWriteQueue *theQueue = theSession->GetInterleavedQueue();
+    if (!theSession->GetSessionMutex()->TryLock()) {
+      // mark it first, then try again: the holder either sees the mark when it unlocks, or has unlocked already
+      theQueue->fHandedOff.store(true);
+      if (!theSession->GetSessionMutex()->TryLock())
+        continue;
+
+      if (!theQueue->TakeHandOff()) {
+        // the holder unlocked meanwhile and wrote it
+        theSession->GetSessionMutex()->Unlock();
+        continue;
+      }
+    }
+
+    theQueue->fIsPending = false;
+    theSession->FlushInterleavedQueue();
+    theSession->GetSessionMutex()->Unlock();
+
+    // the hold taken by AddPendingSession, the session may go away after this
+    theSession->DecrementObjectHolderCount();
+  }
+  thePending->fNumSessions = 0;
+
+  ReapOrphanedZeroCopySends();
+}
+
+bool InterleavedWriteQueue::TakeHandOff() {
+  if (!fHandedOff.exchange(false))
+    return false;
+
+  fIsPending = false;
+  return true;
+}
+
+/**
+ * 连接关闭时仍在发送的零拷贝数据引用着池中 PacketBuffer 的页面，内核确认前不能归还缓冲区：
+ * 用 dup 的描述符保持 socket，队列挂到孤儿列表，由 FlushPendingSessions 继续读取完成通知
+ */
+void InterleavedWriteQueue::Destroy(InterleavedWriteQueue *inQueue, int inSocketFD) {
+  if (inQueue == nullptr)
+    return;
+
+  inQueue->ReapZeroCopySends(inSocketFD);
+  if (inQueue->fNumZeroCopySends == 0) {
+    delete inQueue;
+    return;
+  }
+
+#if INTERLEAVED_ZERO_COPY
+  int theFD = ::dup(inSocketFD);
+  if (theFD < 0) {
+    // no way to learn when the kernel is done, keep the buffers rather than reuse the pages early
+    return;
+  }
+
+  // the owner's close only drops its reference now, end the connection here
+  ::shutdown(theFD, SHUT_RDWR);
+
+  inQueue->fOrphanFD = theFD;
+  OrphanedQueues *theOrphans = GetOrphanedQueues();
+  CF::Core::MutexLocker locker(&theOrphans->fMutex);
+  inQueue->fNextOrphan = theOrphans->fFirst;
+  theOrphans->fFirst = inQueue;
+  theOrphans->fNumQueues++;
+#endif
+}
+
+void InterleavedWriteQueue::ReapOrphanedZeroCopySends() {
+#if INTERLEAVED_ZERO_COPY
+  OrphanedQueues *theOrphans = GetOrphanedQueues();
+  if (theOrphans->fNumQueues.load() == 0 || !theOrphans->fMutex.TryLock())
+    return;
+
+  InterleavedWriteQueue **theLink = &theOrphans->fFirst;
+  while (*theLink != nullptr) {
+    InterleavedWriteQueue *theQueue = *theLink;
+    theQueue->ReapZeroCopySends(theQueue->fOrphanFD);
+    if (theQueue->fNumZeroCopySends > 0) {
+      theLink = &theQueue->fNextOrphan;
+      continue;
+    }
+
+    *theLink = theQueue->fNextOrphan;
+    theOrphans->fNumQueues--;
+    ::close(theQueue->fOrphanFD);
+    delete theQueue;
+  }
+
+  theOrphans->fMutex.Unlock();
+#endif
+}
+
+InterleavedWriteQueue::InterleavedWriteQueue()
+    : fNumVectors(0),
+      fNumBytes(0),
+      fLastCoalescedVector(-1),
+      fCoalesceBuffer(nullptr),
+      fCoalesceLen(0),
+      fNumPacketBuffers(0),
+      fAllPayloadsHeld(true),
+      fIsPending(false),
+      fHandedOff(false),
+      fOrphanFD(-1),
+      fNextOrphan(nullptr),
+      fZeroCopyState(kZeroCopyUnknown),
+      fNextZeroCopyID(0),
+      fFirstZeroCopySend(0),
+      fNumZeroCopySends(0) {
+  ::memset(fVectors, 0, sizeof(fVectors));
+}
+
+InterleavedWriteQueue::~InterleavedWriteQueue() {
+  // see Destroy, the pages of a zero copy send are reused as soon as its buffers go back to the pool
+  Assert(fNumZeroCopySends == 0);
+  this->ReleasePacketBuffers();
+  delete[] fCoalesceBuffer;
+}
+
+void InterleavedWriteQueue::ReleasePacketBuffers() {
+  for (UInt32 i = 0; i < fNumPacketBuffers; i++)
+    fPacketBuffers[i]->Release();
+  fNumPacketBuffers = 0;
+}
+
+bool InterleavedWriteQueue::Queue(UInt8 inChannel, char *inPacket, UInt32 inLen, char *inHeader, UInt32 inHeaderLen,
+                                  PacketBuffer *inPacketBuffer) {
+  if (inHeader == nullptr || inHeaderLen > inLen)
+    inHeaderLen = 0;
+
+  UInt32 thePayloadLen = inLen - inHeaderLen;
+  bool coalescePayload = thePayloadLen <= kMaxCoalescedPayload;
+  UInt32 theCopyLen = kInterleaveHeaderSize + inHeaderLen + (coalescePayload ? thePayloadLen : 0);
+
+  if (fCoalesceLen + theCopyLen > kCoalesceBufferSize || fNumVectors + 2 > kMaxVectors)
+    return false;
+
+  if (fCoalesceBuffer == nullptr)
+    fCoalesceBuffer = new char[kCoalesceBufferSize];
+
+  // '$' + channel + length, then the rewritten header, then a small payload
+  char *theCopy = fCoalesceBuffer + fCoalesceLen;
+  theCopy[0] = '$';
+  theCopy[1] = (char) inChannel;
+  theCopy[2] = (char) ((inLen >> 8) & 0xff);
+  theCopy[3] = (char) (inLen & 0xff);
+  if (inHeaderLen > 0)
+    ::memcpy(theCopy + kInterleaveHeaderSize, inHeader, inHeaderLen);
+  if (coalescePayload && thePayloadLen > 0)
+    ::memcpy(theCopy + kInterleaveHeaderSize + inHeaderLen, inPacket + inHeaderLen, thePayloadLen);
+  fCoalesceLen += theCopyLen;
+
+  if (fLastCoalescedVector >= 0) {
+    // still right after the previous coalesced bytes, grow their vector
+    fVectors[fLastCoalescedVector].iov_len += theCopyLen;
+  } else {
+    fNumVectors++;
+    fVectors[fNumVectors].iov_base = theCopy;
+    fVectors[fNumVectors].iov_len = theCopyLen;
+    fLastCoalescedVector = (SInt32) fNumVectors;
+  }
+
+  if (!coalescePayload) {
+    fNumVectors++;
+    fVectors[fNumVectors].iov_base = inPacket + inHeaderLen;
+    fVectors[fNumVectors].iov_len = thePayloadLen;
+    fLastCoalescedVector = -1;
+
+    // the writer may free its packet before the flush
+    if (inPacketBuffer != nullptr) {
+      inPacketBuffer->Retain();
+      fPacketBuffers[fNumPacketBuffers++] = inPacketBuffer;
+    } else {
+      fAllPayloadsHeld = false;
+    }
+  }
+
+  fNumBytes += kInterleaveHeaderSize + inLen;
+  return true;
+}
+
+QTSS_Error InterleavedWriteQueue::Flush(RTSPResponseStream *inStream, int inSocketFD) {
+  if (fNumVectors == 0)
+    return QTSS_NoErr;
+
+  this->ReapZeroCopySends(inSocketFD);
+
+  QTSS_Error theErr;
+  UInt32 theLengthSent = 0;
+  bool zeroCopied = false;
+
+  // kAlwaysBuffer: what the socket doesn't take now is copied into the stream, and goes
+  // out before anything else written on the connection
+  if (this->CanZeroCopy(inStream, inSocketFD))
+    theErr = inStream->WriteVZeroCopy(fVectors, fNumVectors + 1, fNumBytes, &theLengthSent,
+                                      RTSPResponseStream::kAlwaysBuffer, &zeroCopied);
+  else
+    theErr = inStream->WriteV(fVectors, fNumVectors + 1, fNumBytes, &theLengthSent, RTSPResponseStream::kAlwaysBuffer);
+
+  // a zero copy send takes over the references, until the kernel is done with the pages
+  if (zeroCopied)
+    this->HoldZeroCopySend();
+  else
+    this->ReleasePacketBuffers();
+
+  fNumVectors = 0;
+  fNumBytes = 0;
+  fLastCoalescedVector = -1;
+  fCoalesceLen = 0;
+  fNumPacketBuffers = 0;
+  fAllPayloadsHeld = true;
+
+  return theErr;
+}
+
+bool InterleavedWriteQueue::CanZeroCopy(RTSPResponseStream *inStream, int inSocketFD) {
+#if INTERLEAVED_ZERO_COPY
+  if (fNumBytes < kZeroCopyMinBytes || !fAllPayloadsHeld || fNumPacketBuffers == 0)
+    return false;
+
+  // buffered bytes go first and would be copied anyway
+  if (inStream->GetNumBytesBuffered() > 0 || fNumZeroCopySends == kMaxZeroCopyInFlight)
+    return false;
+
+  if (fZeroCopyState == kZeroCopyUnknown) {
+    int theOne = 1;
+    if (::setsockopt(inSocketFD, SOL_SOCKET, SO_ZEROCOPY, &theOne, sizeof(theOne)) == 0)
+      fZeroCopyState = kZeroCopyEnabled;
+    else
+      fZeroCopyState = kZeroCopyDisabled;
+  }
+  return fZeroCopyState == kZeroCopyEnabled;
+#else
+  return false;
+#endif
+}
+
+/**
+ * 零拷贝发送的数据在内核确认前不能修改：持有负载的 PacketBuffer，合并缓冲随发送记录转移，下次入队时重新分配
+ */
+void InterleavedWriteQueue::HoldZeroCopySend() {
+  Assert(fNumZeroCopySends < kMaxZeroCopyInFlight);
+
+  ZeroCopySend &theSend = fZeroCopySends[(fFirstZeroCopySend + fNumZeroCopySends) % kMaxZeroCopyInFlight];
+  theSend.fID = fNextZeroCopyID++;
+  theSend.fCoalesceBuffer = fCoalesceBuffer;
+  theSend.fPacketBuffers = new PacketBuffer *[fNumPacketBuffers];
+  theSend.fNumPacketBuffers = fNumPacketBuffers;
+  for (UInt32 i = 0; i < fNumPacketBuffers; i++)
+    theSend.fPacketBuffers[i] = fPacketBuffers[i];
+  fNumZeroCopySends++;
+
+  fCoalesceBuffer = nullptr;
+}
+
+/**
+ * 读取 socket 错误队列中的完成通知, 每个通知确认 [ee_info, ee_data] 区间内的发送, 按发送顺序到达
+ */
+void InterleavedWriteQueue::ReapZeroCopySends(int inSocketFD) {
+#if INTERLEAVED_ZERO_COPY
+  while (fNumZeroCopySends > 0) {
+    alignas(struct cmsghdr) char theControl[128];
+    struct msghdr theMsg;
+    ::memset(&theMsg, 0, sizeof(theMsg));
+    theMsg.msg_control = theControl;
+    theMsg.msg_controllen = sizeof(theControl);
+
+    if (::recvmsg(inSocketFD, &theMsg, MSG_ERRQUEUE) < 0)
+      break; // EAGAIN: nothing more completed
+
+    for (struct cmsghdr *theCmsg = CMSG_FIRSTHDR(&theMsg); theCmsg != nullptr;
+         theCmsg = CMSG_NXTHDR(&theMsg, theCmsg)) {
+      if (!(theCmsg->cmsg_level == SOL_IP && theCmsg->cmsg_type == IP_RECVERR) &&
+          !(theCmsg->cmsg_level == SOL_IPV6 && theCmsg->cmsg_type == IPV6_RECVERR))
+        continue;
+
+      auto *theErr = (struct sock_extended_err *) CMSG_DATA(theCmsg);
+      if (theErr->ee_errno != 0 || theErr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      this->CompleteZeroCopySends(theErr->ee_data);
+    }
+  }
+#endif
+}
+
+void InterleavedWriteQueue::CompleteZeroCopySends(UInt32 inLastID) {
+  while (fNumZeroCopySends > 0) {
+    ZeroCopySend &theSend = fZeroCopySends[fFirstZeroCopySend];
+    if ((SInt32) (theSend.fID - inLastID) > 0)
+      break;
+
+    this->ReleaseZeroCopySend(theSend);
+    fFirstZeroCopySend = (fFirstZeroCopySend + 1) % kMaxZeroCopyInFlight;
+    fNumZeroCopySends--;
+  }
+}
+
+void InterleavedWriteQueue::ReleaseZeroCopySend(ZeroCopySend &inSend) {
+  for (UInt32 i = 0; i < inSend.fNumPacketBuffers; i++)
+    inSend.fPacketBuffers[i]->Release();
+  delete[] inSend.fPacketBuffers;
+  delete[] inSend.fCoalesceBuffer;
+
+  inSend.fPacketBuffers = nullptr;
+  inSend.fNumPacketBuffers = 0;
+  inSend.fCoalesceBuffer = nullptr;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file InterleavedWriteQueue.h
+ *
+ * Output queue of the RTP/RTCP packets interleaved on one RTSP connection.
+ *
+ * RTPStream queues interleaved packets here when the writer asks for it
+ * (qtssWriteFlagsBatchTCP) instead of issuing one writev per packet. The
+ * queue collects the packets of all streams of the session during a fan-out
+ * pass, and the writer's QTSS_FlushWriteBatch writes them with one writev
+ * through RTSPResponseStream, which buffers whatever a partial write leaves.
+ *
+ * The '$' headers, rewritten RTP headers and small payloads are coalesced
+ * into one buffer, so adjacent packets share an iovec. Larger payloads are
+ * referenced in place and held by their PacketBuffer until the flush, as
+ * with UDPSendBatcher; a payload without one must stay valid until then.
+ *
+ * Big flushes (a GOP burst to a new viewer) are sent with MSG_ZEROCOPY where
+ * the kernel supports it. The payload buffers and the coalesce buffer of
+ * such a send are retained until the kernel reports it complete on the
+ * socket error queue. A queue whose connection goes away with sends still in
+ * flight is kept, with a dup of the socket, until the kernel reports them.
+ *
+ * @note not thread safe, used under the session mutex of its RTSP session, which is
+ *       taken only to queue a packet and to flush.
+ */
+
+#ifndef __INTERLEAVED_WRITE_QUEUE_H__
+#define __INTERLEAVED_WRITE_QUEUE_H__
+
+#include <atomic>
+
+#include <CF/Types.h>
+
+#if !__WinSock__
+#include <sys/uio.h>
+#endif
+
+#include "QTSS.h"
+#include "RTSPResponseStream.h"
+#include "PacketBuffer.h"
+
+class RTSPSessionInterface;
+
+class InterleavedWriteQueue {
+ public:
+
+  enum {
+    kMaxVectors = 128,              // iovecs per flush, not counting the one left blank for WriteV
+    kCoalesceBufferSize = 8192,     // '$' headers, rewritten headers and small payloads
+    kMaxCoalescedPayload = 256,     // payloads up to this size are copied into the coalesce buffer
+    kInterleaveHeaderSize = 4,      // '$' + 1 byte channel + 2 bytes length
+    kZeroCopyMinBytes = 32 * 1024,  // smaller flushes are cheaper to copy
+    kMaxZeroCopyInFlight = 16,      // zero copy sends not yet reported complete
+    kMaxPendingSessions = 256,      // sessions with queued data on one thread
+  };
+
+  InterleavedWriteQueue();
+
+  //
+  // Delete the queue of a connection that goes away, inSocketFD is still open.
+  // The buffers of the zero copy sends the kernel hasn't reported yet are not released until it does.
+  static void Destroy(InterleavedWriteQueue *inQueue, int inSocketFD);
+
+  bool IsEmpty() { return fNumVectors == 0; }
+
+  UInt32 GetNumBytes() { return fNumBytes; }
+
+  //
+  // Queue one interleaved packet, inHeader is written in place of the first inHeaderLen bytes of inPacket.
+  // Returns false if the queue is full, the caller must flush it first.
+  bool Queue(UInt8 inChannel, char *inPacket, UInt32 inLen, char *inHeader, UInt32 inHeaderLen,
+             PacketBuffer *inPacketBuffer);
+
+  //
+  // Write everything queued to inStream. What the socket doesn't take is buffered by inStream,
+  // so the queue is always empty afterwards.
+  QTSS_Error Flush(RTSPResponseStream *inStream, int inSocketFD);
+
+  //
+  // Sessions with queued data are remembered per thread until the writer flushes its batch.
+  // A pending session is held by its object holder count, so it doesn't go away before the flush.
+  // The caller holds the session mutex, the flush takes it again only while writing the queue.
+  static void AddPendingSession(RTSPSessionInterface *inSession);
+
+  //
+  // A session whose mutex is held is handed off to the holder, which writes its queue when it
+  // unlocks (RTSPSessionInterface::UnlockSessionMutex), so no session stays on the list.
+  static void FlushPendingSessions();
+
+  bool IsPending() { return fIsPending; }
+
+  bool IsHandedOff() { return fHandedOff.load(); }
+
+  //
+  // The caller holds the session mutex. Returns true if the queue was handed off and not yet taken,
+  // the caller then flushes it and drops the hold of the pending list.
+  bool TakeHandOff();
+
+ private:
+
+  struct ZeroCopySend {
+    UInt32 fID;                   // kernel zero copy counter of the send
+    char *fCoalesceBuffer;
+    PacketBuffer **fPacketBuffers;
+    UInt32 fNumPacketBuffers;
+  };
+
+  ~InterleavedWriteQueue();
+
+  static void ReapOrphanedZeroCopySends();
+
+  bool CanZeroCopy(RTSPResponseStream *inStream, int inSocketFD);
+  void HoldZeroCopySend();
+  void ReapZeroCopySends(int inSocketFD);
+  void CompleteZeroCopySends(UInt32 inLastID);
+  void ReleaseZeroCopySend(ZeroCopySend &inSend);
+  void ReleasePacketBuffers();
+
+  // the first one is left blank for RTSPResponseStream::WriteV
+  struct iovec fVectors[kMaxVectors + 1];
+  UInt32 fNumVectors;
+  UInt32 fNumBytes;
+  SInt32 fLastCoalescedVector;  // the vector the next coalesced bytes can be appended to, -1 if none
+
+  char *fCoalesceBuffer;
+  UInt32 fCoalesceLen;
+
+  // the buffers of the referenced payloads, held until the flush, or by a zero copy send
+  PacketBuffer *fPacketBuffers[kMaxVectors];
+  UInt32 fNumPacketBuffers;
+  bool fAllPayloadsHeld;        // every referenced payload has a PacketBuffer
+
+  bool fIsPending;
+  std::atomic_bool fHandedOff;  // left to the holder of the session mutex by FlushPendingSessions
+
+  // a queue still waiting for zero copy completions after its connection went away
+  int fOrphanFD;
+  InterleavedWriteQueue *fNextOrphan;
+
+  enum {
+    kZeroCopyUnknown = 0,
+    kZeroCopyEnabled = 1,
+    kZeroCopyDisabled = 2,
+  };
+  UInt32 fZeroCopyState;
+  UInt32 fNextZeroCopyID;
+  ZeroCopySend fZeroCopySends[kMaxZeroCopyInFlight];
+  UInt32 fFirstZeroCopySend;
+  UInt32 fNumZeroCopySends;
+};
+
+#endif // __INTERLEAVED_WRITE_QUEUE_H__
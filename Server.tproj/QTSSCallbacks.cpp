@@ -35,6 +35,8 @@
 #include "QTSSFile.h"
 #include "QTSSSocket.h"
 #include "QTSSDataConverter.h"
+#include "UDPSendBatcher.h"
+#include "InterleavedWriteQueue.h"
 
 //#include "EasyProtocolDef.h"
 //#include "EasyProtocol.h"
@@ -896,3 +898,8 @@ void QTSSCallbacks::QTSS_LockStdLib() {
 void QTSSCallbacks::QTSS_UnlockStdLib() {
   ::GetStdLibMutex()->Unlock();
 }
+
+void QTSSCallbacks::QTSS_FlushWriteBatch() {
+  InterleavedWriteQueue::FlushPendingSessions();
+  UDPSendBatcher::GetThreadBatcher()->Flush();
+}
@@ -158,6 +158,8 @@ class QTSSCallbacks {
   static void QTSS_LockStdLib();
   static void QTSS_UnlockStdLib();
 
+  static void QTSS_FlushWriteBatch();
+
   static void *Easy_GetRTSPPushSessions();
 };
 
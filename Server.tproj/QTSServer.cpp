@@ -63,6 +63,7 @@
 #include "QTSSAccessLogModule.h"
 #include "QTSSFlowControlModule.h"
 #include "QTSSReflectorModule.h"
+#include "QTSSFileModule.h"
 //#include "EasyCMSModule.h"
 //#include "EasyRedisModule.h"
 
@@ -219,8 +220,8 @@ bool QTSServer::Initialize(XMLPrefsParser *inPrefsSource, PrefsSource *inMessage
   //
   // CREATE GLOBAL OBJECTS
   fSocketPool = new RTPSocketPool();
-  fRTPMap = new RefTable(kRTPSessionMapSize);
-  fReflectorSessionMap = new RefTable(kReflectorSessionMapSize);
+  fRTPMap = new ShardedRefTable(kRTPSessionMapSize);
+  fReflectorSessionMap = new ShardedRefTable(kReflectorSessionMapSize);
 
   //
   // Load ERROR LOG module only. This is good in case there is a startup error.
@@ -324,7 +325,6 @@ void QTSServer::InitModules(QTSS_ServerState inEndState) {
 }
 
 void QTSServer::StartTasks() {
-  fRTCPTask = new RTCPTask();
   fStatsTask = new RTPStatsUpdaterTask();
 
   //
@@ -657,6 +657,11 @@ void QTSServer::LoadCompiledInModules() {
   (void) theReflectorModule->SetupModule(&sCallbacks, &QTSSReflectorModule_Main);
   (void) AddModule(theReflectorModule);
 
+  // 点播模块, 在转发模块之后, 只处理转发模块没有接受的请求
+  QTSSModule *theFileModule = new QTSSModule("QTSSFileModule");
+  (void) theFileModule->SetupModule(&sCallbacks, &QTSSFileModule_Main);
+  (void) AddModule(theFileModule);
+
   // RTP access log module
   QTSSModule *theAccessLog = new QTSSModule("QTSSAccessLogModule");
   (void) theAccessLog->SetupModule(&sCallbacks, &QTSSAccessLogModule_Main);
@@ -792,6 +797,8 @@ void QTSServer::InitCallbacks() {
   sCallbacks.addr[kLockStdLibCallback] = (QTSS_CallbackProcPtr) QTSSCallbacks::QTSS_LockStdLib;
   sCallbacks.addr[kUnlockStdLibCallback] = (QTSS_CallbackProcPtr) QTSSCallbacks::QTSS_UnlockStdLib;
 
+  sCallbacks.addr[kFlushWriteBatchCallback] = (QTSS_CallbackProcPtr) QTSSCallbacks::QTSS_FlushWriteBatch;
+
 }
 
 void QTSServer::LoadModules(QTSServerPrefs *inPrefs) {
@@ -1102,24 +1109,36 @@ bool RTSPListenerSocket::OverMaxConnections(UInt32 buffer) {
 }
 
 Net::UDPSocketPair *RTPSocketPool::ConstructUDPSocketPair() {
-  Thread::Task *theTask = ((QTSServer *) QTSServerInterface::GetServer())->fRTCPTask;
+  // every pair gets its own RTCP task, so RTCP of different pairs is received
+  // in parallel by the task threads
+  auto *theTask = new RTCPTask();
 
   // construct a pair of UDP sockets, the lower one for RTP data (outgoing only, no demuxer
   // necessary), and one for RTCP data (incoming, so definitely need a demuxer).
-  // These are nonblocking sockets that DON'T receive events (we are going to poll for data)
   // They do receive events - we don't poll from them anymore
-  // 在 RTCPTask 的 Run 函数里,会寻找带有 Demuxer 的 socket,将接收到的数据交由 Demuxer 相联
-  // 系的 Task 进行处理。
-  // 注意这里传入的是 fRTCPTask!
-  return new Net::UDPSocketPair(
+  // 在 RTCPTask 的 Run 函数里,将这一对 socket 接收到的数据交由 Demuxer 相联系的 RTPStream 进行处理。
+  auto *thePair = new RTCPSocketPair(
+      theTask,
       new Net::UDPSocket(theTask, Net::Socket::kNonBlockingSocketType | Net::Socket::kEdgeTriggeredSocketMode),
       new Net::UDPSocket(theTask, Net::UDPSocket::kWantsDemuxer | Net::Socket::kNonBlockingSocketType | Net::Socket::kEdgeTriggeredSocketMode));
+  theTask->Attach(thePair);
+  return thePair;
 }
 
 void RTPSocketPool::DestructUDPSocketPair(Net::UDPSocketPair *inPair) {
-  delete inPair->GetSocketA();
-  delete inPair->GetSocketB();
-  delete inPair;
+  auto *thePair = (RTCPSocketPair *) inPair;
+  RTCPTask *theTask = thePair->GetTask();
+
+  // wait for the task to be done with the pair
+  theTask->Detach();
+
+  // deleting the sockets unregisters them from the event thread, they can't signal the task anymore
+  delete thePair->GetSocketA();
+  delete thePair->GetSocketB();
+  delete thePair;
+
+  // the task deletes itself
+  theTask->Signal(Thread::Task::kKillEvent);
 }
 
 void RTPSocketPool::SetUDPSocketOptions(Net::UDPSocketPair *inPair) {
@@ -277,11 +277,14 @@ void QTSServerInterface::LogError(QTSS_ErrorVerbosity inVerbosity, char *inBuffe
 }
 
 void QTSServerInterface::KillAllRTPSessions() {
-  Core::MutexLocker locker(fRTPMap->GetMutex());
-  for (RefHashTableIter theIter(fRTPMap->GetHashTable()); !theIter.IsDone(); theIter.Next()) {
-    Ref *theRef = theIter.GetCurrent();
-    auto *theSession = (RTPSessionInterface *) theRef->GetObject();
-    theSession->Signal(Thread::Task::kKillEvent);
+  for (UInt32 theShard = 0; theShard < fRTPMap->GetNumShards(); theShard++) {
+    RefTable *theTable = fRTPMap->GetShard(theShard);
+    Core::MutexLocker locker(theTable->GetMutex());
+    for (RefHashTableIter theIter(theTable->GetHashTable()); !theIter.IsDone(); theIter.Next()) {
+      Ref *theRef = theIter.GetCurrent();
+      auto *theSession = (RTPSessionInterface *) theRef->GetObject();
+      theSession->Signal(Thread::Task::kKillEvent);
+    }
   }
 }
 
@@ -453,7 +456,7 @@ SInt64 RTPStatsUpdaterTask::Run() {
     SInt32 maxKBits = theServer->GetPrefs()->GetMaxKBitsBandwidth();
     if ((maxKBits > -1) && (theServer->fAvgRTPBandwidthInBits > ((UInt32) maxKBits * 1024))) {
       //we need to make sure that all of this happens atomically write the session map
-      Core::MutexLocker locker2(theServer->GetRTPSessionMap()->GetMutex());
+      ShardedRefTableLocker locker2(theServer->GetRTPSessionMap());
       RTPSessionInterface *theSession = this->GetNewestSession(theServer->fRTPMap);
       if (theSession != nullptr)
         if ((curTime - theSession->GetSessionCreateTime()) < theServer->GetPrefs()->GetSafePlayDurationInSecs() * 1000)
@@ -471,21 +474,24 @@ SInt64 RTPStatsUpdaterTask::Run() {
 }
 
 /**
- * @note Caller must lock down the RTP session map
+ * @note Caller must lock down all the shards of the RTP session map
  */
-RTPSessionInterface *RTPStatsUpdaterTask::GetNewestSession(RefTable *inRTPSessionMap) {
+RTPSessionInterface *RTPStatsUpdaterTask::GetNewestSession(ShardedRefTable *inRTPSessionMap) {
   SInt64 theNewestPlayTime = 0;
   RTPSessionInterface *theNewestSession = nullptr;
 
   // use the session map to iterate through all the sessions, finding the most
   // recently connected client
-  for (RefHashTableIter theIter(inRTPSessionMap->GetHashTable()); !theIter.IsDone(); theIter.Next()) {
-    Ref *theRef = theIter.GetCurrent();
-    auto theSession = (RTPSessionInterface *) theRef->GetObject();
-    Assert(theSession->GetSessionCreateTime() > 0);
-    if (theSession->GetSessionCreateTime() > theNewestPlayTime) {
-      theNewestPlayTime = theSession->GetSessionCreateTime();
-      theNewestSession = theSession;
+  for (UInt32 theShard = 0; theShard < inRTPSessionMap->GetNumShards(); theShard++) {
+    RefHashTable *theHashTable = inRTPSessionMap->GetShard(theShard)->GetHashTable();
+    for (RefHashTableIter theIter(theHashTable); !theIter.IsDone(); theIter.Next()) {
+      Ref *theRef = theIter.GetCurrent();
+      auto theSession = (RTPSessionInterface *) theRef->GetObject();
+      Assert(theSession->GetSessionCreateTime() > 0);
+      if (theSession->GetSessionCreateTime() > theNewestPlayTime) {
+        theNewestPlayTime = theSession->GetSessionCreateTime();
+        theNewestSession = theSession;
+      }
     }
   }
   return theNewestSession;
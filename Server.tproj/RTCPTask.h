@@ -25,33 +25,61 @@
 /*
     File:       RTCPTask.h
 
-    Contains:   A task object that processes all incoming RTCP packets
-                for the server, and passes each one onto the task for
-                which it belongs.
+    Contains:   A task object that processes the incoming RTCP packets of
+                one RTP socket pair, and passes each one onto the RTPStream
+                to which it belongs.
+
+                Each socket pair of the RTP socket pool gets its own task,
+                signalled by the events of its sockets, so RTCP reception is
+                spread over the task threads and never takes the pool mutex.
 
 */
 
 #ifndef __RTCP_TASK_H__
 #define __RTCP_TASK_H__
 
+#include <CF/Core/Mutex.h>
 #include <CF/Thread/Task.h>
+#include <CF/Net/Socket/UDPSocketPool.h>
 
 /**
- * This task handles all incoming RTCP data.
+ * This task handles the incoming RTCP data of one socket pair.
  */
 class RTCPTask : public CF::Thread::Task {
  public:
-  RTCPTask() : Task() {
+  RTCPTask() : Task(), fSocketPair(nullptr) {
     this->SetTaskName("RTCPTask");
-
-    // It just polls, so make sure to start the polling process by signalling a start event.
-    this->Signal(kStartEvent);
   }
 
   ~RTCPTask() override = default;
 
+  //
+  // The pair is constructed with this task as the event target of its sockets,
+  // and attached once it exists. Detach before the pair is destroyed, and signal
+  // kKillEvent once its sockets are gone: the task then deletes itself.
+  void Attach(CF::Net::UDPSocketPair *inPair);
+
+  void Detach();
+
  private:
   SInt64 Run() override;
+
+  CF::Core::Mutex fMutex;   // held while the pair is being drained
+  CF::Net::UDPSocketPair *fSocketPair;
+};
+
+/**
+ * A socket pair of the RTP socket pool, with the task that receives its RTCP.
+ */
+class RTCPSocketPair : public CF::Net::UDPSocketPair {
+ public:
+  RTCPSocketPair(RTCPTask *inTask, CF::Net::UDPSocket *inSocketA, CF::Net::UDPSocket *inSocketB)
+      : UDPSocketPair(inSocketA, inSocketB), fTask(inTask) {}
+
+  RTCPTask *GetTask() { return fTask; }
+
+ private:
+  RTCPTask *fTask;
 };
 
 #endif //__RTCP_TASK_H__
@@ -31,9 +31,11 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "RTPPacketResender.h"
 #include "RTPStream.h"
+#include "RTPPacketView.h"
 
 #if RTP_PACKET_RESENDER_DEBUGGING
 #include "QTSSRollingLog.h"
@@ -72,13 +74,7 @@ public:
 
 using namespace CF;
 
-static const UInt32 kPacketArrayIncreaseInterval = 32;// must be multiple of 2
-static const UInt32 kInitialPacketArraySize =
-    64;// must be multiple of kPacketArrayIncreaseInterval (Turns out this is as big as we typically need)
-//static const UInt32 kMaxPacketArraySize = 512;// must be multiple of kPacketArrayIncreaseInterval it would have to be a 3 mbit or more
-
-static const UInt32 kMaxDataBufferSize = 1600;
-BufferPool RTPPacketResender::sBufferPool(kMaxDataBufferSize);
+std::atomic_uint RTPPacketResender::sNumBuffers{0};
 std::atomic_uint RTPPacketResender::sNumWastedBytes{0};
 
 RTPPacketResender::RTPPacketResender()
@@ -94,32 +90,29 @@ RTPPacketResender::RTPPacketResender()
       fNumSent(0),
       fPacketArray(NULL),
       fPacketArraySize(kInitialPacketArraySize),
-      fPacketArrayMask(0),
-      fHighestSeqNum(0),
-      fLastUsed(0),
+      fPacketArrayMask(kInitialPacketArraySize - 1),
+      fLastWheelTick(0),
       fPacketQMutex() {
-  fPacketArray = (RTPResenderEntry *) new char[sizeof(RTPResenderEntry)
-      * fPacketArraySize];
+  fPacketArray = (RTPResenderEntry *) new char[sizeof(RTPResenderEntry) * fPacketArraySize];
   ::memset(fPacketArray, 0, sizeof(RTPResenderEntry) * fPacketArraySize);
 
+  for (UInt32 x = 0; x < kWheelSlots; x++)
+    fWheel[x] = RTPResenderEntry::kNoEntry;
 }
 
 RTPPacketResender::~RTPPacketResender() {
   for (UInt32 x = 0; x < fPacketArraySize; x++) {
-    if (fPacketArray[x].fPacketSize > 0)
-      //atomic_sub(&sNumWastedBytes, kMaxDataBufferSize - fPacketArray[x].fPacketSize);
-      sNumWastedBytes.fetch_sub(
-          kMaxDataBufferSize - fPacketArray[x].fPacketSize);
-    if (fPacketArray[x].fPacketData != NULL) {
-      if (fPacketArray[x].fIsSpecialBuffer)
-        delete[](char *) fPacketArray[x].fPacketData;
-      else
-        sBufferPool.Put(fPacketArray[x].fPacketData);
-    }
-  }
+    RTPResenderEntry *theEntry = &fPacketArray[x];
+    if (theEntry->fBuffer == NULL)
+      continue;
 
-  delete[] fPacketArray;
+    if (theEntry->fIsCopy)
+      sNumWastedBytes.fetch_sub(theEntry->fBuffer->GetCapacity() - theEntry->fPacketSize);
+    sNumBuffers.fetch_sub(1);
+    theEntry->fBuffer->Release();
+  }
 
+  delete[] (char *) fPacketArray;
 }
 
 #if RTP_PACKET_RESENDER_DEBUGGING
@@ -225,87 +218,134 @@ void RTPPacketResender::SetDestination(Net::UDPSocket *inOutputSocket,
   fDestPort = inDestPort;
 }
 
-RTPResenderEntry *RTPPacketResender::GetEmptyEntry(UInt16 inSeqNum,
-                                                   UInt32 inPacketSize) {
+RTPResenderEntry *RTPPacketResender::GetEntryBySeqNum(UInt16 inSeqNum) {
+  RTPResenderEntry *theEntry = &fPacketArray[inSeqNum & fPacketArrayMask];
+  if (theEntry->fBuffer == NULL || theEntry->fSeqNum != inSeqNum)
+    return NULL;
+  return theEntry;
+}
 
-  RTPResenderEntry *theEntry = NULL;
+RTPResenderEntry *RTPPacketResender::GetEmptyEntry(UInt16 inSeqNum) {
+  RTPResenderEntry *theEntry = &fPacketArray[inSeqNum & fPacketArrayMask];
+  if (theEntry->fBuffer == NULL)
+    return theEntry;
 
-  for (UInt32 packetIndex = 0; packetIndex < fPacketsInList;
-       packetIndex++) // see if packet is already in the array
-  {
-    if (inSeqNum == fPacketArray[packetIndex].fSeqNum) {
-      return NULL;
-    }
-  }
+  if (theEntry->fSeqNum == inSeqNum) // packet is already in the array
+    return NULL;
 
-  if (fPacketsInList == fPacketArraySize) // allocate a new array
-  {
-    fPacketArraySize += kPacketArrayIncreaseInterval;
-    RTPResenderEntry *tempArray =
-        (RTPResenderEntry *) new char[sizeof(RTPResenderEntry)
-            * fPacketArraySize];
-    ::memset(tempArray, 0, sizeof(RTPResenderEntry) * fPacketArraySize);
-    ::memcpy(tempArray,
-             fPacketArray,
-             sizeof(RTPResenderEntry) * fPacketsInList);
-    delete[] fPacketArray;
-    fPacketArray = tempArray;
-    //s_printf("NewArray size=%" _S32BITARG_ " packetsInList=%" _S32BITARG_ "\n",fPacketArraySize, fPacketsInList);
+  // more packets in flight than slots: grow the ring, or once it's as big as
+  // allowed, drop the old packet in place and keep its window available
+  if (fPacketArraySize < kMaxPacketArraySize) {
+    this->ReallocatePacketArray(fPacketArraySize * 2);
+    return this->GetEmptyEntry(inSeqNum);
   }
 
-  if (fPacketsInList < fPacketArraySize) // have an open spot
-  {
-    theEntry = &fPacketArray[fPacketsInList];
-    fPacketsInList++;
+  fBandwidthTracker->EmptyWindow(theEntry->fPacketSize, false);
+  this->RemovePacket(theEntry);
+  return theEntry;
+}
 
-    if (fPacketsInList < fPacketArraySize)
-      fLastUsed = fPacketsInList;
-    else
-      fLastUsed = fPacketArraySize;
-  } else {
-    // nothing open so re-use
-    if (fLastUsed < fPacketArraySize - 1)
-      fLastUsed++;
-    else
-      fLastUsed = 0;
-
-    //s_printf("array is full = %"   _U32BITARG_   " reusing index=%"   _U32BITARG_   "\n",fPacketsInList,fLastUsed);
-    theEntry = &fPacketArray[fLastUsed];
-    RemovePacket(fLastUsed,
-                 false); // delete packet in place don't fill we will use the spot
+void RTPPacketResender::ReallocatePacketArray(UInt32 inNewSize) {
+  RTPResenderEntry *theOldArray = fPacketArray;
+  UInt32 theOldSize = fPacketArraySize;
+
+  fPacketArray = (RTPResenderEntry *) new char[sizeof(RTPResenderEntry) * inNewSize];
+  ::memset(fPacketArray, 0, sizeof(RTPResenderEntry) * inNewSize);
+  fPacketArraySize = inNewSize;
+  fPacketArrayMask = inNewSize - 1;
+
+  // the wheel lists are linked by seq, but entries may be dropped below: rebuild it
+  for (UInt32 x = 0; x < kWheelSlots; x++)
+    fWheel[x] = RTPResenderEntry::kNoEntry;
+
+  for (UInt32 x = 0; x < theOldSize; x++) {
+    RTPResenderEntry *theOldEntry = &theOldArray[x];
+    if (theOldEntry->fBuffer == NULL)
+      continue;
+
+    RTPResenderEntry *theEntry = &fPacketArray[theOldEntry->fSeqNum & fPacketArrayMask];
+    if (theEntry->fBuffer != NULL) {
+      // seqs still collide, the ring is meant for a contiguous window of packets
+      fBandwidthTracker->EmptyWindow(theOldEntry->fPacketSize, false);
+      if (theOldEntry->fIsCopy)
+        sNumWastedBytes.fetch_sub(theOldEntry->fBuffer->GetCapacity() - theOldEntry->fPacketSize);
+      sNumBuffers.fetch_sub(1);
+      theOldEntry->fBuffer->Release();
+      fPacketsInList--;
+      continue;
+    }
+
+    *theEntry = *theOldEntry;
+    if (theEntry->fDueTime != 0)
+      this->Schedule(theEntry, theEntry->fDueTime);
   }
 
-  //
-  // Check to see if this packet is too big for the buffer. If it is, then
-  // we need to specially allocate a special buffer
-  if (inPacketSize > kMaxDataBufferSize) {
-    //sBufferPool.Put(theEntry->fPacketData);
-    theEntry->fIsSpecialBuffer = true;
-    theEntry->fPacketData = new char[inPacketSize];
-  } else// It is not special, it's from the buffer pool
-  {
-    theEntry->fIsSpecialBuffer = false;
-    theEntry->fPacketData = sBufferPool.Get();
+  delete[] (char *) theOldArray;
+  //s_printf("NewArray size=%" _S32BITARG_ " packetsInList=%" _S32BITARG_ "\n",fPacketArraySize, fPacketsInList);
+}
+
+/**
+ * put the entry in the timer wheel list of inDueTime
+ */
+void RTPPacketResender::Schedule(RTPResenderEntry *inEntry, SInt64 inDueTime) {
+  SInt32 *theHead = &fWheel[(inDueTime / kWheelTickMSecs) & (kWheelSlots - 1)];
+
+  inEntry->fDueTime = inDueTime;
+  inEntry->fPrevDue = RTPResenderEntry::kNoEntry;
+  inEntry->fNextDue = *theHead;
+  if (*theHead != RTPResenderEntry::kNoEntry)
+    fPacketArray[*theHead & fPacketArrayMask].fPrevDue = inEntry->fSeqNum;
+  *theHead = inEntry->fSeqNum;
+}
+
+void RTPPacketResender::Unschedule(RTPResenderEntry *inEntry) {
+  if (inEntry->fDueTime == 0) // not in the wheel
+    return;
+
+  if (inEntry->fPrevDue == RTPResenderEntry::kNoEntry)
+    fWheel[(inEntry->fDueTime / kWheelTickMSecs) & (kWheelSlots - 1)] = inEntry->fNextDue;
+  else
+    fPacketArray[inEntry->fPrevDue & fPacketArrayMask].fNextDue = inEntry->fNextDue;
+
+  if (inEntry->fNextDue != RTPResenderEntry::kNoEntry)
+    fPacketArray[inEntry->fNextDue & fPacketArrayMask].fPrevDue = inEntry->fPrevDue;
+
+  inEntry->fDueTime = 0;
+  inEntry->fPrevDue = inEntry->fNextDue = RTPResenderEntry::kNoEntry;
+}
+
+void RTPPacketResender::SendEntry(RTPResenderEntry *inEntry) {
+  if (inEntry->fHeaderLen == 0) {
+    fSocket->SendTo(fDestAddr, fDestPort, inEntry->fBuffer->GetData(), inEntry->fPacketSize);
+    return;
   }
 
-  return theEntry;
+  // the writer rewrote the header of the shared packet, AddPacket made sure it fits
+  char theFlatPacket[PacketBuffer::kDefaultCapacity];
+  ::memcpy(theFlatPacket, inEntry->fHeader, inEntry->fHeaderLen);
+  ::memcpy(theFlatPacket + inEntry->fHeaderLen, inEntry->fBuffer->GetData() + inEntry->fHeaderLen,
+           inEntry->fPacketSize - inEntry->fHeaderLen);
+  fSocket->SendTo(fDestAddr, fDestPort, theFlatPacket, inEntry->fPacketSize);
 }
 
 void RTPPacketResender::ClearOutstandingPackets() {
   //OSMutexLocker packetQLocker(&fPacketQMutex);
-  //for (UInt16 packetIndex = 0; packetIndex < fPacketArraySize; packetIndex++) //Testing purposes
-  for (UInt16 packetIndex = 0; packetIndex < fPacketsInList; packetIndex++) {
-    this->RemovePacket(packetIndex, false);// don't move packets delete in place
-    Assert(fPacketArray[packetIndex].fPacketSize == 0);
+  for (UInt32 packetIndex = 0; packetIndex < fPacketArraySize && fPacketsInList > 0; packetIndex++) {
+    RTPResenderEntry *theEntry = &fPacketArray[packetIndex];
+    if (theEntry->fBuffer == NULL)
+      continue;
+
+    if (fBandwidthTracker != NULL)
+      fBandwidthTracker->EmptyWindow(theEntry->fPacketSize, false); // keep window available
+    this->RemovePacket(theEntry);
   }
   if (fBandwidthTracker != NULL)
     fBandwidthTracker->EmptyWindow(fBandwidthTracker->BytesInList()); //clean it out
-  fPacketsInList = 0; // deleting in place doesn't decrement
 
   Assert(fPacketsInList == 0);
 }
 
-void RTPPacketResender::AddPacket(void *inRTPPacket, UInt32 packetSize, SInt32 ageLimit) {
+void RTPPacketResender::AddPacket(QTSS_PacketStruct *inPacket, UInt32 packetSize, SInt32 ageLimit) {
   // 在 RTPStream::ReliableRTPWrite 函数(针对 qtssRTPTransportTypeReliableUDP)里,
   // 会调用 AddPacket 登记要发送的数据以及到期 Drop 的时间。
 
@@ -315,21 +355,55 @@ void RTPPacketResender::AddPacket(void *inRTPPacket, UInt32 packetSize, SInt32 a
 
   // we compute a re-transmit timeout based on the Karns RTT esmitate
 
-  UInt16 *theSeqNumP = (UInt16 *) inRTPPacket;
-  UInt16 theSeqNum = ntohs(theSeqNumP[1]);
+  UInt32 theHeaderLen = inPacket->packetHeader != NULL ? inPacket->packetHeaderLen : 0;
+
+  // the sequence number is in the rewritten header if there is one
+  UInt16 theSeqNum = theHeaderLen >= RTPPacketView::kSeqNumOffset + 2
+                     ? RTPPacketView((char *) inPacket->packetHeader, theHeaderLen).GetSeqNumber()
+                     : RTPPacketView((char *) inPacket->packetData, packetSize).GetSeqNumber();
 
   if (ageLimit > 0) {
-    RTPResenderEntry *theEntry = this->GetEmptyEntry(theSeqNum, packetSize);
+    RTPResenderEntry *theEntry = this->GetEmptyEntry(theSeqNum);
 
     //
     // This may happen if this sequence number has already been added.
     // That may happen if we have repeat packets in the stream.
-    if (theEntry == NULL || theEntry->fPacketSize > 0)
+    if (theEntry == NULL)
       return;
 
+    //
+    // Keep a reference on the writer's buffer, only the rewritten header is
+    // copied. Without a shared buffer (or with a header we can't keep) the
+    // packet is copied flat into a buffer of our own.
+    auto *theBuffer = (PacketBuffer *) inPacket->packetBuffer;
+    if (theBuffer != NULL && theHeaderLen <= RTPResenderEntry::kMaxHeaderSize
+        && packetSize <= PacketBuffer::kDefaultCapacity && packetSize <= theBuffer->GetCapacity()) {
+      theBuffer->Retain();
+      if (theHeaderLen > 0)
+        ::memcpy(theEntry->fHeader, inPacket->packetHeader, theHeaderLen);
+      theEntry->fHeaderLen = theHeaderLen;
+      theEntry->fIsCopy = false;
+    } else {
+      UInt32 theCapacity = packetSize > PacketBuffer::kDefaultCapacity ? packetSize : (UInt32) PacketBuffer::kDefaultCapacity;
+      theBuffer = PacketBuffer::Create(theCapacity);
+      if (theHeaderLen > packetSize)
+        theHeaderLen = packetSize;
+      if (theHeaderLen > 0)
+        ::memcpy(theBuffer->GetData(), inPacket->packetHeader, theHeaderLen);
+      ::memcpy(theBuffer->GetData() + theHeaderLen, (char *) inPacket->packetData + theHeaderLen, packetSize - theHeaderLen);
+      theBuffer->SetLen(packetSize);
+      theEntry->fHeaderLen = 0;
+      theEntry->fIsCopy = true;
+
+      //
+      // Track the number of wasted bytes we have
+      sNumWastedBytes.fetch_add(theBuffer->GetCapacity() - packetSize);
+    }
+    sNumBuffers.fetch_add(1);
+
     //
     // Reset all the information in the RTPResenderEntry
-    ::memcpy(theEntry->fPacketData, inRTPPacket, packetSize);
+    theEntry->fBuffer = theBuffer;
     theEntry->fPacketSize = packetSize;
     theEntry->fAddedTime = Core::Time::Milliseconds();
     theEntry->fOrigRetransTimeout = fBandwidthTracker->CurRetransmitTimeout();
@@ -337,17 +411,17 @@ void RTPPacketResender::AddPacket(void *inRTPPacket, UInt32 packetSize, SInt32 a
     theEntry->fNumResends = 0;
     theEntry->fSeqNum = theSeqNum;
 
-    //
-    // Track the number of wasted bytes we have
-    //atomic_add(&sNumWastedBytes, kMaxDataBufferSize - packetSize);
-    sNumWastedBytes.fetch_add(kMaxDataBufferSize - packetSize);
+    // looked at again once the re-transmit timeout has passed
+    this->Schedule(theEntry, theEntry->fAddedTime + theEntry->fOrigRetransTimeout + 1);
+
+    fPacketsInList++;
+    if (fPacketsInList > fMaxPacketsInList)
+      fMaxPacketsInList = fPacketsInList;
 
-    //PLDoubleLinkedListNode<RTPResenderEntry> * listNode = new PLDoubleLinkedListNode<RTPResenderEntry>( new RTPResenderEntry(inRTPPacket, packetSize, ageLimit, fRTTEstimator.CurRetransmitTimeout() ) );
-    //fAckList.AddNodeToTail(listNode);
     fBandwidthTracker->FillWindow(packetSize);
   } else {
 #if RTP_PACKET_RESENDER_DEBUGGING
-    this->logprintf("packet too old to add: seq# %li, age limit %li, cur late %li, track id %li\n", (SInt32)ntohs(*((UInt16*)(((char*)inRTPPacket) + 2))), (SInt32)ageLimit, fCurrentPacketDelay, fTrackID);
+    this->logprintf("packet too old to add: seq# %li, age limit %li, cur late %li, track id %li\n", (SInt32)theSeqNum, (SInt32)ageLimit, fCurrentPacketDelay, fTrackID);
 #endif
     fNumExpired++;
   }
@@ -360,19 +434,9 @@ void RTPPacketResender::AckPacket(UInt16 inSeqNum, SInt64 &inCurTimeInMsec) {
 
   //OSMutexLocker packetQLocker(&fPacketQMutex);
 
-  SInt32 foundIndex = -1;
-  for (UInt32 packetIndex = 0; packetIndex < fPacketsInList; packetIndex++) {
-    if (inSeqNum == fPacketArray[packetIndex].fSeqNum) {
-      foundIndex = packetIndex;
-      break;
-    }
-  }
-
-  RTPResenderEntry *theEntry = NULL;
-  if (foundIndex != -1)
-    theEntry = &fPacketArray[foundIndex];
+  RTPResenderEntry *theEntry = this->GetEntryBySeqNum(inSeqNum);
 
-  if (theEntry == NULL || theEntry->fPacketSize == 0) {   /*  we got an ack for a packet that has already expired or
+  if (theEntry == NULL) {   /*  we got an ack for a packet that has already expired or
 			for a packet whose re-transmit crossed with it's original ack
 
 		*/
@@ -421,122 +485,105 @@ void RTPPacketResender::AckPacket(UInt16 inSeqNum, SInt64 &inCurTimeInMsec) {
     } else {
 #if RTP_PACKET_RESENDER_DEBUGGING
       this->logprintf("re-tx'd packet acked.  ack num : %li, pack seq #: %li, num resends %li, track id %li, size %li, OS::MSecs %qd\n" \
-          , (SInt32)inSeqNum, (SInt32)ntohs(*((UInt16*)(((char*)theEntry->fPacketData) + 2))), (SInt32)theEntry->fNumResends
+          , (SInt32)inSeqNum, (SInt32)theEntry->fSeqNum, (SInt32)theEntry->fNumResends
           , (SInt32)fTrackID, theEntry->fPacketSize, OS::Milliseconds());
 #endif
     }
-    this->RemovePacket(foundIndex);
+    this->RemovePacket(theEntry);
   }
 }
 
-void RTPPacketResender::RemovePacket(UInt32 packetIndex, bool reuseIndex) {
+void RTPPacketResender::RemovePacket(RTPResenderEntry *inEntry) {
   //OSMutexLocker packetQLocker(&fPacketQMutex);
 
-  Assert(packetIndex < fPacketArraySize);
-  if (packetIndex >= fPacketArraySize)
+  if (inEntry->fBuffer == NULL)
     return;
 
-  if (fPacketsInList == 0)
-    return;
-
-  RTPResenderEntry *theEntry = &fPacketArray[packetIndex];
-  if (theEntry->fPacketSize == 0)
-    return;
+  this->Unschedule(inEntry);
 
   //
   // Track the number of wasted bytes we have
-  //atomic_sub(&sNumWastedBytes, kMaxDataBufferSize - theEntry->fPacketSize);
-  sNumWastedBytes.fetch_sub(kMaxDataBufferSize - theEntry->fPacketSize);
+  if (inEntry->fIsCopy)
+    sNumWastedBytes.fetch_sub(inEntry->fBuffer->GetCapacity() - inEntry->fPacketSize);
+  sNumBuffers.fetch_sub(1);
 
-  Assert(theEntry->fPacketSize > 0);
+  inEntry->fBuffer->Release();
+  ::memset(inEntry, 0, sizeof(RTPResenderEntry));
 
   //
   // Update our list information
   Assert(fPacketsInList > 0);
-
-  if (theEntry->fIsSpecialBuffer) {
-    delete[](char *) theEntry->fPacketData;
-  } else if (theEntry->fPacketData != NULL)
-    sBufferPool.Put(theEntry->fPacketData);
-
-  if (reuseIndex) // we are re-using the space so keep array contiguous
-  {
-    fPacketArray[packetIndex] = fPacketArray[fPacketsInList - 1];
-    ::memset(&fPacketArray[fPacketsInList - 1], 0, sizeof(RTPResenderEntry));
-    fPacketsInList--;
-
-  } else    // the array is full
-  {
-    fBandwidthTracker->EmptyWindow(theEntry->fPacketSize,
-                                   false); // keep window available
-    ::memset(theEntry, 0, sizeof(RTPResenderEntry));
-  }
-
+  fPacketsInList--;
 }
 
 void RTPPacketResender::ResendDueEntries() {
   // 在 RTPStream::ReliableRTPWrite 函数(针对 qtssRTPTransportTypeReliableUDP )里,会调
   // 用该函数,重发或者丢弃那些过期的 RTP 包。
 
-  if (fPacketsInList <= 0)
+  if (fPacketsInList == 0)
     return;
 
   //OSMutexLocker packetQLocker(&fPacketQMutex);
   //
-  SInt32 numResends = 0;
-  RTPResenderEntry *theEntry = NULL;
   SInt64 curTime = Core::Time::Milliseconds();
-  for (SInt32 packetIndex = fPacketsInList - 1;
-       packetIndex >= 0;
-       packetIndex--) { // walk backwards because remove packet moves array members forward
-    theEntry = &fPacketArray[packetIndex];
+  SInt64 curTick = curTime / kWheelTickMSecs;
 
-    if (theEntry->fPacketSize == 0)
-      continue;
+  // only the slots that came due since the last call, at most one lap of the wheel
+  SInt64 theTick = fLastWheelTick;
+  if (curTick - theTick > kWheelSlots)
+    theTick = curTick - kWheelSlots;
+
+  for (theTick++; theTick <= curTick; theTick++) {
+    // detach the list, the entries that are not due yet (a later lap) go back
+    SInt32 theSeqNum = fWheel[theTick & (kWheelSlots - 1)];
+    fWheel[theTick & (kWheelSlots - 1)] = RTPResenderEntry::kNoEntry;
+
+    while (theSeqNum != RTPResenderEntry::kNoEntry) {
+      RTPResenderEntry *theEntry = &fPacketArray[theSeqNum & fPacketArrayMask];
+      theSeqNum = theEntry->fNextDue;
+
+      SInt64 theDueTime = theEntry->fDueTime;
+      theEntry->fDueTime = 0;
+      theEntry->fPrevDue = theEntry->fNextDue = RTPResenderEntry::kNoEntry;
+
+      if (theDueTime > curTime) {
+        this->Schedule(theEntry, theDueTime);
+        continue;
+      }
+
+      // the re-transmit timeout may have grown since the entry was scheduled
+      if ((curTime - theEntry->fAddedTime) <= fBandwidthTracker->CurRetransmitTimeout()) {
+        this->Schedule(theEntry, theEntry->fAddedTime + fBandwidthTracker->CurRetransmitTimeout() + 1);
+        continue;
+      }
 
-    if ((curTime - theEntry->fAddedTime)
-        > fBandwidthTracker->CurRetransmitTimeout()) {
       // Change:  Only expire packets after they were due to be resent. This gives the client
       // a chance to ack them and improves congestion avoidance and RTT calculation
       if (curTime > theEntry->fExpireTime) {
 #if RTP_PACKET_RESENDER_DEBUGGING
-        unsigned char version;
-        version = *((char*)theEntry->fPacketData);
-        version &= 0x84;    // grab most sig 2 bits
-        version = version >> 6; // shift by 6 bits
-        this->logprintf("expired:  seq number %li, track id %li (port: %li), vers # %li, pack seq # %li, size: %li, OS::Msecs: %qd\n", \
-            (SInt32)ntohs(*((UInt16*)(((char*)theEntry->fPacketData) + 2))), fTrackID, (SInt32)ntohs(fDestPort), \
-            (SInt32)version, (SInt32)ntohs(*((UInt16*)(((char*)theEntry->fPacketData) + 2))), theEntry->fPacketSize, OS::Milliseconds());
+        this->logprintf("expired:  seq number %li, track id %li (port: %li), size: %li, OS::Msecs: %qd\n", \
+            (SInt32)theEntry->fSeqNum, fTrackID, (SInt32)ntohs(fDestPort), theEntry->fPacketSize, OS::Milliseconds());
 #endif
         //
         // This packet is expired
         fNumExpired++;
-        //s_printf("Packet expired: %d\n", ((UInt16*)thePacket)[1]);
         fBandwidthTracker->EmptyWindow(theEntry->fPacketSize);
-        this->RemovePacket(packetIndex);
-        //              s_printf("Expired packet %d\n", theEntry->fSeqNum);
+        this->RemovePacket(theEntry);
         continue;
       }
 
       // Resend this packet
-      fSocket->SendTo(fDestAddr,
-                      fDestPort,
-                      theEntry->fPacketData,
-                      theEntry->fPacketSize);
-      //s_printf("Packet resent: %d\n", ((UInt16*)theEntry->fPacketData)[1]);
+      this->SendEntry(theEntry);
 
       theEntry->fNumResends++;
 #if RTP_PACKET_RESENDER_DEBUGGING
-      this->logprintf("re-sent: %li RTO %li, track id %li (port %li), size: %li, OS::Ms %qd\n", (SInt32)ntohs(*((UInt16*)(((char*)theEntry->fPacketData) + 2))), curTime - theEntry->fAddedTime, \
+      this->logprintf("re-sent: %li RTO %li, track id %li (port %li), size: %li, OS::Ms %qd\n", (SInt32)theEntry->fSeqNum, curTime - theEntry->fAddedTime, \
           fTrackID, (SInt32)ntohs(fDestPort) \
           , theEntry->fPacketSize, OS::Milliseconds());
 #endif
 
       fNumResends++;
 
-      numResends++;
-      //s_printf("resend loop numResends=%" _S32BITARG_ " packet theEntry->fNumResends=%" _S32BITARG_ " stream fNumResends=\n",numResends,theEntry->fNumResends++, fNumResends);
-
       // ok -- lets try this.. add 1.5x of the INITIAL duration since the last send to the rto estimator
       // since we won't get an ack on this packet
       // this should keep us from exponentially increasing due o a one time increase
@@ -550,10 +597,9 @@ void RTPPacketResender::ResendDueEntries() {
       //          s_printf("Retransmitted packet %d\n", theEntry->fSeqNum);
       theEntry->fAddedTime = curTime;
       fBandwidthTracker->AdjustWindowForRetransmit();
-      continue;
+      this->Schedule(theEntry, curTime + fBandwidthTracker->CurRetransmitTimeout() + 1);
     }
-
   }
-}
 
-void RTPPacketResender::RemovePacket(RTPResenderEntry *inEntry) {Assert(0); }
+  fLastWheelTick = curTick;
+}
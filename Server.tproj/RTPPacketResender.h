@@ -27,19 +27,27 @@
 
     Contains:   RTPPacketResender class to buffer and track re-transmits of RTP packets.
 
-    the ctor copies the packet data, sets a timer for the packet's age limit and
-    another timer for it's possible re-transmission.
+    AddPacket keeps a reference on the packet data (the shared PacketBuffer of
+    the writer when there is one, a private copy otherwise), sets a timer for
+    the packet's age limit and another timer for it's possible re-transmission.
     A duration timer is started to measure the RTT based on the client's ack.
 
+    Outstanding packets live in a ring indexed by RTP sequence number
+    (seq & mask), so finding the entry of a new packet or of an ack is O(1).
+    Re-transmit timers are kept in a timer wheel: ResendDueEntries only looks
+    at the wheel slots that came due since the last call.
+
 */
 
 #ifndef __RTP_PACKET_RESENDER_H__
 #define __RTP_PACKET_RESENDER_H__
 
-#include <CF/PLDoubleLinkedList.h>
+#include <atomic>
+
 #include <CF/Net/Socket/UDPSocket.h>
-#include <CF/BufferPool.h>
 
+#include "QTSS.h"
+#include "PacketBuffer.h"
 #include "RTPBandwidthTracker.h"
 
 #define RTP_PACKET_RESENDER_DEBUGGING 0
@@ -49,14 +57,26 @@ class MyAckListLog;
 class RTPResenderEntry {
  public:
 
-  void *fPacketData;
+  enum {
+    kMaxHeaderSize = 32,  // rewritten header bytes kept next to the shared packet
+    kNoEntry = -1,        // end of a timer wheel list
+  };
+
+  PacketBuffer *fBuffer;    // the packet data, nullptr if the entry is free
+  bool fIsCopy;             // fBuffer is a private copy, not the writer's buffer
   UInt32 fPacketSize;
-  bool fIsSpecialBuffer;
+  UInt32 fHeaderLen;        // bytes of fHeader sent in place of the start of fBuffer
+  char fHeader[kMaxHeaderSize];
   SInt64 fExpireTime;
   SInt64 fAddedTime;
   SInt64 fOrigRetransTimeout;
+  SInt64 fDueTime;          // next time the entry has to be looked at
   UInt32 fNumResends;
   UInt16 fSeqNum;
+
+  // timer wheel list, linked by sequence number
+  SInt32 fNextDue;
+  SInt32 fPrevDue;
 #if RTP_PACKET_RESENDER_DEBUGGING
   UInt32              fPacketArraySizeWhenAdded;
 #endif
@@ -81,8 +101,9 @@ class RTPPacketResender {
 
   //
   // AddPacket adds a new packet to the resend queue. This will not send the packet.
+  // If the packet has a packetBuffer, a reference on it is kept instead of a copy.
   // AddPacket itself is not thread safe.
-  void AddPacket(void *rtpPacket, UInt32 packetSize, SInt32 ageLimitInMsec);
+  void AddPacket(QTSS_PacketStruct *inPacket, UInt32 packetSize, SInt32 ageLimitInMsec);
 
   //
   // Acks a packet. Also not thread safe.
@@ -107,7 +128,7 @@ class RTPPacketResender {
 
   SInt32 GetNumResends() { return fNumResends; }
 
-  static UInt32 GetNumRetransmitBuffers() { return sBufferPool.GetTotalNumBuffers(); }
+  static UInt32 GetNumRetransmitBuffers() { return sNumBuffers; }
 
   static UInt32 GetWastedBufferBytes() { return sNumWastedBytes; }
 
@@ -151,27 +172,41 @@ class RTPPacketResender {
   DssDurationTimer    fInfoDisplayTimer;
 #endif
 
+  enum {
+    kInitialPacketArraySize = 64,   // turns out this is as big as we typically need
+    kMaxPacketArraySize = 4096,     // must be a power of 2, and no more than 65536
+
+    kWheelSlots = 128,              // must be a power of 2
+    kWheelTickMSecs = 10,           // the wheel covers kWheelSlots * kWheelTickMSecs
+  };
+
+  // ring of outstanding packets, indexed by seq & fPacketArrayMask
   RTPResenderEntry *fPacketArray;
-  UInt16 fStartSeqNum;
   UInt32 fPacketArraySize;
   UInt32 fPacketArrayMask;
-  UInt16 fHighestSeqNum;
-  UInt32 fLastUsed;
-  CF::Core::Mutex fPacketQMutex;
 
-  RTPResenderEntry *GetEntryByIndex(UInt16 inIndex);
+  // heads of the timer wheel lists, by fDueTime / kWheelTickMSecs
+  SInt32 fWheel[kWheelSlots];
+  SInt64 fLastWheelTick;
 
-  RTPResenderEntry *GetEntryBySeqNum(UInt16 inSeqNum);
+  CF::Core::Mutex fPacketQMutex;
 
-  RTPResenderEntry *GetEmptyEntry(UInt16 inSeqNum, UInt32 inPacketSize);
+  RTPResenderEntry *GetEntryBySeqNum(UInt16 inSeqNum);
 
-  void ReallocatePacketArray();
+  RTPResenderEntry *GetEmptyEntry(UInt16 inSeqNum);
 
-  void RemovePacket(UInt32 packetIndex, bool reuse = true);
+  void ReallocatePacketArray(UInt32 inNewSize);
 
+  // free the entry, the bandwidth tracker is up to the caller
   void RemovePacket(RTPResenderEntry *inEntry);
 
-  static CF::BufferPool sBufferPool;
+  void Schedule(RTPResenderEntry *inEntry, SInt64 inDueTime);
+
+  void Unschedule(RTPResenderEntry *inEntry);
+
+  void SendEntry(RTPResenderEntry *inEntry);
+
+  static std::atomic_uint sNumBuffers;
   static std::atomic_uint sNumWastedBytes;
 
   void UpdateCongestionWindow(SInt32 bytesToOpenBy);
@@ -483,7 +483,7 @@ SInt64 RTPSession::Run() {
 
       // We cannot block waiting to UnRegister, because we have to
       // give the RTSPSessionTask a chance to release the RTPSession.
-      RefTable *sessionTable = QTSServerInterface::GetServer()->GetRTPSessionMap();
+      ShardedRefTable *sessionTable = QTSServerInterface::GetServer()->GetRTPSessionMap();
       Assert(sessionTable != nullptr);
       if (!sessionTable->TryUnRegister(&fRTPMapElem)) {
         this->Signal(kKillEvent);// So that we get back to this place in the code
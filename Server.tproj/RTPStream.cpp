@@ -36,6 +36,7 @@
 
 #if !__WinSock__
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #endif
 
@@ -49,6 +50,8 @@
 #include "RTCPAPPQTSSPacket.h"
 #include "RTCPAckPacket.h"
 #include "RTCPAPPNADUPacket.h"
+#include "UDPSendBatcher.h"
+#include "RTPPacketView.h"
 
 #if DEBUG
 #define RTP_TCP_STREAM_DEBUG 1
@@ -730,6 +733,79 @@ void RTPStream::UDPMonitorWrite(void *thePacketData, UInt32 inLen, bool isRTCP)
   }
 }
 
+/**
+ * 发送 QTSS_PacketStruct，包头(如果调用者改写过)和共享的包数据通过 iovec 合并为一个数据报
+ *
+ * @param inBatch  放入本线程的发送批次，由调用者通过 QTSS_FlushWriteBatch 统一发送
+ */
+OS_Error RTPStream::UDPWritePacket(Net::UDPSocket *inSocket, UInt16 inRemotePort, QTSS_PacketStruct *inPacket, UInt32 inLen, bool inBatch) {
+  if (inBatch && UDPSendBatcher::GetThreadBatcher()->Queue(inSocket->GetSocketFD(), fRemoteAddr, inRemotePort, inPacket, inLen))
+    return OS_NoErr;
+
+  if (inPacket->packetHeader == nullptr || inPacket->packetHeaderLen == 0 || inPacket->packetHeaderLen > inLen)
+    return inSocket->SendTo(fRemoteAddr, inRemotePort, inPacket->packetData, inLen);
+
+#if __WinSock__
+  char theFlatPacket[kMaxFlattenPacketSize];
+  void *thePacketData = this->FlattenPacket(inPacket, inLen, theFlatPacket);
+  if (thePacketData == nullptr)
+    return EINVAL;
+  return inSocket->SendTo(fRemoteAddr, inRemotePort, thePacketData, inLen);
+#else
+  struct sockaddr_in theRemoteAddr;
+  ::memset(&theRemoteAddr, 0, sizeof(theRemoteAddr));
+  theRemoteAddr.sin_family = AF_INET;
+  theRemoteAddr.sin_port = htons(inRemotePort);
+  theRemoteAddr.sin_addr.s_addr = htonl(fRemoteAddr);
+
+  struct iovec iov[2];
+  iov[0].iov_base = (char *) inPacket->packetHeader;
+  iov[0].iov_len = inPacket->packetHeaderLen;
+  iov[1].iov_base = (char *) inPacket->packetData + inPacket->packetHeaderLen;
+  iov[1].iov_len = inLen - inPacket->packetHeaderLen;
+
+  struct msghdr theMsg;
+  ::memset(&theMsg, 0, sizeof(theMsg));
+  theMsg.msg_name = &theRemoteAddr;
+  theMsg.msg_namelen = sizeof(theRemoteAddr);
+  theMsg.msg_iov = iov;
+  theMsg.msg_iovlen = 2;
+
+  if (::sendmsg(inSocket->GetSocketFD(), &theMsg, 0) < 0)
+    return (OS_Error) Core::Thread::GetErrno();
+  return OS_NoErr;
+#endif
+}
+
+/**
+ * 返回包头和包数据连续存放的包，没有改写包头时直接返回 packetData，否则拷贝到 ioBuffer
+ *
+ * @param ioBuffer  at least kMaxFlattenPacketSize bytes
+ * @return nullptr if the packet is too large to flatten
+ */
+void *RTPStream::FlattenPacket(QTSS_PacketStruct *inPacket, UInt32 inLen, char *ioBuffer) {
+  if (inPacket->packetHeader == nullptr || inPacket->packetHeaderLen == 0 || inPacket->packetHeaderLen > inLen)
+    return inPacket->packetData;
+
+  if (inLen > kMaxFlattenPacketSize)
+    return nullptr;
+
+  ::memcpy(ioBuffer, inPacket->packetHeader, inPacket->packetHeaderLen);
+  ::memcpy(ioBuffer + inPacket->packetHeaderLen, (char *) inPacket->packetData + inPacket->packetHeaderLen,
+           inLen - inPacket->packetHeaderLen);
+  return ioBuffer;
+}
+
+void RTPStream::UDPMonitorWritePacket(QTSS_PacketStruct *inPacket, UInt32 inLen, bool isRTCP) {
+  char theFlatPacket[kMaxFlattenPacketSize];
+  this->UDPMonitorWrite(this->FlattenPacket(inPacket, inLen, theFlatPacket), inLen, isRTCP);
+}
+
+void RTPStream::PrintPacketStruct(QTSS_PacketStruct *inPacket, UInt32 inLen, SInt32 inType) {
+  char theFlatPacket[kMaxFlattenPacketSize];
+  this->PrintPacketPrefEnabled((char *) this->FlattenPacket(inPacket, inLen, theFlatPacket), inLen, inType);
+}
+
 /**
  * InterleavedWrite
  *
@@ -740,7 +816,8 @@ void RTPStream::UDPMonitorWrite(void *thePacketData, UInt32 inLen, bool isRTCP)
  * @note InterleavedWrite must be called from a fSession mutex protected caller
  *
  */
-QTSS_Error RTPStream::InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel) {
+QTSS_Error RTPStream::InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel,
+                                       void *inHeader, UInt32 inHeaderLen, PacketBuffer *inPacketBuffer, bool inBatch) {
 
   if (fSession->GetRTSPSession() == NULL) { // RTSPSession required for interleaved write
     return EAGAIN;
@@ -748,7 +825,8 @@ QTSS_Error RTPStream::InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *out
 
   Core::MutexLocker locker(fSession->GetRTSPSessionMutex());
 
-  QTSS_Error err = fSession->GetRTSPSession()->InterleavedWrite(inBuffer, inLen, outLenWritten, channel);
+  QTSS_Error err = fSession->GetRTSPSession()->InterleavedWrite(inBuffer, inLen, outLenWritten, channel, inHeader, inHeaderLen,
+                                                                inPacketBuffer, inBatch);
 #if DEBUG
   //if (outLenWritten != NULL) {
   //  Assert((*outLenWritten == 0) || (*outLenWritten == 2044));
@@ -783,7 +861,7 @@ void RTPStream::SendRetransmits() {
 /**
  * @note ReliableRTPWrite must be called from a fSession mutex protected caller
  */
-QTSS_Error RTPStream::ReliableRTPWrite(void *inBuffer, UInt32 inLen, const SInt64 &curPacketDelay) {
+QTSS_Error RTPStream::ReliableRTPWrite(QTSS_PacketStruct *inPacket, UInt32 inLen, const SInt64 &curPacketDelay) {
   QTSS_Error err = QTSS_NoErr;
 
   // this must ALSO be called in response to a packet timeout
@@ -838,9 +916,9 @@ QTSS_Error RTPStream::ReliableRTPWrite(void *inBuffer, UInt32 inLen, const SInt6
     // Assign a lifetime to the packet using the current delay of the packet and
     // the time until this packet becomes stale.
     fBytesSentThisInterval += inLen;
-    fResender.AddPacket(inBuffer, inLen, (SInt32) (fDropAllPacketsForThisStreamDelay - curPacketDelay));
+    fResender.AddPacket(inPacket, inLen, (SInt32) (fDropAllPacketsForThisStreamDelay - curPacketDelay));
 
-    (void) fSockets->GetSocketA()->SendTo(fRemoteAddr, fRemoteRTPPort, inBuffer, inLen);
+    (void) this->UDPWritePacket(fSockets->GetSocketA(), fRemoteRTPPort, inPacket, inLen, false);
   }
 
   return err;
@@ -995,6 +1073,12 @@ QTSS_Error RTPStream::Write(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten,
   // Data passed into this version of write must be a QTSS_PacketStruct
   auto *thePacket = (QTSS_PacketStruct *) inBuffer;
 
+  // packetData may be shared with other streams, a rewritten header travels separately
+  // in packetHeader and is gathered with the data at send time.
+  UInt32 theHeaderLen = 0;
+  if (thePacket->packetHeader != nullptr && thePacket->packetHeaderLen <= inLen)
+    theHeaderLen = thePacket->packetHeaderLen;
+
   thePacket->suggestedWakeupTime = -1;
   SInt64 theCurrentPacketDelay = theTime - thePacket->packetTransmitTime;  // 延时
 
@@ -1031,15 +1115,18 @@ QTSS_Error RTPStream::Write(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten,
     }
 
     if (fTransportType == qtssRTPTransportTypeTCP) { // write out in interleave format on the RTSP TCP channel
-      err = this->InterleavedWrite(thePacket->packetData, inLen, outLenWritten, fRTCPChannel);
+      err = this->InterleavedWrite(thePacket->packetData, inLen, outLenWritten, fRTCPChannel, thePacket->packetHeader, theHeaderLen,
+                                     (PacketBuffer *) thePacket->packetBuffer, (inFlags & qtssWriteFlagsBatchTCP) != 0);
     } else if (inLen > 0) {
-      (void) this->fSockets->GetSocketB()->SendTo(fRemoteAddr, fRemoteRTCPPort, thePacket->packetData, inLen);
+      (void) this->UDPWritePacket(this->fSockets->GetSocketB(), fRemoteRTCPPort, thePacket, inLen,
+                                  (inFlags & qtssWriteFlagsBatchUDP) != 0);
 
-      this->UDPMonitorWrite(thePacket->packetData, inLen, kIsRTCPPacket);
+      if (fUDPMonitorEnabled)
+        this->UDPMonitorWritePacket(thePacket, inLen, kIsRTCPPacket);
     }
 
-    if (err == QTSS_NoErr)
-      this->PrintPacketPrefEnabled((char *) thePacket->packetData, inLen, (SInt32) RTPStream::rtcpSR);
+    if (err == QTSS_NoErr && QTSServerInterface::GetServer()->GetPrefs()->PacketHeaderPrintfsEnabled())
+      this->PrintPacketStruct(thePacket, inLen, (SInt32) RTPStream::rtcpSR);
   } else if (inFlags & qtssWriteFlagsIsRTP) {
     {   //
       // Check to see if this packet fits in the overbuffer window
@@ -1063,17 +1150,21 @@ QTSS_Error RTPStream::Write(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten,
     // also tells us whether this packet is just too old to send
     if (this->UpdateQualityLevel(thePacket->packetTransmitTime, theCurrentPacketDelay, theTime, inLen)) {
       if (fTransportType == qtssRTPTransportTypeTCP) {  // write out in interleave format on the RTSP TCP channel.
-        err = this->InterleavedWrite(thePacket->packetData, inLen, outLenWritten, fRTPChannel);
+        err = this->InterleavedWrite(thePacket->packetData, inLen, outLenWritten, fRTPChannel, thePacket->packetHeader, theHeaderLen,
+                                     (PacketBuffer *) thePacket->packetBuffer, (inFlags & qtssWriteFlagsBatchTCP) != 0);
       } else if (fTransportType == qtssRTPTransportTypeReliableUDP) {
-        err = this->ReliableRTPWrite(thePacket->packetData, inLen, theCurrentPacketDelay);
+        // the resender keeps a reference on the packet buffer, or a copy if there is none
+        err = this->ReliableRTPWrite(thePacket, inLen, theCurrentPacketDelay);
       } else if (inLen > 0) {
-        (void) fSockets->GetSocketA()->SendTo(fRemoteAddr, fRemoteRTPPort, thePacket->packetData, inLen);
+        (void) this->UDPWritePacket(fSockets->GetSocketA(), fRemoteRTPPort, thePacket, inLen,
+                                    (inFlags & qtssWriteFlagsBatchUDP) != 0);
 
-        this->UDPMonitorWrite(thePacket->packetData, inLen, kIsRTPPacket);
+        if (fUDPMonitorEnabled)
+          this->UDPMonitorWritePacket(thePacket, inLen, kIsRTPPacket);
       }
 
-      if (err == QTSS_NoErr)
-        this->PrintPacketPrefEnabled((char *) thePacket->packetData, inLen, (SInt32) RTPStream::rtp);
+      if (err == QTSS_NoErr && QTSServerInterface::GetServer()->GetPrefs()->PacketHeaderPrintfsEnabled())
+        this->PrintPacketStruct(thePacket, inLen, (SInt32) RTPStream::rtp);
 
 #if 0 // testing
       UInt16 *theSeqNumP = (UInt16 *) thePacket->packetData;
@@ -1143,8 +1234,11 @@ QTSS_Error RTPStream::Write(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten,
       QTSServerInterface::GetServer()->IncrementTotalQuality(this->GetQualityLevel());
 
       // Record the RTP timestamp for RTCPs
-      auto *timeStampP = (UInt32 *) (thePacket->packetData);
-      fLastRTPTimestamp = ntohl(timeStampP[1]);
+      // the timestamp is in the rewritten header if there is one
+      if (theHeaderLen >= RTPPacketView::kTimestampOffset + 4)
+        fLastRTPTimestamp = RTPPacketView((char *) thePacket->packetHeader, theHeaderLen).GetTimestamp();
+      else
+        fLastRTPTimestamp = RTPPacketView((char *) thePacket->packetData, inLen).GetTimestamp();
 
       // stream statistics
       fPacketCount++;
@@ -1574,9 +1668,10 @@ char *RTPStream::GetStreamTypeStr() {
 
 void RTPStream::PrintRTP(char *packetBuff, UInt32 inLen) {
 
-  UInt16 sequence = ntohs(((UInt16 *) packetBuff)[1]);
-  UInt32 timestamp = ntohl(((UInt32 *) packetBuff)[1]);
-  UInt32 ssrc = ntohl(((UInt32 *) packetBuff)[2]);
+  RTPPacketView thePacket(packetBuff, inLen);
+  UInt16 sequence = thePacket.GetSeqNumber();
+  UInt32 timestamp = thePacket.GetTimestamp();
+  UInt32 ssrc = thePacket.GetSSRC();
 
   if (fFirstTimeStamp == 0)
     fFirstTimeStamp = timestamp;
@@ -52,6 +52,7 @@
 #include "RTSPRequestInterface.h"
 #include "RTPSessionInterface.h"
 #include "RTPPacketResender.h"
+#include "PacketBuffer.h"
 #include "QTSServerInterface.h"
 #include "RTCPPacket.h"
 
@@ -198,7 +199,8 @@ class RTPStream : public QTSSDictionary, public CF::Net::UDPDemuxerTask {
     kNumPrebuiltChNums = 10,
     kMaxQualityLevel = 0,
     kIsRTCPPacket = TRUE,
-    kIsRTPPacket = FALSE
+    kIsRTPPacket = FALSE,
+    kMaxFlattenPacketSize = PacketBuffer::kDefaultCapacity // same as ReflectorPacket::kMaxReflectorPacketSize
   };
 
   SInt64 fLastQualityChange;
@@ -358,10 +360,19 @@ class RTPStream : public QTSSDictionary, public CF::Net::UDPDemuxerTask {
 
   //-----------------------------------------------------------
   // acutally write the data out that way
-  QTSS_Error InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel);
+  QTSS_Error InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel,
+                              void *inHeader = nullptr, UInt32 inHeaderLen = 0,
+                              PacketBuffer *inPacketBuffer = nullptr, bool inBatch = false);
+
+  // send the packet with the rewritten header (if any) and the shared packet data gathered in one datagram
+  OS_Error UDPWritePacket(CF::Net::UDPSocket *inSocket, UInt16 inRemotePort, QTSS_PacketStruct *inPacket, UInt32 inLen,
+                          bool inBatch = false);
+
+  // contiguous copy of header and data, for writers that can't gather
+  void *FlattenPacket(QTSS_PacketStruct *inPacket, UInt32 inLen, char *ioBuffer);
 
   // implements the ReliableRTP protocol
-  QTSS_Error ReliableRTPWrite(void *inBuffer, UInt32 inLen, const SInt64 &curPacketDelay);
+  QTSS_Error ReliableRTPWrite(QTSS_PacketStruct *inPacket, UInt32 inLen, const SInt64 &curPacketDelay);
 
   void SetTCPThinningParams();
 
@@ -410,6 +421,11 @@ class RTPStream : public QTSSDictionary, public CF::Net::UDPDemuxerTask {
 
   void UDPMonitorWrite(void *thePacketData, UInt32 inLen, bool isRTCP);
 
+  // the UDP monitor and the header printfs need the packet flattened, the buffer lives only in these calls
+  void UDPMonitorWritePacket(QTSS_PacketStruct *inPacket, UInt32 inLen, bool isRTCP);
+
+  void PrintPacketStruct(QTSS_PacketStruct *inPacket, UInt32 inLen, SInt32 inType);
+
 };
 
 #endif // __RTPSTREAM_H__
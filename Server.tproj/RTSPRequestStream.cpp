@@ -40,18 +40,24 @@ RTSPRequestStream::RTSPRequestStream(CF::Net::TCPSocket *sock)
     : fSocket(sock),
       fRetreatBytes(0),
       fRetreatBytesRead(0),
+      fRequestBuffer(fInlineBuffer),
+      fRequestBufferSize(kRequestBufferSizeInBytes),
       fCurOffset(0),
       fEncodedBytesRemaining(0),
-      fRequest(fRequestBuffer, 0),
+      fRequest(fInlineBuffer, 0),
       fRequestPtr(NULL),
       fDecode(false),
+      fIsDataPacket(false),
+      fNumDataPackets(0),
       fPrintRTSP(false) {}
 
 void RTSPRequestStream::SnarfRetreat(RTSPRequestStream &fromRequest) {
   // Simplest thing to do is to just completely blow away everything in this current
   // stream, and replace it with the retreat bytes from the other stream.
   fRequestPtr = NULL;
-  Assert(fRetreatBytes < kRequestBufferSizeInBytes);
+  if (fromRequest.fRetreatBytes >= fRequestBufferSize)
+    this->GrowRequestBuffer();
+  Assert(fromRequest.fRetreatBytes < fRequestBufferSize);
   fRetreatBytes = fromRequest.fRetreatBytes;
   fEncodedBytesRemaining = fCurOffset = fRequest.Len = 0;
   ::memcpy(&fRequestBuffer[0],
@@ -90,7 +96,7 @@ QTSS_Error RTSPRequestStream::ReadRequest() {
         //  that this principle is maintained.
         ::memmove(&fRequestBuffer[fRetreatBytes], &fRequestBuffer[fCurOffset - fEncodedBytesRemaining], fEncodedBytesRemaining);
         fCurOffset = fRetreatBytes + fEncodedBytesRemaining;
-        Assert(fCurOffset < kRequestBufferSizeInBytes);
+        Assert(fCurOffset < fRequestBufferSize);
       } else
         fCurOffset = fRetreatBytes;
 
@@ -110,7 +116,7 @@ QTSS_Error RTSPRequestStream::ReadRequest() {
       } else {
         // We don't have any new data, get some from the socket...
         // NOTE: the socket is non blocking
-        QTSS_Error sockErr = fSocket->Read(&fRequestBuffer[fCurOffset], (kRequestBufferSizeInBytes - fCurOffset) - 1, &newOffset);
+        QTSS_Error sockErr = fSocket->Read(&fRequestBuffer[fCurOffset], (fRequestBufferSize - fCurOffset) - 1, &newOffset);
         // assume the client is dead if we get an error back
         if (sockErr == EAGAIN)
           return QTSS_NoErr;
@@ -131,11 +137,15 @@ QTSS_Error RTSPRequestStream::ReadRequest() {
         if (decodeErr == QTSS_NoErr) Assert(fEncodedBytesRemaining < 4);
       } else
         fRequest.Len += newOffset;
-      Assert(fRequest.Len < kRequestBufferSizeInBytes);
+      Assert(fRequest.Len < fRequestBufferSize);
       fCurOffset += newOffset;
     }
     Assert(newOffset > 0);
 
+    // garbage after interleaved data, look for the next frame
+    if (fIsDataPacket && '$' != *(fRequest.Ptr) && !this->ResyncDataPackets())
+      continue;
+
     // See if this is an interleaved data packet
     if ('$' == *(fRequest.Ptr)) {
       /*
@@ -150,29 +160,39 @@ QTSS_Error RTSPRequestStream::ReadRequest() {
        *    |                              ...                              |
        *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
        *
-       * 按 data length 读取数据包，会对封装在同一个 TCP 包的多个 RTP 包进行分拆
+       * 一次取出缓冲区头部所有完整的数据包，它们在缓冲区中是连续的，由 RTSPSession 逐个分拆。
+       * 推流端每次读取可能带有上百个小包，逐包返回会为每个包搬移一次剩余数据并走一遍请求状态机
        */
+      if (!fDecode && fRequestBuffer == &fInlineBuffer[0])
+        this->GrowRequestBuffer();
+
+      UInt32 theFramedLen = 0;
+      UInt32 theNumPackets = 0;
+      while (theFramedLen + 4 <= fRequest.Len && '$' == fRequest.Ptr[theFramedLen]) {
+        auto *theHeader = (UInt8 *) &fRequest.Ptr[theFramedLen];
+        UInt32 interleavedPacketLen = ((theHeader[2] << 8U) | theHeader[3]) + 4;
+        if (theFramedLen + interleavedPacketLen > fRequest.Len)
+          break;
+        theFramedLen += interleavedPacketLen;
+        theNumPackets++;
+      }
 
-      // check header length
-      if (fRequest.Len < 4)
-        continue;
-
-      // check packet length
-      UInt16 *dataLenP = (UInt16 *) fRequest.Ptr;
-      UInt32 interleavedPacketLen = ntohs(dataLenP[1]) + 4;
-      if (interleavedPacketLen > fRequest.Len)
+      // wait for the header and the data of the first packet
+      if (theNumPackets == 0)
         continue;
 
-      // put back any data that is not part of the header
-      fRetreatBytes += fRequest.Len - interleavedPacketLen;
-      fRequest.Len = interleavedPacketLen;
+      // put back any data that is not part of the packets
+      fRetreatBytes += fRequest.Len - theFramedLen;
+      fRequest.Len = theFramedLen;
 
       fRequestPtr = &fRequest;
       fIsDataPacket = true;
+      fNumDataPackets = theNumPackets;
       return QTSS_RequestArrived;
     }
     // else
     fIsDataPacket = false;
+    fNumDataPackets = 0;
 
     if (fPrintRTSP) {
       CF::DateBuffer theDate;
@@ -252,13 +272,57 @@ QTSS_Error RTSPRequestStream::ReadRequest() {
     }
 
     // check for a full buffer
-    if (fCurOffset == kRequestBufferSizeInBytes - 1) {
+    if (fCurOffset == fRequestBufferSize - 1) {
       fRequestPtr = &fRequest;
       return E2BIG;
     }
   }
 }
 
+void RTSPRequestStream::GrowRequestBuffer() {
+  Assert(fRequestBuffer == &fInlineBuffer[0]);
+  if (fRequestBuffer != &fInlineBuffer[0])
+    return;
+
+  fRequestBuffer = new char[kDataBufferSizeInBytes];
+  fRequestBufferSize = kDataBufferSizeInBytes;
+  ::memcpy(fRequestBuffer, fInlineBuffer, fCurOffset);
+  if (fRequest.Ptr == &fInlineBuffer[0]) {
+    fRequest.Ptr = fRequestBuffer;
+  } else {
+    // the decoded request buffer must be as large as the request buffer, see DecodeIncomingData
+    char *theDecodeBuffer = new char[kDataBufferSizeInBytes];
+    ::memcpy(theDecodeBuffer, fRequest.Ptr, kRequestBufferSizeInBytes);
+    delete[] fRequest.Ptr;
+    fRequest.Ptr = theDecodeBuffer;
+  }
+}
+
+/**
+ * 数据包之后应当是下一个 '$' 或 RTSP 请求行，其他字节说明流已错位，丢弃到下一个 '$' 为止。
+ * memchr 在 glibc 中是向量化的，错位时的扫描不会逐字节进行
+ *
+ * @return false if all data was dropped
+ */
+bool RTSPRequestStream::ResyncDataPackets() {
+  char theFirst = *(fRequest.Ptr);
+  if (fDecode || (theFirst >= 'A' && theFirst <= 'Z') || (theFirst >= 'a' && theFirst <= 'z') ||
+      theFirst == '\r' || theFirst == '\n')
+    return true; // may be an RTSP request
+
+  auto *theFrame = (char *) ::memchr(fRequest.Ptr, '$', fRequest.Len);
+  if (theFrame == NULL) {
+    fRequest.Len = fCurOffset = 0;
+    return false;
+  }
+
+  UInt32 theSkipped = (UInt32) (theFrame - fRequest.Ptr);
+  ::memmove(fRequest.Ptr, theFrame, fRequest.Len - theSkipped);
+  fRequest.Len -= theSkipped;
+  fCurOffset -= theSkipped;
+  return true;
+}
+
 QTSS_Error RTSPRequestStream::Read(void *ioBuffer, UInt32 inBufLen, UInt32 *outLengthRead) {
   UInt32 theLengthRead = 0;
   UInt8 *theIoBuffer = (UInt8 *) ioBuffer;
@@ -308,8 +372,10 @@ QTSS_Error RTSPRequestStream::DecodeIncomingData(char *inSrcData,
                                                  UInt32 inSrcDataLen) {
   Assert(fRetreatBytes == 0);
 
+  // decoded data is never longer than the encoded data, so a buffer of the request buffer's
+  // size holds all of it. GrowRequestBuffer grows this one along with the request buffer
   if (fRequest.Ptr == &fRequestBuffer[0]) {
-    fRequest.Ptr = new char[kRequestBufferSizeInBytes];
+    fRequest.Ptr = new char[fRequestBufferSize];
     fRequest.Len = 0;
   }
 
@@ -351,7 +417,7 @@ QTSS_Error RTSPRequestStream::DecodeIncomingData(char *inSrcData,
   // Make sure to replace the sacred endChar
   inSrcData[bytesToDecode] = endChar;
 
-  Assert(fRequest.Len < kRequestBufferSizeInBytes);
+  Assert(fRequest.Len < fRequestBufferSize);
   Assert(encodedBytesConsumed == bytesToDecode);
 
   return QTSS_NoErr;
@@ -54,6 +54,8 @@ class RTSPRequestStream {
   ~RTSPRequestStream() {
     if (fRequest.Ptr != &fRequestBuffer[0])
       delete[] fRequest.Ptr;
+    if (fRequestBuffer != &fInlineBuffer[0])
+      delete[] fRequestBuffer;
   }
 
   //ReadRequest
@@ -61,6 +63,9 @@ class RTSPRequestStream {
   //Attempts to read data into the stream, stopping when we hit the EOL - EOL that
   //ends an RTSP header.
   //
+  //Interleaved data ($ frames) is framed in bulk: every complete frame at the
+  //head of the buffer is returned at once as one data "request", see GetNumDataPackets.
+  //
   //Returns:          QTSS_NoErr:     Out of data, haven't hit EOL - EOL yet
   //                  QTSS_RequestArrived: full request has arrived
   //                  E2BIG: ran out of buffer space
@@ -92,6 +97,9 @@ class RTSPRequestStream {
 
   bool IsDataPacket() { return fIsDataPacket; }
 
+  // the number of consecutive interleaved frames in the request buffer of a data packet
+  UInt32 GetNumDataPackets() { return fNumDataPackets; }
+
   void ShowRTSP(bool enable) { fPrintRTSP = enable; }
 
   void SnarfRetreat(RTSPRequestStream &fromRequest);
@@ -100,9 +108,16 @@ class RTSPRequestStream {
 
   // CONSTANTS:
   enum {
-    kRequestBufferSizeInBytes = QTSS_MAX_REQUEST_BUFFER_SIZE  // UInt32
+    kRequestBufferSizeInBytes = QTSS_MAX_REQUEST_BUFFER_SIZE,  // UInt32
+    kDataBufferSizeInBytes = 64 * 1024 + 8                     // holds the largest interleaved frame (4 + 65535)
   };
 
+  // switch to a kDataBufferSizeInBytes buffer, so one socket read of a pushing client carries many frames
+  void GrowRequestBuffer();
+
+  // drop the bytes before the next '$' after a data packet was followed by garbage
+  bool ResyncDataPackets();
+
   // Base64 decodes into fRequest.Ptr, updates fRequest.Len, and returns the amount
   // of data left undecoded in inSrcData
   QTSS_Error DecodeIncomingData(char *inSrcData, UInt32 inSrcDataLen);
@@ -111,7 +126,9 @@ class RTSPRequestStream {
   UInt32 fRetreatBytes;
   UInt32 fRetreatBytesRead; // Used by Read() when it is reading RetreatBytes
 
-  char fRequestBuffer[kRequestBufferSizeInBytes];
+  char *fRequestBuffer;       // fInlineBuffer, until interleaved data arrives
+  UInt32 fRequestBufferSize;
+  char fInlineBuffer[kRequestBufferSizeInBytes];
   UInt32 fCurOffset; // tracks how much valid data is in the above buffer
   UInt32 fEncodedBytesRemaining; // If we are decoding, tracks how many encoded bytes are in the buffer
 
@@ -119,6 +136,7 @@ class RTSPRequestStream {
   CF::StrPtrLen *fRequestPtr; // pointer to a request header or interleaved frame
   bool fDecode;        // should we base 64 decode?
   bool fIsDataPacket;  // is this a data packet? Like for a record?
+  UInt32 fNumDataPackets;
   bool fPrintRTSP;     // debugging printfs
 
 };
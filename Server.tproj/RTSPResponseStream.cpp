@@ -28,12 +28,31 @@
  * Impelementation of object in .h
  */
 
+#include <string.h>
+#include <errno.h>
+
+#if __linux__
+#include <sys/socket.h>
+#endif
+
 #include <CF/Core/Time.h>
 
 #include "RTSPResponseStream.h"
 
 QTSS_Error RTSPResponseStream::
 WriteV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengthSent, UInt32 inSendType) {
+  return this->WriteV(inVec, inNumVectors, inTotalLength, outLengthSent, inSendType, false, nullptr);
+}
+
+QTSS_Error RTSPResponseStream::
+WriteVZeroCopy(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengthSent, UInt32 inSendType,
+               bool *outZeroCopied) {
+  return this->WriteV(inVec, inNumVectors, inTotalLength, outLengthSent, inSendType, true, outZeroCopied);
+}
+
+QTSS_Error RTSPResponseStream::
+WriteV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengthSent, UInt32 inSendType,
+       bool inZeroCopy, bool *outZeroCopied) {
   QTSS_Error theErr = QTSS_NoErr;
   UInt32 theLengthSent = 0;
   UInt32 amtInBuffer = this->GetCurrentOffset() - fBytesSentInBuffer;
@@ -76,7 +95,10 @@ WriteV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengt
     }
     // theLengthSent now represents how much data in the ioVec was sent
   } else if (inNumVectors > 1) {
-    theErr = fSocket->WriteV(&inVec[1], inNumVectors - 1, &theLengthSent);
+    if (inZeroCopy)
+      theErr = this->SendZeroCopy(&inVec[1], inNumVectors - 1, &theLengthSent, outZeroCopied);
+    else
+      theErr = fSocket->WriteV(&inVec[1], inNumVectors - 1, &theLengthSent);
   }
 
   // We are supposed to refresh the timeout if there is a successful write.
@@ -116,8 +138,10 @@ WriteV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengt
   if (outLengthSent != NULL)
     *outLengthSent = inTotalLength;
 
+  // a partial write may end anywhere, even inside the '$' header of an interleaved packet:
+  // the rest of that vector is buffered, so the receiver still sees whole frames
   UInt32 curVec = 1;
-  while (theLengthSent >= inVec[curVec].iov_len) {
+  while (curVec < inNumVectors && theLengthSent >= inVec[curVec].iov_len) {
     // Skip over the vectors that were in fact sent.
     Assert(curVec < inNumVectors);
     theLengthSent -= inVec[curVec].iov_len;
@@ -168,3 +192,31 @@ QTSS_Error RTSPResponseStream::Flush() {
   }
   return QTSS_NoErr;
 }
+
+/**
+ * sendmsg the ioVec with MSG_ZEROCOPY, errors other than EAGAIN go through TCPSocket::WriteV so the socket
+ * state is updated the usual way
+ */
+OS_Error RTSPResponseStream::SendZeroCopy(iovec *inVec, UInt32 inNumVectors, UInt32 *outLengthSent, bool *outZeroCopied) {
+#if __linux__ && defined(MSG_ZEROCOPY)
+  struct msghdr theMsg;
+  ::memset(&theMsg, 0, sizeof(theMsg));
+  theMsg.msg_iov = inVec;
+  theMsg.msg_iovlen = inNumVectors;
+
+  ssize_t theResult = ::sendmsg(fSocket->GetSocketFD(), &theMsg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+  if (theResult >= 0) {
+    *outLengthSent = (UInt32) theResult;
+    if (outZeroCopied != nullptr)
+      *outZeroCopied = theResult > 0;
+    return OS_NoErr;
+  }
+
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    *outLengthSent = 0;
+    return EAGAIN;
+  }
+  // ENOBUFS: out of optmem for the notifications, just copy
+#endif
+  return fSocket->WriteV(inVec, inNumVectors, outLengthSent);
+}
@@ -82,6 +82,19 @@ class RTSPResponseStream : public CF::ResizeableStringFormatter {
 
   QTSS_Error WriteV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengthSent, UInt32 inSendType);
 
+  // WriteVZeroCopy
+  //
+  // Same as WriteV, but if nothing is buffered the ioVec is sent with MSG_ZEROCOPY
+  // where the platform supports it. outZeroCopied is set if the kernel took some of
+  // the data without copying it: that data must then stay untouched until the send
+  // is reported complete on the socket error queue. Unsent data is buffered (copied)
+  // as for WriteV.
+  QTSS_Error WriteVZeroCopy(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengthSent,
+                            UInt32 inSendType, bool *outZeroCopied);
+
+  // Data written to this stream that the socket hasn't taken yet
+  UInt32 GetNumBytesBuffered() { return this->GetCurrentOffset() - fBytesSentInBuffer; }
+
   // Flushes any buffered data to the socket. If all data could be sent,
   // this returns QTSS_NoErr, otherwise, it returns EWOULDBLOCK
   QTSS_Error Flush();
@@ -99,6 +112,12 @@ class RTSPResponseStream : public CF::ResizeableStringFormatter {
   //cases. But if the response is too big for this buffer, the BufferIsFull function will
   //allocate a larger buffer.
   char fOutputBuf[kOutputBufferSizeInBytes];
+
+  QTSS_Error WriteV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength, UInt32 *outLengthSent, UInt32 inSendType,
+                    bool inZeroCopy, bool *outZeroCopied);
+
+  OS_Error SendZeroCopy(iovec *inVec, UInt32 inNumVectors, UInt32 *outLengthSent, bool *outZeroCopied);
+
   CF::Net::TCPSocket *fSocket;
   UInt32 fBytesSentInBuffer;
   CF::Thread::TimeoutTask *fTimeoutTask;
@@ -154,6 +154,9 @@ RTSPSession::RTSPSession(bool doReportHTTPConnectionAddress)
     : RTSPSessionInterface(),
       fRequest(nullptr),
       fRTPSession(nullptr),
+      fChannelSessions(nullptr),
+      fNumChannelSessions(0),
+      fNumChannelPackets(0),
       fReadMutex(),
       fHTTPMethod(kHTTPMethodInit),
       fWasHTTPRequest(false),
@@ -196,6 +199,8 @@ RTSPSession::~RTSPSession() {
     (void) QTSServerInterface::GetModule(QTSSModule::kRTSPSessionClosingRole, x)->CallDispatch( QTSS_RTSPSessionClosing_Role, &theParams);
 
   fLiveSession = false; //used in Clean up request to remove the RTP session.
+  this->ReleaseChannelSessions();
+  delete[] fChannelSessions;
   this->CleanupRequest();// Make sure that all our objects are deleted
   if (fSessionType == qtssRTSPSession)
     QTSServerInterface::GetServer()->AlterCurrentRTSPSessionCount(-1);
@@ -337,6 +342,9 @@ SInt64 RTSPSession::Run() {
           // that we've read all outstanding data off the socket,
           // and still don't have a full request. Wait for more data.
 
+          // don't hold the RTP sessions while idle
+          this->ReleaseChannelSessions();
+
           //+rt use the socket that reads the data, may be different now.
           fInputSocketP->RequestEvent(EV_REOS);
           return 0;
@@ -355,6 +363,7 @@ SInt64 RTSPSession::Run() {
             Assert(fOutputSocketP != fInputSocketP);
             Assert(!fInputSocketP->IsConnected());
             fInputSocketP->Cleanup();
+            this->ReleaseChannelSessions();
             return 0;
           } else {
             Assert(!this->IsLiveSession());
@@ -433,6 +442,9 @@ SInt64 RTSPSession::Run() {
           break;
         }
 
+        // a request may change the channels or tear down the RTP session
+        this->ReleaseChannelSessions();
+
         //
         // In case a module wants to replace the request
         char *theReplacedRequest = nullptr;
@@ -1061,8 +1073,9 @@ SInt64 RTSPSession::Run() {
   //printf("RTSPSession fObjectHolders:%d !\n", fObjectHolders.load());
 
   //fObjectHolders--
+  this->ReleaseChannelSessions();
   if (!IsLiveSession() && fObjectHolders > 0) {
-    RefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
+    ShardedRefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
     Ref *theRef = theMap->Resolve(&fLastRTPSessionIDPtr);
     if (theRef != nullptr) {
       fRTPSession = (RTPSession *) theRef->GetObject();
@@ -1427,8 +1440,16 @@ void RTSPSession::CheckAuthentication() {
     char *userPasswdStr = userPassword->GetAsCString(); // memory allocated
     char *reqPasswdStr = reqPassword->GetAsCString();   // memory allocated
 
+    // the same user, password and realm checked against the same stored password
+    // passed before, on this connection or lately on another one
+    QTSSCredentialCache::Credential credential =
+        QTSSCredentialCache::Hash(*profile->GetValue(qtssUserName), *reqPassword,
+                                  *fRequest->GetValue(qtssRTSPReqURLRealm), *userPassword);
+
     if (userPassword->Len == 0) {
       authenticated = false;
+    } else if (fVerifiedCredential.IsVerified(credential)) {
+      authenticated = true;
     } else {
 #if __Win32__ || __MinGW__
       // The password is md5 encoded for win32
@@ -1441,6 +1462,8 @@ void RTSPSession::CheckAuthentication() {
       if (::strcmp(userPasswdStr, (char *) ::crypt(reqPasswdStr, userPasswdStr)) != 0)
         authenticated = false;
 #endif
+      if (authenticated)
+        fVerifiedCredential.SetVerified(credential);
     }
 
     delete[] userPasswdStr;    // deleting allocated memory
@@ -1566,7 +1589,7 @@ void RTSPSession::SetupRequest() {
   // let's also refresh RTP session timeout so that it's kept alive in sync with the RTSP session.
   //
   // Attempt to find the RTP session for this request.
-  RefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
+  ShardedRefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
   theErr = this->FindRTPSession(theMap);
 
   if (fRTPSession != nullptr) {
@@ -1690,7 +1713,7 @@ void RTSPSession::SetupRequest() {
 void RTSPSession::CleanupRequest() {
   if (fRTPSession != nullptr) {
     // Release the ref.
-    RefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
+    ShardedRefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
     theMap->Release(fRTPSession->GetRef());
 
     // nullptr out any references to this RTP session
@@ -1718,14 +1741,14 @@ void RTSPSession::CleanupRequest() {
     fRoleParams.rtspRequestParams.inRTSPHeaders = nullptr;
   }
 
-  fSessionMutex.Unlock();
+  this->UnlockSessionMutex();
   fReadMutex.Unlock();
 
   // Clear out our last value for request body length before moving onto the next request
   this->SetRequestBodyLength(-1);
 }
 
-QTSS_Error RTSPSession::FindRTPSession(RefTable *inRefTable) {
+QTSS_Error RTSPSession::FindRTPSession(ShardedRefTable *inRefTable) {
   // This function attempts to locate the appropriate RTP session for this RTSP
   // Request. It uses an RTSP session ID as a key to finding the correct RTP session,
   // and it looks for this session ID in two places. First, the RTSP session ID header
@@ -1746,7 +1769,7 @@ QTSS_Error RTSPSession::FindRTPSession(RefTable *inRefTable) {
   return QTSS_NoErr;
 }
 
-QTSS_Error RTSPSession::CreateNewRTPSession(RefTable *inRefTable) {
+QTSS_Error RTSPSession::CreateNewRTPSession(ShardedRefTable *inRefTable) {
   Assert(fLastRTPSessionIDPtr.Ptr == &fLastRTPSessionID[0]);
 
   // This is a brand spanking new session. At this point, we need to create
@@ -1858,8 +1881,11 @@ UInt32 RTSPSession::GenerateNewSessionID(char *ioBuffer) {
   QTSServerInterface *theServer = QTSServerInterface::GetServer();
 
   {
-    Core::MutexLocker locker(theServer->GetRTPSessionMap()->GetMutex());
-    RefHashTable *theHashTable = theServer->GetRTPSessionMap()->GetHashTable();
+    // a random shard, then a random session in it
+    ShardedRefTable *theMap = theServer->GetRTPSessionMap();
+    RefTable *theTable = theMap->GetShard(theFirstRandom % theMap->GetNumShards());
+    Core::MutexLocker locker(theTable->GetMutex());
+    RefHashTable *theHashTable = theTable->GetHashTable();
     if (theHashTable->GetNumEntries() > 0) {
       theFirstRandom %= theHashTable->GetNumEntries();
       theFirstRandom >>= 2;
@@ -2003,37 +2029,105 @@ QTSS_Error RTSPSession::DumpRequestData() {
  *
  */
 void RTSPSession::HandleIncomingDataPacket() {
+  // fInputStream frames all the complete packets of a read at once, they are contiguous in its buffer
+  StrPtrLen *theFrames = fInputStream.GetRequestBuffer();
 
-  // Attempt to find the RTP session for this request.
-  UInt8 packetChannel = (UInt8) fInputStream.GetRequestBuffer()->Ptr[1];
-  StrPtrLen *theSessionID = this->GetSessionIDForChannelNum(packetChannel);
-  if (theSessionID == nullptr) {
-    Assert(0);
-    return;  // TODO(james): filter invalid packet?
-    theSessionID = &fLastRTPSessionIDPtr;
+  if (fChannelSessions == nullptr) {
+    fChannelSessions = new ChannelSession[kNumChannelSessions]();
   }
 
-  RefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
-  Ref *theRef = theMap->Resolve(theSessionID);
+  // give the references back once in a while, see fChannelSessions
+  fNumChannelPackets += fInputStream.GetNumDataPackets();
+  if (fNumChannelPackets > kMaxPacketsPerChannelSessions)
+    this->ReleaseChannelSessions();
+
+  // consecutive packets of the same RTP session are dispatched together
+  RTPSession *theRunSession = nullptr;
+  char *theRunStart = nullptr;
+  UInt32 theRunLen = 0;
+
+  for (UInt32 theOffset = 0; theOffset + 4 <= theFrames->Len;) {
+    char *theFrame = theFrames->Ptr + theOffset;
+    UInt8 packetChannel = (UInt8) theFrame[1];
+    UInt32 theFrameLen = (((UInt8) theFrame[2] << 8U) | (UInt8) theFrame[3]) + 4;
+    theOffset += theFrameLen;
+
+    RTPSession *theSession = this->ResolveChannelSession(packetChannel);
+    if (theSession != theRunSession || theSession == nullptr) {
+      this->DispatchIncomingData(theRunSession, theRunStart, theRunLen);
+      theRunSession = theSession;
+      theRunStart = theFrame;
+      theRunLen = 0;
+    }
+    if (theSession != nullptr)
+      theRunLen += theFrameLen;
+  }
+  this->DispatchIncomingData(theRunSession, theRunStart, theRunLen);
+}
 
-  if (theRef != nullptr) fRTPSession = (RTPSession *) theRef->GetObject();
+/**
+ * 取通道所属的 RTP session，缓存在 fChannelSessions 中
+ *
+ * @return nullptr if the channel doesn't belong to any RTP session, its packets are dropped
+ */
+RTPSession *RTSPSession::ResolveChannelSession(UInt8 inChannel) {
+  ChannelSession &theEntry = fChannelSessions[inChannel >> 1U];
+  if (theEntry.fSession == nullptr) {
+    StrPtrLen *theSessionID = this->GetSessionIDForChannelNum(inChannel);
+    if (theSessionID == nullptr) {
+      Assert(0);
+      return nullptr;  // TODO(james): filter invalid packet?
+    }
+
+    ShardedRefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
+    Ref *theRef = theMap->Resolve(theSessionID);
+    if (theRef == nullptr) return nullptr;
 
-  if (fRTPSession == nullptr) return;
+    // the reference is kept by the cache entry
+    theEntry.fSession = (RTPSession *) theRef->GetObject();
+    theEntry.fStream = nullptr;
+    fNumChannelSessions++;
+  }
+  return theEntry.fSession;
+}
 
-  StrPtrLen packetWithoutHeaders(fInputStream.GetRequestBuffer()->Ptr + 4, fInputStream.GetRequestBuffer()->Len - 4);
+/**
+ * 将同一个 RTP session 的若干连续数据包交给 RTPStream 和 QTSS_RTSPIncomingData_Role 模块，
+ * 模块每批只调用一次，inPacketData 中是连续的 Interleaved Frame
+ */
+void RTSPSession::DispatchIncomingData(RTPSession *inSession, char *inFrames, UInt32 inLen) {
+  if (inSession == nullptr || inLen == 0) return;
 
-  Core::MutexLocker locker(fRTPSession->GetMutex());
-  fRTPSession->RefreshTimeout();
-  RTPStream *theStream = fRTPSession->FindRTPStreamForChannelNum(packetChannel);
-  theStream->ProcessIncomingInterleavedData(packetChannel, this, &packetWithoutHeaders);
+  {
+    Core::MutexLocker locker(inSession->GetMutex());
+    inSession->RefreshTimeout();
+
+    // streams are never removed from a live session, only added by SETUP
+    for (UInt32 theOffset = 0; theOffset + 4 <= inLen;) {
+      char *theFrame = inFrames + theOffset;
+      UInt8 packetChannel = (UInt8) theFrame[1];
+      UInt32 theFrameLen = (((UInt8) theFrame[2] << 8U) | (UInt8) theFrame[3]) + 4;
+      theOffset += theFrameLen;
+
+      ChannelSession &theEntry = fChannelSessions[packetChannel >> 1U];
+      RTPStream *theStream = theEntry.fStream;
+      if (theStream == nullptr
+          || (theStream->GetRTPChannelNum() != packetChannel && theStream->GetRTCPChannelNum() != packetChannel))
+        theEntry.fStream = inSession->FindRTPStreamForChannelNum(packetChannel);
+      if (theEntry.fStream != nullptr) {
+        StrPtrLen packetWithoutHeaders(theFrame + 4, theFrameLen - 4);
+        theEntry.fStream->ProcessIncomingInterleavedData(packetChannel, this, &packetWithoutHeaders);
+      }
+    }
+  }
 
   //
   // We currently don't support async notifications from within this role
   QTSS_RoleParams packetParams;
   packetParams.rtspIncomingDataParams.inRTSPSession = this;
-  packetParams.rtspIncomingDataParams.inClientSession = fRTPSession;
-  packetParams.rtspIncomingDataParams.inPacketData = fInputStream.GetRequestBuffer()->Ptr;
-  packetParams.rtspIncomingDataParams.inPacketLen = fInputStream.GetRequestBuffer()->Len;
+  packetParams.rtspIncomingDataParams.inClientSession = inSession;
+  packetParams.rtspIncomingDataParams.inPacketData = inFrames;
+  packetParams.rtspIncomingDataParams.inPacketLen = inLen;
 
   UInt32 numModules = QTSServerInterface::GetNumModulesInRole(QTSSModule::kRTSPIncomingDataRole);
   for (; fCurrentModule < numModules; fCurrentModule++) {
@@ -2042,3 +2136,18 @@ void RTSPSession::HandleIncomingDataPacket() {
   }
   fCurrentModule = 0;
 }
+
+void RTSPSession::ReleaseChannelSessions() {
+  fNumChannelPackets = 0;
+  if (fNumChannelSessions == 0) return;
+
+  ShardedRefTable *theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
+  for (UInt32 x = 0; x < kNumChannelSessions && fNumChannelSessions > 0; x++) {
+    if (fChannelSessions[x].fSession == nullptr) continue;
+
+    theMap->Release(fChannelSessions[x].fSession->GetRef());
+    fChannelSessions[x].fSession = nullptr;
+    fChannelSessions[x].fStream = nullptr;
+    fNumChannelSessions--;
+  }
+}
@@ -39,6 +39,7 @@
 #include "RTSPRequestStream.h"
 #include "RTSPRequest.h"
 #include "RTPSession.h"
+#include "QTSSCredentialCache.h"
 
 class RTSPSession : public RTSPSessionInterface {
  public:
@@ -62,9 +63,9 @@ class RTSPSession : public RTSPSessionInterface {
   SInt64 Run() override;
 
   // Gets & creates RTP session for this request.
-  QTSS_Error FindRTPSession(RefTable *inTable);
+  QTSS_Error FindRTPSession(ShardedRefTable *inTable);
 
-  QTSS_Error CreateNewRTPSession(RefTable *inTable);
+  QTSS_Error CreateNewRTPSession(ShardedRefTable *inTable);
 
   void SetupClientSessionAttrs();
 
@@ -93,6 +94,32 @@ class RTSPSession : public RTSPSessionInterface {
   RTSPRequest *fRequest;
   RTPSession *fRTPSession;
 
+  // the Basic credential last verified on this connection, see CheckAuthentication
+  QTSSCredentialCache::Connection fVerifiedCredential;
+
+  //
+  // Interleaved data packets are routed through this cache, indexed by
+  // channel >> 1, instead of resolving the session ID of the channel in the
+  // session map for every packet. Each entry holds a reference on the RTP
+  // session, so all of them are dropped whenever this session stops reading
+  // data packets: when the socket is drained, when a real RTSP request comes
+  // in (it may change the channel map or tear the session down), and after
+  // kMaxPacketsPerChannelSessions packets so a dying RTP session can't be
+  // kept alive by a busy connection.
+  struct ChannelSession {
+    RTPSession *fSession;
+    RTPStream *fStream;
+  };
+
+  enum {
+    kNumChannelSessions = 128,
+    kMaxPacketsPerChannelSessions = 256,
+  };
+
+  ChannelSession *fChannelSessions;
+  UInt32 fNumChannelSessions;     // entries holding a reference
+  UInt32 fNumChannelPackets;      // packets routed since the cache was filled
+
   //RTSPSessionHandler* fRTSPSessionHandler;
 
 
@@ -108,6 +135,13 @@ class RTSPSession : public RTSPSessionInterface {
   bool ParseProxyTunnelHTTP();                     // use by PreFilterForHTTPProxyTunnel
   void HandleIncomingDataPacket();
 
+  RTPSession *ResolveChannelSession(UInt8 inChannel);
+
+  void DispatchIncomingData(RTPSession *inSession, char *inFrames, UInt32 inLen);
+
+  // Drops the RTP sessions resolved for interleaved data, see HandleIncomingDataPacket
+  void ReleaseChannelSessions();
+
   static RefTable *sHTTPProxyTunnelMap;    // a map of available partners.
 
   enum {
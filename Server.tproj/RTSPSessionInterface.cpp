@@ -84,8 +84,7 @@ RTSPSessionInterface::RTSPSessionInterface()
       fInputStream(&fSocket),
       fOutputStream(&fSocket, &fTimeoutTask),
       fSessionMutex(),
-      fTCPCoalesceBuffer(nullptr),
-      fNumInCoalesceBuffer(0),
+      fInterleavedQueue(nullptr),
       fSocket(nullptr, CF::Net::Socket::kNonBlockingSocketType),
       fOutputSocketP(&fSocket),
       fInputSocketP(&fSocket),
@@ -124,7 +123,8 @@ RTSPSessionInterface::~RTSPSessionInterface() {
   if (fInputSocketP != fOutputSocketP)
     delete fInputSocketP;
 
-  delete[] fTCPCoalesceBuffer;
+  // fSocket is still open here, the queue may have to wait for the kernel on it
+  InterleavedWriteQueue::Destroy(fInterleavedQueue, fOutputSocketP->GetSocketFD());
 
   for (UInt8 x = 0; x < (fCurChannelNum >> 1); x++)
     delete[] fChNumToSessIDMap[x].Ptr;
@@ -194,11 +194,6 @@ QTSS_Error RTSPSessionInterface::RequestEvent(QTSS_EventType inEventMask) {
 }
 
 UInt8 RTSPSessionInterface::GetTwoChannelNumbers(CF::StrPtrLen *inRTSPSessionID) {
-  //
-  // Allocate a TCP coalesce buffer if still needed
-  if (fTCPCoalesceBuffer != nullptr)
-    fTCPCoalesceBuffer = new char[kTCPCoalesceBufferSize];
-
   //
   // Allocate 2 channel numbers
   UInt8 theChannelNum = fCurChannelNum;
@@ -231,11 +226,22 @@ CF::StrPtrLen *RTSPSessionInterface::GetSessionIDForChannelNum(UInt8 inChannelNu
 
 /**
  * Write the given RTP packet out on the RTSP channel in interleaved format.
+ *
+ * A batched packet is queued with the packets of the other streams, the queue is written with one writev by
+ * FlushInterleavedQueue. The first queued packet puts the session on the thread's pending list, which holds
+ * it until the flush. The session mutex is not kept meanwhile, so the other streams of the client are not
+ * blocked; the queue only holds whole frames, an RTSP response written in between goes out before them.
+ *
+ * @param inHeader        optional rewritten copy of the packet header, the packet data in inBuffer
+ *                        may be shared with other sessions and is not modified
+ * @param inPacketBuffer  buffer of the packet data if any, held by a zero copy flush
  */
 QTSS_Error
-RTSPSessionInterface::InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel) {
+RTSPSessionInterface::InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel,
+                                       void *inHeader, UInt32 inHeaderLen, PacketBuffer *inPacketBuffer, bool inBatch) {
 
-  if (inLen == 0 && fNumInCoalesceBuffer == 0) {
+  bool hasQueued = fInterleavedQueue != nullptr && !fInterleavedQueue->IsEmpty();
+  if (inLen == 0 && !hasQueued) {
     if (outLenWritten != nullptr)
       *outLenWritten = 0;
     return QTSS_NoErr;
@@ -248,78 +254,84 @@ RTSPSessionInterface::InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *out
   if (this->GetSessionMutex()->TryLock() == false) {
     return EAGAIN;
   }
+  hasQueued = fInterleavedQueue != nullptr && !fInterleavedQueue->IsEmpty();
 
-  // DMS - this struct should be packed.
-  // TODO: is this struct more portable (byte alignment could be a problem)?
-  struct RTPInterleaveHeader {
-    unsigned char header;
-    unsigned char channel;
-    UInt16 len;
-  };
-
-  struct iovec iov[3];
   QTSS_Error err = QTSS_NoErr;
 
-  // flush rules
-  if (fNumInCoalesceBuffer > 0 && (inLen == 0 || inLen > kTCPCoalesceDirectWriteSize ||
-      inLen + fNumInCoalesceBuffer + kInteleaveHeaderSize > kTCPCoalesceBufferSize)) {
-    UInt32 buffLenWritten;
-
-    // skip iov[0], WriteV uses it
-    iov[1].iov_base = fTCPCoalesceBuffer;
-    iov[1].iov_len = fNumInCoalesceBuffer;
+  if (inHeader == nullptr || inHeaderLen > inLen)
+    inHeaderLen = 0;
+
+  bool queued = false;
+  if (inBatch && inLen > 0) {
+    // flow control: don't queue more while the socket hasn't taken what an earlier flush buffered
+    if (!hasQueued && this->GetOutputStream()->GetNumBytesBuffered() > 0)
+      err = this->GetOutputStream()->Flush();
+
+    if (err == QTSS_NoErr) {
+      if (fInterleavedQueue == nullptr)
+        fInterleavedQueue = new InterleavedWriteQueue();
+
+      queued = fInterleavedQueue->Queue(channel, (char *) inBuffer, inLen, (char *) inHeader, inHeaderLen, inPacketBuffer);
+      if (!queued && hasQueued) {
+        // full, write it now and queue the packet only if the socket took all of it
+        this->FlushInterleavedQueue();
+        hasQueued = false;
+        if (this->GetOutputStream()->GetNumBytesBuffered() > 0)
+          err = EAGAIN;
+        else
+          queued = fInterleavedQueue->Queue(channel, (char *) inBuffer, inLen, (char *) inHeader, inHeaderLen, inPacketBuffer);
+      }
 
-    err = this->GetOutputStream()->WriteV(iov, 2, fNumInCoalesceBuffer, &buffLenWritten, RTSPResponseStream::kAllOrNothing);
+      if (queued && !hasQueued)
+        InterleavedWriteQueue::AddPendingSession(this);
+    }
 
 #if RTSP_SESSION_INTERFACE_DEBUGGING
-    s_printf("InterleavedWrite: flushing %li\n", fNumInCoalesceBuffer);
+    if (queued)
+      s_printf("InterleavedWrite: queue %li, total queued %li\n", inLen, fInterleavedQueue->GetNumBytes());
 #endif
-
-    if (err == QTSS_NoErr)
-      fNumInCoalesceBuffer = 0;
   }
 
-  if (err == QTSS_NoErr) {
+  if (!queued && err == QTSS_NoErr) {
+    // write what is queued first to keep the order
+    if (hasQueued)
+      this->FlushInterleavedQueue();
+
+    if (inLen > 0) {
+      // DMS - this struct should be packed.
+      // TODO: is this struct more portable (byte alignment could be a problem)?
+      struct RTPInterleaveHeader {
+        unsigned char header;
+        unsigned char channel;
+        UInt16 len;
+      };
 
-    if (inLen > kTCPCoalesceDirectWriteSize) {
-      // write direct to stream
       RTPInterleaveHeader rih = {
           .header = '$',
           .channel = channel,
           .len = htons((UInt16) inLen)
       };
 
+      // skip iov[0], WriteV uses it
+      struct iovec iov[4];
       iov[1].iov_base = (char *) &rih;
       iov[1].iov_len = sizeof(rih);
 
-      iov[2].iov_base = (char *) inBuffer;
-      iov[2].iov_len = inLen;
-
-      err = this->GetOutputStream()->WriteV(iov, 3, inLen + sizeof(rih), outLenWritten, RTSPResponseStream::kAllOrNothing);
-
-#if RTSP_SESSION_INTERFACE_DEBUGGING
-      s_printf("InterleavedWrite: bypass %li\n", inLen);
-#endif
-
-    } else {
-      // coalesce with other small writes
-
-      fTCPCoalesceBuffer[fNumInCoalesceBuffer++] = '$';
-      fTCPCoalesceBuffer[fNumInCoalesceBuffer++] = channel;
-
-      // if we ever turn TCPCoalesce back on, this should be optimized
-      // for processors w/o alignment restrictions as above.
-      // 不要直接强转指针
+      UInt32 numVectors = 2;
+      if (inHeaderLen > 0) {
+        iov[numVectors].iov_base = (char *) inHeader;
+        iov[numVectors].iov_len = inHeaderLen;
+        numVectors++;
+      }
 
-      SInt16 pcketLen = htons((UInt16) inLen);
-      ::memcpy(&fTCPCoalesceBuffer[fNumInCoalesceBuffer], &pcketLen, 2);
-      fNumInCoalesceBuffer += 2;
+      iov[numVectors].iov_base = (char *) inBuffer + inHeaderLen;
+      iov[numVectors].iov_len = inLen - inHeaderLen;
+      numVectors++;
 
-      ::memcpy(&fTCPCoalesceBuffer[fNumInCoalesceBuffer], inBuffer, inLen);
-      fNumInCoalesceBuffer += inLen;
+      err = this->GetOutputStream()->WriteV(iov, numVectors, inLen + sizeof(rih), outLenWritten, RTSPResponseStream::kAllOrNothing);
 
 #if RTSP_SESSION_INTERFACE_DEBUGGING
-      s_printf("InterleavedWrite: coalesce %li, total bufff %li\n", inLen, fNumInCoalesceBuffer);
+      s_printf("InterleavedWrite: bypass %li\n", inLen);
 #endif
     }
   }
@@ -328,18 +340,55 @@ RTSPSessionInterface::InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *out
     /*  if no error sure to correct outLenWritten, cuz WriteV above includes the interleave header count
 
          GetOutputStream()->WriteV guarantees all or nothing for writes
-         if no error, then all was written.
+         if no error, then all was written, or queued.
     */
     if (outLenWritten != nullptr)
       *outLenWritten = inLen;
   }
 
-  this->GetSessionMutex()->Unlock();
+  this->UnlockSessionMutex();
 
   return err;
 
 }
 
+/**
+ * 释放会话锁。写线程的 FlushPendingSessions 取不到锁时把待写队列交给持锁者，在这里写出
+ *
+ * The hand off is checked after the unlock: one made while the mutex was held is seen here, a later one
+ * finds the mutex free. If another holder took the mutex meanwhile, it checks again when it unlocks.
+ */
+void RTSPSessionInterface::UnlockSessionMutex() {
+  UInt32 theNumTaken = 0;
+  for (;;) {
+    fSessionMutex.Unlock();
+
+    if (fInterleavedQueue == nullptr || !fInterleavedQueue->IsHandedOff() || !fSessionMutex.TryLock())
+      break;
+
+    if (fInterleavedQueue->TakeHandOff()) {
+      this->FlushInterleavedQueue();
+      theNumTaken++;
+    }
+  }
+
+  // the holds of the pending lists, the session may go away after this
+  while (theNumTaken-- > 0)
+    this->DecrementObjectHolderCount();
+}
+
+void RTSPSessionInterface::FlushInterleavedQueue() {
+  if (fInterleavedQueue == nullptr || fInterleavedQueue->IsEmpty())
+    return;
+
+  // partial writes are buffered by the output stream, the next write or Flush sends the rest
+  (void) fInterleavedQueue->Flush(this->GetOutputStream(), fOutputSocketP->GetSocketFD());
+
+#if RTSP_SESSION_INTERFACE_DEBUGGING
+  s_printf("InterleavedWrite: flushed queue\n");
+#endif
+}
+
 /*
 	take the TCP socket away from a RTSP session that's
 	waiting to be snarfed.
@@ -38,6 +38,7 @@
 
 #include "RTSPRequestStream.h"
 #include "RTSPResponseStream.h"
+#include "InterleavedWriteQueue.h"
 
 #include "QTSS.h"
 #include "QTSSDictionary.h"
@@ -121,7 +122,19 @@ class RTSPSessionInterface : public QTSSDictionary, public CF::Thread::Task {
   QTSS_Error RequestEvent(QTSS_EventType inEventMask) override;
 
   // performs RTP over RTSP
-  QTSS_Error InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel);
+  // if inHeaderLen > 0, inHeader is written in place of the first inHeaderLen bytes of inBuffer
+  // if inBatch, the packet is queued until the thread's QTSS_FlushWriteBatch, see InterleavedWriteQueue
+  QTSS_Error InterleavedWrite(void *inBuffer, UInt32 inLen, UInt32 *outLenWritten, unsigned char channel,
+                              void *inHeader = nullptr, UInt32 inHeaderLen = 0,
+                              PacketBuffer *inPacketBuffer = nullptr, bool inBatch = false);
+
+  // writes the interleaved packets queued by batched writes, the caller holds the session mutex
+  void FlushInterleavedQueue();
+
+  // unlocks the session mutex, and writes the interleaved queue a writer thread handed off meanwhile
+  void UnlockSessionMutex();
+
+  InterleavedWriteQueue *GetInterleavedQueue() { return fInterleavedQueue; }
 
   // OPTIONS request
   void SaveOutputStream();
@@ -176,14 +189,9 @@ class RTSPSessionInterface : public QTSSDictionary, public CF::Thread::Task {
   // be prevented from writing while an RTSP request is in progress
   CF::Core::Mutex fSessionMutex;
 
-  // for coalescing small interleaved writes into a single TCP frame
-  enum {
-    kTCPCoalesceBufferSize = 1450, //1450 is the max data space in an TCP segment over ent
-    kTCPCoalesceDirectWriteSize = 0, // if > this # bytes bypass coalescing and make a direct write
-    kInteleaveHeaderSize = 4  // '$ '+ 1 byte ch ID + 2 bytes length
-  };
-  char *fTCPCoalesceBuffer;  // 合并缓冲
-  SInt32 fNumInCoalesceBuffer;
+  // interleaved packets of all streams queued during a send pass, allocated on the first batched write.
+  // while it isn't empty the session is held by its object holder count, the mutex is taken only to queue and flush
+  InterleavedWriteQueue *fInterleavedQueue;
 
   //+rt  socket we get from "accept()"
   CF::Net::TCPSocket fSocket;
@@ -0,0 +1,55 @@
+/**
+ * @file ShardedRefTable.cpp
+ *
+ * Session registry split into independently locked shards, see ShardedRefTable.h
+ */
+
+#include "ShardedRefTable.h"
+
+using namespace CF;
+
+ShardedRefTable::ShardedRefTable(UInt32 inTableSize, UInt32 inNumShards)
+    : fShards(nullptr), fNumShards(1) {
+  while (fNumShards < inNumShards)
+    fNumShards <<= 1U;
+
+  UInt32 theShardSize = inTableSize / fNumShards;
+  if (theShardSize == 0)
+    theShardSize = 1;
+
+  fShards = new RefTable *[fNumShards];
+  for (UInt32 i = 0; i < fNumShards; i++)
+    fShards[i] = new RefTable(theShardSize);
+}
+
+ShardedRefTable::~ShardedRefTable() {
+  for (UInt32 i = 0; i < fNumShards; i++)
+    delete fShards[i];
+  delete[] fShards;
+}
+
+UInt32 ShardedRefTable::HashKey(StrPtrLen *inKey) {
+  UInt32 theHash = 2166136261U;
+  for (UInt32 i = 0; i < inKey->Len; i++) {
+    theHash ^= (UInt8) inKey->Ptr[i];
+    theHash *= 16777619U;
+  }
+  return theHash;
+}
+
+UInt32 ShardedRefTable::GetNumRefsInTable() {
+  UInt32 theNumRefs = 0;
+  for (UInt32 i = 0; i < fNumShards; i++)
+    theNumRefs += fShards[i]->GetNumRefsInTable();
+  return theNumRefs;
+}
+
+void ShardedRefTable::LockAll() {
+  for (UInt32 i = 0; i < fNumShards; i++)
+    fShards[i]->GetMutex()->Lock();
+}
+
+void ShardedRefTable::UnlockAll() {
+  for (UInt32 i = fNumShards; i > 0; i--)
+    fShards[i - 1]->GetMutex()->Unlock();
+}
@@ -0,0 +1,209 @@
+/**
+ * @file UDPSendBatcher.cpp
+ *
+ * Per-thread transmit batch for RTP/RTCP over UDP, see UDPSendBatcher.h
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#if __linux__
+#include <netinet/udp.h>
+#endif
+
+#include "UDPSendBatcher.h"
+
+#if __linux__ && defined(UDP_SEGMENT)
+std::atomic<bool> UDPSendBatcher::sGSOEnabled(true);
+#else
+std::atomic<bool> UDPSendBatcher::sGSOEnabled(false);
+#endif
+
+UDPSendBatcher *UDPSendBatcher::GetThreadBatcher() {
+  static thread_local UDPSendBatcher sBatcher;
+  return &sBatcher;
+}
+
+bool UDPSendBatcher::IsSupported() {
+#if __linux__
+  return true;
+#else
+  return false;
+#endif
+}
+
+UDPSendBatcher::UDPSendBatcher() : fNumQueued(0) {
+#if __linux__
+  ::memset(fMsgs, 0, sizeof(fMsgs));
+#endif
+}
+
+bool UDPSendBatcher::Queue(int inSocketFD, UInt32 inRemoteAddr, UInt16 inRemotePort, QTSS_PacketStruct *inPacket, UInt32 inLen) {
+#if __linux__
+  UInt32 theHeaderLen = 0;
+  if (inPacket->packetHeader != nullptr && inPacket->packetHeaderLen <= inLen)
+    theHeaderLen = inPacket->packetHeaderLen;
+
+  if (theHeaderLen > kMaxHeaderSize)
+    return false;
+
+  if (fNumQueued == kMaxBatchSize)
+    this->Flush();
+
+  Entry &theEntry = fEntries[fNumQueued];
+  theEntry.fSocketFD = inSocketFD;
+  ::memset(&theEntry.fRemoteAddr, 0, sizeof(theEntry.fRemoteAddr));
+  theEntry.fRemoteAddr.sin_family = AF_INET;
+  theEntry.fRemoteAddr.sin_port = htons(inRemotePort);
+  theEntry.fRemoteAddr.sin_addr.s_addr = htonl(inRemoteAddr);
+
+  if (theHeaderLen > 0)
+    ::memcpy(theEntry.fHeader, inPacket->packetHeader, theHeaderLen);
+  theEntry.fHeaderLen = theHeaderLen;
+  theEntry.fData = (char *) inPacket->packetData + theHeaderLen;
+  theEntry.fDataLen = inLen - theHeaderLen;
+
+  // the writer may free its packet before the flush
+  theEntry.fBuffer = (PacketBuffer *) inPacket->packetBuffer;
+  if (theEntry.fBuffer != nullptr)
+    theEntry.fBuffer->Retain();
+
+  fNumQueued++;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void UDPSendBatcher::Flush() {
+#if __linux__
+  UInt32 theFirst = 0;
+  while (theFirst < fNumQueued) {
+    // sendmmsg works on one socket, send each run of the same socket together
+    UInt32 theEnd = theFirst + 1;
+    while (theEnd < fNumQueued && fEntries[theEnd].fSocketFD == fEntries[theFirst].fSocketFD)
+      theEnd++;
+
+    this->SendRun(theFirst, theEnd - theFirst);
+    theFirst = theEnd;
+  }
+
+  for (UInt32 i = 0; i < fNumQueued; i++) {
+    if (fEntries[i].fBuffer != nullptr)
+      fEntries[i].fBuffer->Release();
+    fEntries[i].fBuffer = nullptr;
+  }
+#endif
+
+  fNumQueued = 0;
+}
+
+void UDPSendBatcher::SendRun(UInt32 inFirstEntry, UInt32 inNumEntries) {
+#if __linux__
+  UInt32 theEnd = inFirstEntry + inNumEntries;
+  UInt32 theNumMsgs = 0;
+  UInt32 theNumIovs = 0;
+  bool useGSO = sGSOEnabled.load(std::memory_order_relaxed);
+
+  for (UInt32 i = inFirstEntry; i < theEnd;) {
+    UInt32 theSegments = 1;
+    UInt32 theSegmentLen = fEntries[i].GetLen();
+
+    if (useGSO) {
+      // equally sized datagrams to the same destination, only the last one may be shorter
+      UInt32 theTotalLen = theSegmentLen;
+      while (i + theSegments < theEnd) {
+        Entry &theNext = fEntries[i + theSegments];
+        if (!theNext.SameDestination(fEntries[i]) || theNext.GetLen() > theSegmentLen ||
+            theTotalLen + theNext.GetLen() > kMaxGSOBytes)
+          break;
+
+        theTotalLen += theNext.GetLen();
+        theSegments++;
+        if (theNext.GetLen() < theSegmentLen)
+          break;
+      }
+    }
+
+    struct msghdr &theHdr = fMsgs[theNumMsgs].msg_hdr;
+    ::memset(&theHdr, 0, sizeof(theHdr));
+    theHdr.msg_name = &fEntries[i].fRemoteAddr;
+    theHdr.msg_namelen = sizeof(struct sockaddr_in);
+    theHdr.msg_iov = &fIovs[theNumIovs];
+
+    for (UInt32 j = i; j < i + theSegments; j++) {
+      if (fEntries[j].fHeaderLen > 0) {
+        fIovs[theNumIovs].iov_base = fEntries[j].fHeader;
+        fIovs[theNumIovs].iov_len = fEntries[j].fHeaderLen;
+        theNumIovs++;
+      }
+      fIovs[theNumIovs].iov_base = fEntries[j].fData;
+      fIovs[theNumIovs].iov_len = fEntries[j].fDataLen;
+      theNumIovs++;
+    }
+    theHdr.msg_iovlen = &fIovs[theNumIovs] - theHdr.msg_iov;
+
+#ifdef UDP_SEGMENT
+    if (theSegments > 1) {
+      theHdr.msg_control = fControl[theNumMsgs];
+      theHdr.msg_controllen = CMSG_SPACE(sizeof(UInt16));
+      struct cmsghdr *theCmsg = CMSG_FIRSTHDR(&theHdr);
+      theCmsg->cmsg_level = SOL_UDP;
+      theCmsg->cmsg_type = UDP_SEGMENT;
+      theCmsg->cmsg_len = CMSG_LEN(sizeof(UInt16));
+      auto theGSOSize = (UInt16) theSegmentLen;
+      ::memcpy(CMSG_DATA(theCmsg), &theGSOSize, sizeof(theGSOSize));
+    }
+#endif
+
+    fMsgFirstEntry[theNumMsgs] = i;
+    fMsgNumEntries[theNumMsgs] = theSegments;
+    theNumMsgs++;
+    i += theSegments;
+  }
+
+  int theSocketFD = fEntries[inFirstEntry].fSocketFD;
+  UInt32 theSent = 0;
+  while (theSent < theNumMsgs) {
+    int theResult = ::sendmmsg(theSocketFD, &fMsgs[theSent], theNumMsgs - theSent, 0);
+    if (theResult > 0) {
+      theSent += theResult;
+      continue;
+    }
+
+    if (fMsgNumEntries[theSent] > 1 && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+      // no GSO on this kernel or device: turn it off and send these segments one by one
+      sGSOEnabled.store(false, std::memory_order_relaxed);
+      for (UInt32 j = 0; j < fMsgNumEntries[theSent]; j++)
+        this->SendEntry(fEntries[fMsgFirstEntry[theSent] + j]);
+    }
+
+    // like an unchecked SendTo, a datagram that can't be sent now (EAGAIN, ...) is dropped
+    theSent++;
+  }
+#endif
+}
+
+void UDPSendBatcher::SendEntry(Entry &inEntry) {
+#if __linux__
+  struct iovec iov[2];
+  UInt32 theNumIovs = 0;
+  if (inEntry.fHeaderLen > 0) {
+    iov[theNumIovs].iov_base = inEntry.fHeader;
+    iov[theNumIovs].iov_len = inEntry.fHeaderLen;
+    theNumIovs++;
+  }
+  iov[theNumIovs].iov_base = inEntry.fData;
+  iov[theNumIovs].iov_len = inEntry.fDataLen;
+  theNumIovs++;
+
+  struct msghdr theMsg;
+  ::memset(&theMsg, 0, sizeof(theMsg));
+  theMsg.msg_name = &inEntry.fRemoteAddr;
+  theMsg.msg_namelen = sizeof(struct sockaddr_in);
+  theMsg.msg_iov = iov;
+  theMsg.msg_iovlen = theNumIovs;
+
+  (void) ::sendmsg(inEntry.fSocketFD, &theMsg, 0);
+#endif
+}
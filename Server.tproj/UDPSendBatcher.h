@@ -0,0 +1,105 @@
+/**
+ * @file UDPSendBatcher.h
+ *
+ * Per-thread transmit batch for RTP/RTCP over UDP.
+ *
+ * RTPStream::Write queues datagrams here when the writer asks for it
+ * (qtssWriteFlagsBatchUDP), and the writer flushes the batch once it is
+ * done with a fan-out pass (QTSS_FlushWriteBatch). A flush sends all
+ * queued datagrams with sendmmsg(), and runs of equally sized datagrams
+ * to the same destination go out as one UDP GSO super-packet where the
+ * kernel supports it.
+ *
+ * Statistics (overbuffer window, byte counts) are updated by RTPStream
+ * when the datagram is queued, exactly as for an immediate SendTo whose
+ * result was never checked: a queued datagram is always flushed.
+ *
+ * @note the packet data is referenced, not copied. A packet with a
+ *       PacketBuffer (QTSS_PacketStruct::packetBuffer) is held by the batch
+ *       until it is sent, any other data must stay valid until Flush() is
+ *       called. The (small) rewritten header is copied.
+ */
+
+#ifndef __UDP_SEND_BATCHER_H__
+#define __UDP_SEND_BATCHER_H__
+
+#include <atomic>
+
+#include <CF/Types.h>
+
+#if !__WinSock__
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "QTSS.h"
+#include "PacketBuffer.h"
+
+class UDPSendBatcher {
+ public:
+
+  enum {
+    kMaxBatchSize = 64,     // datagrams per batch, also the GSO segment limit
+    kMaxHeaderSize = 32,    // rewritten header bytes copied into the batch
+    kMaxGSOBytes = 65000,   // payload bytes of one GSO super-packet
+  };
+
+  // the batch of the calling thread
+  static UDPSendBatcher *GetThreadBatcher();
+
+  static bool IsSupported();
+
+  UDPSendBatcher();
+  ~UDPSendBatcher() = default;
+
+  //
+  // Queue one datagram to inRemoteAddr:inRemotePort (host byte order) on inSocketFD.
+  // Flushes first if the batch is full.
+  // Returns false if the datagram can't be batched, the caller must send it itself.
+  bool Queue(int inSocketFD, UInt32 inRemoteAddr, UInt16 inRemotePort, QTSS_PacketStruct *inPacket, UInt32 inLen);
+
+  //
+  // Send everything that has been queued.
+  void Flush();
+
+  UInt32 GetNumQueued() { return fNumQueued; }
+
+ private:
+
+  struct Entry {
+    int fSocketFD;
+    struct sockaddr_in fRemoteAddr;
+    char fHeader[kMaxHeaderSize];
+    UInt32 fHeaderLen;
+    char *fData;
+    UInt32 fDataLen;
+    PacketBuffer *fBuffer;  // holds fData if not nullptr
+
+    UInt32 GetLen() { return fHeaderLen + fDataLen; }
+
+    bool SameDestination(Entry &inEntry) {
+      return fSocketFD == inEntry.fSocketFD &&
+          fRemoteAddr.sin_addr.s_addr == inEntry.fRemoteAddr.sin_addr.s_addr &&
+          fRemoteAddr.sin_port == inEntry.fRemoteAddr.sin_port;
+    }
+  };
+
+  void SendRun(UInt32 inFirstEntry, UInt32 inNumEntries);
+  void SendEntry(Entry &inEntry);
+
+  Entry fEntries[kMaxBatchSize];
+  UInt32 fNumQueued;
+
+#if __linux__
+  struct mmsghdr fMsgs[kMaxBatchSize];
+  struct iovec fIovs[kMaxBatchSize * 2];
+  // UDP_SEGMENT control message of each GSO message, CMSG_SPACE keeps every row aligned
+  alignas(struct cmsghdr) char fControl[kMaxBatchSize][CMSG_SPACE(sizeof(UInt16))];
+  UInt32 fMsgFirstEntry[kMaxBatchSize];
+  UInt32 fMsgNumEntries[kMaxBatchSize];
+#endif
+
+  static std::atomic<bool> sGSOEnabled;
+};
+
+#endif // __UDP_SEND_BATCHER_H__
@@ -37,7 +37,6 @@
 
 #include "QTSServerInterface.h"
 
-class RTCPTask;
 
 class RTSPListenerSocket;
 
@@ -116,7 +115,6 @@ class QTSServer : public QTSServerInterface {
 
   //
   // GLOBAL TASKS
-  RTCPTask *fRTCPTask{};
   RTPStatsUpdaterTask *fStatsTask{};
   static char const *sPortPrefString;
   static XMLPrefsParser *sPrefsSource;
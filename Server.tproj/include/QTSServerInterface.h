@@ -48,6 +48,7 @@
 #include "QTSServerPrefs.h"
 #include "QTSSMessages.h"
 #include "QTSSModule.h"
+#include "ShardedRefTable.h"
 
 //class RTPStatsUpdaterTask;
 class RTPSessionInterface;
@@ -244,9 +245,9 @@ class QTSServerInterface : public QTSSDictionary {
   static QTSServerInterface *GetServer() { return sServer; }
 
   //Allows you to map RTP session IDs (strings) to actual RTP session objects
-  CF::RefTable *GetRTPSessionMap() { return fRTPMap; }
+  ShardedRefTable *GetRTPSessionMap() { return fRTPMap; }
 
-  CF::RefTable *GetReflectorSessionMap() { return fReflectorSessionMap; }
+  ShardedRefTable *GetReflectorSessionMap() { return fReflectorSessionMap; }
 
   //Server provides a statically created & bound UDPSocket / Demuxer pair
   //for each IP address setup to serve RTP. You access those pairs through
@@ -344,8 +345,8 @@ class QTSServerInterface : public QTSSDictionary {
   CF::Net::UDPSocketPool *fSocketPool;
 
   // All RTP sessions are put into this map
-  CF::RefTable *fRTPMap;
-  CF::RefTable *fReflectorSessionMap;
+  ShardedRefTable *fRTPMap;
+  ShardedRefTable *fReflectorSessionMap;
 
   QTSServerPrefs *fSrvrPrefs;
   QTSSMessages *fSrvrMessages;
@@ -486,7 +487,7 @@ class RTPStatsUpdaterTask : public CF::Thread::Task {
 
   SInt64 Run() override;
 
-  RTPSessionInterface *GetNewestSession(CF::RefTable *inRTPSessionMap);
+  RTPSessionInterface *GetNewestSession(ShardedRefTable *inRTPSessionMap);
 
   Float32 GetCPUTimeInSeconds();
 
@@ -0,0 +1,97 @@
+/**
+ * @file ShardedRefTable.h
+ *
+ * Session registry split into independently locked shards.
+ *
+ * The key string is hashed once to pick a shard, each shard is a plain
+ * CF::RefTable with its own mutex. Lookups of different sessions no longer
+ * serialize on one global mutex, which is what every interleaved packet
+ * (RTSPSession::HandleIncomingDataPacket) and every reflector request used
+ * to do.
+ *
+ * Ref counting semantics are exactly the ones of RefTable: Resolve() takes a
+ * reference that must be given back with Release(), and UnRegister() waits
+ * for the references to go away.
+ *
+ * Whole-table operations (statistics, kill all, ...) are rare: they either
+ * walk the shards one at a time, or lock all of them in index order with
+ * ShardedRefTableLocker.
+ */
+
+#ifndef __SHARDED_REF_TABLE_H__
+#define __SHARDED_REF_TABLE_H__
+
+#include <CF/Types.h>
+#include <CF/Ref.h>
+#include <CF/Core/Mutex.h>
+
+class ShardedRefTable {
+ public:
+
+  enum {
+    kDefaultNumShards = 16, // must be a power of 2
+  };
+
+  /**
+   * @param inTableSize the total size, divided among the shards
+   */
+  explicit ShardedRefTable(UInt32 inTableSize = CF::RefTable::kDefaultTableSize,
+                           UInt32 inNumShards = kDefaultNumShards);
+
+  ~ShardedRefTable();
+
+  ShardedRefTable(const ShardedRefTable &) = delete;
+  ShardedRefTable &operator=(const ShardedRefTable &) = delete;
+
+  // FNV-1a, independent of the hash RefTable uses inside a shard
+  static UInt32 HashKey(CF::StrPtrLen *inKey);
+
+  UInt32 GetNumShards() { return fNumShards; }
+
+  CF::RefTable *GetShard(UInt32 inIndex) { return fShards[inIndex]; }
+
+  CF::RefTable *GetShard(CF::StrPtrLen *inKey) { return fShards[HashKey(inKey) & (fNumShards - 1)]; }
+
+  //
+  // RefTable interface, forwarded to the shard of the key
+
+  OS_Error Register(CF::Ref *inRef) { return GetShard(inRef->GetString())->Register(inRef); }
+
+  CF::Ref *RegisterOrResolve(CF::Ref *inRef) { return GetShard(inRef->GetString())->RegisterOrResolve(inRef); }
+
+  void UnRegister(CF::Ref *inRef, UInt32 refCount = 0) { GetShard(inRef->GetString())->UnRegister(inRef, refCount); }
+
+  bool TryUnRegister(CF::Ref *inRef, UInt32 refCount = 0) {
+    return GetShard(inRef->GetString())->TryUnRegister(inRef, refCount);
+  }
+
+  CF::Ref *Resolve(CF::StrPtrLen *inString) { return GetShard(inString)->Resolve(inString); }
+
+  void Release(CF::Ref *inRef) { GetShard(inRef->GetString())->Release(inRef); }
+
+  UInt32 GetNumRefsInTable();
+
+  //
+  // lock every shard, in index order so two lockers can't deadlock
+
+  void LockAll();
+
+  void UnlockAll();
+
+ private:
+
+  CF::RefTable **fShards;
+  UInt32 fNumShards;
+};
+
+class ShardedRefTableLocker {
+ public:
+  explicit ShardedRefTableLocker(ShardedRefTable *inTable) : fTable(inTable) { fTable->LockAll(); }
+
+  ~ShardedRefTableLocker() { fTable->UnlockAll(); }
+
+ private:
+  ShardedRefTable *fTable;
+};
+
+#endif //__SHARDED_REF_TABLE_H__
@@ -0,0 +1,310 @@
+//
+// AnnexBRecorder.cpp
+//
+
+#include <string.h>
+
+#include <CF/Core/Mutex.h>
+#include <CF/Core/Cond.h>
+#include <CF/Core/Thread.h>
+#include <CF/Core/Time.h>
+
+#include "AnnexBRecorder.h"
+#include "RTPProtocol.h"
+#include "H264Packet.h"
+#include "KeyFrameDetector.h"
+
+using namespace CF;
+
+/**
+ * 所有录制共用的写线程
+ *
+ * 队列中的记录为 (recorder, buffer)，buffer 为 nullptr 表示关闭该 recorder
+ */
+class AnnexBWriterThread : public Core::Thread {
+ public:
+
+  static AnnexBWriterThread *GetWriter();
+
+  AnnexBWriterThread() : fHead(0), fLen(0), fNumDropped(0) {}
+
+  ~AnnexBWriterThread() override = default;
+
+  bool Put(AnnexBRecorder *inRecorder, PacketBuffer *inBuffer);
+
+  UInt32 GetNumDropped() { return fNumDropped; }
+
+ private:
+
+  enum {
+    kMaxRecordsPerPass = 256,
+  };
+
+  struct Record {
+    AnnexBRecorder *fRecorder;
+    PacketBuffer *fBuffer;
+  };
+
+  void Entry() override;
+
+  Core::Mutex fMutex;
+  Core::Cond fCond;
+
+  Record fRecords[AnnexBRecorder::kQueueSize];
+  UInt32 fHead;
+  UInt32 fLen;
+  UInt32 fNumDropped;
+
+  // the open recorders, writer thread only
+  Queue fRecorders;
+};
+
+static Core::Mutex sWriterMutex;
+static AnnexBWriterThread *sWriter = nullptr;
+
+AnnexBWriterThread *AnnexBWriterThread::GetWriter() {
+  Core::MutexLocker locker(&sWriterMutex);
+  if (sWriter == nullptr) {
+    sWriter = new AnnexBWriterThread();
+    sWriter->Start();
+  }
+  return sWriter;
+}
+
+bool AnnexBWriterThread::Put(AnnexBRecorder *inRecorder, PacketBuffer *inBuffer) {
+  Core::MutexLocker locker(&fMutex);
+
+  // a close is never dropped, the recorder would leak
+  if (inBuffer != nullptr && fLen == AnnexBRecorder::kQueueSize) {
+    fNumDropped++;
+    return false;
+  }
+
+  if (fLen == AnnexBRecorder::kQueueSize) {
+    // no room for the close: wait for the writer to make some
+    while (fLen == AnnexBRecorder::kQueueSize)
+      fCond.Wait(&fMutex, 10);
+  }
+
+  Record &theRecord = fRecords[(fHead + fLen) % AnnexBRecorder::kQueueSize];
+  theRecord.fRecorder = inRecorder;
+  theRecord.fBuffer = inBuffer;
+  fLen++;
+
+  if (fLen == 1)
+    fCond.Signal();
+  return true;
+}
+
+void AnnexBWriterThread::Entry() {
+  Record theRecords[kMaxRecordsPerPass];
+
+  while (!this->IsStopRequested()) {
+    UInt32 theNumRecords = 0;
+    {
+      Core::MutexLocker locker(&fMutex);
+      if (fLen == 0)
+        fCond.Wait(&fMutex, AnnexBRecorder::kFlushIntervalMSec);
+
+      while (fLen > 0 && theNumRecords < kMaxRecordsPerPass) {
+        theRecords[theNumRecords++] = fRecords[fHead];
+        fHead = (fHead + 1) % AnnexBRecorder::kQueueSize;
+        fLen--;
+      }
+    }
+
+    SInt64 theCurrentTime = Core::Time::Milliseconds();
+
+    for (UInt32 i = 0; i < theNumRecords; i++) {
+      AnnexBRecorder *theRecorder = theRecords[i].fRecorder;
+
+      if (theRecords[i].fBuffer == nullptr) { // close
+        if (theRecorder->fWriterElem.IsMemberOfAnyQueue())
+          fRecorders.Remove(&theRecorder->fWriterElem);
+        theRecorder->Flush(theCurrentTime);
+        delete theRecorder;
+        continue;
+      }
+
+      if (!theRecorder->fWriterElem.IsMemberOfAnyQueue())
+        fRecorders.EnQueue(&theRecorder->fWriterElem);
+
+      theRecorder->WriteRTPPacket(theRecords[i].fBuffer->GetData(), theRecords[i].fBuffer->GetLen());
+      theRecords[i].fBuffer->Release();
+    }
+
+    // don't let data wait in the write buffers forever on a slow stream
+    for (QueueIter iter(&fRecorders); !iter.IsDone(); iter.Next()) {
+      auto *theRecorder = (AnnexBRecorder *) iter.GetCurrent()->GetEnclosingObject();
+      if (theCurrentTime - theRecorder->fLastFlushTime >= AnnexBRecorder::kFlushIntervalMSec)
+        theRecorder->Flush(theCurrentTime);
+    }
+  }
+}
+
+AnnexBRecorder *AnnexBRecorder::Create(char const *inFilePath) {
+  if (inFilePath == nullptr || inFilePath[0] == '\0')
+    return nullptr;
+
+  (void) AnnexBWriterThread::GetWriter();
+  return new AnnexBRecorder(inFilePath);
+}
+
+UInt32 AnnexBRecorder::GetNumDroppedPackets() {
+  return AnnexBWriterThread::GetWriter()->GetNumDropped();
+}
+
+AnnexBRecorder::AnnexBRecorder(char const *inFilePath)
+    : fFilePath(nullptr),
+      fFile(nullptr),
+      fOpenFailed(false),
+      fWriteBuffer(new char[kWriteBufferSize]),
+      fWriteLen(0),
+      fLastFlushTime(0),
+      fHasKeyFrame(false),
+      fInFragmentedNALU(false),
+      fHasLastSeqNum(false),
+      fLastSeqNum(0),
+      fWriterElem() {
+  fWriterElem.SetEnclosingObject(this);
+
+  size_t theLen = ::strlen(inFilePath);
+  fFilePath = new char[theLen + 1];
+  ::memcpy(fFilePath, inFilePath, theLen + 1);
+}
+
+AnnexBRecorder::~AnnexBRecorder() {
+  if (fFile != nullptr)
+    ::fclose(fFile);
+  delete[] fWriteBuffer;
+  delete[] fFilePath;
+}
+
+bool AnnexBRecorder::PutPacket(PacketBuffer *inBuffer) {
+  if (AnnexBWriterThread::GetWriter()->Put(this, inBuffer))
+    return true;
+
+  inBuffer->Release();
+  return false;
+}
+
+void AnnexBRecorder::Close() {
+  (void) AnnexBWriterThread::GetWriter()->Put(this, nullptr);
+}
+
+/**
+ * 解 RTP 包(rfc6184)，支持单一 NALU、STAP-A 和 FU-A
+ *
+ * 一个 FU-A 的后续分片只接在写出了其起始分片的 NALU 之后：起始分片丢失(包丢失或录制队列满)时，
+ * 后续分片被丢弃，而不是拼接到上一个 NALU 上
+ */
+void AnnexBRecorder::WriteRTPPacket(char *inPacket, UInt32 inLen) {
+  UInt8 const *thePayloadPtr = nullptr;
+  UInt32 thePayloadLen = 0;
+  if (!KeyFrameDetector::GetRTPPayload(inPacket, inLen, &thePayloadPtr, &thePayloadLen))
+    return;
+
+  // a gap in the sequence numbers may have taken the end of the current FU-A
+  UInt16 theSeqNum = ntohs(reinterpret_cast<RTPFixedHeader *>(inPacket)->seq);
+  if (fHasLastSeqNum && theSeqNum != (UInt16) (fLastSeqNum + 1))
+    fInFragmentedNALU = false;
+  fLastSeqNum = theSeqNum;
+  fHasLastSeqNum = true;
+
+  char const *thePayload = reinterpret_cast<char const *>(thePayloadPtr);
+  auto const *nalHeader = reinterpret_cast<NALUHeader const *>(thePayload);
+
+  if (nalHeader->type != 28) // a FU-A that lost its end fragment is over
+    fInFragmentedNALU = false;
+
+  if (nalHeader->type >= 1 && nalHeader->type <= 23) { // 单一包
+    (void) this->WriteNALU(thePayload, thePayloadLen, nullptr, 0);
+  } else if (nalHeader->type == 24) { // STAP-A
+    UInt32 theOffset = sizeof(NALUHeader);
+    while (theOffset + sizeof(UInt16) < thePayloadLen) {
+      UInt16 theNALULen = ntohs(*reinterpret_cast<UInt16 const *>(thePayload + theOffset));
+      theOffset += sizeof(UInt16);
+      if (theNALULen == 0 || theOffset + theNALULen > thePayloadLen)
+        break;
+      (void) this->WriteNALU(thePayload + theOffset, theNALULen, nullptr, 0);
+      theOffset += theNALULen;
+    }
+  } else if (nalHeader->type == 28) { // FU-A
+    if (thePayloadLen <= sizeof(FUIndicator) + sizeof(FUHeader)) {
+      fInFragmentedNALU = false;
+      return;
+    }
+
+    auto const *fuHeader = reinterpret_cast<FUHeader const *>(thePayload + sizeof(FUIndicator));
+    char const *theFragment = thePayload + sizeof(FUIndicator) + sizeof(FUHeader);
+    UInt32 theFragmentLen = thePayloadLen - sizeof(FUIndicator) - sizeof(FUHeader);
+
+    if (fuHeader->s) {
+      // the NALU header is rebuilt from the FU indicator and the FU header,
+      // the packet is shared and is never written
+      NALUHeader theNALUHeader = *nalHeader;
+      theNALUHeader.type = fuHeader->type;
+      fInFragmentedNALU = this->WriteNALU(reinterpret_cast<char const *>(&theNALUHeader), sizeof(NALUHeader),
+                                          theFragment, theFragmentLen);
+    } else if (fInFragmentedNALU) {
+      this->Append(theFragment, theFragmentLen);
+    }
+
+    if (fuHeader->e)
+      fInFragmentedNALU = false;
+  }
+}
+
+/**
+ * 写入一个 NALU: 起始码、NALU 头部分及其余部分
+ *
+ * @return false if it was skipped, before the first SPS/IDR
+ */
+bool AnnexBRecorder::WriteNALU(char const *inHead, UInt32 inHeadLen, char const *inRest, UInt32 inRestLen) {
+  static char const sStartCode[4] = {0x00, 0x00, 0x00, 0x01};
+
+  UInt8 theType = reinterpret_cast<NALUHeader const *>(inHead)->type;
+  if (!fHasKeyFrame) {
+    if (theType != 5 && theType != 7) // IDR/SPS
+      return false;
+    fHasKeyFrame = true;
+  }
+
+  this->Append(sStartCode, sizeof(sStartCode));
+  this->Append(inHead, inHeadLen);
+  if (inRestLen > 0)
+    this->Append(inRest, inRestLen);
+  return true;
+}
+
+void AnnexBRecorder::Append(char const *inData, UInt32 inLen) {
+  while (inLen > 0) {
+    if (fWriteLen == kWriteBufferSize)
+      this->Flush(Core::Time::Milliseconds());
+
+    UInt32 theLen = kWriteBufferSize - fWriteLen;
+    if (theLen > inLen)
+      theLen = inLen;
+
+    ::memcpy(fWriteBuffer + fWriteLen, inData, theLen);
+    fWriteLen += theLen;
+    inData += theLen;
+    inLen -= theLen;
+  }
+}
+
+void AnnexBRecorder::Flush(SInt64 inCurrentTime) {
+  fLastFlushTime = inCurrentTime;
+  if (fWriteLen == 0)
+    return;
+
+  if (fFile == nullptr && !fOpenFailed) {
+    fFile = ::fopen(fFilePath, "ab");
+    fOpenFailed = (fFile == nullptr);
+  }
+
+  if (fFile != nullptr)
+    (void) ::fwrite(fWriteBuffer, 1, fWriteLen, fFile);
+
+  fWriteLen = 0;
+}
@@ -0,0 +1,248 @@
+//
+// KeyFrameDetector.cpp
+//
+
+#include <string.h>
+
+#include "KeyFrameDetector.h"
+#include "RTPProtocol.h"
+#include "H264Packet.h"
+#include "H265Packet.h"
+#include "AV1Packet.h"
+
+using namespace CF;
+
+static H264KeyFrameDetector sH264Detector;
+static H265KeyFrameDetector sH265Detector;
+static AV1KeyFrameDetector sAV1Detector;
+
+KeyFrameDetector::Entry KeyFrameDetector::sDetectors[kMaxDetectors] = {
+    {"H264", &sH264Detector},
+    {"H265", &sH265Detector},
+    {"AV1", &sAV1Detector},
+};
+UInt32 KeyFrameDetector::sNumDetectors = 3;
+
+static inline UInt16 GetUInt16(UInt8 const *inPtr) {
+  return (UInt16) ((inPtr[0] << 8) | inPtr[1]);
+}
+
+KeyFrameDetector *KeyFrameDetector::Find(StrPtrLen &inPayloadName) {
+  if (inPayloadName.Ptr == nullptr)
+    return nullptr;
+
+  // "H265/90000" -> "H265"
+  StrPtrLen theEncodingName(inPayloadName.Ptr, inPayloadName.Len);
+  for (UInt32 i = 0; i < inPayloadName.Len; i++) {
+    if (inPayloadName.Ptr[i] == '/') {
+      theEncodingName.Len = i;
+      break;
+    }
+  }
+
+  for (UInt32 i = 0; i < sNumDetectors; i++) {
+    if (theEncodingName.EqualIgnoreCase(sDetectors[i].fEncodingName, (UInt32) ::strlen(sDetectors[i].fEncodingName)))
+      return sDetectors[i].fDetector;
+  }
+  return nullptr;
+}
+
+void KeyFrameDetector::Register(char const *inEncodingName, KeyFrameDetector *inDetector) {
+  StrPtrLen theEncodingName((char *) inEncodingName);
+  for (UInt32 i = 0; i < sNumDetectors; i++) {
+    if (theEncodingName.EqualIgnoreCase(sDetectors[i].fEncodingName, (UInt32) ::strlen(sDetectors[i].fEncodingName))) {
+      sDetectors[i].fDetector = inDetector;
+      return;
+    }
+  }
+
+  Assert(sNumDetectors < kMaxDetectors);
+  if (sNumDetectors < kMaxDetectors) {
+    sDetectors[sNumDetectors].fEncodingName = inEncodingName;
+    sDetectors[sNumDetectors].fDetector = inDetector;
+    sNumDetectors++;
+  }
+}
+
+bool KeyFrameDetector::GetRTPPayload(char const *inPacket, UInt32 inLen, UInt8 const **outPayload, UInt32 *outLen) {
+  if (inPacket == nullptr || inLen <= sizeof(RTPFixedHeader))
+    return false;
+
+  auto const *rtpHeader = reinterpret_cast<RTPFixedHeader const *>(inPacket);
+  UInt32 theHeaderLen = sizeof(RTPFixedHeader) + rtpHeader->cc * sizeof(UInt32);
+  if (rtpHeader->x) { // header extension: 16 bits profile, 16 bits length in words
+    if (inLen < theHeaderLen + sizeof(RTPExtHeader))
+      return false;
+    auto const *extHeader = reinterpret_cast<UInt8 const *>(inPacket + theHeaderLen);
+    theHeaderLen += sizeof(RTPExtHeader) + GetUInt16(extHeader + 2) * sizeof(UInt32);
+  }
+  if (inLen <= theHeaderLen)
+    return false;
+
+  if (rtpHeader->p) { // padding count is the last byte, it counts itself
+    UInt32 thePaddingLen = (UInt8) inPacket[inLen - 1];
+    if (thePaddingLen == 0 || thePaddingLen > inLen - theHeaderLen)
+      return false;
+    inLen -= thePaddingLen;
+  }
+
+  if (inLen <= theHeaderLen)
+    return false;
+
+  *outPayload = reinterpret_cast<UInt8 const *>(inPacket + theHeaderLen);
+  *outLen = inLen - theHeaderLen;
+  return true;
+}
+
+KeyFrameDetector::PacketKind KeyFrameDetector::ClassifyRTPPacket(char const *inPacket, UInt32 inLen) {
+  UInt8 const *thePayload = nullptr;
+  UInt32 thePayloadLen = 0;
+  if (!GetRTPPayload(inPacket, inLen, &thePayload, &thePayloadLen))
+    return kFramePacket;
+  return this->Classify(thePayload, thePayloadLen);
+}
+
+//
+// H.264, rfc6184
+
+KeyFrameDetector::PacketKind H264KeyFrameDetector::GetNALUKind(UInt8 inNALUType) {
+  if (inNALUType == 5) // IDR
+    return kKeyFrameStart;
+  if (inNALUType == 7 || inNALUType == 8) // SPS/PPS
+    return kParameterSet;
+  return kFramePacket;
+}
+
+KeyFrameDetector::PacketKind H264KeyFrameDetector::Classify(UInt8 const *inPayload, UInt32 inLen) {
+  if (inLen < sizeof(NALUHeader))
+    return kFramePacket;
+
+  auto const *nalHeader = reinterpret_cast<NALUHeader const *>(inPayload);
+  if (nalHeader->type >= 1 && nalHeader->type <= 23) // 单一包
+    return GetNALUKind(nalHeader->type);
+
+  if (nalHeader->type == 28 || nalHeader->type == 29) { // FU-A/B
+    if (inLen < sizeof(FUIndicator) + sizeof(FUHeader))
+      return kFramePacket;
+    auto const *fuHeader = reinterpret_cast<FUHeader const *>(inPayload + sizeof(FUIndicator));
+    return fuHeader->s ? GetNALUKind(fuHeader->type) : kFramePacket; // 仅起始包
+  }
+
+  // 聚合包: NALU 前的字段长度, 及 NALU size 中计入的 NALU 前字段长度
+  UInt32 theOffset;
+  UInt32 theUnitPrefixLen;
+  switch (nalHeader->type) {
+    case 24: // STAP-A: nal header
+      theOffset = sizeof(NALUHeader);
+      theUnitPrefixLen = 0;
+      break;
+    case 25: // STAP-B: nal header + DON
+      theOffset = sizeof(NALUHeader) + sizeof(UInt16);
+      theUnitPrefixLen = 0;
+      break;
+    case 26: // MTAP16: nal header + DONB, each unit has DOND + 16 bits TS offset
+      theOffset = sizeof(NALUHeader) + sizeof(UInt16);
+      theUnitPrefixLen = sizeof(UInt8) + 2;
+      break;
+    case 27: // MTAP24: nal header + DONB, each unit has DOND + 24 bits TS offset
+      theOffset = sizeof(NALUHeader) + sizeof(UInt16);
+      theUnitPrefixLen = sizeof(UInt8) + 3;
+      break;
+    default:
+      return kFramePacket;
+  }
+
+  PacketKind theKind = kFramePacket;
+  while (theOffset + sizeof(UInt16) < inLen) {
+    UInt32 theUnitLen = GetUInt16(inPayload + theOffset);
+    theOffset += sizeof(UInt16);
+    if (theUnitLen <= theUnitPrefixLen || theOffset + theUnitLen > inLen)
+      break;
+
+    auto const *naluHeader = reinterpret_cast<NALUHeader const *>(inPayload + theOffset + theUnitPrefixLen);
+    PacketKind theUnitKind = GetNALUKind(naluHeader->type);
+    if (theUnitKind > theKind)
+      theKind = theUnitKind;
+    theOffset += theUnitLen;
+  }
+  return theKind;
+}
+
+//
+// H.265/HEVC, rfc7798
+
+KeyFrameDetector::PacketKind H265KeyFrameDetector::GetNALUKind(UInt8 inNALUType) {
+  if (inNALUType >= kH265NALUTypeIRAPFirst && inNALUType <= kH265NALUTypeIRAPLast) // BLA/IDR/CRA
+    return kKeyFrameStart;
+  if (inNALUType >= kH265NALUTypeVPS && inNALUType <= kH265NALUTypePPS) // VPS/SPS/PPS
+    return kParameterSet;
+  return kFramePacket;
+}
+
+KeyFrameDetector::PacketKind H265KeyFrameDetector::Classify(UInt8 const *inPayload, UInt32 inLen) {
+  if (inLen < sizeof(H265NALUHeader))
+    return kFramePacket;
+
+  auto const *payloadHeader = reinterpret_cast<H265NALUHeader const *>(inPayload);
+  if (payloadHeader->type < kH265NALUTypeAP) // 单一包
+    return GetNALUKind(payloadHeader->type);
+
+  if (payloadHeader->type == kH265NALUTypeFU) {
+    if (inLen < sizeof(H265NALUHeader) + sizeof(H265FUHeader))
+      return kFramePacket;
+    auto const *fuHeader = reinterpret_cast<H265FUHeader const *>(inPayload + sizeof(H265NALUHeader));
+    return fuHeader->s ? GetNALUKind(fuHeader->type) : kFramePacket; // 仅起始包
+  }
+
+  if (payloadHeader->type == kH265NALUTypeAP) {
+    PacketKind theKind = kFramePacket;
+    UInt32 theOffset = sizeof(H265NALUHeader);
+    while (theOffset + sizeof(UInt16) < inLen) {
+      UInt32 theUnitLen = GetUInt16(inPayload + theOffset);
+      theOffset += sizeof(UInt16);
+      if (theUnitLen < sizeof(H265NALUHeader) || theOffset + theUnitLen > inLen)
+        break;
+
+      auto const *naluHeader = reinterpret_cast<H265NALUHeader const *>(inPayload + theOffset);
+      PacketKind theUnitKind = GetNALUKind(naluHeader->type);
+      if (theUnitKind > theKind)
+        theKind = theUnitKind;
+      theOffset += theUnitLen;
+    }
+    return theKind;
+  }
+
+  if (payloadHeader->type == kH265NALUTypePACI) { // the 6 bits after the A bit is the type of the carried NALU
+    if (inLen < sizeof(H265NALUHeader) + 1)
+      return kFramePacket;
+    return GetNALUKind((UInt8) ((inPayload[sizeof(H265NALUHeader)] >> 1) & 0x3f));
+  }
+
+  return kFramePacket;
+}
+
+//
+// AV1
+
+KeyFrameDetector::PacketKind AV1KeyFrameDetector::Classify(UInt8 const *inPayload, UInt32 inLen) {
+  if (inLen < sizeof(AV1AggregationHeader) + sizeof(AV1OBUHeader))
+    return kFramePacket;
+
+  auto const *aggrHeader = reinterpret_cast<AV1AggregationHeader const *>(inPayload);
+  if (aggrHeader->n) // 新的 coded video sequence 从关键帧和 sequence header 开始
+    return kKeyFrameStart;
+  if (aggrHeader->z) // 首个 OBU 是上一个包的延续
+    return kFramePacket;
+
+  UInt32 theOffset = sizeof(AV1AggregationHeader);
+  if (aggrHeader->w != 1) { // skip the LEB128 length of the first OBU element
+    while (theOffset < inLen && (inPayload[theOffset] & 0x80))
+      theOffset++;
+    theOffset++;
+    if (theOffset >= inLen)
+      return kFramePacket;
+  }
+
+  auto const *obuHeader = reinterpret_cast<AV1OBUHeader const *>(inPayload + theOffset);
+  return obuHeader->type == kAV1OBUTypeSequenceHeader ? kParameterSet : kFramePacket;
+}
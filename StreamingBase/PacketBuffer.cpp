@@ -0,0 +1,48 @@
+//
+// PacketBuffer.cpp
+//
+
+#include <new>
+
+#include <CF/Core/Mutex.h>
+
+#include "PacketBuffer.h"
+
+// 只缓存默认容量的缓冲区，ReflectorPacket 换出被共享的缓冲区时直接从这里取
+static CF::Core::Mutex sPoolMutex;
+static PacketBuffer *sFreeList = nullptr;
+static UInt32 sNumFree = 0;
+
+PacketBuffer *PacketBuffer::Create(UInt32 inCapacity) {
+  if (inCapacity == kDefaultCapacity) {
+    CF::Core::MutexLocker locker(&sPoolMutex);
+    if (sFreeList != nullptr) {
+      PacketBuffer *theBuffer = sFreeList;
+      sFreeList = theBuffer->fNextFree;
+      sNumFree--;
+
+      theBuffer->fNextFree = nullptr;
+      theBuffer->fLen = 0;
+      theBuffer->fRefCount.store(1, std::memory_order_relaxed);
+      return theBuffer;
+    }
+  }
+
+  void *theMemory = ::operator new(sizeof(PacketBuffer) + inCapacity);
+  return new(theMemory) PacketBuffer(inCapacity);
+}
+
+void PacketBuffer::Destroy(PacketBuffer *inBuffer) {
+  if (inBuffer->fCapacity == kDefaultCapacity) {
+    CF::Core::MutexLocker locker(&sPoolMutex);
+    if (sNumFree < kMaxPooledBuffers) {
+      inBuffer->fNextFree = sFreeList;
+      sFreeList = inBuffer;
+      sNumFree++;
+      return;
+    }
+  }
+
+  inBuffer->~PacketBuffer();
+  ::operator delete(inBuffer);
+}
@@ -31,6 +31,7 @@
 
 #include "RTCPPacket.h"
 #include "RTCPAckPacket.h"
+#include "RTPPacketView.h"
 
 #define RTCP_PACKET_DEBUG 0
 
@@ -45,19 +46,21 @@ bool RTCPPacket::ParsePacket(UInt8 *inPacketBuffer, UInt32 inPacketLen) {
   if (RTCP_PACKET_DEBUG)
     s_printf("RTCPPacket::ParsePacket first 4 bytes of packet=%x \n", ntohl(*(UInt32 *) inPacketBuffer));
 
+  RTCPPacketView thePacket((char const *) inPacketBuffer, inPacketLen);
+
   // the length of this packet can be no less than the advertised length (which is
   // in 32-bit words, so we must multiply) plus the size of the header (4 bytes)
   if (RTCP_PACKET_DEBUG)
     s_printf("RTCPPacket::ParsePacket len=%"   _U32BITARG_   " min allowed=%"   _U32BITARG_   "\n",
-             inPacketLen, (UInt32) ((this->GetPacketLength() * 4) + kRTCPHeaderSizeInBytes));
-  if (inPacketLen < (UInt32) ((this->GetPacketLength() * 4) + kRTCPHeaderSizeInBytes)) {
+             inPacketLen, (UInt32) ((thePacket.GetLengthInWords() * 4) + kRTCPHeaderSizeInBytes));
+  if (!thePacket.IsComplete()) {
     if (RTCP_PACKET_DEBUG)
       s_printf("RTCPPacket::ParsePacket invalid len=%"   _U32BITARG_   "\n", inPacketLen);
     return false;
   }
 
   // do some basic validation on the packet
-  if (this->GetVersion() != kSupportedRTCPVersion) {
+  if (thePacket.GetVersion() != kSupportedRTCPVersion) {
     if (RTCP_PACKET_DEBUG)
       s_printf("RTCPPacket::ParsePacket unsupported version\n");
     return false;
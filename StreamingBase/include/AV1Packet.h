@@ -0,0 +1,85 @@
+//
+// AV1Packet.h
+//
+
+#ifndef _EDSS2_AV1PACKET_H_
+#define _EDSS2_AV1PACKET_H_
+
+#include <CF/Types.h>
+
+
+/**
+ * AV1 Packet
+ *
+ *
+ * Aggregation Header:
+ *
+ *    +---------------+
+ *    |0|1|2|3|4|5|6|7|
+ *    +-+-+-+-+-+-+-+-+
+ *    |Z|Y| W |N|-|-|-|
+ *    +---------------+
+ *
+ *   Z: the first OBU element is the continuation of an OBU fragment from the previous packet
+ *   Y: the last OBU element will continue in the next packet
+ *   W: the number of OBU elements, 0 means each element is preceded by its LEB128 length;
+ *      otherwise every element but the last one is preceded by its length
+ *   N: the packet is the first packet of a coded video sequence
+ *
+ * @see  RTP Payload Format For AV1 (section 4.4)
+ *
+ */
+struct AV1AggregationHeader {
+#if BIGENDIAN
+  unsigned char z:1;
+  unsigned char y:1;
+  unsigned char w:2;
+  unsigned char n:1;
+  unsigned char reserved:3;
+#else
+  unsigned char reserved:3;
+  unsigned char n:1;
+  unsigned char w:2;
+  unsigned char y:1;
+  unsigned char z:1;
+#endif
+};
+
+/**
+ * OBU Header:
+ *
+ *    +---------------+
+ *    |0|1|2|3|4|5|6|7|
+ *    +-+-+-+-+-+-+-+-+
+ *    |F| type  |X|S|-|
+ *    +---------------+
+ *
+ * @see  AV1 Bitstream & Decoding Process Specification(5.3.2)
+ *
+ */
+struct AV1OBUHeader {
+#if BIGENDIAN
+  unsigned char forbidden:1;
+  unsigned char type:4;
+  unsigned char extension:1;
+  unsigned char hasSize:1;
+  unsigned char reserved:1;
+#else
+  unsigned char reserved:1;
+  unsigned char hasSize:1;
+  unsigned char extension:1;
+  unsigned char type:4;
+  unsigned char forbidden:1;
+#endif
+};
+
+enum {
+  kAV1OBUTypeSequenceHeader = 1,
+  kAV1OBUTypeTemporalDelimiter = 2,
+  kAV1OBUTypeFrameHeader = 3,
+  kAV1OBUTypeTileGroup = 4,
+  kAV1OBUTypeMetadata = 5,
+  kAV1OBUTypeFrame = 6,
+};
+
+#endif // _EDSS2_AV1PACKET_H_
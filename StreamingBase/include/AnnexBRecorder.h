@@ -0,0 +1,88 @@
+//
+// AnnexBRecorder.h
+//
+
+#ifndef _EDSS2_ANNEXB_RECORDER_H_
+#define _EDSS2_ANNEXB_RECORDER_H_
+
+#include <stdio.h>
+
+#include <CF/Types.h>
+#include <CF/Queue.h>
+
+#include "PacketBuffer.h"
+
+/**
+ * 将 H.264 RTP 流还原为 Annex-B 字节流写入文件
+ *
+ * 收流线程只把共享的包缓冲区放入一个有界队列，解包、打开文件和写盘都在
+ * 专用的写线程中完成，写入先在每个文件的缓冲区中合并，再大块顺序写出。
+ * 队列满时直接丢包，收流线程永远不会因磁盘 I/O 阻塞。
+ */
+class AnnexBRecorder {
+ public:
+
+  enum {
+    kQueueSize = 8192,             // packets queued for all recorders
+    kWriteBufferSize = 256 * 1024, // bytes merged before a write
+    kFlushIntervalMSec = 1000,     // max time data waits in the write buffer
+  };
+
+  /**
+   * @note the file is created by the writer thread when the first packet is written
+   */
+  static AnnexBRecorder *Create(char const *inFilePath);
+
+  /**
+   * queue one RTP packet of the stream, takes over a reference of inBuffer
+   *
+   * @return false if the queue is full and the packet was dropped
+   */
+  bool PutPacket(PacketBuffer *inBuffer);
+
+  /**
+   * flush and close the file on the writer thread, which then deletes the recorder.
+   * the recorder must not be used after this call
+   */
+  void Close();
+
+  static UInt32 GetNumDroppedPackets();
+
+ private:
+
+  explicit AnnexBRecorder(char const *inFilePath);
+
+  ~AnnexBRecorder();
+
+  AnnexBRecorder(const AnnexBRecorder &) = delete;
+  AnnexBRecorder &operator=(const AnnexBRecorder &) = delete;
+
+  //
+  // writer thread only
+  void WriteRTPPacket(char *inPacket, UInt32 inLen);
+
+  bool WriteNALU(char const *inHead, UInt32 inHeadLen, char const *inRest, UInt32 inRestLen);
+
+  void Append(char const *inData, UInt32 inLen);
+
+  void Flush(SInt64 inCurrentTime);
+
+  char *fFilePath;
+  FILE *fFile;
+  bool fOpenFailed;
+
+  char *fWriteBuffer;
+  UInt32 fWriteLen;
+  SInt64 fLastFlushTime;
+
+  bool fHasKeyFrame; // skip everything before the first SPS/IDR
+  bool fInFragmentedNALU; // the start of the current FU-A was written, its continuations follow it
+  bool fHasLastSeqNum;
+  UInt16 fLastSeqNum; // RTP sequence number of the last packet, a gap ends the current FU-A
+
+  CF::QueueElem fWriterElem; // in the writer's list of open recorders
+
+  friend class AnnexBWriterThread;
+};
+
+#endif //_EDSS2_ANNEXB_RECORDER_H_
@@ -0,0 +1,117 @@
+//
+// H265Packet.h
+//
+
+#ifndef _EDSS2_H265PACKET_H_
+#define _EDSS2_H265PACKET_H_
+
+#include <CF/Types.h>
+
+
+/**
+ * H.265/HEVC Packet
+ *
+ *
+ * NAL Unit Header (also the PayloadHdr of AP/FU/PACI):
+ *
+ *    +---------------+---------------+
+ *    |0|1|2|3|4|5|6|7|0|1|2|3|4|5|6|7|
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *    |F|   Type    |  LayerId  | TID |
+ *    +-------------+-----------------+
+ *
+ * @see  rfc7798(section 1.1.4)
+ *
+ */
+struct H265NALUHeader {
+#if BIGENDIAN
+  unsigned char f:1;
+  unsigned char type:6;
+  unsigned char layerIdHigh:1;
+  unsigned char layerIdLow:5;
+  unsigned char tid:3;
+#else
+  unsigned char layerIdHigh:1;
+  unsigned char type:6;
+  unsigned char f:1;
+  unsigned char tid:3;
+  unsigned char layerIdLow:5;
+#endif
+};
+
+enum {
+  kH265NALUTypeIRAPFirst = 16,    // BLA_W_LP
+  kH265NALUTypeIRAPLast = 23,     // RSV_IRAP_VCL23
+  kH265NALUTypeVPS = 32,
+  kH265NALUTypeSPS = 33,
+  kH265NALUTypePPS = 34,
+  kH265NALUTypeAP = 48,           // Aggregation Packet
+  kH265NALUTypeFU = 49,           // Fragmentation Unit
+  kH265NALUTypePACI = 50,         // PAyload Content Information
+};
+
+/**
+ * AP:
+ *
+ *     0                   1                   2                   3
+ *     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *    |    PayloadHdr (Type=48)       |         NALU 1 Size           |
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *    |          NALU 1 HDR           |                               |
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+         NALU 1 Data           |
+ *    |                   . . .                                       |
+ *    |                                                               |
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *    |  . . .        | NALU 2 Size                   | NALU 2 HDR    |
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * @see  rfc7798(4.4.2)
+ *
+ * @note  without sprop-max-don-diff there is no DONL/DOND field
+ *
+ */
+
+/**
+ * FU:
+ *
+ *     0                   1                   2                   3
+ *     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *    |    PayloadHdr (Type=49)       |   FU header   | DONL (cond)   |
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-|
+ *    | DONL (cond)   |                                               |
+ *    |-+-+-+-+-+-+-+-+                                               |
+ *    |                         FU payload                            |
+ *    |                                                               |
+ *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * @see  rfc7798(4.4.3)
+ *
+ */
+
+/**
+ * FU header:
+ *
+ *    +---------------+
+ *    |0|1|2|3|4|5|6|7|
+ *    +-+-+-+-+-+-+-+-+
+ *    |S|E|  FuType   |
+ *    +---------------+
+ *
+ * @see  rfc7798(4.4.3)
+ *
+ */
+struct H265FUHeader {
+#if BIGENDIAN
+  unsigned char s:1;
+  unsigned char e:1;
+  unsigned char type:6;
+#else
+  unsigned char type:6;
+  unsigned char e:1;
+  unsigned char s:1;
+#endif
+};
+
+#endif // _EDSS2_H265PACKET_H_
@@ -0,0 +1,92 @@
+//
+// KeyFrameDetector.h
+//
+
+#ifndef _EDSS2_KEY_FRAME_DETECTOR_H_
+#define _EDSS2_KEY_FRAME_DETECTOR_H_
+
+#include <CF/Types.h>
+#include <CF/StrPtrLen.h>
+
+/**
+ * 视频 RTP 包的关键帧识别
+ *
+ * 每种编码一个无状态的识别器，按 SDP rtpmap 的编码名查找。识别只看单个包：
+ * 分片包仅起始包可能是关键帧起始，聚合包中只要含有关键帧/参数集就按最重要的一种归类。
+ *
+ * 内置 H264(rfc6184)、H265(rfc7798) 和 AV1，其他编码实现 Classify 后 Register 即可。
+ */
+class KeyFrameDetector {
+ public:
+
+  // ordered, an aggregation packet takes the greatest kind of its units
+  enum PacketKind {
+    kFramePacket = 0,     // any other packet of the stream
+    kParameterSet = 1,    // SPS/PPS, VPS/SPS/PPS, AV1 sequence header
+    kKeyFrameStart = 2,   // first packet of a key frame: IDR, IRAP, new AV1 coded video sequence
+  };
+
+  virtual ~KeyFrameDetector() = default;
+
+  // classify the payload of one RTP packet
+  virtual PacketKind Classify(UInt8 const *inPayload, UInt32 inLen) = 0;
+
+  PacketKind ClassifyRTPPacket(char const *inPacket, UInt32 inLen);
+
+  /**
+   * @param inPayloadName the rtpmap encoding name, e.g. "H265/90000", the clock rate part is ignored
+   * @return nullptr if the codec has no detector
+   */
+  static KeyFrameDetector *Find(CF::StrPtrLen &inPayloadName);
+
+  /**
+   * add or replace the detector of an encoding name
+   *
+   * @note call at startup, before any stream looks up its detector. the detector must never be deleted
+   */
+  static void Register(char const *inEncodingName, KeyFrameDetector *inDetector);
+
+  /**
+   * skip the RTP header, CSRCs, header extension and padding
+   *
+   * @return false if the packet has no payload
+   */
+  static bool GetRTPPayload(char const *inPacket, UInt32 inLen, UInt8 const **outPayload, UInt32 *outLen);
+
+ private:
+
+  enum {
+    kMaxDetectors = 16,
+  };
+
+  struct Entry {
+    char const *fEncodingName;
+    KeyFrameDetector *fDetector;
+  };
+
+  static Entry sDetectors[kMaxDetectors];
+  static UInt32 sNumDetectors;
+};
+
+class H264KeyFrameDetector : public KeyFrameDetector {
+ public:
+  PacketKind Classify(UInt8 const *inPayload, UInt32 inLen) override;
+
+ private:
+  static PacketKind GetNALUKind(UInt8 inNALUType);
+};
+
+class H265KeyFrameDetector : public KeyFrameDetector {
+ public:
+  PacketKind Classify(UInt8 const *inPayload, UInt32 inLen) override;
+
+ private:
+  static PacketKind GetNALUKind(UInt8 inNALUType);
+};
+
+class AV1KeyFrameDetector : public KeyFrameDetector {
+ public:
+  PacketKind Classify(UInt8 const *inPayload, UInt32 inLen) override;
+};
+
+#endif //_EDSS2_KEY_FRAME_DETECTOR_H_
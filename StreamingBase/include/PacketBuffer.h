@@ -0,0 +1,71 @@
+//
+// PacketBuffer.h
+//
+
+#ifndef _EDSS2_PACKET_BUFFER_H_
+#define _EDSS2_PACKET_BUFFER_H_
+
+#include <atomic>
+
+#include <CF/Types.h>
+
+/**
+ * 带引用计数的包缓冲区
+ *
+ * 推流端收到的包只在入队前写入一次，之后视为只读，由 ReflectorSender 的队列、
+ * 所有 RTPSessionOutput 以及其它需要持有包数据的模块(关键帧缓存、重传队列等)
+ * 共享同一份负载，各自对包头的改写写入自己的 scatter/gather 头中，不再拷贝或改写负载。
+ *
+ * @note 数据区紧跟在对象之后分配，只能通过 Create 创建，通过 Release 释放
+ */
+class PacketBuffer {
+ public:
+
+  enum {
+    kDefaultCapacity = 2060,  // same as ReflectorPacket::kMaxReflectorPacketSize
+    kMaxPooledBuffers = 4096, // 缓存的空闲缓冲区上限
+  };
+
+  static PacketBuffer *Create(UInt32 inCapacity = kDefaultCapacity);
+
+  void Retain() { fRefCount.fetch_add(1, std::memory_order_relaxed); }
+
+  void Release() {
+    if (fRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      Destroy(this);
+  }
+
+  /**
+   * 除调用者外还有其他持有者，此时数据必须视为只读
+   */
+  bool IsShared() const { return fRefCount.load(std::memory_order_acquire) > 1; }
+
+  UInt32 GetRefCount() const { return fRefCount.load(std::memory_order_relaxed); }
+
+  char *GetData() { return reinterpret_cast<char *>(this + 1); }
+
+  UInt32 GetCapacity() const { return fCapacity; }
+
+  UInt32 GetLen() const { return fLen; }
+
+  void SetLen(UInt32 inLen) { fLen = inLen <= fCapacity ? inLen : fCapacity; }
+
+ private:
+
+  explicit PacketBuffer(UInt32 inCapacity) : fRefCount(1), fCapacity(inCapacity), fLen(0), fNextFree(nullptr) {}
+
+  ~PacketBuffer() = default;
+
+  PacketBuffer(const PacketBuffer &) = delete;
+  PacketBuffer &operator=(const PacketBuffer &) = delete;
+
+  static void Destroy(PacketBuffer *inBuffer);
+
+  std::atomic<UInt32> fRefCount;
+  UInt32 fCapacity;
+  UInt32 fLen;
+
+  PacketBuffer *fNextFree; // link of the free pool, only valid while pooled
+};
+
+#endif //_EDSS2_PACKET_BUFFER_H_
@@ -0,0 +1,226 @@
+//
+// RTPPacketView.h
+//
+
+#ifndef _EDSS2_RTP_PACKET_VIEW_H_
+#define _EDSS2_RTP_PACKET_VIEW_H_
+
+#include <CF/Types.h>
+
+#include "RTPProtocol.h"
+
+/**
+ * RTP/RTCP 包头的读取视图和原地改写
+ *
+ * 字段偏移在编译期确定(布局见 RTPProtocol.h 和 rfc3550)，按字节读写网络序：不要求包缓冲对齐，
+ * 编译器会合并为一次 load/store 加字节交换。
+ *
+ * 视图构造时检查一次长度，长度不够的包视为空包。各访问函数的检查都是和常量比较，
+ * 调用方已用 IsValid() 判断过时，内联后会被编译器消除。
+ *
+ * @note 视图不持有包数据，只在包缓冲有效期间使用
+ */
+
+constexpr UInt16 RTPLoad16(char const *inPtr) {
+  return (UInt16) (((UInt8) inPtr[0] << 8) | (UInt8) inPtr[1]);
+}
+
+constexpr UInt32 RTPLoad32(char const *inPtr) {
+  return ((UInt32) (UInt8) inPtr[0] << 24) | ((UInt32) (UInt8) inPtr[1] << 16)
+      | ((UInt32) (UInt8) inPtr[2] << 8) | (UInt32) (UInt8) inPtr[3];
+}
+
+inline void RTPStore16(char *inPtr, UInt16 inValue) {
+  inPtr[0] = (char) (inValue >> 8);
+  inPtr[1] = (char) inValue;
+}
+
+inline void RTPStore32(char *inPtr, UInt32 inValue) {
+  inPtr[0] = (char) (inValue >> 24);
+  inPtr[1] = (char) (inValue >> 16);
+  inPtr[2] = (char) (inValue >> 8);
+  inPtr[3] = (char) inValue;
+}
+
+class RTPPacketView {
+ public:
+
+  // RTP fixed header, rfc3550 section 5.1
+  enum {
+    kVersion = 2,
+    kSeqNumOffset = 2,
+    kTimestampOffset = 4,
+    kSSRCOffset = 8,
+    kFixedHeaderSize = 12,
+  };
+
+  static_assert(kFixedHeaderSize == sizeof(RTPFixedHeader), "RTPFixedHeader layout");
+
+  RTPPacketView(char const *inPacket, UInt32 inLen)
+      : fPacket(inPacket), fLen(inPacket != nullptr ? inLen : 0) {}
+
+  // the fixed header is all there
+  bool IsValid() const { return fLen >= kFixedHeaderSize; }
+
+  char const *GetPacket() const { return fPacket; }
+  UInt32 GetLen() const { return fLen; }
+
+  UInt8 GetVersion() const { return fLen > 0 ? (UInt8) ((UInt8) fPacket[0] >> 6) : 0; }
+  bool HasPadding() const { return fLen > 0 && ((UInt8) fPacket[0] & 0x20) != 0; }
+  bool HasExtension() const { return fLen > 0 && ((UInt8) fPacket[0] & 0x10) != 0; }
+  UInt8 GetCSRCCount() const { return fLen > 0 ? (UInt8) ((UInt8) fPacket[0] & 0x0f) : 0; }
+  bool GetMarker() const { return fLen > 1 && ((UInt8) fPacket[1] & 0x80) != 0; }
+  UInt8 GetPayloadType() const { return fLen > 1 ? (UInt8) ((UInt8) fPacket[1] & 0x7f) : 0; }
+
+  UInt16 GetSeqNumber() const {
+    return fLen >= kSeqNumOffset + 2 ? RTPLoad16(fPacket + kSeqNumOffset) : 0;
+  }
+
+  UInt32 GetTimestamp() const {
+    return fLen >= kTimestampOffset + 4 ? RTPLoad32(fPacket + kTimestampOffset) : 0;
+  }
+
+  UInt32 GetSSRC() const {
+    return fLen >= kSSRCOffset + 4 ? RTPLoad32(fPacket + kSSRCOffset) : 0;
+  }
+
+  /**
+   * length of the fixed header, CSRCs and header extension
+   *
+   * @return 0 if the packet is shorter than its header
+   */
+  UInt32 GetHeaderLen() const {
+    if (!IsValid())
+      return 0;
+
+    UInt32 theHeaderLen = kFixedHeaderSize + GetCSRCCount() * 4;
+    if (HasExtension()) { // 16 bits profile, 16 bits length in words
+      if (fLen < theHeaderLen + 4)
+        return 0;
+      theHeaderLen += 4 + RTPLoad16(fPacket + theHeaderLen + 2) * 4;
+    }
+    return theHeaderLen <= fLen ? theHeaderLen : 0;
+  }
+
+ private:
+  char const *fPacket;
+  UInt32 fLen;
+};
+
+/**
+ * 改写 RTP 包头中的 seq/timestamp/ssrc，buffer 至少要有 RTPPacketView::kFixedHeaderSize 字节
+ */
+class RTPHeaderWriter {
+ public:
+
+  explicit RTPHeaderWriter(char *inHeader) : fHeader(inHeader) {}
+
+  void SetSeqNumber(UInt16 inSeqNumber) { RTPStore16(fHeader + RTPPacketView::kSeqNumOffset, inSeqNumber); }
+  void SetTimestamp(UInt32 inTimestamp) { RTPStore32(fHeader + RTPPacketView::kTimestampOffset, inTimestamp); }
+  void SetSSRC(UInt32 inSSRC) { RTPStore32(fHeader + RTPPacketView::kSSRCOffset, inSSRC); }
+
+  // the three per-output fields at once, they are adjacent
+  void Rewrite(UInt16 inSeqNumber, UInt32 inTimestamp, UInt32 inSSRC) {
+    SetSeqNumber(inSeqNumber);
+    SetTimestamp(inTimestamp);
+    SetSSRC(inSSRC);
+  }
+
+  // a fixed header without CSRCs, extension or padding
+  void Build(UInt8 inPayloadType, bool inMarker, UInt16 inSeqNumber, UInt32 inTimestamp, UInt32 inSSRC) {
+    fHeader[0] = (char) (RTPPacketView::kVersion << 6);
+    fHeader[1] = (char) ((inMarker ? 0x80 : 0) | (inPayloadType & 0x7f));
+    Rewrite(inSeqNumber, inTimestamp, inSSRC);
+  }
+
+ private:
+  char *fHeader;
+};
+
+/**
+ * RTCP 公共头，以及 SR 的 sender info, rfc3550 section 6.4.1
+ */
+class RTCPPacketView {
+ public:
+
+  enum {
+    kVersion = 2,
+    kHeaderSize = 4,
+    kSSRCOffset = 4,
+    kSSRCHeaderSize = 8,        // header + sender SSRC
+    kNTPTimestampOffset = 8,
+    kRTPTimestampOffset = 16,
+    kPacketCountOffset = 20,
+    kOctetCountOffset = 24,
+    kSenderReportSize = 28,     // up to the sender info, without report blocks
+    kSenderReportType = 200,
+  };
+
+  RTCPPacketView(char const *inPacket, UInt32 inLen)
+      : fPacket(inPacket), fLen(inPacket != nullptr ? inLen : 0) {}
+
+  bool IsValid() const { return fLen >= kHeaderSize; }
+
+  char const *GetPacket() const { return fPacket; }
+  UInt32 GetLen() const { return fLen; }
+
+  UInt8 GetVersion() const { return fLen > 0 ? (UInt8) ((UInt8) fPacket[0] >> 6) : 0; }
+  bool HasPadding() const { return fLen > 0 && ((UInt8) fPacket[0] & 0x20) != 0; }
+  UInt8 GetReportCount() const { return fLen > 0 ? (UInt8) ((UInt8) fPacket[0] & 0x1f) : 0; }
+  UInt8 GetPacketType() const { return fLen > 1 ? (UInt8) fPacket[1] : 0; }
+
+  // in 32-bit words, not counting the header
+  UInt16 GetLengthInWords() const { return IsValid() ? RTPLoad16(fPacket + 2) : 0; }
+
+  // the advertised length fits in the buffer
+  bool IsComplete() const { return IsValid() && fLen >= (UInt32) GetLengthInWords() * 4 + kHeaderSize; }
+
+  UInt32 GetSSRC() const {
+    return fLen >= kSSRCHeaderSize ? RTPLoad32(fPacket + kSSRCOffset) : 0;
+  }
+
+  SInt64 GetNTPTimestamp() const {
+    return fLen >= kNTPTimestampOffset + 8
+           ? (SInt64) (((UInt64) RTPLoad32(fPacket + kNTPTimestampOffset) << 32)
+               | RTPLoad32(fPacket + kNTPTimestampOffset + 4))
+           : 0;
+  }
+
+  UInt32 GetRTPTimestamp() const {
+    return fLen >= kRTPTimestampOffset + 4 ? RTPLoad32(fPacket + kRTPTimestampOffset) : 0;
+  }
+
+  UInt32 GetPacketCount() const {
+    return fLen >= kPacketCountOffset + 4 ? RTPLoad32(fPacket + kPacketCountOffset) : 0;
+  }
+
+  UInt32 GetOctetCount() const {
+    return fLen >= kOctetCountOffset + 4 ? RTPLoad32(fPacket + kOctetCountOffset) : 0;
+  }
+
+ private:
+  char const *fPacket;
+  UInt32 fLen;
+};
+
+/**
+ * 改写 SR 的 sender info，buffer 至少要有 RTCPPacketView::kSenderReportSize 字节
+ */
+class RTCPSenderInfoWriter {
+ public:
+
+  explicit RTCPSenderInfoWriter(char *inReport) : fReport(inReport) {}
+
+  void SetNTPTimestamp(SInt64 inNTPTimestamp) {
+    RTPStore32(fReport + RTCPPacketView::kNTPTimestampOffset, (UInt32) ((UInt64) inNTPTimestamp >> 32));
+    RTPStore32(fReport + RTCPPacketView::kNTPTimestampOffset + 4, (UInt32) inNTPTimestamp);
+  }
+  void SetRTPTimestamp(UInt32 inTimestamp) { RTPStore32(fReport + RTCPPacketView::kRTPTimestampOffset, inTimestamp); }
+  void SetPacketCount(UInt32 inCount) { RTPStore32(fReport + RTCPPacketView::kPacketCountOffset, inCount); }
+  void SetOctetCount(UInt32 inCount) { RTPStore32(fReport + RTCPPacketView::kOctetCountOffset, inCount); }
+
+ private:
+  char *fReport;
+};
+
+#endif //_EDSS2_RTP_PACKET_VIEW_H_
@@ -0,0 +1,69 @@
+/*
+    File:       KeyFrameDetectorTest.cpp
+
+    Contains:   RTP payload extraction of KeyFrameDetector, padding counts
+                that don't fit the packet must not give a payload.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "KeyFrameDetector.h"
+
+#define CHECK(cond) do { if (!(cond)) { \
+  fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+enum {
+  kRTPHeaderLen = 12,
+  kPaddingBit = 0x20,
+};
+
+// an RTP packet with a single H.264 IDR NAL unit of inPayloadLen bytes, then inPaddingLen padding bytes
+// whose last one is inPaddingCount
+static UInt32 MakePacket(char *ioPacket, UInt32 inPayloadLen, UInt32 inPaddingLen, UInt8 inPaddingCount) {
+  ::memset(ioPacket, 0, kRTPHeaderLen + inPayloadLen + inPaddingLen);
+  ioPacket[0] = (char) (0x80 | (inPaddingLen > 0 ? kPaddingBit : 0)); // V=2
+  ioPacket[1] = 96;
+  ioPacket[kRTPHeaderLen] = 0x65; // NRI=3, type 5
+  if (inPaddingLen > 0)
+    ioPacket[kRTPHeaderLen + inPayloadLen + inPaddingLen - 1] = (char) inPaddingCount;
+  return kRTPHeaderLen + inPayloadLen + inPaddingLen;
+}
+
+int main() {
+  char thePacket[512];
+  UInt8 const *thePayload = nullptr;
+  UInt32 thePayloadLen = 0;
+
+  // no padding
+  UInt32 theLen = MakePacket(thePacket, 100, 0, 0);
+  CHECK(KeyFrameDetector::GetRTPPayload(thePacket, theLen, &thePayload, &thePayloadLen));
+  CHECK(thePayload == (UInt8 const *) thePacket + kRTPHeaderLen);
+  CHECK(thePayloadLen == 100);
+
+  // valid padding
+  theLen = MakePacket(thePacket, 100, 4, 4);
+  CHECK(KeyFrameDetector::GetRTPPayload(thePacket, theLen, &thePayload, &thePayloadLen));
+  CHECK(thePayloadLen == 100);
+
+  H264KeyFrameDetector theDetector;
+  CHECK(theDetector.ClassifyRTPPacket(thePacket, theLen) == KeyFrameDetector::kKeyFrameStart);
+
+  // padding count larger than the payload, the header or the packet
+  theLen = MakePacket(thePacket, 8, 4, 200);
+  CHECK(!KeyFrameDetector::GetRTPPayload(thePacket, theLen, &thePayload, &thePayloadLen));
+  CHECK(theDetector.ClassifyRTPPacket(thePacket, theLen) == KeyFrameDetector::kFramePacket);
+
+  theLen = MakePacket(thePacket, 8, 4, 8 + 4 + 1);
+  CHECK(!KeyFrameDetector::GetRTPPayload(thePacket, theLen, &thePayload, &thePayloadLen));
+
+  // padding taking the whole payload
+  theLen = MakePacket(thePacket, 8, 4, 8 + 4);
+  CHECK(!KeyFrameDetector::GetRTPPayload(thePacket, theLen, &thePayload, &thePayloadLen));
+
+  // a padding count of zero is invalid
+  theLen = MakePacket(thePacket, 8, 4, 0);
+  CHECK(!KeyFrameDetector::GetRTPPayload(thePacket, theLen, &thePayload, &thePayloadLen));
+
+  return 0;
+}
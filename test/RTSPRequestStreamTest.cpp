@@ -0,0 +1,118 @@
+/*
+    File:       RTSPRequestStreamTest.cpp
+
+    Contains:   A tunnelled (base64 encoded) RTSP request longer than the inline
+                request buffer. The POST connection first sends an interleaved
+                frame, so its request buffer grows, and then more encoded bytes
+                than the inline buffer holds. They are snarfed by the stream of
+                the GET connection and decoded there.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include <CF/base64.h>
+#include <CF/Net/Socket/TCPSocket.h>
+
+#include "RTSPRequestStream.h"
+
+#define CHECK(cond) do { if (!(cond)) { \
+  fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+// a connected pair of loopback TCP sockets
+static bool MakeSocketPair(int *outClient, int *outServer) {
+  int theListener = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (theListener < 0)
+    return false;
+
+  struct sockaddr_in theAddr;
+  ::memset(&theAddr, 0, sizeof(theAddr));
+  theAddr.sin_family = AF_INET;
+  theAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t theAddrLen = sizeof(theAddr);
+  if (::bind(theListener, (struct sockaddr *) &theAddr, sizeof(theAddr)) != 0
+      || ::listen(theListener, 1) != 0
+      || ::getsockname(theListener, (struct sockaddr *) &theAddr, &theAddrLen) != 0) {
+    ::close(theListener);
+    return false;
+  }
+
+  *outClient = ::socket(AF_INET, SOCK_STREAM, 0);
+  bool connected = *outClient >= 0
+      && ::connect(*outClient, (struct sockaddr *) &theAddr, sizeof(theAddr)) == 0;
+  *outServer = connected ? ::accept(theListener, NULL, NULL) : -1;
+  ::close(theListener);
+  return *outServer >= 0;
+}
+
+static bool SendAll(int inSocket, std::string const &inData) {
+  size_t theSent = 0;
+  while (theSent < inData.size()) {
+    ssize_t theLen = ::send(inSocket, inData.data() + theSent, inData.size() - theSent, 0);
+    if (theLen <= 0)
+      return false;
+    theSent += theLen;
+  }
+  return true;
+}
+
+int main() {
+  int theClient = -1, theServer = -1;
+  CHECK(MakeSocketPair(&theClient, &theServer));
+
+  // the request to tunnel, twice the inline buffer
+  std::string theRequest("OPTIONS rtsp://127.0.0.1/live.sdp RTSP/1.0\r\nCSeq: 2\r\nX-Padding: ");
+  theRequest.append(2 * QTSS_MAX_REQUEST_BUFFER_SIZE, 'a');
+  theRequest += "\r\n\r\n";
+
+  std::vector<char> theEncoded(Base64encode_len((int) theRequest.size()));
+  Base64encode(&theEncoded[0], theRequest.data(), (int) theRequest.size());
+
+  // an interleaved frame that takes most of the first read, then the POST and its body
+  std::string theData("$\0", 2);
+  UInt16 theFrameLen = QTSS_MAX_REQUEST_BUFFER_SIZE - 64;
+  theData += (char) (theFrameLen >> 8);
+  theData += (char) (theFrameLen & 0xff);
+  theData.append(theFrameLen, 'x');
+  theData += "POST /live.sdp RTSP/1.0\r\nx-sessioncookie: 1\r\nContent-Type: application/x-rtsp-tunnelled\r\n\r\n";
+  theData += &theEncoded[0];
+  CHECK(SendAll(theClient, theData));
+
+  struct sockaddr_in theRemoteAddr;
+  ::memset(&theRemoteAddr, 0, sizeof(theRemoteAddr));
+  CF::Net::TCPSocket theSocket(NULL, 0);
+  theSocket.Set(theServer, &theRemoteAddr);
+
+  // the POST connection: the frame, then the POST header
+  RTSPRequestStream thePostStream(&theSocket);
+  CHECK(thePostStream.ReadRequest() == QTSS_RequestArrived);
+  CHECK(thePostStream.IsDataPacket());
+
+  QTSS_Error theErr;
+  while ((theErr = thePostStream.ReadRequest()) == QTSS_NoErr);
+  CHECK(theErr == QTSS_RequestArrived);
+  CHECK(!thePostStream.IsDataPacket());
+
+  // the GET connection takes over the encoded body, as RTSPSessionInterface::SnarfInputSocket does
+  RTSPRequestStream theGetStream(&theSocket);
+  theGetStream.IsBase64Encoded(true);
+  theGetStream.SnarfRetreat(thePostStream);
+
+  while ((theErr = theGetStream.ReadRequest()) == QTSS_NoErr);
+  CHECK(theErr == QTSS_RequestArrived);
+
+  CF::StrPtrLen *theDecoded = theGetStream.GetRequestBuffer();
+  CHECK(theDecoded != NULL);
+  CHECK(theDecoded->Len == theRequest.size());
+  CHECK(::memcmp(theDecoded->Ptr, theRequest.data(), theRequest.size()) == 0);
+
+  ::close(theClient);
+  return 0;
+}